@@ -27,9 +27,16 @@ distribution.
 #if defined(ANDROID_NDK) || defined(__BORLANDC__) || defined(__QNXNTO__)
 #   include <stddef.h>
 #   include <stdarg.h>
+#   include <float.h>
 #else
 #   include <cstddef>
 #   include <cstdarg>
+#   include <cfloat>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define TIXML_SSE2 1
+#   include <emmintrin.h>
 #endif
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1400 ) && (!defined WINCE)
@@ -186,12 +193,60 @@ void StrPair::Reset()
     if ( _flags & NEEDS_DELETE ) {
         delete [] _start;
     }
+    else if ( _flags & NEEDS_RELEASE ) {
+        uint32_t offset = 0;
+        memcpy( &offset, _start - sizeof( offset ), sizeof( offset ) );
+        ReleaseBlock( _start - offset );
+    }
     _flags = 0;
     _start = 0;
     _end = 0;
 }
 
 
+void StrPair::Share( StrPair* other )
+{
+    TIXMLASSERT( other != this );
+    Reset();
+    // Interned strings have no end, and nothing to normalize.
+    if ( other->_end ) {
+        other->GetStr();
+    }
+    _start = other->_start;
+    _end = other->_end;
+}
+
+
+void StrPair::Cover( const char* begin, const char* end, char** low, char** high ) const
+{
+    if ( ( _flags & NEEDS_DELETE ) || !_end || _start < begin || _start >= end ) {
+        return;
+    }
+    // The end is taken in too: GetStr() writes the terminator there.
+    char* const last = _end + 1 < end ? _end + 1 : const_cast<char*>( end );
+    if ( !*low || _start < *low ) {
+        *low = _start;
+    }
+    if ( last > *high ) {
+        *high = last;
+    }
+}
+
+
+bool StrPair::Relocate( const char* low, const char* high, char* copy )
+{
+    if ( ( _flags & NEEDS_DELETE ) || !_end ) {
+        return true;
+    }
+    if ( _start < low || _start >= high ) {
+        return false;
+    }
+    _start = copy + ( _start - low );
+    _end = copy + ( _end - low );
+    return true;
+}
+
+
 void StrPair::SetStr( const char* str, int flags )
 {
     TIXMLASSERT( str );
@@ -205,26 +260,94 @@ void StrPair::SetStr( const char* str, int flags )
 }
 
 
-char* StrPair::ParseText( char* p, const char* endTag, int strFlags, int* curLineNumPtr )
+// A block of counted strings starts with this header. Each string in it
+// is put after its offset in the block, to find the header again.
+struct CountedBlockHeader
+{
+    size_t count;	// strings in the block, and one for the block being filled
+    size_t used;
+    size_t size;
+};
+
+
+void StrPair::SetCounted( const char* str, char** block )
+{
+    TIXMLASSERT( str );
+    TIXMLASSERT( block );
+    Reset();
+    const size_t length = strlen( str );
+    const size_t needed = sizeof( uint32_t ) + length + 1;
+    CountedBlockHeader* header = reinterpret_cast<CountedBlockHeader*>( *block );
+    if ( !header || header->size - header->used < needed ) {
+        // Each block is twice the size of the last, up to 64k.
+        static const size_t MIN_BLOCK = 1024;
+        static const size_t MAX_BLOCK = 64 * 1024;
+        size_t size = header ? header->size * 2 : MIN_BLOCK;
+        if ( size > MAX_BLOCK ) {
+            size = MAX_BLOCK;
+        }
+        if ( size < sizeof( CountedBlockHeader ) + needed ) {
+            size = sizeof( CountedBlockHeader ) + needed;
+        }
+        char* const fresh = new char[size];
+        if ( *block ) {
+            ReleaseBlock( *block );
+        }
+        *block = fresh;
+        header = reinterpret_cast<CountedBlockHeader*>( fresh );
+        header->count = 1;
+        header->used = sizeof( CountedBlockHeader );
+        header->size = size;
+    }
+    const uint32_t offset = static_cast<uint32_t>( header->used + sizeof( uint32_t ) );
+    memcpy( *block + header->used, &offset, sizeof( offset ) );
+    _start = *block + offset;
+    memcpy( _start, str, length + 1 );
+    _end = _start + length;
+    _flags = NEEDS_RELEASE;
+    header->used += needed;
+    ++header->count;
+}
+
+
+void StrPair::ReleaseBlock( char* block )
+{
+    CountedBlockHeader* header = reinterpret_cast<CountedBlockHeader*>( block );
+    TIXMLASSERT( header->count > 0 );
+    if ( --header->count == 0 ) {
+        delete [] block;
+    }
+}
+
+
+char* StrPair::ParseText( char* p, const char* endTag, int strFlags )
 {
     TIXMLASSERT( p );
     TIXMLASSERT( endTag && *endTag );
-	TIXMLASSERT(curLineNumPtr);
 
     char* start = p;
     const char  endChar = *endTag;
     size_t length = strlen( endTag );
 
-    // Inner loop of text parsing.
+    // Inner loop of text parsing. Lines come from the document's newline
+    // index, so only the end character is looked for: a byte at a time
+    // for short runs like attribute values, then with strchr().
+    int scanned = 0;
     while ( *p ) {
-        if ( *p == endChar && strncmp( p, endTag, length ) == 0 ) {
-            Set( start, p, strFlags );
-            return p + length;
-        } else if (*p == '\n') {
-            ++(*curLineNumPtr);
+        if ( *p == endChar ) {
+            if ( strncmp( p, endTag, length ) == 0 ) {
+                Set( start, p, strFlags );
+                return p + length;
+            }
+        }
+        else if ( ++scanned >= 16 ) {
+            p = strchr( p, endChar );
+            if ( !p ) {
+                return 0;
+            }
+            continue;
         }
         ++p;
-        TIXMLASSERT( p );
     }
     return 0;
 }
@@ -250,31 +373,15 @@ char* StrPair::ParseName( char* p )
 }
 
 
-void StrPair::CollapseWhitespace()
+// A collapsed run of whitespace is written, as one space, only once
+// something follows it. It never catches up with the read pointer: the run
+// itself was skipped.
+inline void StrPair::WritePendingSpace( char** q, bool* space )
 {
-    // Adjusting _start would cause undefined behavior on delete[]
-    TIXMLASSERT( ( _flags & NEEDS_DELETE ) == 0 );
-    // Trim leading space.
-    _start = XMLUtil::SkipWhiteSpace( _start, 0 );
-
-    if ( *_start ) {
-        const char* p = _start;	// the read pointer
-        char* q = _start;	// the write pointer
-
-        while( *p ) {
-            if ( XMLUtil::IsWhiteSpace( *p )) {
-                p = XMLUtil::SkipWhiteSpace( p, 0 );
-                if ( *p == 0 ) {
-                    break;    // don't write to q; this trims the trailing space.
-                }
-                *q = ' ';
-                ++q;
-            }
-            *q = *p;
-            ++q;
-            ++p;
-        }
-        *q = 0;
+    if ( *space ) {
+        **q = ' ';
+        ++*q;
+        *space = false;
     }
 }
 
@@ -290,6 +397,11 @@ const char* StrPair::GetStr()
         if ( _flags ) {
             const char* p = _start;	// the read pointer
             char* q = _start;	// the write pointer
+            // Whitespace is collapsed as it is written: a run of it becomes
+            // one pending space, written before the next other character,
+            // so leading and trailing runs are dropped.
+            const bool collapse = ( _flags & NEEDS_WHITESPACE_COLLAPSING ) != 0;
+            bool space = false;
 
             while( p < _end ) {
                 if ( (_flags & NEEDS_NEWLINE_NORMALIZATION) && *p == CR ) {
@@ -302,8 +414,13 @@ const char* StrPair::GetStr()
                     else {
                         ++p;
                     }
-                    *q = LF;
-                    ++q;
+                    if ( collapse ) {
+                        space = ( q != _start );
+                    }
+                    else {
+                        *q = LF;
+                        ++q;
+                    }
                 }
                 else if ( (_flags & NEEDS_NEWLINE_NORMALIZATION) && *p == LF ) {
                     if ( *(p+1) == CR ) {
@@ -312,8 +429,13 @@ const char* StrPair::GetStr()
                     else {
                         ++p;
                     }
-                    *q = LF;
-                    ++q;
+                    if ( collapse ) {
+                        space = ( q != _start );
+                    }
+                    else {
+                        *q = LF;
+                        ++q;
+                    }
                 }
                 else if ( (_flags & NEEDS_ENTITY_PROCESSING) && *p == '&' ) {
                     // Entities handled by tinyXML2:
@@ -327,6 +449,7 @@ const char* StrPair::GetStr()
                         int len = 0;
                         const char* adjusted = const_cast<char*>( XMLUtil::GetCharacterRef( p, buf, &len ) );
                         if ( adjusted == 0 ) {
+                            WritePendingSpace( &q, &space );
                             *q = *p;
                             ++p;
                             ++q;
@@ -335,8 +458,14 @@ const char* StrPair::GetStr()
                             TIXMLASSERT( 0 <= len && len <= buflen );
                             TIXMLASSERT( q + len <= adjusted );
                             p = adjusted;
-                            memcpy( q, buf, len );
-                            q += len;
+                            if ( collapse && len == 1 && XMLUtil::IsWhiteSpace( buf[0] ) ) {
+                                space = ( q != _start );
+                            }
+                            else {
+                                WritePendingSpace( &q, &space );
+                                memcpy( q, buf, len );
+                                q += len;
+                            }
                         }
                     }
                     else {
@@ -346,6 +475,7 @@ const char* StrPair::GetStr()
                             if ( strncmp( p + 1, entity.pattern, entity.length ) == 0
                                     && *( p + entity.length + 1 ) == ';' ) {
                                 // Found an entity - convert.
+                                WritePendingSpace( &q, &space );
                                 *q = entity.value;
                                 ++q;
                                 p += entity.length + 2;
@@ -355,12 +485,19 @@ const char* StrPair::GetStr()
                         }
                         if ( !entityFound ) {
                             // fixme: treat as error?
+                            WritePendingSpace( &q, &space );
+                            *q = *p;
                             ++p;
                             ++q;
                         }
                     }
                 }
+                else if ( collapse && XMLUtil::IsWhiteSpace( *p ) ) {
+                    space = ( q != _start );
+                    ++p;
+                }
                 else {
+                    WritePendingSpace( &q, &space );
                     *q = *p;
                     ++p;
                     ++q;
@@ -368,11 +505,6 @@ const char* StrPair::GetStr()
             }
             *q = 0;
         }
-        // The loop below has plenty going on, and this
-        // is a less useful mode. Break it out.
-        if ( _flags & NEEDS_WHITESPACE_COLLAPSING ) {
-            CollapseWhitespace();
-        }
         _flags = (_flags & NEEDS_DELETE);
     }
     TIXMLASSERT( _start );
@@ -468,6 +600,71 @@ void XMLUtil::ConvertUTF32ToUTF8( unsigned long input, char* output, int* length
 }
 
 
+const char* XMLUtil::FindInvalidUTF8( const char* p, size_t length )
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>( p );
+    const unsigned char* const end = u + length;
+    while ( u < end ) {
+        const unsigned char* stop = end;
+#if defined( TIXML_SSE2 )
+        // Skip ASCII a cache line at a time; check anything else byte by
+        // byte up to the end of the block it was found in.
+        if ( end - u >= 64 ) {
+            const __m128i* v = reinterpret_cast<const __m128i*>( u );
+            const __m128i any = _mm_or_si128( _mm_or_si128( _mm_loadu_si128( v ), _mm_loadu_si128( v + 1 ) ),
+                                              _mm_or_si128( _mm_loadu_si128( v + 2 ), _mm_loadu_si128( v + 3 ) ) );
+            if ( !_mm_movemask_epi8( any ) ) {
+                u += 64;
+                continue;
+            }
+            stop = u + 64;
+        }
+#endif
+        while ( u < stop ) {
+            const unsigned char lead = *u;
+            if ( lead < 0x80 ) {
+                ++u;
+                continue;
+            }
+            // The range of the second byte rules out overlong forms,
+            // surrogates and code points past U+10FFFF.
+            int trail = 0;
+            unsigned char low = 0x80;
+            unsigned char high = 0xBF;
+            if ( lead < 0xC2 ) {
+                return reinterpret_cast<const char*>( u );
+            }
+            else if ( lead < 0xE0 ) {
+                trail = 1;
+            }
+            else if ( lead < 0xF0 ) {
+                trail = 2;
+                low = ( lead == 0xE0 ) ? 0xA0 : 0x80;
+                high = ( lead == 0xED ) ? 0x9F : 0xBF;
+            }
+            else if ( lead < 0xF5 ) {
+                trail = 3;
+                low = ( lead == 0xF0 ) ? 0x90 : 0x80;
+                high = ( lead == 0xF4 ) ? 0x8F : 0xBF;
+            }
+            else {
+                return reinterpret_cast<const char*>( u );
+            }
+            if ( end - u <= trail || u[1] < low || u[1] > high ) {
+                return reinterpret_cast<const char*>( u );
+            }
+            for( int i = 2; i <= trail; ++i ) {
+                if ( ( u[i] & 0xC0 ) != 0x80 ) {
+                    return reinterpret_cast<const char*>( u );
+                }
+            }
+            u += trail + 1;
+        }
+    }
+    return 0;
+}
+
+
 const char* XMLUtil::GetCharacterRef( const char* p, char* value, int* length )
 {
     // Presume an entity, and pull it out.
@@ -564,2424 +761,7680 @@ const char* XMLUtil::GetCharacterRef( const char* p, char* value, int* length )
 }
 
 
+// Integers are formatted by hand, two digits at a time, rather than with
+// snprintf: it is much faster, and they are printed a lot.
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Writes the decimal digits of 'v' backwards, ending just before 'end'.
+// Returns a pointer to the first digit.
+static char* FormatDecimal( uint64_t v, bool negative, char* end )
+{
+    char* p = end;
+    while ( v >= 100 ) {
+        const unsigned pair = static_cast<unsigned>( v % 100 ) * 2;
+        v /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if ( v >= 10 ) {
+        const unsigned pair = static_cast<unsigned>( v ) * 2;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    else {
+        *--p = static_cast<char>( '0' + v );
+    }
+    if ( negative ) {
+        *--p = '-';
+    }
+    return p;
+}
+
+// Copies with the truncation rules of snprintf.
+static void CopyToBuffer( const char* str, size_t length, char* buffer, int bufferSize )
+{
+    if ( bufferSize <= 0 ) {
+        return;
+    }
+    if ( length >= static_cast<size_t>( bufferSize ) ) {
+        length = bufferSize - 1;
+    }
+    memcpy( buffer, str, length );
+    buffer[length] = 0;
+}
+
+static void FormatDecimal( uint64_t v, bool negative, char* buffer, int bufferSize )
+{
+    char digits[24];    // 20 digits of UINT64_MAX, the sign, the null
+    char* const end = digits + sizeof( digits );
+    const char* start = FormatDecimal( v, negative, end );
+    CopyToBuffer( start, end - start, buffer, bufferSize );
+}
+
+
 void XMLUtil::ToStr( int v, char* buffer, int bufferSize )
 {
-    TIXML_SNPRINTF( buffer, bufferSize, "%d", v );
+    ToStr( static_cast<int64_t>( v ), buffer, bufferSize );
 }
 
 
 void XMLUtil::ToStr( unsigned v, char* buffer, int bufferSize )
 {
-    TIXML_SNPRINTF( buffer, bufferSize, "%u", v );
+    FormatDecimal( v, false, buffer, bufferSize );
 }
 
 
 void XMLUtil::ToStr( bool v, char* buffer, int bufferSize )
 {
-    TIXML_SNPRINTF( buffer, bufferSize, "%s", v ? writeBoolTrue : writeBoolFalse);
+    const char* str = v ? writeBoolTrue : writeBoolFalse;
+    CopyToBuffer( str, strlen( str ), buffer, bufferSize );
 }
 
 /*
 	ToStr() of a number is a very tricky topic.
 	https://github.com/leethomason/tinyxml2/issues/106
 */
-void XMLUtil::ToStr( float v, char* buffer, int bufferSize )
+// Floating point values are printed with the fewest digits that read back
+// to the same value, using Florian Loitsch's Grisu2 ("Printing
+// Floating-Point Numbers Quickly and Accurately with Integers", PLDI 2010).
+// A "DiyFp" is the unnormalized value f * 2^e.
+struct DiyFp
+{
+    uint64_t f;
+    int e;
+};
+
+static DiyFp MakeDiyFp( uint64_t f, int e )
 {
-    TIXML_SNPRINTF( buffer, bufferSize, "%.8g", v );
+    DiyFp r;
+    r.f = f;
+    r.e = e;
+    return r;
 }
 
-
-void XMLUtil::ToStr( double v, char* buffer, int bufferSize )
+// The upper 64 bits of the 128 bit product, rounded.
+static DiyFp MultiplyDiyFp( const DiyFp& x, const DiyFp& y )
 {
-    TIXML_SNPRINTF( buffer, bufferSize, "%.17g", v );
-}
+    const uint64_t LOW = 0xFFFFFFFFu;
+    const uint64_t xLo = x.f & LOW;
+    const uint64_t xHi = x.f >> 32;
+    const uint64_t yLo = y.f & LOW;
+    const uint64_t yHi = y.f >> 32;
 
+    const uint64_t p0 = xLo * yLo;
+    const uint64_t p1 = xLo * yHi;
+    const uint64_t p2 = xHi * yLo;
+    const uint64_t p3 = xHi * yHi;
 
-void XMLUtil::ToStr( int64_t v, char* buffer, int bufferSize )
-{
-	// horrible syntax trick to make the compiler happy about %lld
-	TIXML_SNPRINTF(buffer, bufferSize, "%lld", static_cast<long long>(v));
+    uint64_t q = ( p0 >> 32 ) + ( p1 & LOW ) + ( p2 & LOW );
+    q += static_cast<uint64_t>( 1 ) << 31;
+    return MakeDiyFp( p3 + ( p1 >> 32 ) + ( p2 >> 32 ) + ( q >> 32 ), x.e + y.e + 64 );
 }
 
-void XMLUtil::ToStr( uint64_t v, char* buffer, int bufferSize )
+static DiyFp NormalizeDiyFp( DiyFp x )
 {
-    // horrible syntax trick to make the compiler happy about %llu
-    TIXML_SNPRINTF(buffer, bufferSize, "%llu", (long long)v);
+    TIXMLASSERT( x.f != 0 );
+    while ( ( x.f >> 63 ) == 0 ) {
+        x.f <<= 1;
+        --x.e;
+    }
+    return x;
 }
 
-bool XMLUtil::ToInt(const char* str, int* value)
+// The value 'v' = f * 2^e, and the midpoints to its neighbours, m- and m+.
+// Any number strictly between the midpoints reads back as 'v'.
+struct DiyFpBoundaries
 {
-    if (IsPrefixHex(str)) {
-        unsigned v;
-        if (TIXML_SSCANF(str, "%x", &v) == 1) {
-            *value = static_cast<int>(v);
-            return true;
-        }
+    DiyFp minus;
+    DiyFp v;
+    DiyFp plus;
+};
+
+// 'bits' holds the IEEE representation of a value with 'precision'
+// significand bits (hidden bit included) and exponent bias 'bias'.
+static DiyFpBoundaries ComputeBoundaries( uint64_t bits, int precision, int bias )
+{
+    const uint64_t hiddenBit = static_cast<uint64_t>( 1 ) << ( precision - 1 );
+    const int biasedExponent = static_cast<int>( bits >> ( precision - 1 ) );
+    const uint64_t fraction = bits & ( hiddenBit - 1 );
+
+    DiyFp v;
+    if ( biasedExponent == 0 ) {
+        v = MakeDiyFp( fraction, 1 - bias );    // denormal
     }
     else {
-        if (TIXML_SSCANF(str, "%d", value) == 1) {
-            return true;
-        }
+        v = MakeDiyFp( fraction + hiddenBit, biasedExponent - bias );
     }
-    return false;
-}
+    // At a power of two the lower neighbour is closer.
+    const bool lowerIsCloser = ( fraction == 0 && biasedExponent > 1 );
 
-bool XMLUtil::ToUnsigned(const char* str, unsigned* value)
-{
-    if (TIXML_SSCANF(str, IsPrefixHex(str) ? "%x" : "%u", value) == 1) {
-        return true;
-    }
-    return false;
+    DiyFpBoundaries b;
+    b.plus = NormalizeDiyFp( MakeDiyFp( 2 * v.f + 1, v.e - 1 ) );
+    const DiyFp minus = lowerIsCloser ? MakeDiyFp( 4 * v.f - 1, v.e - 2 ) : MakeDiyFp( 2 * v.f - 1, v.e - 1 );
+    b.minus = MakeDiyFp( minus.f << ( minus.e - b.plus.e ), b.plus.e );
+    b.v = NormalizeDiyFp( v );
+    return b;
 }
 
-bool XMLUtil::ToBool( const char* str, bool* value )
+// Normalized powers of ten, 10^k = f * 2^e, for k = -300, -292, ... 324.
+// Split into 32 bit halves so no 64 bit literals are needed.
+struct CachedPower
 {
-    int ival = 0;
-    if ( ToInt( str, &ival )) {
-        *value = (ival==0) ? false : true;
-        return true;
-    }
-    static const char* TRUE_VALS[] = { "true", "True", "TRUE", 0 };
-    static const char* FALSE_VALS[] = { "false", "False", "FALSE", 0 };
+    uint32_t fHi;
+    uint32_t fLo;
+    int e;
+    int k;
+};
 
-    for (int i = 0; TRUE_VALS[i]; ++i) {
-        if (StringEqual(str, TRUE_VALS[i])) {
-            *value = true;
-            return true;
-        }
-    }
-    for (int i = 0; FALSE_VALS[i]; ++i) {
-        if (StringEqual(str, FALSE_VALS[i])) {
-            *value = false;
-            return true;
-        }
-    }
-    return false;
-}
+static const CachedPower CACHED_POWERS[] = {
+    { 0xAB70FE17, 0xC79AC6CA, -1060, -300 },
+    { 0xFF77B1FC, 0xBEBCDC4F, -1034, -292 },
+    { 0xBE5691EF, 0x416BD60C, -1007, -284 },
+    { 0x8DD01FAD, 0x907FFC3C,  -980, -276 },
+    { 0xD3515C28, 0x31559A83,  -954, -268 },
+    { 0x9D71AC8F, 0xADA6C9B5,  -927, -260 },
+    { 0xEA9C2277, 0x23EE8BCB,  -901, -252 },
+    { 0xAECC4991, 0x4078536D,  -874, -244 },
+    { 0x823C1279, 0x5DB6CE57,  -847, -236 },
+    { 0xC2109436, 0x4DFB5637,  -821, -228 },
+    { 0x9096EA6F, 0x3848984F,  -794, -220 },
+    { 0xD77485CB, 0x25823AC7,  -768, -212 },
+    { 0xA086CFCD, 0x97BF97F4,  -741, -204 },
+    { 0xEF340A98, 0x172AACE5,  -715, -196 },
+    { 0xB23867FB, 0x2A35B28E,  -688, -188 },
+    { 0x84C8D4DF, 0xD2C63F3B,  -661, -180 },
+    { 0xC5DD4427, 0x1AD3CDBA,  -635, -172 },
+    { 0x936B9FCE, 0xBB25C996,  -608, -164 },
+    { 0xDBAC6C24, 0x7D62A584,  -582, -156 },
+    { 0xA3AB6658, 0x0D5FDAF6,  -555, -148 },
+    { 0xF3E2F893, 0xDEC3F126,  -529, -140 },
+    { 0xB5B5ADA8, 0xAAFF80B8,  -502, -132 },
+    { 0x87625F05, 0x6C7C4A8B,  -475, -124 },
+    { 0xC9BCFF60, 0x34C13053,  -449, -116 },
+    { 0x964E858C, 0x91BA2655,  -422, -108 },
+    { 0xDFF97724, 0x70297EBD,  -396, -100 },
+    { 0xA6DFBD9F, 0xB8E5B88F,  -369,  -92 },
+    { 0xF8A95FCF, 0x88747D94,  -343,  -84 },
+    { 0xB9447093, 0x8FA89BCF,  -316,  -76 },
+    { 0x8A08F0F8, 0xBF0F156B,  -289,  -68 },
+    { 0xCDB02555, 0x653131B6,  -263,  -60 },
+    { 0x993FE2C6, 0xD07B7FAC,  -236,  -52 },
+    { 0xE45C10C4, 0x2A2B3B06,  -210,  -44 },
+    { 0xAA242499, 0x697392D3,  -183,  -36 },
+    { 0xFD87B5F2, 0x8300CA0E,  -157,  -28 },
+    { 0xBCE50864, 0x92111AEB,  -130,  -20 },
+    { 0x8CBCCC09, 0x6F5088CC,  -103,  -12 },
+    { 0xD1B71758, 0xE219652C,   -77,   -4 },
+    { 0x9C400000, 0x00000000,   -50,    4 },
+    { 0xE8D4A510, 0x00000000,   -24,   12 },
+    { 0xAD78EBC5, 0xAC620000,     3,   20 },
+    { 0x813F3978, 0xF8940984,    30,   28 },
+    { 0xC097CE7B, 0xC90715B3,    56,   36 },
+    { 0x8F7E32CE, 0x7BEA5C70,    83,   44 },
+    { 0xD5D238A4, 0xABE98068,   109,   52 },
+    { 0x9F4F2726, 0x179A2245,   136,   60 },
+    { 0xED63A231, 0xD4C4FB27,   162,   68 },
+    { 0xB0DE6538, 0x8CC8ADA8,   189,   76 },
+    { 0x83C7088E, 0x1AAB65DB,   216,   84 },
+    { 0xC45D1DF9, 0x42711D9A,   242,   92 },
+    { 0x924D692C, 0xA61BE758,   269,  100 },
+    { 0xDA01EE64, 0x1A708DEA,   295,  108 },
+    { 0xA26DA399, 0x9AEF774A,   322,  116 },
+    { 0xF209787B, 0xB47D6B85,   348,  124 },
+    { 0xB454E4A1, 0x79DD1877,   375,  132 },
+    { 0x865B8692, 0x5B9BC5C2,   402,  140 },
+    { 0xC83553C5, 0xC8965D3D,   428,  148 },
+    { 0x952AB45C, 0xFA97A0B3,   455,  156 },
+    { 0xDE469FBD, 0x99A05FE3,   481,  164 },
+    { 0xA59BC234, 0xDB398C25,   508,  172 },
+    { 0xF6C69A72, 0xA3989F5C,   534,  180 },
+    { 0xB7DCBF53, 0x54E9BECE,   561,  188 },
+    { 0x88FCF317, 0xF22241E2,   588,  196 },
+    { 0xCC20CE9B, 0xD35C78A5,   614,  204 },
+    { 0x98165AF3, 0x7B2153DF,   641,  212 },
+    { 0xE2A0B5DC, 0x971F303A,   667,  220 },
+    { 0xA8D9D153, 0x5CE3B396,   694,  228 },
+    { 0xFB9B7CD9, 0xA4A7443C,   720,  236 },
+    { 0xBB764C4C, 0xA7A44410,   747,  244 },
+    { 0x8BAB8EEF, 0xB6409C1A,   774,  252 },
+    { 0xD01FEF10, 0xA657842C,   800,  260 },
+    { 0x9B10A4E5, 0xE9913129,   827,  268 },
+    { 0xE7109BFB, 0xA19C0C9D,   853,  276 },
+    { 0xAC2820D9, 0x623BF429,   880,  284 },
+    { 0x80444B5E, 0x7AA7CF85,   907,  292 },
+    { 0xBF21E440, 0x03ACDD2D,   933,  300 },
+    { 0x8E679C2F, 0x5E44FF8F,   960,  308 },
+    { 0xD433179D, 0x9C8CB841,   986,  316 },
+    { 0x9E19DB92, 0xB4E31BA9,  1013,  324 },
+};
 
+static const int CACHED_POWERS_MIN_DEC_EXP = -300;
+static const int CACHED_POWERS_DEC_STEP = 8;
 
-bool XMLUtil::ToFloat( const char* str, float* value )
+// Products are scaled into 2^ALPHA..2^GAMMA, so the integral part of the
+// scaled value fits 32 bits and digit generation needs no bignums.
+static const int GRISU_ALPHA = -60;
+static const int GRISU_GAMMA = -32;
+
+static const CachedPower& CachedPowerForBinaryExponent( int e )
 {
-    if ( TIXML_SSCANF( str, "%f", value ) == 1 ) {
-        return true;
-    }
-    return false;
+    // k = ceil( (ALPHA - e - 1) * log10(2) ); 78913 / 2^18 approximates log10(2).
+    const int f = GRISU_ALPHA - e - 1;
+    const int k = ( f * 78913 ) / ( 1 << 18 ) + ( f > 0 ? 1 : 0 );
+    const int index = ( -CACHED_POWERS_MIN_DEC_EXP + k + ( CACHED_POWERS_DEC_STEP - 1 ) ) / CACHED_POWERS_DEC_STEP;
+    TIXMLASSERT( index >= 0 && index < static_cast<int>( sizeof( CACHED_POWERS ) / sizeof( CACHED_POWERS[0] ) ) );
+    const CachedPower& cached = CACHED_POWERS[index];
+    TIXMLASSERT( GRISU_ALPHA <= cached.e + e + 64 && cached.e + e + 64 <= GRISU_GAMMA );
+    return cached;
 }
 
-
-bool XMLUtil::ToDouble( const char* str, double* value )
+// Number of decimal digits of 'n', and the power of ten of the first one.
+static int LargestPow10( uint32_t n, uint32_t* pow10 )
 {
-    if ( TIXML_SSCANF( str, "%lf", value ) == 1 ) {
-        return true;
+    static const uint32_t POW10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+    int digits = 10;
+    while ( digits > 1 && n < POW10[digits - 1] ) {
+        --digits;
     }
-    return false;
+    *pow10 = POW10[digits - 1];
+    return digits;
 }
 
-
-bool XMLUtil::ToInt64(const char* str, int64_t* value)
+// Moves the last digit towards 'dist' (the distance to the exact value)
+// while that stays inside the safe interval 'delta'.
+static void GrisuRound( char* buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t tenK )
 {
-    if (IsPrefixHex(str)) {
-        unsigned long long v = 0;	// horrible syntax trick to make the compiler happy about %llx
-        if (TIXML_SSCANF(str, "%llx", &v) == 1) {
-            *value = static_cast<int64_t>(v);
-            return true;
-        }
-    }
-    else {
-        long long v = 0;	// horrible syntax trick to make the compiler happy about %lld
-        if (TIXML_SSCANF(str, "%lld", &v) == 1) {
-            *value = static_cast<int64_t>(v);
-            return true;
-        }
+    while ( rest < dist
+            && delta - rest >= tenK
+            && ( rest + tenK < dist || dist - rest > rest + tenK - dist ) ) {
+        --buf[len - 1];
+        rest += tenK;
     }
-	return false;
 }
 
+// Writes the digits of a value in (mMinus, mPlus), close to 'w'. The
+// digits D satisfy value = D * 10^decimalExponent.
+static int GrisuDigitGen( char* buf, int* decimalExponent, const DiyFp& mMinus, const DiyFp& w, const DiyFp& mPlus )
+{
+    uint64_t delta = mPlus.f - mMinus.f;
+    uint64_t dist = mPlus.f - w.f;
 
-bool XMLUtil::ToUnsigned64(const char* str, uint64_t* value) {
-    unsigned long long v = 0;	// horrible syntax trick to make the compiler happy about %llu
-    if(TIXML_SSCANF(str, IsPrefixHex(str) ? "%llx" : "%llu", &v) == 1) {
-        *value = (uint64_t)v;
-        return true;
+    const int shift = -mPlus.e;
+    const uint64_t one = static_cast<uint64_t>( 1 ) << shift;
+    uint32_t p1 = static_cast<uint32_t>( mPlus.f >> shift );
+    uint64_t p2 = mPlus.f & ( one - 1 );
+
+    int len = 0;
+    uint32_t pow10 = 0;
+    int n = LargestPow10( p1, &pow10 );
+    while ( n > 0 ) {
+        buf[len++] = static_cast<char>( '0' + p1 / pow10 );
+        p1 %= pow10;
+        --n;
+        const uint64_t rest = ( static_cast<uint64_t>( p1 ) << shift ) + p2;
+        if ( rest <= delta ) {
+            *decimalExponent += n;
+            GrisuRound( buf, len, dist, delta, rest, static_cast<uint64_t>( pow10 ) << shift );
+            return len;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    for( ;; ) {
+        p2 *= 10;
+        buf[len++] = static_cast<char>( '0' + ( p2 >> shift ) );
+        p2 &= one - 1;
+        ++m;
+        delta *= 10;
+        dist *= 10;
+        if ( p2 <= delta ) {
+            break;
+        }
     }
-    return false;
+    *decimalExponent -= m;
+    GrisuRound( buf, len, dist, delta, p2, one );
+    return len;
 }
 
-
-char* XMLDocument::Identify( char* p, XMLNode** node )
+static int Grisu2( char* buf, int* decimalExponent, const DiyFpBoundaries& b )
 {
-    TIXMLASSERT( node );
-    TIXMLASSERT( p );
-    char* const start = p;
-    int const startLine = _parseCurLineNum;
-    p = XMLUtil::SkipWhiteSpace( p, &_parseCurLineNum );
-    if( !*p ) {
-        *node = 0;
-        TIXMLASSERT( p );
-        return p;
-    }
+    const CachedPower& cached = CachedPowerForBinaryExponent( b.plus.e );
+    const DiyFp c = MakeDiyFp( ( static_cast<uint64_t>( cached.fHi ) << 32 ) | cached.fLo, cached.e );
 
-    // These strings define the matching patterns:
-    static const char* xmlHeader		= { "<?" };
-    static const char* commentHeader	= { "<!--" };
-    static const char* cdataHeader		= { "<![CDATA[" };
-    static const char* dtdHeader		= { "<!" };
-    static const char* elementHeader	= { "<" };	// and a header for everything else; check last.
+    const DiyFp w = MultiplyDiyFp( b.v, c );
+    const DiyFp wMinus = MultiplyDiyFp( b.minus, c );
+    const DiyFp wPlus = MultiplyDiyFp( b.plus, c );
 
-    static const int xmlHeaderLen		= 2;
-    static const int commentHeaderLen	= 4;
-    static const int cdataHeaderLen		= 9;
-    static const int dtdHeaderLen		= 2;
-    static const int elementHeaderLen	= 1;
+    // Shrink the interval by one unit on each side to stay within the
+    // rounding error of the products.
+    const DiyFp mMinus = MakeDiyFp( wMinus.f + 1, wMinus.e );
+    const DiyFp mPlus = MakeDiyFp( wPlus.f - 1, wPlus.e );
 
-    TIXMLASSERT( sizeof( XMLComment ) == sizeof( XMLUnknown ) );		// use same memory pool
-    TIXMLASSERT( sizeof( XMLComment ) == sizeof( XMLDeclaration ) );	// use same memory pool
-    XMLNode* returnNode = 0;
-    if ( XMLUtil::StringEqual( p, xmlHeader, xmlHeaderLen ) ) {
-        returnNode = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
-        returnNode->_parseLineNum = _parseCurLineNum;
-        p += xmlHeaderLen;
+    *decimalExponent = -cached.k;
+    return GrisuDigitGen( buf, decimalExponent, mMinus, w, mPlus );
+}
+
+// Lays out 'len' digits times 10^decimalExponent the way %g would: plain
+// notation for moderate magnitudes, "1.5e+20" style otherwise, and no
+// trailing ".0" on integral values. Returns the end of the output.
+static char* FormatShortest( char* p, const char* digits, int len, int decimalExponent )
+{
+    static const int MAX_FIXED_DIGITS = 17;
+    const int point = len + decimalExponent;    // digits before the decimal point
+
+    if ( decimalExponent >= 0 && point <= MAX_FIXED_DIGITS ) {
+        memcpy( p, digits, len );
+        p += len;
+        memset( p, '0', decimalExponent );
+        return p + decimalExponent;
     }
-    else if ( XMLUtil::StringEqual( p, commentHeader, commentHeaderLen ) ) {
-        returnNode = CreateUnlinkedNode<XMLComment>( _commentPool );
-        returnNode->_parseLineNum = _parseCurLineNum;
-        p += commentHeaderLen;
+    if ( point > 0 && point <= MAX_FIXED_DIGITS ) {
+        memcpy( p, digits, point );
+        p += point;
+        *p++ = '.';
+        memcpy( p, digits + point, len - point );
+        return p + len - point;
     }
-    else if ( XMLUtil::StringEqual( p, cdataHeader, cdataHeaderLen ) ) {
-        XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
-        returnNode = text;
-        returnNode->_parseLineNum = _parseCurLineNum;
-        p += cdataHeaderLen;
-        text->SetCData( true );
+    if ( point > -4 && point <= 0 ) {
+        *p++ = '0';
+        *p++ = '.';
+        memset( p, '0', -point );
+        p += -point;
+        memcpy( p, digits, len );
+        return p + len;
     }
-    else if ( XMLUtil::StringEqual( p, dtdHeader, dtdHeaderLen ) ) {
-        returnNode = CreateUnlinkedNode<XMLUnknown>( _commentPool );
-        returnNode->_parseLineNum = _parseCurLineNum;
-        p += dtdHeaderLen;
+
+    *p++ = digits[0];
+    if ( len > 1 ) {
+        *p++ = '.';
+        memcpy( p, digits + 1, len - 1 );
+        p += len - 1;
     }
-    else if ( XMLUtil::StringEqual( p, elementHeader, elementHeaderLen ) ) {
-        returnNode =  CreateUnlinkedNode<XMLElement>( _elementPool );
-        returnNode->_parseLineNum = _parseCurLineNum;
-        p += elementHeaderLen;
+    *p++ = 'e';
+    int exponent = point - 1;
+    if ( exponent < 0 ) {
+        *p++ = '-';
+        exponent = -exponent;
     }
     else {
-        returnNode = CreateUnlinkedNode<XMLText>( _textPool );
-        returnNode->_parseLineNum = _parseCurLineNum; // Report line of first non-whitespace character
-        p = start;	// Back it up, all the text counts.
-        _parseCurLineNum = startLine;
+        *p++ = '+';
     }
-
-    TIXMLASSERT( returnNode );
-    TIXMLASSERT( p );
-    *node = returnNode;
+    if ( exponent >= 100 ) {
+        *p++ = static_cast<char>( '0' + exponent / 100 );
+        exponent %= 100;
+    }
+    *p++ = static_cast<char>( '0' + exponent / 10 );
+    *p++ = static_cast<char>( '0' + exponent % 10 );
     return p;
 }
 
-
-bool XMLDocument::Accept( XMLVisitor* visitor ) const
+// 'bits', 'precision' and 'bias' describe the float or double being
+// printed, 'v' is its value.
+static void FormatFloatingPoint( double v, uint64_t bits, int precision, int bias, char* buffer, int bufferSize )
 {
-    TIXMLASSERT( visitor );
-    if ( visitor->VisitEnter( *this ) ) {
-        for ( const XMLNode* node=FirstChild(); node; node=node->NextSibling() ) {
-            if ( !node->Accept( visitor ) ) {
-                break;
-            }
+    const uint64_t signMask = static_cast<uint64_t>( 1 ) << ( precision == 53 ? 63 : 31 );
+    char out[40];
+    char* p = out;
+    if ( v != v ) {
+        memcpy( p, "nan", 3 );
+        p += 3;
+    }
+    else {
+        if ( bits & signMask ) {
+            *p++ = '-';
+            v = -v;
+        }
+        if ( v == 0 ) {
+            *p++ = '0';
+        }
+        else if ( v > DBL_MAX ) {
+            memcpy( p, "inf", 3 );
+            p += 3;
+        }
+        else {
+            char digits[20];
+            int decimalExponent = 0;
+            const int len = Grisu2( digits, &decimalExponent, ComputeBoundaries( bits & ~signMask, precision, bias ) );
+            p = FormatShortest( p, digits, len, decimalExponent );
         }
     }
-    return visitor->VisitExit( *this );
+    CopyToBuffer( out, p - out, buffer, bufferSize );
 }
 
 
-// --------- XMLNode ----------- //
+void XMLUtil::ToStr( float v, char* buffer, int bufferSize )
+{
+    uint32_t bits = 0;
+    memcpy( &bits, &v, sizeof( bits ) );
+    FormatFloatingPoint( v, bits, 24, 150, buffer, bufferSize );
+}
 
-XMLNode::XMLNode( XMLDocument* doc ) :
-    _document( doc ),
-    _parent( 0 ),
-    _value(),
-    _parseLineNum( 0 ),
-    _firstChild( 0 ), _lastChild( 0 ),
-    _prev( 0 ), _next( 0 ),
-	_userData( 0 ),
-    _memPool( 0 )
+
+void XMLUtil::ToStr( double v, char* buffer, int bufferSize )
 {
+    uint64_t bits = 0;
+    memcpy( &bits, &v, sizeof( bits ) );
+    FormatFloatingPoint( v, bits, 53, 1075, buffer, bufferSize );
 }
 
 
-XMLNode::~XMLNode()
+void XMLUtil::ToStr( int64_t v, char* buffer, int bufferSize )
 {
-    DeleteChildren();
-    if ( _parent ) {
-        _parent->Unlink( this );
-    }
+    // Negate as unsigned, so INT64_MIN doesn't overflow.
+    const uint64_t magnitude = ( v < 0 ) ? 0 - static_cast<uint64_t>( v ) : static_cast<uint64_t>( v );
+    FormatDecimal( magnitude, v < 0, buffer, bufferSize );
 }
 
-const char* XMLNode::Value() const
+void XMLUtil::ToStr( uint64_t v, char* buffer, int bufferSize )
 {
-    // Edge case: XMLDocuments don't have a Value. Return null.
-    if ( this->ToDocument() )
-        return 0;
-    return _value.GetStr();
+    FormatDecimal( v, false, buffer, bufferSize );
 }
 
-void XMLNode::SetValue( const char* str, bool staticMem )
+// Reads an integer the way sscanf's %d / %x would - leading whitespace,
+// an optional sign, decimal digits, or "0x" and hex digits without a
+// sign - but without the format and locale machinery. A decimal value
+// must not exceed 'posLimit' (or 'negLimit' when negative); hex digits
+// are a bit pattern no wider than 'hexLimit'. Returns a pointer past the
+// last digit, or null if there are no digits or the value overflows.
+static const char* ParseInteger( const char* p, uint64_t posLimit, uint64_t negLimit, uint64_t hexLimit,
+                                 uint64_t* magnitude, bool* negative )
 {
-    if ( staticMem ) {
-        _value.SetInternedStr( str );
+    while ( XMLUtil::IsWhiteSpace( *p ) ) {
+        ++p;
     }
-    else {
-        _value.SetStr( str );
+    uint64_t v = 0;
+    *negative = false;
+    if ( *p == '0' && ( p[1] == 'x' || p[1] == 'X' ) ) {
+        p += 2;
+        const char* const digits = p;
+        const uint64_t shiftLimit = hexLimit >> 4;
+        for( ;; ++p ) {
+            unsigned d;
+            if ( *p >= '0' && *p <= '9' ) {
+                d = *p - '0';
+            }
+            else if ( *p >= 'a' && *p <= 'f' ) {
+                d = *p - 'a' + 10;
+            }
+            else if ( *p >= 'A' && *p <= 'F' ) {
+                d = *p - 'A' + 10;
+            }
+            else {
+                break;
+            }
+            if ( v > shiftLimit ) {
+                return 0;
+            }
+            v = ( v << 4 ) | d;
+        }
+        if ( p == digits ) {
+            return 0;
+        }
+        *magnitude = v;
+        return p;
+    }
+
+    if ( *p == '-' ) {
+        *negative = true;
+        ++p;
+    }
+    else if ( *p == '+' ) {
+        ++p;
+    }
+    const uint64_t limit = *negative ? negLimit : posLimit;
+    const uint64_t tensLimit = limit / 10;
+    const unsigned lastDigitLimit = static_cast<unsigned>( limit % 10 );
+    const char* const digits = p;
+    for( ; *p >= '0' && *p <= '9'; ++p ) {
+        const unsigned d = *p - '0';
+        if ( v >= tensLimit && ( v > tensLimit || d > lastDigitLimit ) ) {
+            return 0;
+        }
+        v = v * 10 + d;
+    }
+    if ( p == digits ) {
+        return 0;
     }
+    *magnitude = v;
+    return p;
 }
 
-XMLNode* XMLNode::DeepClone(XMLDocument* target) const
+// Negates a magnitude no larger than -INT64_MIN without signed overflow.
+static int64_t NegateMagnitude( uint64_t magnitude )
 {
-	XMLNode* clone = this->ShallowClone(target);
-	if (!clone) return 0;
-
-	for (const XMLNode* child = this->FirstChild(); child; child = child->NextSibling()) {
-		XMLNode* childClone = child->DeepClone(target);
-		TIXMLASSERT(childClone);
-		clone->InsertEndChild(childClone);
-	}
-	return clone;
+    if ( magnitude == 0 ) {
+        return 0;
+    }
+    return -static_cast<int64_t>( magnitude - 1 ) - 1;
 }
 
-void XMLNode::DeleteChildren()
+static const uint64_t MAX_UINT64 = ~static_cast<uint64_t>( 0 );
+static const uint64_t MAX_INT64 = MAX_UINT64 >> 1;
+
+
+bool XMLUtil::ToInt(const char* str, int* value)
 {
-    while( _firstChild ) {
-        TIXMLASSERT( _lastChild );
-        DeleteChild( _firstChild );
+    uint64_t magnitude = 0;
+    bool negative = false;
+    if ( !ParseInteger( str, INT_MAX, static_cast<uint64_t>( INT_MAX ) + 1, UINT_MAX, &magnitude, &negative ) ) {
+        return false;
     }
-    _firstChild = _lastChild = 0;
+    if ( negative ) {
+        *value = static_cast<int>( NegateMagnitude( magnitude ) );
+    }
+    else {
+        // Hex values above INT_MAX wrap, as they did with sscanf.
+        *value = static_cast<int>( static_cast<unsigned>( magnitude ) );
+    }
+    return true;
 }
 
-
-void XMLNode::Unlink( XMLNode* child )
+bool XMLUtil::ToUnsigned(const char* str, unsigned* value)
 {
-    TIXMLASSERT( child );
-    TIXMLASSERT( child->_document == _document );
-    TIXMLASSERT( child->_parent == this );
-    if ( child == _firstChild ) {
-        _firstChild = _firstChild->_next;
+    uint64_t magnitude = 0;
+    bool negative = false;
+    if ( !ParseInteger( str, UINT_MAX, 0, UINT_MAX, &magnitude, &negative ) ) {
+        return false;
     }
-    if ( child == _lastChild ) {
-        _lastChild = _lastChild->_prev;
+    *value = static_cast<unsigned>( magnitude );
+    return true;
+}
+
+bool XMLUtil::ToBool( const char* str, bool* value )
+{
+    uint64_t magnitude = 0;
+    bool negative = false;
+    if ( ParseInteger( str, INT_MAX, static_cast<uint64_t>( INT_MAX ) + 1, UINT_MAX, &magnitude, &negative ) ) {
+        *value = (magnitude==0) ? false : true;
+        return true;
     }
+    static const char* TRUE_VALS[] = { "true", "True", "TRUE", 0 };
+    static const char* FALSE_VALS[] = { "false", "False", "FALSE", 0 };
 
-    if ( child->_prev ) {
-        child->_prev->_next = child->_next;
+    for (int i = 0; TRUE_VALS[i]; ++i) {
+        if (StringEqual(str, TRUE_VALS[i])) {
+            *value = true;
+            return true;
+        }
     }
-    if ( child->_next ) {
-        child->_next->_prev = child->_prev;
+    for (int i = 0; FALSE_VALS[i]; ++i) {
+        if (StringEqual(str, FALSE_VALS[i])) {
+            *value = false;
+            return true;
+        }
     }
-	child->_next = 0;
-	child->_prev = 0;
-	child->_parent = 0;
+    return false;
 }
 
 
-void XMLNode::DeleteChild( XMLNode* node )
+// Clinger's fast path: when both the digits and the power of ten are
+// exactly representable, one multiplication or division gives the
+// correctly rounded result - provided the arithmetic really is done in
+// the precision of the type, and not in x87 extended precision.
+#if ( defined( FLT_EVAL_METHOD ) && FLT_EVAL_METHOD == 0 ) \
+    || ( defined( __FLT_EVAL_METHOD__ ) && __FLT_EVAL_METHOD__ == 0 ) \
+    || defined( _M_X64 ) || defined( _M_ARM64 )
+#   define TIXML_FAST_FLOAT_PARSE 1
+#else
+#   define TIXML_FAST_FLOAT_PARSE 0
+#endif
+
+#if TIXML_FAST_FLOAT_PARSE
+static inline bool IsDecimalDigit( char c )
 {
-    TIXMLASSERT( node );
-    TIXMLASSERT( node->_document == _document );
-    TIXMLASSERT( node->_parent == this );
-    Unlink( node );
-	TIXMLASSERT(node->_prev == 0);
-	TIXMLASSERT(node->_next == 0);
-	TIXMLASSERT(node->_parent == 0);
-    DeleteNode( node );
+    return c >= '0' && c <= '9';
 }
 
-
-XMLNode* XMLNode::InsertEndChild( XMLNode* addThis )
+// Splits a plain decimal number - [sign] digits [. digits] [e [sign] digits]
+// after optional whitespace - into its significant digits and power of ten.
+// Returns null for anything else (too many digits, hex, inf, nan, or a
+// number not followed by whitespace or the end of the string) so the
+// caller can fall back to sscanf.
+static const char* ParseDecimal( const char* p, uint64_t* mantissa, int* exponent, bool* negative )
 {
-    TIXMLASSERT( addThis );
-    if ( addThis->_document != _document ) {
-        TIXMLASSERT( false );
+    while ( XMLUtil::IsWhiteSpace( *p ) ) {
+        ++p;
+    }
+    *negative = false;
+    if ( *p == '-' ) {
+        *negative = true;
+        ++p;
+    }
+    else if ( *p == '+' ) {
+        ++p;
+    }
+
+    static const int MAX_DIGITS = 19;   // always fits uint64_t
+    uint64_t m = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+    for( ; IsDecimalDigit( *p ); ++p ) {
+        any = true;
+        if ( m == 0 && *p == '0' ) {
+            continue;
+        }
+        if ( digits == MAX_DIGITS ) {
+            return 0;
+        }
+        m = m * 10 + ( *p - '0' );
+        ++digits;
+    }
+    if ( *p == '.' ) {
+        for( ++p; IsDecimalDigit( *p ); ++p ) {
+            any = true;
+            --exp10;
+            if ( m == 0 && *p == '0' ) {
+                continue;
+            }
+            if ( digits == MAX_DIGITS ) {
+                return 0;
+            }
+            m = m * 10 + ( *p - '0' );
+            ++digits;
+        }
+    }
+    if ( !any ) {
         return 0;
     }
-    InsertChildPreamble( addThis );
+    if ( *p == 'e' || *p == 'E' ) {
+        ++p;
+        bool negativeExponent = false;
+        if ( *p == '-' ) {
+            negativeExponent = true;
+            ++p;
+        }
+        else if ( *p == '+' ) {
+            ++p;
+        }
+        if ( !IsDecimalDigit( *p ) ) {
+            return 0;
+        }
+        int e = 0;
+        for( ; IsDecimalDigit( *p ); ++p ) {
+            if ( e < 100000 ) {
+                e = e * 10 + ( *p - '0' );
+            }
+        }
+        exp10 += negativeExponent ? -e : e;
+    }
+    if ( *p && !XMLUtil::IsWhiteSpace( *p ) ) {
+        return 0;
+    }
+    *mantissa = m;
+    *exponent = exp10;
+    return p;
+}
+#endif
 
-    if ( _lastChild ) {
-        TIXMLASSERT( _firstChild );
-        TIXMLASSERT( _lastChild->_next == 0 );
-        _lastChild->_next = addThis;
-        addThis->_prev = _lastChild;
-        _lastChild = addThis;
 
-        addThis->_next = 0;
+bool XMLUtil::ToFloat( const char* str, float* value )
+{
+#if TIXML_FAST_FLOAT_PARSE
+    static const float POW10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool negative = false;
+    if ( ParseDecimal( str, &mantissa, &exponent, &negative )
+         && mantissa <= ( 1u << 24 ) && exponent >= -10 && exponent <= 10 ) {
+        float f = static_cast<float>( mantissa );
+        if ( exponent < 0 ) {
+            f /= POW10[-exponent];
+        }
+        else {
+            f *= POW10[exponent];
+        }
+        *value = negative ? -f : f;
+        return true;
     }
-    else {
-        TIXMLASSERT( _firstChild == 0 );
-        _firstChild = _lastChild = addThis;
-
-        addThis->_prev = 0;
-        addThis->_next = 0;
+#endif
+    if ( TIXML_SSCANF( str, "%f", value ) == 1 ) {
+        return true;
     }
-    addThis->_parent = this;
-    return addThis;
+    return false;
 }
 
 
-XMLNode* XMLNode::InsertFirstChild( XMLNode* addThis )
+#if TIXML_FAST_FLOAT_PARSE
+// Returns the end of the number, or null if it needs the slow path.
+static const char* FastToDouble( const char* str, double* value )
 {
-    TIXMLASSERT( addThis );
-    if ( addThis->_document != _document ) {
-        TIXMLASSERT( false );
+    static const double POW10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool negative = false;
+    const char* end = ParseDecimal( str, &mantissa, &exponent, &negative );
+    if ( !end || mantissa > ( static_cast<uint64_t>( 1 ) << 53 ) || exponent < -22 || exponent > 22 ) {
         return 0;
     }
-    InsertChildPreamble( addThis );
-
-    if ( _firstChild ) {
-        TIXMLASSERT( _lastChild );
-        TIXMLASSERT( _firstChild->_prev == 0 );
-
-        _firstChild->_prev = addThis;
-        addThis->_next = _firstChild;
-        _firstChild = addThis;
-
-        addThis->_prev = 0;
+    double d = static_cast<double>( mantissa );
+    if ( exponent < 0 ) {
+        d /= POW10[-exponent];
     }
     else {
-        TIXMLASSERT( _lastChild == 0 );
-        _firstChild = _lastChild = addThis;
-
-        addThis->_prev = 0;
-        addThis->_next = 0;
+        d *= POW10[exponent];
     }
-    addThis->_parent = this;
-    return addThis;
+    *value = negative ? -d : d;
+    return end;
 }
+#endif
 
 
-XMLNode* XMLNode::InsertAfterChild( XMLNode* afterThis, XMLNode* addThis )
+bool XMLUtil::ToDouble( const char* str, double* value )
 {
-    TIXMLASSERT( addThis );
-    if ( addThis->_document != _document ) {
-        TIXMLASSERT( false );
-        return 0;
+#if TIXML_FAST_FLOAT_PARSE
+    if ( FastToDouble( str, value ) ) {
+        return true;
+    }
+#endif
+    if ( TIXML_SSCANF( str, "%lf", value ) == 1 ) {
+        return true;
     }
+    return false;
+}
 
-    TIXMLASSERT( afterThis );
 
-    if ( afterThis->_parent != this ) {
-        TIXMLASSERT( false );
-        return 0;
-    }
-    if ( afterThis == addThis ) {
-        // Current state: BeforeThis -> AddThis -> OneAfterAddThis
-        // Now AddThis must disappear from it's location and then
-        // reappear between BeforeThis and OneAfterAddThis.
-        // So just leave it where it is.
-        return addThis;
+bool XMLUtil::ToInt64(const char* str, int64_t* value)
+{
+    uint64_t magnitude = 0;
+    bool negative = false;
+    if ( !ParseInteger( str, MAX_INT64, MAX_INT64 + 1, MAX_UINT64, &magnitude, &negative ) ) {
+        return false;
     }
+    // Hex values above INT64_MAX wrap, as they did with sscanf.
+    *value = negative ? NegateMagnitude( magnitude ) : static_cast<int64_t>( magnitude );
+    return true;
+}
 
-    if ( afterThis->_next == 0 ) {
-        // The last node or the only node.
-        return InsertEndChild( addThis );
+
+bool XMLUtil::ToUnsigned64(const char* str, uint64_t* value) {
+    uint64_t magnitude = 0;
+    bool negative = false;
+    if ( !ParseInteger( str, MAX_UINT64, 0, MAX_UINT64, &magnitude, &negative ) ) {
+        return false;
     }
-    InsertChildPreamble( addThis );
-    addThis->_prev = afterThis;
-    addThis->_next = afterThis->_next;
-    afterThis->_next->_prev = addThis;
-    afterThis->_next = addThis;
-    addThis->_parent = this;
-    return addThis;
+    *value = magnitude;
+    return true;
 }
 
 
+// The array conversions walk the string once, converting each value in
+// place instead of copying the tokens out. Within a list a value must be
+// followed by whitespace or the end, so "1,2" is an error rather than 1.
+static inline bool EndsListValue( const char* p )
+{
+    return *p == 0 || XMLUtil::IsWhiteSpace( *p );
+}
 
-
-const XMLElement* XMLNode::FirstChildElement( const char* name ) const
+static const char* SkipListWhiteSpace( const char* p )
 {
-    for( const XMLNode* node = _firstChild; node; node = node->_next ) {
-        const XMLElement* element = node->ToElementWithName( name );
-        if ( element ) {
-            return element;
-        }
+    while ( XMLUtil::IsWhiteSpace( *p ) ) {
+        ++p;
     }
-    return 0;
+    return p;
 }
 
-
-const XMLElement* XMLNode::LastChildElement( const char* name ) const
+bool XMLUtil::ToIntArray( const char* str, int* values, int* count )
 {
-    for( const XMLNode* node = _lastChild; node; node = node->_prev ) {
-        const XMLElement* element = node->ToElementWithName( name );
+    TIXMLASSERT( values || *count == 0 );
+    const int capacity = *count;
+    int n = 0;
+    const char* p = SkipListWhiteSpace( str );
+    while ( *p ) {
+        if ( n == capacity ) {
+            return false;
+        }
+        uint64_t magnitude = 0;
+        bool negative = false;
+        p = ParseInteger( p, INT_MAX, static_cast<uint64_t>( INT_MAX ) + 1, UINT_MAX, &magnitude, &negative );
+        if ( !p || !EndsListValue( p ) ) {
+            return false;
+        }
+        values[n++] = negative ? static_cast<int>( NegateMagnitude( magnitude ) )
+                               : static_cast<int>( static_cast<unsigned>( magnitude ) );
+        p = SkipListWhiteSpace( p );
+    }
+    *count = n;
+    return true;
+}
+
+bool XMLUtil::ToDoubleArray( const char* str, double* values, int* count )
+{
+    TIXMLASSERT( values || *count == 0 );
+    const int capacity = *count;
+    int n = 0;
+    const char* p = SkipListWhiteSpace( str );
+    while ( *p ) {
+        if ( n == capacity ) {
+            return false;
+        }
+        const char* end = 0;
+#if TIXML_FAST_FLOAT_PARSE
+        end = FastToDouble( p, &values[n] );
+#endif
+        if ( !end ) {
+            // The slow path needs the value on its own.
+            char token[64];
+            const char* q = p;
+            while ( !EndsListValue( q ) ) {
+                ++q;
+            }
+            const size_t length = q - p;
+            if ( length >= sizeof( token ) ) {
+                return false;
+            }
+            memcpy( token, p, length );
+            token[length] = 0;
+            int used = 0;
+            if ( TIXML_SSCANF( token, "%lf%n", &values[n], &used ) != 1 || used != static_cast<int>( length ) ) {
+                return false;
+            }
+            end = q;
+        }
+        ++n;
+        p = SkipListWhiteSpace( end );
+    }
+    *count = n;
+    return true;
+}
+
+
+char* XMLDocument::Identify( char* p, XMLNode** node )
+{
+    TIXMLASSERT( node );
+    TIXMLASSERT( p );
+    char* const start = p;
+    p = XMLUtil::SkipWhiteSpace( p, 0 );
+    if( !*p ) {
+        *node = 0;
+        TIXMLASSERT( p );
+        return p;
+    }
+    const char* const markup = p;
+
+    // These strings define the matching patterns:
+    static const char* xmlHeader		= { "<?" };
+    static const char* commentHeader	= { "<!--" };
+    static const char* cdataHeader		= { "<![CDATA[" };
+    static const char* dtdHeader		= { "<!" };
+    static const char* elementHeader	= { "<" };	// and a header for everything else; check last.
+
+    static const int xmlHeaderLen		= 2;
+    static const int commentHeaderLen	= 4;
+    static const int cdataHeaderLen		= 9;
+    static const int dtdHeaderLen		= 2;
+    static const int elementHeaderLen	= 1;
+
+    TIXMLASSERT( sizeof( XMLComment ) == sizeof( XMLUnknown ) );		// use same memory pool
+    TIXMLASSERT( sizeof( XMLComment ) == sizeof( XMLDeclaration ) );	// use same memory pool
+    XMLNode* returnNode = 0;
+    if ( XMLUtil::StringEqual( p, xmlHeader, xmlHeaderLen ) ) {
+        returnNode = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
+        p += xmlHeaderLen;
+    }
+    else if ( XMLUtil::StringEqual( p, commentHeader, commentHeaderLen ) ) {
+        returnNode = CreateUnlinkedNode<XMLComment>( _commentPool );
+        p += commentHeaderLen;
+    }
+    else if ( XMLUtil::StringEqual( p, cdataHeader, cdataHeaderLen ) ) {
+        XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
+        returnNode = text;
+        p += cdataHeaderLen;
+        text->SetCData( true );
+    }
+    else if ( XMLUtil::StringEqual( p, dtdHeader, dtdHeaderLen ) ) {
+        returnNode = CreateUnlinkedNode<XMLUnknown>( _commentPool );
+        p += dtdHeaderLen;
+    }
+    else if ( XMLUtil::StringEqual( p, elementHeader, elementHeaderLen ) ) {
+        returnNode =  CreateUnlinkedNode<XMLElement>( _elementPool );
+        p += elementHeaderLen;
+    }
+    else {
+        returnNode = CreateUnlinkedNode<XMLText>( _textPool );
+        p = start;	// Back it up, all the text counts.
+    }
+
+    TIXMLASSERT( returnNode );
+    TIXMLASSERT( p );
+    // Text reports the position of its first non-whitespace character.
+    Locate( markup, &returnNode->_parseLineNum, &returnNode->_parseColumn );
+    *node = returnNode;
+    return p;
+}
+
+
+bool XMLDocument::Accept( XMLVisitor* visitor ) const
+{
+    TIXMLASSERT( visitor );
+    if ( visitor->VisitEnter( *this ) ) {
+        for ( const XMLNode* node=ChildrenHolder()->FirstChild(); node; node=node->NextSibling() ) {
+            if ( !node->Accept( visitor ) ) {
+                break;
+            }
+        }
+    }
+    return visitor->VisitExit( *this );
+}
+
+
+// --------- XMLNode ----------- //
+
+XMLNode::XMLNode( XMLDocument* doc ) :
+    _document( doc ),
+    _parent( 0 ),
+    _value(),
+    _parseLineNum( 0 ),
+    _parseColumn( 0 ),
+    _firstChild( 0 ), _lastChild( 0 ),
+    _prev( 0 ), _next( 0 ),
+	_userData( 0 ),
+    _memPool( 0 )
+{
+}
+
+
+XMLNode::~XMLNode()
+{
+    DeleteChildren();
+    if ( _parent ) {
+        _parent->Unlink( this );
+    }
+}
+
+const char* XMLNode::Value() const
+{
+    // Edge case: XMLDocuments don't have a Value. Return null.
+    if ( this->ToDocument() )
+        return 0;
+    return _value.GetStr();
+}
+
+void XMLNode::SetValue( const char* str, bool staticMem )
+{
+    if ( staticMem ) {
+        _value.SetInternedStr( str );
+    }
+    else {
+        _value.SetStr( str );
+    }
+    // A new name may have a new prefix.
+    XMLElement* element = ToElement();
+    if ( element && element->NamespaceScope() ) {
+        element->ResolveName();
+    }
+    InvalidateSubtreeHash();
+}
+
+// The node after 'node' in document order, within the subtree of 'root'.
+static const XMLNode* NextInSubtree( const XMLNode* node, const XMLNode* root )
+{
+    if ( node->FirstChild() ) {
+        return node->FirstChild();
+    }
+    while ( node != root && !node->NextSibling() ) {
+        node = node->Parent();
+    }
+    return node == root ? 0 : node->NextSibling();
+}
+
+
+XMLNode* XMLNode::DeepClone(XMLDocument* target) const
+{
+    if ( ToDocument() ) {
+        return 0;
+    }
+    if ( !target ) {
+        target = _document;
+    }
+
+    // Only the top of the copy is unlinked; the nodes under it are
+    // linked as they are made. Elements and text, the usual nodes, are
+    // made without asking the node what it is again.
+    DynArray< XMLNode*, 32 > parents;
+    XMLNode* root = 0;
+    const XMLNode* node = this;
+    while ( node ) {
+        const XMLElement* element = node->ToElement();
+        const XMLText* text = element ? 0 : node->ToText();
+        XMLNode* clone = 0;
         if ( element ) {
-            return element;
+            XMLElement* cloneElement = target->CreateNode<XMLElement>( target->_elementPool, root == 0 );
+            XMLAttribute* last = 0;
+            for( const XMLAttribute* a = element->_rootAttribute; a; a = a->_next ) {
+                XMLAttribute* attrib = cloneElement->CreateAttribute();
+                attrib->_name.SetCounted( a->_name.GetStr(), &target->_cloneStrings );
+                attrib->_value.SetCounted( a->_value.GetStr(), &target->_cloneStrings );
+                if ( last ) {
+                    last->_next = attrib;
+                }
+                else {
+                    cloneElement->_rootAttribute = attrib;
+                }
+                last = attrib;
+            }
+            // The content is the same, and so is its hash.
+            cloneElement->CopySubtreeHash( *element );
+            // The declarations belong to the document they were parsed in.
+            if ( target == _document ) {
+                cloneElement->CopyNamespace( *element );
+            }
+            clone = cloneElement;
+        }
+        else if ( text ) {
+            XMLText* cloneText = target->CreateNode<XMLText>( target->_textPool, root == 0 );
+            cloneText->SetCData( text->CData() );
+            clone = cloneText;
+        }
+        else {
+            clone = target->CreateNodeLike( *node, root == 0 );
+        }
+        clone->_value.SetCounted( node->_value.GetStr(), &target->_cloneStrings );
+
+        if ( root ) {
+            parents.PeekTop()->InsertNewEndChild( clone );
+        }
+        else {
+            root = clone;
+        }
+
+        if ( node->FirstChild() ) {
+            parents.Push( clone );
+            node = node->_firstChild;
+            continue;
+        }
+        while ( node != this && !node->_next ) {
+            node = node->_parent;
+            parents.Pop();
+        }
+        node = node == this ? 0 : node->_next;
+    }
+    return root;
+}
+
+XMLNode* XMLNode::TransferTo( XMLDocument* target )
+{
+    TIXMLASSERT( target );
+    if ( ToDocument() ) {
+        return 0;
+    }
+    XMLDocument* const source = _document;
+    if ( target == source ) {
+        return this;
+    }
+
+    // The strings left in the parse buffer are, normally, the text of the
+    // subtree: one range of it, copied as a whole.
+    const char* const begin = source->_charBuffer;
+    const char* const end = begin + source->_charBufferSize;
+    char* low = 0;
+    char* high = 0;
+    for( const XMLNode* node = this; node; node = NextInSubtree( node, this ) ) {
+        node->_value.Cover( begin, end, &low, &high );
+        const XMLElement* element = node->ToElement();
+        for( const XMLAttribute* a = element ? element->FirstAttribute() : 0; a; a = a->Next() ) {
+            a->_name.Cover( begin, end, &low, &high );
+            a->_value.Cover( begin, end, &low, &high );
+        }
+    }
+    char* copy = 0;
+    if ( low ) {
+        copy = new char[high - low];
+        memcpy( copy, low, high - low );
+        target->_stringBlocks.Push( copy );
+    }
+
+    // The parents, in the target, of the nodes being moved.
+    DynArray< XMLNode*, 32 > parents;
+    XMLNode* root = 0;
+    XMLNode* node = this;
+    while ( node ) {
+        XMLNode* moved = target->CreateNodeLike( *node, root == 0 );
+        target->MoveString( &node->_value, &moved->_value, low, high, copy );
+        moved->_parseLineNum = node->_parseLineNum;
+        moved->_parseColumn = node->_parseColumn;
+        moved->_userData = node->_userData;
+
+        XMLElement* element = node->ToElement();
+        if ( element ) {
+            XMLElement* movedElement = moved->ToElement();
+            movedElement->_closingType = element->_closingType;
+            movedElement->CopySubtreeHash( *element );
+            XMLAttribute* last = 0;
+            for( XMLAttribute* a = element->_rootAttribute; a; a = a->_next ) {
+                XMLAttribute* attrib = movedElement->CreateAttribute();
+                target->MoveString( &a->_name, &attrib->_name, low, high, copy );
+                target->MoveString( &a->_value, &attrib->_value, low, high, copy );
+                attrib->_parseLineNum = a->_parseLineNum;
+                attrib->_parseColumn = a->_parseColumn;
+                if ( last ) {
+                    last->_next = attrib;
+                }
+                else {
+                    movedElement->_rootAttribute = attrib;
+                }
+                last = attrib;
+            }
+        }
+        if ( node->ToText() ) {
+            moved->ToText()->SetCData( node->ToText()->CData() );
+        }
+        if ( root ) {
+            parents.PeekTop()->InsertNewEndChild( moved );
+        }
+        else {
+            root = moved;
+        }
+
+        if ( node->FirstChild() ) {
+            parents.Push( moved );
+            node = node->FirstChild();
+            continue;
+        }
+        while ( node != this && !node->NextSibling() ) {
+            node = node->_parent;
+            parents.Pop();
+        }
+        node = node == this ? 0 : node->NextSibling();
+    }
+
+    // All that is left of the source nodes is their memory.
+    source->DeleteNode( this );
+    return root;
+}
+
+
+void XMLNode::DeleteChildren()
+{
+    // Content that was never parsed, or never copied, has nothing to delete.
+    const XMLElement* element = ToElement();
+    XMLElementExtension* extension = element ? element->Extension( false ) : 0;
+    if ( extension ) {
+        extension->pendingChildren = 0;
+        extension->sharedChildren = 0;
+    }
+    else if ( ToDocument() ) {
+        _document->_sharesChildren = false;
+    }
+    while( _firstChild ) {
+        TIXMLASSERT( _lastChild );
+        DeleteChild( _firstChild );
+    }
+    _firstChild = _lastChild = 0;
+    InvalidateSubtreeHash();
+}
+
+
+void XMLNode::InvalidateSubtreeHash()
+{
+    // A valid hash implies valid hashes below it, so the walk can stop at
+    // the first element without one - in a document that is never hashed,
+    // the first element.
+    for( XMLNode* node = this; node; node = node->_parent ) {
+        const XMLElement* element = node->ToElement();
+        if ( element ) {
+            XMLElementExtension* extension = element->Extension( false );
+            if ( !extension || !extension->subtreeHashValid ) {
+                return;
+            }
+            extension->subtreeHashValid = false;
+        }
+    }
+}
+
+
+void XMLNode::Unlink( XMLNode* child )
+{
+    TIXMLASSERT( child );
+    TIXMLASSERT( child->_document == _document );
+    TIXMLASSERT( child->_parent == this );
+    if ( child == _firstChild ) {
+        _firstChild = _firstChild->_next;
+    }
+    if ( child == _lastChild ) {
+        _lastChild = _lastChild->_prev;
+    }
+
+    if ( child->_prev ) {
+        child->_prev->_next = child->_next;
+    }
+    if ( child->_next ) {
+        child->_next->_prev = child->_prev;
+    }
+	child->_next = 0;
+	child->_prev = 0;
+	child->_parent = 0;
+    InvalidateSubtreeHash();
+}
+
+
+void XMLNode::DeleteChild( XMLNode* node )
+{
+    TIXMLASSERT( node );
+    TIXMLASSERT( node->_document == _document );
+    TIXMLASSERT( node->_parent == this );
+    Unlink( node );
+	TIXMLASSERT(node->_prev == 0);
+	TIXMLASSERT(node->_next == 0);
+	TIXMLASSERT(node->_parent == 0);
+    DeleteNode( node );
+}
+
+
+XMLNode* XMLNode::InsertEndChild( XMLNode* addThis )
+{
+    TIXMLASSERT( addThis );
+    if ( addThis->_document != _document ) {
+        TIXMLASSERT( false );
+        return 0;
+    }
+    if ( !_firstChild && _document->DefersChildren() ) {
+        MaterializeChildren();
+    }
+    InsertChildPreamble( addThis );
+
+    if ( _lastChild ) {
+        TIXMLASSERT( _firstChild );
+        TIXMLASSERT( _lastChild->_next == 0 );
+        _lastChild->_next = addThis;
+        addThis->_prev = _lastChild;
+        _lastChild = addThis;
+
+        addThis->_next = 0;
+    }
+    else {
+        TIXMLASSERT( _firstChild == 0 );
+        _firstChild = _lastChild = addThis;
+
+        addThis->_prev = 0;
+        addThis->_next = 0;
+    }
+    addThis->_parent = this;
+    InvalidateSubtreeHash();
+    return addThis;
+}
+
+
+XMLNode* XMLNode::InsertFirstChild( XMLNode* addThis )
+{
+    TIXMLASSERT( addThis );
+    if ( addThis->_document != _document ) {
+        TIXMLASSERT( false );
+        return 0;
+    }
+    if ( !_firstChild && _document->DefersChildren() ) {
+        MaterializeChildren();
+    }
+    InsertChildPreamble( addThis );
+
+    if ( _firstChild ) {
+        TIXMLASSERT( _lastChild );
+        TIXMLASSERT( _firstChild->_prev == 0 );
+
+        _firstChild->_prev = addThis;
+        addThis->_next = _firstChild;
+        _firstChild = addThis;
+
+        addThis->_prev = 0;
+    }
+    else {
+        TIXMLASSERT( _lastChild == 0 );
+        _firstChild = _lastChild = addThis;
+
+        addThis->_prev = 0;
+        addThis->_next = 0;
+    }
+    addThis->_parent = this;
+    InvalidateSubtreeHash();
+    return addThis;
+}
+
+
+XMLNode* XMLNode::InsertAfterChild( XMLNode* afterThis, XMLNode* addThis )
+{
+    TIXMLASSERT( addThis );
+    if ( addThis->_document != _document ) {
+        TIXMLASSERT( false );
+        return 0;
+    }
+
+    TIXMLASSERT( afterThis );
+
+    if ( afterThis->_parent != this ) {
+        TIXMLASSERT( false );
+        return 0;
+    }
+    if ( afterThis == addThis ) {
+        // Current state: BeforeThis -> AddThis -> OneAfterAddThis
+        // Now AddThis must disappear from it's location and then
+        // reappear between BeforeThis and OneAfterAddThis.
+        // So just leave it where it is.
+        return addThis;
+    }
+
+    if ( afterThis->_next == 0 ) {
+        // The last node or the only node.
+        return InsertEndChild( addThis );
+    }
+    InsertChildPreamble( addThis );
+    addThis->_prev = afterThis;
+    addThis->_next = afterThis->_next;
+    afterThis->_next->_prev = addThis;
+    afterThis->_next = addThis;
+    addThis->_parent = this;
+    InvalidateSubtreeHash();
+    return addThis;
+}
+
+
+
+
+const XMLElement* XMLNode::FirstChildElement( const char* name ) const
+{
+    for( const XMLNode* node = FirstChild(); node; node = node->_next ) {
+        const XMLElement* element = node->ToElementWithName( name );
+        if ( element ) {
+            return element;
+        }
+    }
+    return 0;
+}
+
+
+// The element at or after 'node' in the namespace 'uri' named 'localName'.
+static const XMLElement* NextElementNS( const XMLNode* node, const char* uri, const char* localName )
+{
+    const char* ns = node ? node->GetDocument()->FindNamespaceURI( uri ) : 0;
+    if ( !ns && uri && *uri ) {
+        return 0;
+    }
+    for( ; node; node = node->NextSibling() ) {
+        const XMLElement* element = node->ToElement();
+        if ( element && element->NamespaceURI() == ns
+             && ( !localName || XMLUtil::StringEqual( element->LocalName(), localName ) ) ) {
+            return element;
+        }
+    }
+    return 0;
+}
+
+
+const XMLElement* XMLNode::FirstChildElementNS( const char* uri, const char* localName ) const
+{
+    return NextElementNS( FirstChild(), uri, localName );
+}
+
+
+const XMLElement* XMLNode::NextSiblingElementNS( const char* uri, const char* localName ) const
+{
+    return NextElementNS( _next, uri, localName );
+}
+
+
+const XMLElement* XMLNode::LastChildElement( const char* name ) const
+{
+    for( const XMLNode* node = LastChild(); node; node = node->_prev ) {
+        const XMLElement* element = node->ToElementWithName( name );
+        if ( element ) {
+            return element;
+        }
+    }
+    return 0;
+}
+
+
+const XMLElement* XMLNode::NextSiblingElement( const char* name ) const
+{
+    for( const XMLNode* node = _next; node; node = node->_next ) {
+        const XMLElement* element = node->ToElementWithName( name );
+        if ( element ) {
+            return element;
+        }
+    }
+    return 0;
+}
+
+
+const XMLElement* XMLNode::PreviousSiblingElement( const char* name ) const
+{
+    for( const XMLNode* node = _prev; node; node = node->_prev ) {
+        const XMLElement* element = node->ToElementWithName( name );
+        if ( element ) {
+            return element;
+        }
+    }
+    return 0;
+}
+
+
+char* XMLNode::ParseDeep( char* p, StrPair* parentEndTag )
+{
+    // This is a recursive method, but thinking about it "at the current level"
+    // it is a pretty simple flat list:
+    //		<foo/>
+    //		<!-- comment -->
+    //
+    // With a special case:
+    //		<foo>
+    //		</foo>
+    //		<!-- comment -->
+    //
+    // Where the closing element (/foo) *must* be the next thing after the opening
+    // element, and the names must match. BUT the tricky bit is that the closing
+    // element will be read by the child.
+    //
+    // 'endTag' is the end tag for this node, it is returned by a call to a child.
+    // 'parentEnd' is the end tag for the parent, which is filled in and returned.
+
+	XMLDocument::DepthTracker tracker(_document, p);
+	if (_document->Error())
+		return 0;
+
+	while( p && *p ) {
+        XMLNode* node = 0;
+
+        p = _document->Identify( p, &node );
+        TIXMLASSERT( p );
+        if ( node == 0 ) {
+            break;
+        }
+
+       const int initialLineNum = node->_parseLineNum;
+
+        StrPair endTag;
+        p = node->ParseDeep( p, &endTag );
+        if ( !p ) {
+            DeleteNode( node );
+            if ( !_document->Error() ) {
+                _document->SetError( XML_ERROR_PARSING, initialLineNum, 0);
+            }
+            break;
+        }
+
+        const XMLDeclaration* const decl = node->ToDeclaration();
+        if ( decl ) {
+            // Declarations are only allowed at document level
+            //
+            // Multiple declarations are allowed but all declarations
+            // must occur before anything else. 
+            //
+            // Optimized due to a security test case. If the first node is 
+            // a declaration, and the last node is a declaration, then only 
+            // declarations have so far been added.
+            bool wellLocated = false;
+
+            if (ToDocument()) {
+                if (FirstChild()) {
+                    wellLocated =
+                        FirstChild() &&
+                        FirstChild()->ToDeclaration() &&
+                        LastChild() &&
+                        LastChild()->ToDeclaration();
+                }
+                else {
+                    wellLocated = true;
+                }
+            }
+            if ( !wellLocated ) {
+                _document->SetError( XML_ERROR_PARSING_DECLARATION, initialLineNum, "XMLDeclaration value=%s", decl->Value());
+                DeleteNode( node );
+                break;
+            }
+        }
+
+        XMLElement* ele = node->ToElement();
+        if ( ele ) {
+            // We read the end tag. Return it to the parent.
+            if ( ele->ClosingType() == XMLElement::CLOSING ) {
+                if ( parentEndTag ) {
+                    ele->_value.TransferTo( parentEndTag );
+                }
+                node->_memPool->SetTracked();   // created and then immediately deleted.
+                DeleteNode( node );
+                return p;
+            }
+
+            // Handle an end tag returned to this level.
+            // And handle a bunch of annoying errors.
+            bool mismatch = false;
+            if ( endTag.Empty() ) {
+                // A lazily parsed element has skipped its content and end tag.
+                const XMLElementExtension* extension = ele->Extension( false );
+                if ( ele->ClosingType() == XMLElement::OPEN && !( extension && extension->pendingChildren ) ) {
+                    mismatch = true;
+                }
+            }
+            else {
+                if ( ele->ClosingType() != XMLElement::OPEN ) {
+                    mismatch = true;
+                }
+                else if ( !XMLUtil::StringEqual( endTag.GetStr(), ele->Name() ) ) {
+                    mismatch = true;
+                }
+            }
+            if ( mismatch ) {
+                _document->SetError( XML_ERROR_MISMATCHED_ELEMENT, initialLineNum, "XMLElement name=%s", ele->Name());
+                DeleteNode( node );
+                break;
+            }
+        }
+        InsertEndChild( node );
+    }
+    return 0;
+}
+
+// Parses the content recorded by the lazy pre-scan. Child elements with
+// content of their own are again left pending.
+void XMLNode::MaterializeChildren() const
+{
+    if ( !_document->DefersChildren() ) {
+        return;
+    }
+    const XMLNode* shared = SharedChildren();
+    if ( shared ) {
+        CopySharedChildren( shared );
+        return;
+    }
+    const XMLElement* element = ToElement();
+    XMLElementExtension* extension = element ? element->Extension( false ) : 0;
+    if ( !extension || !extension->pendingChildren ) {
+        return;
+    }
+    const XMLLazySpan* span = extension->pendingChildren;
+    extension->pendingChildren = 0;
+
+    const XMLNamespaceDecl* const outer = _document->_parseNamespaces;
+    _document->_parseNamespaces = ToElement() ? ToElement()->NamespaceScope() : 0;
+    StrPair endTag;
+    const_cast<XMLNode*>( this )->XMLNode::ParseDeep( span->content, &endTag );
+    _document->_parseNamespaces = outer;
+}
+
+// Copies the children of the template node for a snapshot, sharing their
+// strings. Their own children are again left with the template.
+void XMLNode::CopySharedChildren( const XMLNode* holder ) const
+{
+    TIXMLASSERT( holder && !_firstChild );
+    while ( holder->SharedChildren() ) {
+        holder = holder->SharedChildren();
+    }
+    const XMLElement* element = ToElement();
+    if ( element ) {
+        element->Extension( false )->sharedChildren = 0;
+    }
+    else {
+        _document->_sharesChildren = false;
+    }
+
+    XMLNode* const parent = const_cast<XMLNode*>( this );
+    for( const XMLNode* child = holder->FirstChild(); child; child = child->_next ) {
+        XMLNode* copy = _document->CreateNodeLike( *child, false );
+        copy->_value.Share( &child->_value );
+        copy->_parseLineNum = child->_parseLineNum;
+        copy->_parseColumn = child->_parseColumn;
+
+        const XMLElement* childElement = child->ToElement();
+        if ( childElement ) {
+            XMLElement* copyElement = copy->ToElement();
+            copyElement->_closingType = childElement->_closingType;
+            copyElement->CopySubtreeHash( *childElement );
+            copyElement->CopyNamespace( *childElement );
+            XMLAttribute* last = 0;
+            for( const XMLAttribute* a = childElement->_rootAttribute; a; a = a->_next ) {
+                XMLAttribute* attrib = copyElement->CreateAttribute();
+                attrib->_name.Share( &a->_name );
+                attrib->_value.Share( &a->_value );
+                attrib->_parseLineNum = a->_parseLineNum;
+                attrib->_parseColumn = a->_parseColumn;
+                if ( last ) {
+                    last->_next = attrib;
+                }
+                else {
+                    copyElement->_rootAttribute = attrib;
+                }
+                last = attrib;
+            }
+            const XMLElementExtension* extension = childElement->Extension( false );
+            if ( childElement->_firstChild || ( extension && ( extension->pendingChildren || extension->sharedChildren ) ) ) {
+                copyElement->Extension( true )->sharedChildren = childElement;
+            }
+        }
+        else if ( child->ToText() ) {
+            copy->ToText()->SetCData( child->ToText()->CData() );
+        }
+        parent->InsertNewEndChild( copy );
+    }
+}
+
+const XMLNode* XMLNode::SharedChildren() const
+{
+    const XMLElement* element = ToElement();
+    if ( element ) {
+        const XMLElementExtension* extension = element->Extension( false );
+        return extension ? extension->sharedChildren : 0;
+    }
+    const XMLDocument* document = ToDocument();
+    return document && document->_sharesChildren ? document->_snapshotOf : 0;
+}
+
+const XMLNode* XMLNode::ChildrenHolder() const
+{
+    const XMLNode* holder = this;
+    while ( holder->SharedChildren() ) {
+        holder = holder->SharedChildren();
+    }
+    return holder;
+}
+
+/*static*/ void XMLNode::DeleteNode( XMLNode* node )
+{
+    if ( node == 0 ) {
+        return;
+    }
+	TIXMLASSERT(node->_document);
+	if (!node->ToDocument()) {
+		node->_document->MarkInUse(node);
+	}
+
+    MemPool* pool = node->_memPool;
+    node->~XMLNode();
+    pool->Free( node );
+}
+
+void XMLNode::InsertNewEndChild( XMLNode* addThis )
+{
+    TIXMLASSERT( addThis->_document == _document );
+    TIXMLASSERT( !addThis->_parent );
+    addThis->_prev = _lastChild;
+    addThis->_next = 0;
+    addThis->_parent = this;
+    if ( _lastChild ) {
+        _lastChild->_next = addThis;
+    }
+    else {
+        _firstChild = addThis;
+    }
+    _lastChild = addThis;
+}
+
+
+void XMLNode::InsertChildPreamble( XMLNode* insertThis ) const
+{
+    TIXMLASSERT( insertThis );
+    TIXMLASSERT( insertThis->_document == _document );
+
+	if (insertThis->_parent) {
+        insertThis->_parent->Unlink( insertThis );
+	}
+	else {
+		insertThis->_document->MarkInUse(insertThis);
+        insertThis->_memPool->SetTracked();
+	}
+}
+
+const XMLElement* XMLNode::ToElementWithName( const char* name ) const
+{
+    const XMLElement* element = this->ToElement();
+    if ( element == 0 ) {
+        return 0;
+    }
+    if ( name == 0 ) {
+        return element;
+    }
+    if ( XMLUtil::StringEqual( element->Name(), name ) ) {
+       return element;
+    }
+    return 0;
+}
+
+// --------- XMLText ---------- //
+char* XMLText::ParseDeep( char* p, StrPair* )
+{
+    if ( this->CData() ) {
+        p = _value.ParseText( p, "]]>", StrPair::NEEDS_NEWLINE_NORMALIZATION);
+        if ( !p ) {
+            _document->SetError( XML_ERROR_PARSING_CDATA, _parseLineNum, 0 );
+        }
+        return p;
+    }
+    else {
+        int flags = _document->ProcessEntities() ? StrPair::TEXT_ELEMENT : StrPair::TEXT_ELEMENT_LEAVE_ENTITIES;
+        if ( _document->WhitespaceMode() == COLLAPSE_WHITESPACE ) {
+            flags |= StrPair::NEEDS_WHITESPACE_COLLAPSING;
+        }
+
+        p = _value.ParseText( p, "<", flags);
+        if ( p && *p ) {
+            return p-1;
+        }
+        if ( !p ) {
+            _document->SetError( XML_ERROR_PARSING_TEXT, _parseLineNum, 0 );
+        }
+    }
+    return 0;
+}
+
+
+XMLNode* XMLText::ShallowClone( XMLDocument* doc ) const
+{
+    if ( !doc ) {
+        doc = _document;
+    }
+    XMLText* text = doc->NewText( Value() );	// fixme: this will always allocate memory. Intern?
+    text->SetCData( this->CData() );
+    return text;
+}
+
+
+bool XMLText::ShallowEqual( const XMLNode* compare ) const
+{
+    TIXMLASSERT( compare );
+    const XMLText* text = compare->ToText();
+    return ( text && XMLUtil::StringEqual( text->Value(), Value() ) );
+}
+
+
+bool XMLText::Accept( XMLVisitor* visitor ) const
+{
+    TIXMLASSERT( visitor );
+    return visitor->Visit( *this );
+}
+
+
+// --------- XMLComment ---------- //
+
+XMLComment::XMLComment( XMLDocument* doc ) : XMLNode( doc )
+{
+}
+
+
+XMLComment::~XMLComment()
+{
+}
+
+
+char* XMLComment::ParseDeep( char* p, StrPair* )
+{
+    // Comment parses as text.
+    p = _value.ParseText( p, "-->", StrPair::COMMENT);
+    if ( p == 0 ) {
+        _document->SetError( XML_ERROR_PARSING_COMMENT, _parseLineNum, 0 );
+    }
+    return p;
+}
+
+
+XMLNode* XMLComment::ShallowClone( XMLDocument* doc ) const
+{
+    if ( !doc ) {
+        doc = _document;
+    }
+    XMLComment* comment = doc->NewComment( Value() );	// fixme: this will always allocate memory. Intern?
+    return comment;
+}
+
+
+bool XMLComment::ShallowEqual( const XMLNode* compare ) const
+{
+    TIXMLASSERT( compare );
+    const XMLComment* comment = compare->ToComment();
+    return ( comment && XMLUtil::StringEqual( comment->Value(), Value() ));
+}
+
+
+bool XMLComment::Accept( XMLVisitor* visitor ) const
+{
+    TIXMLASSERT( visitor );
+    return visitor->Visit( *this );
+}
+
+
+// --------- XMLDeclaration ---------- //
+
+XMLDeclaration::XMLDeclaration( XMLDocument* doc ) : XMLNode( doc )
+{
+}
+
+
+XMLDeclaration::~XMLDeclaration()
+{
+    //printf( "~XMLDeclaration\n" );
+}
+
+
+char* XMLDeclaration::ParseDeep( char* p, StrPair* )
+{
+    // Declaration parses as text.
+    p = _value.ParseText( p, "?>", StrPair::NEEDS_NEWLINE_NORMALIZATION);
+    if ( p == 0 ) {
+        _document->SetError( XML_ERROR_PARSING_DECLARATION, _parseLineNum, 0 );
+    }
+    return p;
+}
+
+
+XMLNode* XMLDeclaration::ShallowClone( XMLDocument* doc ) const
+{
+    if ( !doc ) {
+        doc = _document;
+    }
+    XMLDeclaration* dec = doc->NewDeclaration( Value() );	// fixme: this will always allocate memory. Intern?
+    return dec;
+}
+
+
+bool XMLDeclaration::ShallowEqual( const XMLNode* compare ) const
+{
+    TIXMLASSERT( compare );
+    const XMLDeclaration* declaration = compare->ToDeclaration();
+    return ( declaration && XMLUtil::StringEqual( declaration->Value(), Value() ));
+}
+
+
+
+bool XMLDeclaration::Accept( XMLVisitor* visitor ) const
+{
+    TIXMLASSERT( visitor );
+    return visitor->Visit( *this );
+}
+
+// --------- XMLUnknown ---------- //
+
+XMLUnknown::XMLUnknown( XMLDocument* doc ) : XMLNode( doc )
+{
+}
+
+
+XMLUnknown::~XMLUnknown()
+{
+}
+
+
+char* XMLUnknown::ParseDeep( char* p, StrPair* )
+{
+    // Unknown parses as text.
+    p = _value.ParseText( p, ">", StrPair::NEEDS_NEWLINE_NORMALIZATION);
+    if ( !p ) {
+        _document->SetError( XML_ERROR_PARSING_UNKNOWN, _parseLineNum, 0 );
+    }
+    return p;
+}
+
+
+XMLNode* XMLUnknown::ShallowClone( XMLDocument* doc ) const
+{
+    if ( !doc ) {
+        doc = _document;
+    }
+    XMLUnknown* text = doc->NewUnknown( Value() );	// fixme: this will always allocate memory. Intern?
+    return text;
+}
+
+
+bool XMLUnknown::ShallowEqual( const XMLNode* compare ) const
+{
+    TIXMLASSERT( compare );
+    const XMLUnknown* unknown = compare->ToUnknown();
+    return ( unknown && XMLUtil::StringEqual( unknown->Value(), Value() ));
+}
+
+
+bool XMLUnknown::Accept( XMLVisitor* visitor ) const
+{
+    TIXMLASSERT( visitor );
+    return visitor->Visit( *this );
+}
+
+// --------- XMLAttribute ---------- //
+
+const char* XMLAttribute::Name() const
+{
+    return _name.GetStr();
+}
+
+const char* XMLAttribute::Value() const
+{
+    return _value.GetStr();
+}
+
+char* XMLAttribute::ParseDeep( char* p, bool processEntities )
+{
+    // Parse using the name rules: bug fix, was using ParseText before
+    p = _name.ParseName( p );
+    if ( !p || !*p ) {
+        return 0;
+    }
+
+    // Skip white space before =
+    p = XMLUtil::SkipWhiteSpace( p, 0 );
+    if ( *p != '=' ) {
+        return 0;
+    }
+
+    ++p;	// move up to opening quote
+    p = XMLUtil::SkipWhiteSpace( p, 0 );
+    if ( *p != '\"' && *p != '\'' ) {
+        return 0;
+    }
+
+    const char endTag[2] = { *p, 0 };
+    ++p;	// move past opening quote
+
+    p = _value.ParseText( p, endTag, processEntities ? StrPair::ATTRIBUTE_VALUE : StrPair::ATTRIBUTE_VALUE_LEAVE_ENTITIES);
+    return p;
+}
+
+
+void XMLAttribute::SetName( const char* n )
+{
+    _name.SetStr( n );
+}
+
+
+XMLError XMLAttribute::QueryIntValue( int* value ) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::INT ) {
+        *value = cache->value.i;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToInt( Value(), value ) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::INT;
+            cache->value.i = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryUnsignedValue( unsigned int* value ) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::UNSIGNED ) {
+        *value = cache->value.u;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToUnsigned( Value(), value ) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::UNSIGNED;
+            cache->value.u = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryInt64Value(int64_t* value) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::INT64 ) {
+        *value = cache->value.i64;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToInt64(Value(), value) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::INT64;
+            cache->value.i64 = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryUnsigned64Value(uint64_t* value) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::UNSIGNED64 ) {
+        *value = cache->value.u64;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToUnsigned64(Value(), value) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::UNSIGNED64;
+            cache->value.u64 = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryBoolValue( bool* value ) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::BOOL ) {
+        *value = cache->value.b;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToBool( Value(), value ) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::BOOL;
+            cache->value.b = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryFloatValue( float* value ) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::FLOAT ) {
+        *value = cache->value.f;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToFloat( Value(), value ) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::FLOAT;
+            cache->value.f = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryDoubleValue( double* value ) const
+{
+    XMLAttributeValueCache* cache = Cache();
+    if ( cache && cache->type == XMLAttributeValueCache::DOUBLE ) {
+        *value = cache->value.d;
+        return XML_SUCCESS;
+    }
+    if ( XMLUtil::ToDouble( Value(), value ) ) {
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::DOUBLE;
+            cache->value.d = *value;
+        }
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryIntArrayValue( int* values, int* count ) const
+{
+    if ( XMLUtil::ToIntArray( Value(), values, count ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+XMLError XMLAttribute::QueryDoubleArrayValue( double* values, int* count ) const
+{
+    if ( XMLUtil::ToDoubleArray( Value(), values, count ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+void XMLAttribute::SetAttribute( const char* v )
+{
+    InvalidateCache();
+    _value.SetStr( v );
+}
+
+
+void XMLAttribute::SetAttribute( int v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    InvalidateCache();
+    _value.SetStr( buf );
+}
+
+
+void XMLAttribute::SetAttribute( unsigned v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    InvalidateCache();
+    _value.SetStr( buf );
+}
+
+
+void XMLAttribute::SetAttribute(int64_t v)
+{
+	char buf[BUF_SIZE];
+	XMLUtil::ToStr(v, buf, BUF_SIZE);
+	InvalidateCache();
+	_value.SetStr(buf);
+}
+
+void XMLAttribute::SetAttribute(uint64_t v)
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr(v, buf, BUF_SIZE);
+    InvalidateCache();
+    _value.SetStr(buf);
+}
+
+
+void XMLAttribute::SetAttribute( bool v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    InvalidateCache();
+    _value.SetStr( buf );
+}
+
+void XMLAttribute::SetAttribute( double v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    InvalidateCache();
+    _value.SetStr( buf );
+}
+
+void XMLAttribute::SetAttribute( float v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    InvalidateCache();
+    _value.SetStr( buf );
+}
+
+
+// --------- XMLElement ---------- //
+XMLElement::XMLElement( XMLDocument* doc ) : XMLNode( doc ),
+    _closingType( OPEN ),
+    _extension( 0 ),
+    _rootAttribute( 0 )
+{
+}
+
+
+XMLElement::~XMLElement()
+{
+    while( _rootAttribute ) {
+        XMLAttribute* next = _rootAttribute->_next;
+        DeleteAttribute( _rootAttribute );
+        _rootAttribute = next;
+    }
+    if ( _extension ) {
+        _document->_freeElementExtensions.Push( _extension );
+    }
+}
+
+
+XMLElementExtension* XMLElement::Extension( bool create ) const
+{
+    if ( !_extension ) {
+        if ( !create ) {
+            return 0;
+        }
+        static const XMLElementExtension empty = XMLElementExtension();
+        if ( _document->_freeElementExtensions.Empty() ) {
+            _document->_elementExtensions.Push( empty );
+            _extension = static_cast<uint32_t>( _document->_elementExtensions.Size() );
+        }
+        else {
+            _extension = _document->_freeElementExtensions.Pop();
+            _document->_elementExtensions[_extension - 1] = empty;
+        }
+    }
+    return &_document->_elementExtensions[_extension - 1];
+}
+
+
+void XMLElement::CopySubtreeHash( const XMLElement& from )
+{
+    const XMLElementExtension* extension = from.Extension( false );
+    if ( extension && extension->subtreeHashValid ) {
+        // Read before making an extension here, which may move it.
+        const uint64_t hash = extension->subtreeHash;
+        XMLElementExtension* copy = Extension( true );
+        copy->subtreeHash = hash;
+        copy->subtreeHashValid = true;
+    }
+}
+
+
+const XMLAttribute* XMLElement::FindAttribute( const char* name ) const
+{
+    for( XMLAttribute* a = _rootAttribute; a; a = a->_next ) {
+        if ( XMLUtil::StringEqual( a->Name(), name ) ) {
+            return a;
+        }
+    }
+    return 0;
+}
+
+
+const char* XMLElement::Attribute( const char* name, const char* value ) const
+{
+    const XMLAttribute* a = FindAttribute( name );
+    if ( !a ) {
+        return 0;
+    }
+    if ( !value || XMLUtil::StringEqual( a->Value(), value )) {
+        return a->Value();
+    }
+    return 0;
+}
+
+int XMLElement::IntAttribute(const char* name, int defaultValue) const
+{
+	int i = defaultValue;
+	QueryIntAttribute(name, &i);
+	return i;
+}
+
+unsigned XMLElement::UnsignedAttribute(const char* name, unsigned defaultValue) const
+{
+	unsigned i = defaultValue;
+	QueryUnsignedAttribute(name, &i);
+	return i;
+}
+
+int64_t XMLElement::Int64Attribute(const char* name, int64_t defaultValue) const
+{
+	int64_t i = defaultValue;
+	QueryInt64Attribute(name, &i);
+	return i;
+}
+
+uint64_t XMLElement::Unsigned64Attribute(const char* name, uint64_t defaultValue) const
+{
+	uint64_t i = defaultValue;
+	QueryUnsigned64Attribute(name, &i);
+	return i;
+}
+
+bool XMLElement::BoolAttribute(const char* name, bool defaultValue) const
+{
+	bool b = defaultValue;
+	QueryBoolAttribute(name, &b);
+	return b;
+}
+
+double XMLElement::DoubleAttribute(const char* name, double defaultValue) const
+{
+	double d = defaultValue;
+	QueryDoubleAttribute(name, &d);
+	return d;
+}
+
+float XMLElement::FloatAttribute(const char* name, float defaultValue) const
+{
+	float f = defaultValue;
+	QueryFloatAttribute(name, &f);
+	return f;
+}
+
+const char* XMLElement::GetText() const
+{
+    /* skip comment node */
+    const XMLNode* node = FirstChild();
+    while (node) {
+        if (node->ToComment()) {
+            node = node->NextSibling();
+            continue;
+        }
+        break;
+    }
+
+    if ( node && node->ToText() ) {
+        return node->Value();
+    }
+    return 0;
+}
+
+
+void	XMLElement::SetText( const char* inText )
+{
+	if ( FirstChild() && FirstChild()->ToText() )
+		FirstChild()->SetValue( inText );
+	else {
+		XMLText*	theText = GetDocument()->NewText( inText );
+		InsertFirstChild( theText );
+	}
+}
+
+
+void XMLElement::SetText( int v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    SetText( buf );
+}
+
+
+void XMLElement::SetText( unsigned v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    SetText( buf );
+}
+
+
+void XMLElement::SetText(int64_t v)
+{
+	char buf[BUF_SIZE];
+	XMLUtil::ToStr(v, buf, BUF_SIZE);
+	SetText(buf);
+}
+
+void XMLElement::SetText(uint64_t v) {
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr(v, buf, BUF_SIZE);
+    SetText(buf);
+}
+
+
+void XMLElement::SetText( bool v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    SetText( buf );
+}
+
+
+void XMLElement::SetText( float v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    SetText( buf );
+}
+
+
+void XMLElement::SetText( double v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    SetText( buf );
+}
+
+
+XMLError XMLElement::QueryIntText( int* ival ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToInt( t, ival ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryUnsignedText( unsigned* uval ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToUnsigned( t, uval ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryInt64Text(int64_t* ival) const
+{
+	if (FirstChild() && FirstChild()->ToText()) {
+		const char* t = FirstChild()->Value();
+		if (XMLUtil::ToInt64(t, ival)) {
+			return XML_SUCCESS;
+		}
+		return XML_CAN_NOT_CONVERT_TEXT;
+	}
+	return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryUnsigned64Text(uint64_t* ival) const
+{
+    if(FirstChild() && FirstChild()->ToText()) {
+        const char* t = FirstChild()->Value();
+        if(XMLUtil::ToUnsigned64(t, ival)) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryBoolText( bool* bval ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToBool( t, bval ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryDoubleText( double* dval ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToDouble( t, dval ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryFloatText( float* fval ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToFloat( t, fval ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryIntArrayText( int* values, int* count ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToIntArray( t, values, count ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+
+XMLError XMLElement::QueryDoubleArrayText( double* values, int* count ) const
+{
+    if ( FirstChild() && FirstChild()->ToText() ) {
+        const char* t = FirstChild()->Value();
+        if ( XMLUtil::ToDoubleArray( t, values, count ) ) {
+            return XML_SUCCESS;
+        }
+        return XML_CAN_NOT_CONVERT_TEXT;
+    }
+    return XML_NO_TEXT_NODE;
+}
+
+int XMLElement::IntText(int defaultValue) const
+{
+	int i = defaultValue;
+	QueryIntText(&i);
+	return i;
+}
+
+unsigned XMLElement::UnsignedText(unsigned defaultValue) const
+{
+	unsigned i = defaultValue;
+	QueryUnsignedText(&i);
+	return i;
+}
+
+int64_t XMLElement::Int64Text(int64_t defaultValue) const
+{
+	int64_t i = defaultValue;
+	QueryInt64Text(&i);
+	return i;
+}
+
+uint64_t XMLElement::Unsigned64Text(uint64_t defaultValue) const
+{
+	uint64_t i = defaultValue;
+	QueryUnsigned64Text(&i);
+	return i;
+}
+
+bool XMLElement::BoolText(bool defaultValue) const
+{
+	bool b = defaultValue;
+	QueryBoolText(&b);
+	return b;
+}
+
+double XMLElement::DoubleText(double defaultValue) const
+{
+	double d = defaultValue;
+	QueryDoubleText(&d);
+	return d;
+}
+
+float XMLElement::FloatText(float defaultValue) const
+{
+	float f = defaultValue;
+	QueryFloatText(&f);
+	return f;
+}
+
+
+XMLAttribute* XMLElement::FindOrCreateAttribute( const char* name )
+{
+    // The attribute is found or created to be set.
+    InvalidateSubtreeHash();
+    XMLAttribute* last = 0;
+    XMLAttribute* attrib = 0;
+    for( attrib = _rootAttribute;
+            attrib;
+            last = attrib, attrib = attrib->_next ) {
+        if ( XMLUtil::StringEqual( attrib->Name(), name ) ) {
+            break;
+        }
+    }
+    if ( !attrib ) {
+        attrib = CreateAttribute();
+        TIXMLASSERT( attrib );
+        if ( last ) {
+            TIXMLASSERT( last->_next == 0 );
+            last->_next = attrib;
+        }
+        else {
+            TIXMLASSERT( _rootAttribute == 0 );
+            _rootAttribute = attrib;
+        }
+        attrib->SetName( name );
+    }
+    return attrib;
+}
+
+
+void XMLElement::DeleteAttribute( const char* name )
+{
+    XMLAttribute* prev = 0;
+    for( XMLAttribute* a=_rootAttribute; a; a=a->_next ) {
+        if ( XMLUtil::StringEqual( name, a->Name() ) ) {
+            if ( prev ) {
+                prev->_next = a->_next;
+            }
+            else {
+                _rootAttribute = a->_next;
+            }
+            DeleteAttribute( a );
+            InvalidateSubtreeHash();
+            break;
+        }
+        prev = a;
+    }
+}
+
+
+char* XMLElement::ParseAttributes( char* p )
+{
+    XMLAttribute* prevAttribute = 0;
+
+    // Read the attributes.
+    while( p ) {
+        p = XMLUtil::SkipWhiteSpace( p, 0 );
+        if ( !(*p) ) {
+            _document->SetError( XML_ERROR_PARSING_ELEMENT, _parseLineNum, "XMLElement name=%s", Name() );
+            return 0;
+        }
+
+        // attribute.
+        if (XMLUtil::IsNameStartChar( (unsigned char) *p ) ) {
+            XMLAttribute* attrib = CreateAttribute();
+            TIXMLASSERT( attrib );
+            _document->Locate( p, &attrib->_parseLineNum, &attrib->_parseColumn );
+
+            const int attrLineNum = attrib->_parseLineNum;
+
+            p = attrib->ParseDeep( p, _document->ProcessEntities());
+            if ( !p || Attribute( attrib->Name() ) ) {
+                DeleteAttribute( attrib );
+                _document->SetError( XML_ERROR_PARSING_ATTRIBUTE, attrLineNum, "XMLElement name=%s", Name() );
+                return 0;
+            }
+            // There is a minor bug here: if the attribute in the source xml
+            // document is duplicated, it will not be detected and the
+            // attribute will be doubly added. However, tracking the 'prevAttribute'
+            // avoids re-scanning the attribute list. Preferring performance for
+            // now, may reconsider in the future.
+            if ( prevAttribute ) {
+                TIXMLASSERT( prevAttribute->_next == 0 );
+                prevAttribute->_next = attrib;
+            }
+            else {
+                TIXMLASSERT( _rootAttribute == 0 );
+                _rootAttribute = attrib;
+            }
+            prevAttribute = attrib;
+        }
+        // end of the tag
+        else if ( *p == '>' ) {
+            ++p;
+            break;
+        }
+        // end of the tag
+        else if ( *p == '/' && *(p+1) == '>' ) {
+            _closingType = CLOSED;
+            return p+2;	// done; sealed element.
+        }
+        else {
+            _document->SetError( XML_ERROR_PARSING_ELEMENT, _parseLineNum, 0 );
+            return 0;
+        }
+    }
+    return p;
+}
+
+void XMLElement::DeleteAttribute( XMLAttribute* attribute )
+{
+    if ( attribute == 0 ) {
+        return;
+    }
+    MemPool* pool = attribute->_memPool;
+    attribute->~XMLAttribute();
+    pool->Free( attribute );
+}
+
+XMLAttribute* XMLElement::CreateAttribute()
+{
+    XMLAttribute* attrib = 0;
+    if ( _document->_cacheAttributeValues ) {
+        TIXMLASSERT( sizeof( XMLCachedAttribute ) == _document->_cachedAttributePool.ItemSize() );
+        attrib = new (_document->_cachedAttributePool.Alloc() ) XMLCachedAttribute();
+        attrib->_memPool = &_document->_cachedAttributePool;
+    }
+    else {
+        TIXMLASSERT( sizeof( XMLAttribute ) == _document->_attributePool.ItemSize() );
+        attrib = new (_document->_attributePool.Alloc() ) XMLAttribute();
+        attrib->_memPool = &_document->_attributePool;
+    }
+    TIXMLASSERT( attrib );
+    attrib->_memPool->SetTracked();
+    return attrib;
+}
+
+
+XMLElement* XMLElement::InsertNewChildElement(const char* name)
+{
+    XMLElement* node = _document->NewElement(name);
+    return InsertEndChild(node) ? node : 0;
+}
+
+XMLComment* XMLElement::InsertNewComment(const char* comment)
+{
+    XMLComment* node = _document->NewComment(comment);
+    return InsertEndChild(node) ? node : 0;
+}
+
+XMLText* XMLElement::InsertNewText(const char* text)
+{
+    XMLText* node = _document->NewText(text);
+    return InsertEndChild(node) ? node : 0;
+}
+
+XMLDeclaration* XMLElement::InsertNewDeclaration(const char* text)
+{
+    XMLDeclaration* node = _document->NewDeclaration(text);
+    return InsertEndChild(node) ? node : 0;
+}
+
+XMLUnknown* XMLElement::InsertNewUnknown(const char* text)
+{
+    XMLUnknown* node = _document->NewUnknown(text);
+    return InsertEndChild(node) ? node : 0;
+}
+
+
+
+//
+//	<ele></ele>
+//	<ele>foo<b>bar</b></ele>
+//
+char* XMLElement::ParseDeep( char* p, StrPair* parentEndTag )
+{
+    // Read the element name.
+    p = XMLUtil::SkipWhiteSpace( p, 0 );
+
+    // The closing element is the </element> form. It is
+    // parsed just like a regular element then deleted from
+    // the DOM.
+    if ( *p == '/' ) {
+        _closingType = CLOSING;
+        ++p;
+    }
+
+    p = _value.ParseName( p );
+    if ( _value.Empty() ) {
+        return 0;
+    }
+
+    p = ParseAttributes( p);
+    if ( p && _document->_namespaces && _closingType != CLOSING ) {
+        ResolveNamespaces( _document->_parseNamespaces );
+    }
+    if ( !p || !*p || _closingType != OPEN ) {
+        return p;
+    }
+
+    if ( !_document->_lazySpans.Empty() ) {
+        const XMLLazySpan* span = _document->FindLazySpan( p );
+        if ( span ) {
+            Extension( true )->pendingChildren = span;
+            return span->end;
+        }
+    }
+
+    const XMLNamespaceDecl* const outer = _document->_parseNamespaces;
+    _document->_parseNamespaces = NamespaceScope();
+    p = XMLNode::ParseDeep( p, parentEndTag);
+    _document->_parseNamespaces = outer;
+    return p;
+}
+
+
+// The prefix an xmlns attribute declares, or null for another attribute.
+static const char* DeclaredPrefix( const XMLAttribute* attribute )
+{
+    const char* name = attribute->Name();
+    if ( strncmp( name, "xmlns", 5 ) == 0 && ( name[5] == 0 || name[5] == ':' ) ) {
+        return name[5] ? name + 6 : "";
+    }
+    return 0;
+}
+
+
+// Whether 'scope' is made of the declarations of the xmlns attributes
+// from 'attribute' on, the last first, over 'outer'.
+static bool DeclaresOver( const XMLNamespaceDecl* scope, const XMLAttribute* attribute, const XMLNamespaceDecl* outer )
+{
+    DynArray< const XMLAttribute*, 8 > declarations;
+    for( ; attribute; attribute = attribute->Next() ) {
+        if ( DeclaredPrefix( attribute ) ) {
+            declarations.Push( attribute );
+        }
+    }
+    for( int i = declarations.Size() - 1; i >= 0; --i ) {
+        const char* prefix = DeclaredPrefix( declarations[i] );
+        const char* uri = declarations[i]->Value();
+        if ( !scope || scope->prefixLength != strlen( prefix ) || strncmp( scope->prefix, prefix, scope->prefixLength ) != 0
+             || ( scope->uri ? !XMLUtil::StringEqual( scope->uri, uri ) : *uri != 0 ) ) {
+            return false;
+        }
+        scope = scope->outer;
+    }
+    return scope == outer;
+}
+
+
+void XMLElement::ResolveNamespaces( const XMLNamespaceDecl* outer )
+{
+    if ( !outer ) {
+        outer = _document->NamespaceBase();
+    }
+    // Resolving again keeps the declarations made before if neither they
+    // nor the ones they were made over have changed, so that doing it
+    // over and over takes no more memory.
+    const XMLNamespaceDecl* scope = NamespaceScope();
+    if ( !scope || !DeclaresOver( scope, _rootAttribute, outer ) ) {
+        scope = outer;
+        for( const XMLAttribute* a = _rootAttribute; a; a = a->_next ) {
+            const char* prefix = DeclaredPrefix( a );
+            if ( prefix ) {
+                scope = _document->DeclareNamespace( prefix, strlen( prefix ), a->Value(), scope );
+            }
+        }
+    }
+    Extension( true )->namespaceScope = scope;
+    ResolveName();
+}
+
+
+// The namespace bound to the 'length' chars of 'prefix' in 'scope'.
+static const char* ResolvePrefix( const char* prefix, size_t length, const XMLNamespaceDecl* scope )
+{
+    for( ; scope; scope = scope->outer ) {
+        if ( scope->prefixLength == length && strncmp( scope->prefix, prefix, length ) == 0 ) {
+            return scope->uri;
+        }
+    }
+    return 0;
+}
+
+
+void XMLElement::ResolveName()
+{
+    XMLElementExtension* extension = Extension( true );
+    TIXMLASSERT( extension->namespaceScope );
+    const char* name = Name();
+    const char* colon = strchr( name, ':' );
+    extension->localNameOffset = colon ? static_cast<int>( colon + 1 - name ) : 0;
+    extension->namespaceURI = ResolvePrefix( name, colon ? colon - name : 0, extension->namespaceScope );
+}
+
+
+const XMLNamespaceDecl* XMLElement::NamespaceScope() const
+{
+    const XMLElementExtension* extension = Extension( false );
+    return extension ? extension->namespaceScope : 0;
+}
+
+
+void XMLElement::CopyNamespace( const XMLElement& from )
+{
+    const XMLElementExtension* extension = from.Extension( false );
+    if ( extension && extension->namespaceScope ) {
+        // Read before making an extension here, which may move it.
+        const XMLElementExtension source = *extension;
+        XMLElementExtension* copy = Extension( true );
+        copy->namespaceURI = source.namespaceURI;
+        copy->namespaceScope = source.namespaceScope;
+        copy->localNameOffset = source.localNameOffset;
+    }
+}
+
+
+const char* XMLElement::NamespaceURI() const
+{
+    const XMLElementExtension* extension = Extension( false );
+    return extension ? extension->namespaceURI : 0;
+}
+
+
+const char* XMLElement::LocalName() const
+{
+    const XMLElementExtension* extension = Extension( false );
+    if ( extension && extension->namespaceScope ) {
+        return Name() + extension->localNameOffset;
+    }
+    const char* name = Name();
+    const char* colon = strchr( name, ':' );
+    return colon ? colon + 1 : name;
+}
+
+
+const XMLAttribute* XMLElement::FindAttributeNS( const char* uri, const char* localName ) const
+{
+    const char* ns = _document->FindNamespaceURI( uri );
+    if ( !ns && uri && *uri ) {
+        return 0;
+    }
+    for( const XMLAttribute* a = _rootAttribute; a; a = a->_next ) {
+        const char* name = a->Name();
+        const char* colon = strchr( name, ':' );
+        if ( !colon ) {
+            if ( !ns && XMLUtil::StringEqual( name, localName ) ) {
+                return a;
+            }
+        }
+        else if ( ns && XMLUtil::StringEqual( colon + 1, localName )
+                  && ResolvePrefix( name, colon - name, NamespaceScope() ) == ns ) {
+            return a;
+        }
+    }
+    return 0;
+}
+
+
+const char* XMLElement::AttributeNS( const char* uri, const char* localName ) const
+{
+    const XMLAttribute* a = FindAttributeNS( uri, localName );
+    return a ? a->Value() : 0;
+}
+
+
+
+XMLNode* XMLElement::ShallowClone( XMLDocument* doc ) const
+{
+    if ( !doc ) {
+        doc = _document;
+    }
+    XMLElement* element = doc->NewElement( Value() );					// fixme: this will always allocate memory. Intern?
+    for( const XMLAttribute* a=FirstAttribute(); a; a=a->Next() ) {
+        element->SetAttribute( a->Name(), a->Value() );					// fixme: this will always allocate memory. Intern?
+    }
+    return element;
+}
+
+
+bool XMLElement::ShallowEqual( const XMLNode* compare ) const
+{
+    TIXMLASSERT( compare );
+    const XMLElement* other = compare->ToElement();
+    if ( other && XMLUtil::StringEqual( other->Name(), Name() )) {
+
+        const XMLAttribute* a=FirstAttribute();
+        const XMLAttribute* b=other->FirstAttribute();
+
+        while ( a && b ) {
+            if ( !XMLUtil::StringEqual( a->Value(), b->Value() ) ) {
+                return false;
+            }
+            a = a->Next();
+            b = b->Next();
+        }
+        if ( a || b ) {
+            // different count
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+
+bool XMLElement::Accept( XMLVisitor* visitor ) const
+{
+    TIXMLASSERT( visitor );
+    if ( visitor->VisitEnter( *this, _rootAttribute ) ) {
+        for ( const XMLNode* node=ChildrenHolder()->FirstChild(); node; node=node->NextSibling() ) {
+            if ( !node->Accept( visitor ) ) {
+                break;
+            }
+        }
+    }
+    return visitor->VisitExit( *this );
+}
+
+
+// --------- XMLDocument ----------- //
+
+// Warning: List must match 'enum XMLError'
+const char* XMLDocument::_errorNames[XML_ERROR_COUNT] = {
+    "XML_SUCCESS",
+    "XML_NO_ATTRIBUTE",
+    "XML_WRONG_ATTRIBUTE_TYPE",
+    "XML_ERROR_FILE_NOT_FOUND",
+    "XML_ERROR_FILE_COULD_NOT_BE_OPENED",
+    "XML_ERROR_FILE_READ_ERROR",
+    "XML_ERROR_PARSING_ELEMENT",
+    "XML_ERROR_PARSING_ATTRIBUTE",
+    "XML_ERROR_PARSING_TEXT",
+    "XML_ERROR_PARSING_CDATA",
+    "XML_ERROR_PARSING_COMMENT",
+    "XML_ERROR_PARSING_DECLARATION",
+    "XML_ERROR_PARSING_UNKNOWN",
+    "XML_ERROR_EMPTY_DOCUMENT",
+    "XML_ERROR_MISMATCHED_ELEMENT",
+    "XML_ERROR_PARSING",
+    "XML_CAN_NOT_CONVERT_TEXT",
+    "XML_NO_TEXT_NODE",
+	"XML_ELEMENT_DEPTH_EXCEEDED",
+    "XML_ERROR_INVALID_EDIT",
+    "XML_ERROR_INVALID_UTF8"
+};
+
+
+XMLDocument::XMLDocument( bool processEntities, Whitespace whitespaceMode ) :
+    XMLNode( 0 ),
+    _writeBOM( false ),
+    _processEntities( processEntities ),
+    _cacheAttributeValues( false ),
+    _errorID(XML_SUCCESS),
+    _whitespaceMode( whitespaceMode ),
+    _errorStr(),
+    _errorLineNum( 0 ),
+    _charBuffer( 0 ),
+    _charBufferSize( 0 ),
+    _newlines(),
+    _newlineCursor( 0 ),
+    _lineStart( 0 ),
+    _lineEnd( 0 ),
+	_parsingDepth(0),
+    _unlinked(),
+    _stringBlocks(),
+    _stringSpace( 0 ),
+    _stringSpaceLeft( 0 ),
+    _cloneStrings( 0 ),
+    _elementPool(),
+    _attributePool(),
+    _textPool(),
+    _commentPool(),
+    _cachedAttributePool(),
+    _subtreeFilters(),
+    _subtreeHandler( 0 ),
+    _lazyParse( false ),
+    _lazySpans(),
+    _snapshotOf( 0 ),
+    _sharesChildren( false ),
+    _elementExtensions(),
+    _freeElementExtensions(),
+    _inputEncoding( XML_ENCODING_UTF8 ),
+    _validateUTF8( false ),
+    _namespaces( false ),
+    _namespaceURIs(),
+    _namespacePool(),
+    _namespaceBase( 0 ),
+    _parseNamespaces( 0 )
+{
+    // avoid VC++ C4355 warning about 'this' in initializer list (C4355 is off by default in VS2012+)
+    _document = this;
+}
+
+
+XMLDocument::~XMLDocument()
+{
+    Clear();
+    ClearSubtreeFilters();
+}
+
+
+void XMLDocument::MarkInUse(const XMLNode* const node)
+{
+	TIXMLASSERT(node);
+	TIXMLASSERT(node->_parent == 0);
+
+	// Nodes are usually linked right after they are created, so the
+	// search starts from the newest.
+	for (int i = _unlinked.Size() - 1; i >= 0; --i) {
+		if (node == _unlinked[i]) {
+			_unlinked.SwapRemove(i);
+			break;
+		}
+	}
+}
+
+void XMLDocument::Clear()
+{
+    DeleteChildren();
+	while( _unlinked.Size()) {
+		DeleteNode(_unlinked[0]);	// Will remove from _unlinked as part of delete.
+	}
+
+#ifdef TINYXML2_DEBUG
+    const bool hadError = Error();
+#endif
+    ClearError();
+
+    delete [] _charBuffer;
+    _charBuffer = 0;
+    _charBufferSize = 0;
+    while ( !_stringBlocks.Empty() ) {
+        delete [] _stringBlocks.Pop();
+    }
+    _stringSpace = 0;
+    _stringSpaceLeft = 0;
+    if ( _cloneStrings ) {
+        StrPair::ReleaseBlock( _cloneStrings );
+        _cloneStrings = 0;
+    }
+	_parsingDepth = 0;
+    _lazySpans.Clear();
+    _newlines.Clear();
+    _newlineCursor = 0;
+    _lineStart = 0;
+    _lineEnd = 0;
+    _snapshotOf = 0;
+    _sharesChildren = false;
+    _elementExtensions.Clear();
+    _freeElementExtensions.Clear();
+    _inputEncoding = XML_ENCODING_UTF8;
+    _namespaceURIs.Clear();
+    _namespacePool.Clear();
+    _namespaceBase = 0;
+    _parseNamespaces = 0;
+
+#if 0
+    _textPool.Trace( "text" );
+    _elementPool.Trace( "element" );
+    _commentPool.Trace( "comment" );
+    _attributePool.Trace( "attribute" );
+#endif
+
+#ifdef TINYXML2_DEBUG
+    if ( !hadError ) {
+        TIXMLASSERT( _elementPool.CurrentAllocs()   == _elementPool.Untracked() );
+        TIXMLASSERT( _attributePool.CurrentAllocs() == _attributePool.Untracked() );
+        TIXMLASSERT( _textPool.CurrentAllocs()      == _textPool.Untracked() );
+        TIXMLASSERT( _commentPool.CurrentAllocs()   == _commentPool.Untracked() );
+        TIXMLASSERT( _cachedAttributePool.CurrentAllocs() == _cachedAttributePool.Untracked() );
+    }
+#endif
+}
+
+
+void XMLDocument::DeepCopy(XMLDocument* target) const
+{
+	TIXMLASSERT(target);
+    if (target == this) {
+        return; // technically success - a no-op.
+    }
+
+	target->Clear();
+	for (const XMLNode* node = this->FirstChild(); node; node = node->NextSibling()) {
+		target->InsertEndChild(node->DeepClone(target));
+	}
+    target->_namespaces = _namespaces;
+    if ( _namespaces ) {
+        target->ResolveNamespaces();
+    }
+}
+
+void XMLDocument::Snapshot( XMLDocument* target ) const
+{
+    TIXMLASSERT( target );
+    if ( target == this ) {
+        return;
+    }
+    target->Clear();
+    target->_writeBOM = _writeBOM;
+    // The namespaces of the shared nodes are those of this document.
+    target->_namespaces = _namespaces;
+    for( int i = 0; i < _namespaceURIs.Size(); ++i ) {
+        target->_namespaceURIs.Push( _namespaceURIs[i] );
+    }
+    if ( !NoChildren() ) {
+        target->_snapshotOf = this;
+        target->_sharesChildren = true;
+    }
+}
+
+char* XMLDocument::CopyToStringBlock( const char* value, size_t length )
+{
+    if ( length >= _stringSpaceLeft ) {
+        // Each block is twice the size of the last, up to 64k.
+        static const size_t MIN_BLOCK = 1024;
+        static const size_t MAX_BLOCK = 64 * 1024;
+        size_t size = MIN_BLOCK << ( _stringBlocks.Size() < 6 ? _stringBlocks.Size() : 6 );
+        if ( size > MAX_BLOCK ) {
+            size = MAX_BLOCK;
+        }
+        if ( size <= length ) {
+            size = length + 1;
+        }
+        _stringSpace = new char[size];
+        _stringSpaceLeft = size;
+        _stringBlocks.Push( _stringSpace );
+    }
+    char* const copy = _stringSpace;
+    memcpy( copy, value, length );
+    copy[length] = 0;
+    _stringSpace += length + 1;
+    _stringSpaceLeft -= length + 1;
+    return copy;
+}
+
+
+const char* XMLDocument::FindNamespaceURI( const char* uri ) const
+{
+    if ( !uri || !*uri ) {
+        return 0;
+    }
+    // Interned pointers are found without comparing the strings.
+    for( int i = 0; i < _namespaceURIs.Size(); ++i ) {
+        if ( _namespaceURIs[i] == uri ) {
+            return uri;
+        }
+    }
+    for( int i = 0; i < _namespaceURIs.Size(); ++i ) {
+        if ( XMLUtil::StringEqual( _namespaceURIs[i], uri ) ) {
+            return _namespaceURIs[i];
+        }
+    }
+    return 0;
+}
+
+
+const char* XMLDocument::InternNamespace( const char* uri )
+{
+    if ( !*uri ) {
+        return 0;
+    }
+    const char* interned = FindNamespaceURI( uri );
+    if ( !interned ) {
+        interned = CopyToStringBlock( uri, strlen( uri ) );
+        _namespaceURIs.Push( interned );
+    }
+    return interned;
+}
+
+
+const XMLNamespaceDecl* XMLDocument::DeclareNamespace( const char* prefix, size_t length, const char* uri, const XMLNamespaceDecl* outer )
+{
+    XMLNamespaceDecl* decl = static_cast<XMLNamespaceDecl*>( _namespacePool.Alloc() );
+    _namespacePool.SetTracked();
+    decl->prefix = length ? CopyToStringBlock( prefix, length ) : "";
+    decl->prefixLength = length;
+    decl->uri = InternNamespace( uri );
+    decl->outer = outer;
+    return decl;
+}
+
+
+const XMLNamespaceDecl* XMLDocument::NamespaceBase()
+{
+    if ( !_namespaceBase ) {
+        const XMLNamespaceDecl* xml = DeclareNamespace( "xml", 3, "http://www.w3.org/XML/1998/namespace", 0 );
+        _namespaceBase = DeclareNamespace( "xmlns", 5, "http://www.w3.org/2000/xmlns/", xml );
+    }
+    return _namespaceBase;
+}
+
+
+void XMLDocument::ResolveNamespaces()
+{
+    for( const XMLNode* node = FirstChild(); node; node = NextInSubtree( node, this ) ) {
+        XMLElement* element = const_cast<XMLElement*>( node->ToElement() );
+        if ( element ) {
+            const XMLElement* parent = element->_parent->ToElement();
+            element->ResolveNamespaces( parent ? parent->NamespaceScope() : 0 );
+        }
+    }
+}
+
+
+void XMLDocument::MoveString( StrPair* from, StrPair* to, const char* low, const char* high, char* copy )
+{
+    if ( from->Relocate( low, high, copy ) ) {
+        from->TransferTo( to );
+    }
+    else {
+        // Kept in the blocks of the other document, or static.
+        to->SetStr( from->GetStr() );
+        from->Reset();
+    }
+}
+
+
+XMLNode* XMLDocument::CreateNodeLike( const XMLNode& node, bool unlinked )
+{
+    if ( node.ToElement() ) {
+        return CreateNode<XMLElement>( _elementPool, unlinked );
+    }
+    if ( node.ToText() ) {
+        return CreateNode<XMLText>( _textPool, unlinked );
+    }
+    if ( node.ToComment() ) {
+        return CreateNode<XMLComment>( _commentPool, unlinked );
+    }
+    if ( node.ToDeclaration() ) {
+        return CreateNode<XMLDeclaration>( _commentPool, unlinked );
+    }
+    TIXMLASSERT( node.ToUnknown() );
+    return CreateNode<XMLUnknown>( _commentPool, unlinked );
+}
+
+
+XMLElement* XMLDocument::NewElement( const char* name )
+{
+    XMLElement* ele = CreateUnlinkedNode<XMLElement>( _elementPool );
+    ele->SetName( name );
+    return ele;
+}
+
+
+XMLComment* XMLDocument::NewComment( const char* str )
+{
+    XMLComment* comment = CreateUnlinkedNode<XMLComment>( _commentPool );
+    comment->SetValue( str );
+    return comment;
+}
+
+
+XMLText* XMLDocument::NewText( const char* str )
+{
+    XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
+    text->SetValue( str );
+    return text;
+}
+
+
+XMLDeclaration* XMLDocument::NewDeclaration( const char* str )
+{
+    XMLDeclaration* dec = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
+    dec->SetValue( str ? str : "xml version=\"1.0\" encoding=\"UTF-8\"" );
+    return dec;
+}
+
+
+XMLUnknown* XMLDocument::NewUnknown( const char* str )
+{
+    XMLUnknown* unk = CreateUnlinkedNode<XMLUnknown>( _commentPool );
+    unk->SetValue( str );
+    return unk;
+}
+
+static FILE* callfopen( const char* filepath, const char* mode )
+{
+    TIXMLASSERT( filepath );
+    TIXMLASSERT( mode );
+#if defined(_MSC_VER) && (_MSC_VER >= 1400 ) && (!defined WINCE)
+    FILE* fp = 0;
+    const errno_t err = fopen_s( &fp, filepath, mode );
+    if ( err ) {
+        return 0;
+    }
+#else
+    FILE* fp = fopen( filepath, mode );
+#endif
+    return fp;
+}
+
+void XMLDocument::DeleteNode( XMLNode* node )	{
+    TIXMLASSERT( node );
+    TIXMLASSERT(node->_document == this );
+    if (node->_parent) {
+        node->_parent->DeleteChild( node );
+    }
+    else {
+        // Isn't in the tree.
+        // Use the parent delete.
+        // Also, we need to mark it tracked: we 'know'
+        // it was never used.
+        node->_memPool->SetTracked();
+        // Call the static XMLNode version:
+        XMLNode::DeleteNode(node);
+    }
+}
+
+
+XMLError XMLDocument::LoadFile( const char* filename )
+{
+    if ( !filename ) {
+        TIXMLASSERT( false );
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+        return _errorID;
+    }
+
+    Clear();
+    FILE* fp = callfopen( filename, "rb" );
+    if ( !fp ) {
+        SetError( XML_ERROR_FILE_NOT_FOUND, 0, "filename=%s", filename );
+        return _errorID;
+    }
+    LoadFile( fp );
+    fclose( fp );
+    return _errorID;
+}
+
+// The encoding name in the XML declaration between 'p', after the "<?xml"
+// or "xml", and 'end', or null. Its length is put in 'length'.
+static const char* FindDeclaredEncoding( const char* p, const char* end, size_t* length )
+{
+    const char* q = p;
+    while ( end - q > 8 && *q != '>' && strncmp( q, "encoding", 8 ) != 0 ) {
+        ++q;
+    }
+    if ( end - q <= 8 || *q == '>' ) {
+        return 0;
+    }
+    q += 8;
+    while ( q < end && XMLUtil::IsWhiteSpace( *q ) ) {
+        ++q;
+    }
+    if ( q == end || *q != '=' ) {
+        return 0;
+    }
+    ++q;
+    while ( q < end && XMLUtil::IsWhiteSpace( *q ) ) {
+        ++q;
+    }
+    if ( q == end || ( *q != '"' && *q != '\'' ) ) {
+        return 0;
+    }
+    const char quote = *q++;
+    const char* const name = q;
+    while ( q < end && *q != quote ) {
+        ++q;
+    }
+    if ( q == end ) {
+        return 0;
+    }
+    *length = q - name;
+    return name;
+}
+
+// Whether the XML declaration at the start of the 'n' bytes at 'p' names
+// ISO-8859-1.
+static bool DeclaresLatin1( const char* p, size_t n )
+{
+    static const char* const names[] = {
+        "ISO-8859-1", "ISO_8859-1", "ISO8859-1", "LATIN1", "LATIN-1", "L1",
+        "IBM819", "CP819", "CSISOLATIN1", "ISO-IR-100"
+    };
+    if ( n < 5 || strncmp( p, "<?xml", 5 ) != 0 ) {
+        return false;
+    }
+    size_t length = 0;
+    const char* const name = FindDeclaredEncoding( p + 5, p + n, &length );
+    if ( !name ) {
+        return false;
+    }
+    for( size_t i = 0; i < sizeof( names ) / sizeof( names[0] ); ++i ) {
+        if ( strlen( names[i] ) != length ) {
+            continue;
+        }
+        size_t j = 0;
+        while ( j < length && ( name[j] >= 'a' && name[j] <= 'z' ? name[j] - 'a' + 'A' : name[j] ) == names[i][j] ) {
+            ++j;
+        }
+        if ( j == length ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The encoding of the 'n' bytes of text at 'p', from its first bytes.
+// UTF-8 never has a null in them; UTF-16 does, next to the '<' or the
+// first character, if there is no byte order mark.
+static XMLEncoding DetectEncoding( const char* p, size_t n )
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>( p );
+    if ( n >= 2 && ( ( u[0] == 0xFF && u[1] == 0xFE ) || ( u[0] != 0 && u[1] == 0 && n >= 4 && u[3] == 0 ) ) ) {
+        return XML_ENCODING_UTF16LE;
+    }
+    if ( n >= 2 && ( ( u[0] == 0xFE && u[1] == 0xFF ) || ( u[0] == 0 && u[1] != 0 && n >= 4 && u[2] == 0 ) ) ) {
+        return XML_ENCODING_UTF16BE;
+    }
+    if ( DeclaresLatin1( p, n ) ) {
+        return XML_ENCODING_LATIN1;
+    }
+    return XML_ENCODING_UTF8;
+}
+
+// The most bytes the 'n' bytes of text in 'encoding' take as UTF-8: every
+// UTF-16 unit takes up to 3, every Latin-1 character 2.
+static size_t DecodedSize( XMLEncoding encoding, size_t n )
+{
+    switch ( encoding ) {
+        case XML_ENCODING_UTF16LE:
+        case XML_ENCODING_UTF16BE:
+            return n + n / 2;
+        case XML_ENCODING_LATIN1:
+            return 2 * n;
+        default:
+            return n;
+    }
+}
+
+// Decodes UTF-16 to UTF-8, ASCII 16 units at a time. An unpaired
+// surrogate becomes U+FFFD, an odd last byte is dropped.
+static char* DecodeUTF16( const unsigned char* in, size_t n, bool bigEndian, char* out )
+{
+    const unsigned char* const end = in + ( n & ~static_cast<size_t>( 1 ) );
+    const int hi = bigEndian ? 0 : 1;
+    const int lo = 1 - hi;
+    if ( end - in >= 2 && in[hi] == 0xFE && in[lo] == 0xFF ) {
+        in += 2;
+    }
+#if defined( TIXML_SSE2 )
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nonAscii = _mm_set1_epi16( static_cast<short>( 0xFF80 ) );
+#endif
+    while ( in < end ) {
+        const unsigned char* stop = end;
+#if defined( TIXML_SSE2 )
+        if ( end - in >= 32 ) {
+            __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( in ) );
+            __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( in + 16 ) );
+            if ( bigEndian ) {
+                a = _mm_or_si128( _mm_slli_epi16( a, 8 ), _mm_srli_epi16( a, 8 ) );
+                b = _mm_or_si128( _mm_slli_epi16( b, 8 ), _mm_srli_epi16( b, 8 ) );
+            }
+            const __m128i high = _mm_and_si128( _mm_or_si128( a, b ), nonAscii );
+            if ( _mm_movemask_epi8( _mm_cmpeq_epi8( high, zero ) ) == 0xFFFF ) {
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_packus_epi16( a, b ) );
+                in += 32;
+                out += 16;
+                continue;
+            }
+            stop = in + 32;
+        }
+#endif
+        while ( in < stop ) {
+            unsigned long unit = ( in[hi] << 8 ) | in[lo];
+            in += 2;
+            if ( unit >= 0xD800 && unit < 0xDC00 && end - in >= 2 ) {
+                const unsigned long low = ( in[hi] << 8 ) | in[lo];
+                if ( low >= 0xDC00 && low < 0xE000 ) {
+                    unit = 0x10000 + ( ( unit - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+                    in += 2;
+                }
+            }
+            if ( unit >= 0xD800 && unit < 0xE000 ) {
+                unit = 0xFFFD;
+            }
+            int length = 0;
+            XMLUtil::ConvertUTF32ToUTF8( unit, out, &length );
+            out += length;
+        }
+    }
+    return out;
+}
+
+// Decodes Latin-1 to UTF-8, ASCII 16 characters at a time.
+static char* DecodeLatin1( const unsigned char* in, size_t n, char* out )
+{
+    const unsigned char* const end = in + n;
+    while ( in < end ) {
+        const unsigned char* stop = end;
+#if defined( TIXML_SSE2 )
+        if ( end - in >= 16 ) {
+            const __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( in ) );
+            if ( !_mm_movemask_epi8( v ) ) {
+                _mm_storeu_si128( reinterpret_cast<__m128i*>( out ), v );
+                in += 16;
+                out += 16;
+                continue;
+            }
+            stop = in + 16;
+        }
+#endif
+        for( ; in < stop; ++in ) {
+            const unsigned char c = *in;
+            if ( c < 0x80 ) {
+                *out++ = static_cast<char>( c );
+            }
+            else {
+                *out++ = static_cast<char>( 0xC0 | ( c >> 6 ) );
+                *out++ = static_cast<char>( 0x80 | ( c & 0x3F ) );
+            }
+        }
+    }
+    return out;
+}
+
+// Decodes the 'n' bytes of text in 'encoding' at 'in' to UTF-8 at 'out';
+// returns the length. The output may overlap the input if it starts
+// DecodedSize() - n bytes before it: it never catches up.
+static size_t DecodeText( XMLEncoding encoding, const char* in, size_t n, char* out )
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>( in );
+    switch ( encoding ) {
+        case XML_ENCODING_UTF16LE:
+            return DecodeUTF16( u, n, false, out ) - out;
+        case XML_ENCODING_UTF16BE:
+            return DecodeUTF16( u, n, true, out ) - out;
+        case XML_ENCODING_LATIN1:
+            return DecodeLatin1( u, n, out ) - out;
+        default:
+            memmove( out, in, n );
+            return n;
+    }
+}
+
+
+XMLError XMLDocument::LoadFile( FILE* fp )
+{
+    Clear();
+
+    size_t size = 0;
+    if ( !ReadFile( fp, &size, true ) ) {
+        return _errorID;
+    }
+    Parse();
+    return _errorID;
+}
+
+
+// Reads the whole file into _charBuffer, null terminated.
+bool XMLDocument::ReadFile( FILE* fp, size_t* length, bool decode )
+{
+    TIXML_FSEEK( fp, 0, SEEK_SET );
+    if ( fgetc( fp ) == EOF && ferror( fp ) != 0 ) {
+        SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
+        return false;
+    }
+
+    TIXML_FSEEK( fp, 0, SEEK_END );
+
+    unsigned long long filelength;
+    {
+        const long long fileLengthSigned = TIXML_FTELL( fp );
+        TIXML_FSEEK( fp, 0, SEEK_SET );
+        if ( fileLengthSigned == -1L ) {
+            SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
+            return false;
+        }
+        TIXMLASSERT( fileLengthSigned >= 0 );
+        filelength = static_cast<unsigned long long>(fileLengthSigned);
+    }
+
+    const size_t maxSizeT = static_cast<size_t>(-1);
+    // We'll do the comparison as an unsigned long long, because that's guaranteed to be at
+    // least 8 bytes, even on a 32-bit platform.
+    if ( filelength >= static_cast<unsigned long long>(maxSizeT) ) {
+        // Cannot handle files which won't fit in buffer together with null terminator
+        SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
+        return false;
+    }
+
+    if ( filelength == 0 ) {
+        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(filelength);
+    XMLEncoding encoding = XML_ENCODING_UTF8;
+    if ( decode ) {
+        char head[128];
+        const size_t headSize = fread( head, 1, size < sizeof( head ) ? size : sizeof( head ), fp );
+        TIXML_FSEEK( fp, 0, SEEK_SET );
+        encoding = DetectEncoding( head, headSize );
+    }
+    // Text to decode is read into the end of a buffer big enough for it
+    // as UTF-8, and decoded in place.
+    const size_t offset = DecodedSize( encoding, size ) - size;
+    TIXMLASSERT( _charBuffer == 0 );
+    _charBuffer = new char[offset+size+1];
+    _charBufferSize = size+1;
+    const size_t read = fread( _charBuffer + offset, 1, size, fp );
+    if ( read != size ) {
+        SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
+        return false;
+    }
+    if ( encoding != XML_ENCODING_UTF8 ) {
+        size = DecodeText( encoding, _charBuffer + offset, size, _charBuffer );
+        _charBufferSize = size+1;
+        _inputEncoding = encoding;
+    }
+
+    _charBuffer[size] = 0;
+    *length = size;
+    return true;
+}
+
+
+XMLError XMLDocument::SaveFile( const char* filename, bool compact )
+{
+    if ( !filename ) {
+        TIXMLASSERT( false );
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+        return _errorID;
+    }
+
+    FILE* fp = callfopen( filename, "w" );
+    if ( !fp ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=%s", filename );
+        return _errorID;
+    }
+    SaveFile(fp, compact);
+    fclose( fp );
+    return _errorID;
+}
+
+
+XMLError XMLDocument::SaveFile( FILE* fp, bool compact )
+{
+    // Clear any error from the last save, otherwise it will get reported
+    // for *this* call.
+    ClearError();
+    XMLPrinter stream( fp, compact );
+    Print( &stream );
+    return _errorID;
+}
+
+
+// --------- Binary images ----------- //
+//
+// Layout:
+//  header:       "TXB2", then version, flags, size of the string table and
+//                size of the node table as 32 bit little endian words
+//  string table: null terminated strings, the first one empty
+//  node table:   the number of top level nodes, then the nodes in document
+//                order. A node is (kind, line, value). An element adds its
+//                attribute count, an attribute is (name, value, line), and
+//                then its child count; its children follow.
+// Numbers in the node table are LEB128 varints; strings are referred to by
+// their offset in the string table.
+
+static const char BINARY_MAGIC[4] = { 'T', 'X', 'B', '2' };
+static const uint32_t BINARY_VERSION = 1;
+static const uint32_t BINARY_HEADER_SIZE = 20;
+static const uint32_t BINARY_FLAG_BOM = 1;
+static const uint32_t BINARY_CDATA = 0x100;
+
+enum BinaryNodeKind {
+    BINARY_ELEMENT = 1,
+    BINARY_TEXT,
+    BINARY_COMMENT,
+    BINARY_DECLARATION,
+    BINARY_UNKNOWN,
+    BINARY_DOCUMENT     // only in frozen documents
+};
+
+static inline void WriteBinaryWord( char* p, uint32_t w )
+{
+    p[0] = static_cast<char>( w & 0xff );
+    p[1] = static_cast<char>( ( w >> 8 ) & 0xff );
+    p[2] = static_cast<char>( ( w >> 16 ) & 0xff );
+    p[3] = static_cast<char>( ( w >> 24 ) & 0xff );
+}
+
+static inline uint32_t ReadBinaryWord( const char* p )
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>( p );
+    return static_cast<uint32_t>( u[0] ) | ( static_cast<uint32_t>( u[1] ) << 8 )
+           | ( static_cast<uint32_t>( u[2] ) << 16 ) | ( static_cast<uint32_t>( u[3] ) << 24 );
+}
+
+// Reads a varint, or returns false if it runs past the end.
+static inline bool ReadBinaryNumber( const char** p, const char* end, uint32_t* value )
+{
+    uint32_t v = 0;
+    for( int shift = 0; shift < 35 && *p < end; shift += 7 ) {
+        const unsigned char byte = static_cast<unsigned char>( *( (*p)++ ) );
+        v |= static_cast<uint32_t>( byte & 0x7f ) << shift;
+        if ( !( byte & 0x80 ) ) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// The tables of an image are DynArrays, which must stay well within int.
+static const int MAX_IMAGE_TABLE_SIZE = INT_MAX / 4;
+
+// Names repeat a lot, so every string is stored once.
+class XMLStringTable
+{
+public:
+    XMLStringTable() : _used( 0 ), _tooLarge( false ) {
+        _strings.Push( 0 );     // offset 0 is the empty string
+        Rehash( 256 );
+    }
+
+    uint32_t Add( const char* str ) {
+        if ( !*str ) {
+            return 0;
+        }
+        const int mask = _slots.Size() - 1;
+        int slot = static_cast<int>( Hash( str ) & static_cast<uint32_t>( mask ) );
+        while ( _slots[slot] ) {
+            if ( strcmp( &_strings[_slots[slot]], str ) == 0 ) {
+                return static_cast<uint32_t>( _slots[slot] );
+            }
+            slot = ( slot + 1 ) & mask;
+        }
+        const size_t length = strlen( str ) + 1;
+        if ( length > static_cast<size_t>( MAX_IMAGE_TABLE_SIZE - _strings.Size() ) || _slots.Size() > MAX_IMAGE_TABLE_SIZE / 2 ) {
+            _tooLarge = true;
+            return 0;
+        }
+        const int offset = _strings.Size();
+        memcpy( _strings.PushArr( static_cast<int>( length ) ), str, length );
+        _slots[slot] = offset;
+        if ( ++_used * 2 > _slots.Size() ) {
+            Rehash( _slots.Size() * 2 );
+        }
+        return static_cast<uint32_t>( offset );
+    }
+
+    const char* Mem() const {
+        return _strings.Mem();
+    }
+    size_t Size() const {
+        return static_cast<size_t>( _strings.Size() );
+    }
+    // True if a string didn't fit; the table is then incomplete.
+    bool TooLarge() const {
+        return _tooLarge;
+    }
+
+private:
+    static uint32_t Hash( const char* str ) {
+        uint32_t h = 2166136261U;
+        for( ; *str; ++str ) {
+            h = ( h ^ static_cast<unsigned char>( *str ) ) * 16777619U;
+        }
+        return h;
+    }
+
+    void Rehash( int size ) {
+        DynArray< int, 1 > old;
+        for( int i = 0; i < _slots.Size(); ++i ) {
+            if ( _slots[i] ) {
+                old.Push( _slots[i] );
+            }
+        }
+        _slots.Clear();
+        memset( _slots.PushArr( size ), 0, size * sizeof( int ) );
+        for( int i = 0; i < old.Size(); ++i ) {
+            int slot = static_cast<int>( Hash( &_strings[old[i]] ) & static_cast<uint32_t>( size - 1 ) );
+            while ( _slots[slot] ) {
+                slot = ( slot + 1 ) & ( size - 1 );
+            }
+            _slots[slot] = old[i];
+        }
+    }
+
+    DynArray< char, 1024 > _strings;
+    DynArray< int, 1 > _slots;      // string offsets, 0 for empty
+    int _used;
+    bool _tooLarge;
+};
+
+
+static uint32_t BinaryNodeKindOf( const XMLNode* node )
+{
+    if ( node->ToElement() ) {
+        return BINARY_ELEMENT;
+    }
+    if ( const XMLText* text = node->ToText() ) {
+        return BINARY_TEXT | ( text->CData() ? BINARY_CDATA : 0 );
+    }
+    if ( node->ToComment() ) {
+        return BINARY_COMMENT;
+    }
+    if ( node->ToDeclaration() ) {
+        return BINARY_DECLARATION;
+    }
+    if ( node->ToDocument() ) {
+        return BINARY_DOCUMENT;
+    }
+    return BINARY_UNKNOWN;
+}
+
+
+class XMLBinaryWriter
+{
+public:
+    XMLBinaryWriter() : _tooLarge( false ) {}
+
+    void Number( uint32_t n ) {
+        if ( _nodes.Size() > MAX_IMAGE_TABLE_SIZE - 5 ) {
+            _tooLarge = true;
+            return;
+        }
+        while ( n >= 0x80 ) {
+            _nodes.Push( static_cast<char>( ( n & 0x7f ) | 0x80 ) );
+            n >>= 7;
+        }
+        _nodes.Push( static_cast<char>( n ) );
+    }
+
+    void String( const char* str ) {
+        Number( _strings.Add( str ) );
+    }
+
+    void Node( const XMLNode* node ) {
+        Number( BinaryNodeKindOf( node ) );
+        Number( static_cast<uint32_t>( node->GetLineNum() ) );
+        String( node->Value() );
+        if ( const XMLElement* element = node->ToElement() ) {
+            uint32_t count = 0;
+            for( const XMLAttribute* a = element->FirstAttribute(); a; a = a->Next() ) {
+                ++count;
+            }
+            Number( count );
+            for( const XMLAttribute* a = element->FirstAttribute(); a; a = a->Next() ) {
+                String( a->Name() );
+                String( a->Value() );
+                Number( static_cast<uint32_t>( a->GetLineNum() ) );
+            }
+            Children( element );
+        }
+    }
+
+    void Children( const XMLNode* parent ) {
+        uint32_t count = 0;
+        for( const XMLNode* child = parent->FirstChild(); child; child = child->NextSibling() ) {
+            ++count;
+        }
+        Number( count );
+        for( const XMLNode* child = parent->FirstChild(); child; child = child->NextSibling() ) {
+            Node( child );
+        }
+    }
+
+    // True if the document didn't fit: then the tables are incomplete.
+    bool TooLarge() const {
+        return _tooLarge || _strings.TooLarge();
+    }
+
+    bool Write( FILE* fp, bool bom ) {
+        TIXMLASSERT( !TooLarge() );
+        char header[BINARY_HEADER_SIZE];
+        memcpy( header, BINARY_MAGIC, 4 );
+        WriteBinaryWord( header + 4, BINARY_VERSION );
+        WriteBinaryWord( header + 8, bom ? BINARY_FLAG_BOM : 0 );
+        WriteBinaryWord( header + 12, static_cast<uint32_t>( _strings.Size() ) );
+        WriteBinaryWord( header + 16, static_cast<uint32_t>( _nodes.Size() ) );
+        const size_t nodeBytes = static_cast<size_t>( _nodes.Size() );
+        return fwrite( header, 1, BINARY_HEADER_SIZE, fp ) == BINARY_HEADER_SIZE
+               && fwrite( _strings.Mem(), 1, _strings.Size(), fp ) == _strings.Size()
+               && fwrite( _nodes.Mem(), 1, nodeBytes, fp ) == nodeBytes;
+    }
+
+private:
+    XMLStringTable _strings;
+    DynArray< char, 1024 > _nodes;
+    bool _tooLarge;
+};
+
+
+XMLError XMLDocument::SaveBinary( const char* filename )
+{
+    if ( !filename ) {
+        TIXMLASSERT( false );
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+        return _errorID;
+    }
+
+    FILE* fp = callfopen( filename, "wb" );
+    if ( !fp ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=%s", filename );
+        return _errorID;
+    }
+    SaveBinary( fp );
+    fclose( fp );
+    return _errorID;
+}
+
+
+XMLError XMLDocument::SaveBinary( FILE* fp )
+{
+    ClearError();
+    XMLBinaryWriter writer;
+    writer.Children( this );
+    if ( writer.TooLarge() ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "document too large for a binary image" );
+    }
+    else if ( !writer.Write( fp, _writeBOM ) ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "binary image could not be written" );
+    }
+    return _errorID;
+}
+
+
+XMLError XMLDocument::LoadBinary( const char* filename )
+{
+    if ( !filename ) {
+        TIXMLASSERT( false );
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+        return _errorID;
+    }
+
+    Clear();
+    FILE* fp = callfopen( filename, "rb" );
+    if ( !fp ) {
+        SetError( XML_ERROR_FILE_NOT_FOUND, 0, "filename=%s", filename );
+        return _errorID;
+    }
+    LoadBinary( fp );
+    fclose( fp );
+    return _errorID;
+}
+
+
+XMLError XMLDocument::LoadBinary( FILE* fp )
+{
+    Clear();
+
+    size_t size = 0;
+    if ( !ReadFile( fp, &size, false ) ) {
+        return _errorID;
+    }
+    ParseBinary( size );
+    if ( Error() ) {
+        DeleteChildren();
+        _elementPool.Clear();
+        _attributePool.Clear();
+        _textPool.Clear();
+        _commentPool.Clear();
+        _cachedAttributePool.Clear();
+    }
+    return _errorID;
+}
+
+
+// The strings of the image stay in _charBuffer, where the nodes point to
+// them as they would point into parsed text.
+void XMLDocument::ParseBinary( size_t size )
+{
+    TIXMLASSERT( _charBuffer );
+    if ( size < BINARY_HEADER_SIZE || memcmp( _charBuffer, BINARY_MAGIC, 4 ) != 0 ) {
+        SetError( XML_ERROR_PARSING, 0, "not a binary image" );
+        return;
+    }
+    if ( ReadBinaryWord( _charBuffer + 4 ) != BINARY_VERSION ) {
+        SetError( XML_ERROR_PARSING, 0, "binary image version %u", static_cast<unsigned>( ReadBinaryWord( _charBuffer + 4 ) ) );
+        return;
+    }
+    const uint32_t flags = ReadBinaryWord( _charBuffer + 8 );
+    const size_t stringBytes = ReadBinaryWord( _charBuffer + 12 );
+    const size_t nodeBytes = ReadBinaryWord( _charBuffer + 16 );
+    char* const strings = _charBuffer + BINARY_HEADER_SIZE;
+    if ( stringBytes == 0 || size - BINARY_HEADER_SIZE != stringBytes + nodeBytes || strings[stringBytes-1] != 0 ) {
+        SetError( XML_ERROR_PARSING, 0, "binary image is truncated or corrupt" );
+        return;
+    }
+    _writeBOM = ( flags & BINARY_FLAG_BOM ) != 0;
+
+    const char* p = strings + stringBytes;
+    const char* const end = p + nodeBytes;
+
+    // Nodes are added depth first: the stack holds the open parents and how
+    // many children each still expects.
+    DynArray< XMLNode*, 32 > parents;
+    DynArray< uint32_t, 32 > remaining;
+    uint32_t count = 0;
+    if ( ReadBinaryNumber( &p, end, &count ) ) {
+        parents.Push( this );
+        remaining.Push( count );
+    }
+    while ( !parents.Empty() ) {
+        if ( remaining.PeekTop() == 0 ) {
+            parents.Pop();
+            remaining.Pop();
+            continue;
+        }
+        --remaining[remaining.Size() - 1];
+
+        uint32_t kind = 0;
+        uint32_t line = 0;
+        uint32_t value = 0;
+        if ( !ReadBinaryNumber( &p, end, &kind ) || !ReadBinaryNumber( &p, end, &line )
+             || !ReadBinaryNumber( &p, end, &value ) || value >= stringBytes ) {
+            break;
+        }
+        XMLNode* node = 0;
+        switch ( kind ) {
+            case BINARY_ELEMENT:
+                node = CreateUnlinkedNode<XMLElement>( _elementPool );
+                break;
+            case BINARY_TEXT:
+            case BINARY_TEXT | BINARY_CDATA:
+            {
+                XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
+                text->SetCData( ( kind & BINARY_CDATA ) != 0 );
+                node = text;
+                break;
+            }
+            case BINARY_COMMENT:
+                node = CreateUnlinkedNode<XMLComment>( _commentPool );
+                break;
+            case BINARY_DECLARATION:
+                node = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
+                break;
+            case BINARY_UNKNOWN:
+                node = CreateUnlinkedNode<XMLUnknown>( _commentPool );
+                break;
+            default:
+                break;
+        }
+        if ( !node ) {
+            break;
+        }
+        char* const str = strings + value;
+        node->_value.Set( str, str + strlen( str ), 0 );
+        node->_parseLineNum = static_cast<int>( line );
+        parents.PeekTop()->InsertEndChild( node );
+
+        XMLElement* element = node->ToElement();
+        if ( !element ) {
+            continue;
+        }
+        uint32_t attributes = 0;
+        if ( !ReadBinaryNumber( &p, end, &attributes ) ) {
+            break;
+        }
+        XMLAttribute* prevAttribute = 0;
+        for( ; attributes; --attributes ) {
+            uint32_t name = 0;
+            uint32_t attributeValue = 0;
+            uint32_t attributeLine = 0;
+            if ( !ReadBinaryNumber( &p, end, &name ) || !ReadBinaryNumber( &p, end, &attributeValue )
+                 || !ReadBinaryNumber( &p, end, &attributeLine ) || name >= stringBytes || attributeValue >= stringBytes ) {
+                break;
+            }
+            XMLAttribute* attrib = element->CreateAttribute();
+            attrib->_name.Set( strings + name, strings + name + strlen( strings + name ), 0 );
+            attrib->_value.Set( strings + attributeValue, strings + attributeValue + strlen( strings + attributeValue ), 0 );
+            attrib->_parseLineNum = static_cast<int>( attributeLine );
+            if ( prevAttribute ) {
+                prevAttribute->_next = attrib;
+            }
+            else {
+                element->_rootAttribute = attrib;
+            }
+            prevAttribute = attrib;
+        }
+        uint32_t children = 0;
+        if ( attributes || !ReadBinaryNumber( &p, end, &children ) ) {
+            break;
+        }
+        if ( children ) {
+            if ( parents.Size() > TINYXML2_MAX_ELEMENT_DEPTH ) {
+                SetError( XML_ELEMENT_DEPTH_EXCEEDED, static_cast<int>( line ), "Element nesting is too deep." );
+                return;
+            }
+            parents.Push( element );
+            remaining.Push( children );
+        }
+    }
+    if ( !parents.Empty() || p != end ) {
+        SetError( XML_ERROR_PARSING, 0, "binary image is truncated or corrupt" );
+    }
+}
+
+
+// --------- Frozen documents ----------- //
+//
+// Layout, all 32 bit little endian words:
+//  header:     "TXF1", version, node count, attribute count, size of the
+//              string table
+//  nodes:      FROZEN_NODE_WORDS per node, the document node first
+//  attributes: FROZEN_ATTRIBUTE_WORDS per attribute, those of an element
+//              next to each other
+//  strings:    null terminated, the first one empty
+// Nodes and attributes refer to each other by index, FROZEN_NONE for none,
+// and to strings by offset.
+
+static const char FROZEN_MAGIC[4] = { 'T', 'X', 'F', '1' };
+static const uint32_t FROZEN_VERSION = 1;
+static const uint32_t FROZEN_HEADER_SIZE = 20;
+static const uint32_t FROZEN_NONE = 0xffffffff;
+
+enum {
+    FROZEN_KIND,
+    FROZEN_VALUE,
+    FROZEN_LINE,
+    FROZEN_PARENT,
+    FROZEN_FIRST_CHILD,
+    FROZEN_LAST_CHILD,
+    FROZEN_PREVIOUS,
+    FROZEN_NEXT,
+    FROZEN_FIRST_ATTRIBUTE,
+    FROZEN_ATTRIBUTE_COUNT,
+    FROZEN_NODE_WORDS
+};
+
+enum {
+    FROZEN_ATTRIBUTE_NAME,
+    FROZEN_ATTRIBUTE_VALUE,
+    FROZEN_ATTRIBUTE_LINE,
+    FROZEN_ATTRIBUTE_WORDS
+};
+
+
+class XMLFrozenWriter
+{
+public:
+    XMLFrozenWriter() : _tooLarge( false ) {}
+
+    // Adds the node and its subtree, and returns the index of the node -
+    // or FROZEN_NONE if the document is too large.
+    uint32_t Add( const XMLNode* node, uint32_t parent ) {
+        if ( _nodes.Size() > MAX_FROZEN_WORDS - FROZEN_NODE_WORDS ) {
+            _tooLarge = true;
+            return FROZEN_NONE;
+        }
+        const uint32_t index = static_cast<uint32_t>( _nodes.Size() / FROZEN_NODE_WORDS );
+        uint32_t* record = _nodes.PushArr( FROZEN_NODE_WORDS );
+        record[FROZEN_KIND] = BinaryNodeKindOf( node );
+        record[FROZEN_VALUE] = node->ToDocument() ? 0 : _strings.Add( node->Value() );
+        record[FROZEN_LINE] = static_cast<uint32_t>( node->GetLineNum() );
+        record[FROZEN_PARENT] = parent;
+        record[FROZEN_FIRST_CHILD] = FROZEN_NONE;
+        record[FROZEN_LAST_CHILD] = FROZEN_NONE;
+        record[FROZEN_PREVIOUS] = FROZEN_NONE;
+        record[FROZEN_NEXT] = FROZEN_NONE;
+        record[FROZEN_FIRST_ATTRIBUTE] = static_cast<uint32_t>( _attributes.Size() / FROZEN_ATTRIBUTE_WORDS );
+        record[FROZEN_ATTRIBUTE_COUNT] = 0;
+
+        uint32_t attributes = 0;
+        if ( const XMLElement* element = node->ToElement() ) {
+            for( const XMLAttribute* a = element->FirstAttribute(); a; a = a->Next() ) {
+                if ( _attributes.Size() > MAX_FROZEN_WORDS - FROZEN_ATTRIBUTE_WORDS ) {
+                    _tooLarge = true;
+                    return FROZEN_NONE;
+                }
+                uint32_t* attribute = _attributes.PushArr( FROZEN_ATTRIBUTE_WORDS );
+                attribute[FROZEN_ATTRIBUTE_NAME] = _strings.Add( a->Name() );
+                attribute[FROZEN_ATTRIBUTE_VALUE] = _strings.Add( a->Value() );
+                attribute[FROZEN_ATTRIBUTE_LINE] = static_cast<uint32_t>( a->GetLineNum() );
+                ++attributes;
+            }
+        }
+        // The array may have moved: only use indices from here on.
+        Word( index, FROZEN_ATTRIBUTE_COUNT ) = attributes;
+
+        uint32_t previous = FROZEN_NONE;
+        for( const XMLNode* child = node->FirstChild(); child; child = child->NextSibling() ) {
+            const uint32_t childIndex = Add( child, index );
+            if ( childIndex == FROZEN_NONE ) {
+                return FROZEN_NONE;
+            }
+            if ( previous == FROZEN_NONE ) {
+                Word( index, FROZEN_FIRST_CHILD ) = childIndex;
+            }
+            else {
+                Word( previous, FROZEN_NEXT ) = childIndex;
+            }
+            Word( childIndex, FROZEN_PREVIOUS ) = previous;
+            previous = childIndex;
+        }
+        Word( index, FROZEN_LAST_CHILD ) = previous;
+        return index;
+    }
+
+    // True if the document didn't fit: then the tables are incomplete.
+    bool TooLarge() const {
+        return _tooLarge || _strings.TooLarge();
+    }
+
+    bool Write( FILE* fp ) {
+        TIXMLASSERT( !TooLarge() );
+        char header[FROZEN_HEADER_SIZE];
+        memcpy( header, FROZEN_MAGIC, 4 );
+        WriteBinaryWord( header + 4, FROZEN_VERSION );
+        WriteBinaryWord( header + 8, static_cast<uint32_t>( _nodes.Size() / FROZEN_NODE_WORDS ) );
+        WriteBinaryWord( header + 12, static_cast<uint32_t>( _attributes.Size() / FROZEN_ATTRIBUTE_WORDS ) );
+        WriteBinaryWord( header + 16, static_cast<uint32_t>( _strings.Size() ) );
+        return fwrite( header, 1, FROZEN_HEADER_SIZE, fp ) == FROZEN_HEADER_SIZE
+               && WriteWords( fp, _nodes ) && WriteWords( fp, _attributes )
+               && fwrite( _strings.Mem(), 1, _strings.Size(), fp ) == _strings.Size();
+    }
+
+private:
+    // The words of each table, kept within the same bound as the string table.
+    enum { MAX_FROZEN_WORDS = MAX_IMAGE_TABLE_SIZE / 4 };
+
+    uint32_t& Word( uint32_t index, int field ) {
+        TIXMLASSERT( index < static_cast<uint32_t>( _nodes.Size() / FROZEN_NODE_WORDS ) );
+        return _nodes[static_cast<int>( index ) * FROZEN_NODE_WORDS + field];
+    }
+
+    static bool WriteWords( FILE* fp, const DynArray< uint32_t, 256 >& words ) {
+        char buffer[1024];
+        int used = 0;
+        for( int i = 0; i < words.Size(); ++i ) {
+            WriteBinaryWord( buffer + used, words[i] );
+            used += 4;
+            if ( used == static_cast<int>( sizeof( buffer ) ) || i + 1 == words.Size() ) {
+                if ( fwrite( buffer, 1, used, fp ) != static_cast<size_t>( used ) ) {
+                    return false;
+                }
+                used = 0;
+            }
+        }
+        return true;
+    }
+
+    XMLStringTable _strings;
+    DynArray< uint32_t, 256 > _nodes;
+    DynArray< uint32_t, 256 > _attributes;
+    bool _tooLarge;
+};
+
+
+XMLError XMLDocument::SaveFrozen( const char* filename )
+{
+    if ( !filename ) {
+        TIXMLASSERT( false );
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
+        return _errorID;
+    }
+
+    FILE* fp = callfopen( filename, "wb" );
+    if ( !fp ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=%s", filename );
+        return _errorID;
+    }
+    SaveFrozen( fp );
+    fclose( fp );
+    return _errorID;
+}
+
+
+XMLError XMLDocument::SaveFrozen( FILE* fp )
+{
+    ClearError();
+    XMLFrozenWriter writer;
+    writer.Add( this, FROZEN_NONE );
+    if ( writer.TooLarge() ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "document too large to freeze" );
+    }
+    else if ( !writer.Write( fp ) ) {
+        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "frozen document could not be written" );
+    }
+    return _errorID;
+}
+
+
+XMLFrozenDocument::XMLFrozenDocument() :
+    _errorID( XML_SUCCESS ),
+    _nodes( 0 ),
+    _attributes( 0 ),
+    _strings( 0 ),
+    _nodeCount( 0 ),
+    _attributeCount( 0 ),
+    _stringBytes( 0 ),
+    _buffer( 0 )
+{
+}
+
+
+XMLFrozenDocument::~XMLFrozenDocument()
+{
+    Close();
+}
+
+
+void XMLFrozenDocument::Close()
+{
+    delete [] _buffer;
+    _buffer = 0;
+    _nodes = 0;
+    _attributes = 0;
+    _strings = 0;
+    _nodeCount = 0;
+    _attributeCount = 0;
+    _stringBytes = 0;
+    _errorID = XML_SUCCESS;
+}
+
+
+XMLError XMLFrozenDocument::Open( const void* data, size_t size )
+{
+    Close();
+    const char* const p = static_cast<const char*>( data );
+    if ( !p || size < FROZEN_HEADER_SIZE || memcmp( p, FROZEN_MAGIC, 4 ) != 0
+         || ReadBinaryWord( p + 4 ) != FROZEN_VERSION ) {
+        _errorID = XML_ERROR_PARSING;
+        return _errorID;
+    }
+    const uint32_t nodeCount = ReadBinaryWord( p + 8 );
+    const uint32_t attributeCount = ReadBinaryWord( p + 12 );
+    const uint32_t stringBytes = ReadBinaryWord( p + 16 );
+    const unsigned long long expected = static_cast<unsigned long long>( FROZEN_HEADER_SIZE )
+                                        + static_cast<unsigned long long>( nodeCount ) * FROZEN_NODE_WORDS * 4
+                                        + static_cast<unsigned long long>( attributeCount ) * FROZEN_ATTRIBUTE_WORDS * 4
+                                        + stringBytes;
+    if ( nodeCount == 0 || stringBytes == 0 || expected != static_cast<unsigned long long>( size ) || p[size-1] != 0
+         || ReadBinaryWord( p + FROZEN_HEADER_SIZE ) != BINARY_DOCUMENT ) {
+        _errorID = XML_ERROR_PARSING;
+        return _errorID;
+    }
+    _nodes = p + FROZEN_HEADER_SIZE;
+    _attributes = _nodes + static_cast<size_t>( nodeCount ) * FROZEN_NODE_WORDS * 4;
+    _strings = _attributes + static_cast<size_t>( attributeCount ) * FROZEN_ATTRIBUTE_WORDS * 4;
+    _nodeCount = nodeCount;
+    _attributeCount = attributeCount;
+    _stringBytes = stringBytes;
+    return _errorID;
+}
+
+
+XMLError XMLFrozenDocument::LoadFile( const char* filename )
+{
+    Close();
+    FILE* fp = filename ? callfopen( filename, "rb" ) : 0;
+    if ( !fp ) {
+        _errorID = XML_ERROR_FILE_NOT_FOUND;
+        return _errorID;
+    }
+    TIXML_FSEEK( fp, 0, SEEK_END );
+    const long long length = TIXML_FTELL( fp );
+    TIXML_FSEEK( fp, 0, SEEK_SET );
+    if ( length <= 0 || static_cast<unsigned long long>( length ) >= static_cast<unsigned long long>( static_cast<size_t>(-1) ) ) {
+        fclose( fp );
+        _errorID = XML_ERROR_FILE_READ_ERROR;
+        return _errorID;
+    }
+    const size_t size = static_cast<size_t>( length );
+    char* buffer = new char[size];
+    const size_t read = fread( buffer, 1, size, fp );
+    fclose( fp );
+    if ( read != size ) {
+        delete [] buffer;
+        _errorID = XML_ERROR_FILE_READ_ERROR;
+        return _errorID;
+    }
+    if ( Open( buffer, size ) != XML_SUCCESS ) {
+        delete [] buffer;
+        return _errorID;
+    }
+    _buffer = buffer;
+    return _errorID;
+}
+
+
+XMLFrozenNode XMLFrozenDocument::Document() const
+{
+    return _nodeCount ? XMLFrozenNode( this, 0 ) : XMLFrozenNode();
+}
+
+
+const char* XMLFrozenDocument::NodeRecord( uint32_t index ) const
+{
+    return index < _nodeCount ? _nodes + static_cast<size_t>( index ) * FROZEN_NODE_WORDS * 4 : 0;
+}
+
+
+const char* XMLFrozenDocument::AttributeRecord( uint32_t index ) const
+{
+    return index < _attributeCount ? _attributes + static_cast<size_t>( index ) * FROZEN_ATTRIBUTE_WORDS * 4 : 0;
+}
+
+
+const char* XMLFrozenDocument::String( uint32_t offset ) const
+{
+    // The last byte is checked to be a null, so any offset in range is terminated.
+    return offset < _stringBytes ? _strings + offset : "";
+}
+
+
+const char* XMLFrozenAttribute::Name() const
+{
+    const char* record = _document ? _document->AttributeRecord( _index ) : 0;
+    return record ? _document->String( ReadBinaryWord( record + FROZEN_ATTRIBUTE_NAME * 4 ) ) : 0;
+}
+
+
+const char* XMLFrozenAttribute::Value() const
+{
+    const char* record = _document ? _document->AttributeRecord( _index ) : 0;
+    return record ? _document->String( ReadBinaryWord( record + FROZEN_ATTRIBUTE_VALUE * 4 ) ) : 0;
+}
+
+
+int XMLFrozenAttribute::GetLineNum() const
+{
+    const char* record = _document ? _document->AttributeRecord( _index ) : 0;
+    return record ? static_cast<int>( ReadBinaryWord( record + FROZEN_ATTRIBUTE_LINE * 4 ) ) : 0;
+}
+
+
+XMLFrozenAttribute XMLFrozenAttribute::Next() const
+{
+    if ( !_document || _index + 1 >= _end ) {
+        return XMLFrozenAttribute();
+    }
+    return XMLFrozenAttribute( _document, _index + 1, _end );
+}
+
+XMLError XMLFrozenAttribute::QueryIntValue( int* value ) const
+{
+    if ( XMLUtil::ToInt( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+XMLError XMLFrozenAttribute::QueryUnsignedValue( unsigned int* value ) const
+{
+    if ( XMLUtil::ToUnsigned( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+XMLError XMLFrozenAttribute::QueryInt64Value( int64_t* value ) const
+{
+    if ( XMLUtil::ToInt64( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+XMLError XMLFrozenAttribute::QueryUnsigned64Value( uint64_t* value ) const
+{
+    if ( XMLUtil::ToUnsigned64( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+XMLError XMLFrozenAttribute::QueryBoolValue( bool* value ) const
+{
+    if ( XMLUtil::ToBool( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+XMLError XMLFrozenAttribute::QueryDoubleValue( double* value ) const
+{
+    if ( XMLUtil::ToDouble( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+XMLError XMLFrozenAttribute::QueryFloatValue( float* value ) const
+{
+    if ( XMLUtil::ToFloat( Value(), value ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_WRONG_ATTRIBUTE_TYPE;
+}
+
+
+uint32_t XMLFrozenNode::Kind() const
+{
+    const char* record = _document ? _document->NodeRecord( _index ) : 0;
+    return record ? ReadBinaryWord( record ) : 0;
+}
+
+
+XMLFrozenNode XMLFrozenNode::Link( int field ) const
+{
+    const char* record = _document ? _document->NodeRecord( _index ) : 0;
+    if ( !record ) {
+        return XMLFrozenNode();
+    }
+    const uint32_t index = ReadBinaryWord( record + field * 4 );
+    // Nodes are written in document order: children and next siblings
+    // come after the node, parents and previous siblings before it. A
+    // link that doesn't could send a walk round in circles.
+    const bool forward = field == FROZEN_FIRST_CHILD || field == FROZEN_LAST_CHILD || field == FROZEN_NEXT;
+    if ( ( forward ? index <= _index : index >= _index ) || !_document->NodeRecord( index ) ) {
+        return XMLFrozenNode();
+    }
+    return XMLFrozenNode( _document, index );
+}
+
+
+bool XMLFrozenNode::IsDocument() const
+{
+    return Kind() == BINARY_DOCUMENT;
+}
+
+
+bool XMLFrozenNode::IsElement() const
+{
+    return Kind() == BINARY_ELEMENT;
+}
+
+
+bool XMLFrozenNode::IsText() const
+{
+    return ( Kind() & ~BINARY_CDATA ) == BINARY_TEXT;
+}
+
+
+bool XMLFrozenNode::IsComment() const
+{
+    return Kind() == BINARY_COMMENT;
+}
+
+
+bool XMLFrozenNode::IsDeclaration() const
+{
+    return Kind() == BINARY_DECLARATION;
+}
+
+
+bool XMLFrozenNode::IsUnknown() const
+{
+    return Kind() == BINARY_UNKNOWN;
+}
+
+
+bool XMLFrozenNode::CData() const
+{
+    return Kind() == ( BINARY_TEXT | BINARY_CDATA );
+}
+
+
+const char* XMLFrozenNode::Value() const
+{
+    const char* record = _document ? _document->NodeRecord( _index ) : 0;
+    if ( !record || IsDocument() ) {
+        return 0;
+    }
+    return _document->String( ReadBinaryWord( record + FROZEN_VALUE * 4 ) );
+}
+
+
+const char* XMLFrozenNode::Name() const
+{
+    return IsElement() ? Value() : 0;
+}
+
+
+int XMLFrozenNode::GetLineNum() const
+{
+    const char* record = _document ? _document->NodeRecord( _index ) : 0;
+    return record ? static_cast<int>( ReadBinaryWord( record + FROZEN_LINE * 4 ) ) : 0;
+}
+
+
+XMLFrozenNode XMLFrozenNode::Parent() const
+{
+    return Link( FROZEN_PARENT );
+}
+
+
+XMLFrozenNode XMLFrozenNode::FirstChild() const
+{
+    return Link( FROZEN_FIRST_CHILD );
+}
+
+
+XMLFrozenNode XMLFrozenNode::LastChild() const
+{
+    return Link( FROZEN_LAST_CHILD );
+}
+
+
+XMLFrozenNode XMLFrozenNode::PreviousSibling() const
+{
+    return Link( FROZEN_PREVIOUS );
+}
+
+
+XMLFrozenNode XMLFrozenNode::NextSibling() const
+{
+    return Link( FROZEN_NEXT );
+}
+
+
+// The node itself if it is an element with the name, else the nearest such
+// sibling forward or backward.
+static XMLFrozenNode FrozenElement( XMLFrozenNode node, const char* name, bool forward )
+{
+    for( ; node.Valid(); node = forward ? node.NextSibling() : node.PreviousSibling() ) {
+        if ( node.IsElement() && ( !name || XMLUtil::StringEqual( node.Name(), name ) ) ) {
+            return node;
+        }
+    }
+    return node;
+}
+
+
+XMLFrozenNode XMLFrozenNode::FirstChildElement( const char* name ) const
+{
+    return FrozenElement( FirstChild(), name, true );
+}
+
+
+XMLFrozenNode XMLFrozenNode::LastChildElement( const char* name ) const
+{
+    return FrozenElement( LastChild(), name, false );
+}
+
+
+XMLFrozenNode XMLFrozenNode::PreviousSiblingElement( const char* name ) const
+{
+    return FrozenElement( PreviousSibling(), name, false );
+}
+
+
+XMLFrozenNode XMLFrozenNode::NextSiblingElement( const char* name ) const
+{
+    return FrozenElement( NextSibling(), name, true );
+}
+
+
+XMLFrozenAttribute XMLFrozenNode::FirstAttribute() const
+{
+    const char* record = _document ? _document->NodeRecord( _index ) : 0;
+    if ( !record || !IsElement() ) {
+        return XMLFrozenAttribute();
+    }
+    const uint32_t first = ReadBinaryWord( record + FROZEN_FIRST_ATTRIBUTE * 4 );
+    const uint32_t count = ReadBinaryWord( record + FROZEN_ATTRIBUTE_COUNT * 4 );
+    if ( count == 0 || first >= _document->_attributeCount || count > _document->_attributeCount - first ) {
+        return XMLFrozenAttribute();
+    }
+    return XMLFrozenAttribute( _document, first, first + count );
+}
+
+
+XMLFrozenAttribute XMLFrozenNode::FindAttribute( const char* name ) const
+{
+    XMLFrozenAttribute a = FirstAttribute();
+    for( ; a.Valid(); a = a.Next() ) {
+        if ( XMLUtil::StringEqual( a.Name(), name ) ) {
+            break;
         }
     }
+    return a;
+}
+
+
+const char* XMLFrozenNode::Attribute( const char* name, const char* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return 0;
+    }
+    if ( !value || XMLUtil::StringEqual( a.Value(), value ) ) {
+        return a.Value();
+    }
+    return 0;
+}
+
+XMLError XMLFrozenNode::QueryIntAttribute( const char* name, int* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryIntValue( value );
+}
+
+XMLError XMLFrozenNode::QueryUnsignedAttribute( const char* name, unsigned int* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryUnsignedValue( value );
+}
+
+XMLError XMLFrozenNode::QueryInt64Attribute( const char* name, int64_t* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryInt64Value( value );
+}
+
+XMLError XMLFrozenNode::QueryUnsigned64Attribute( const char* name, uint64_t* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryUnsigned64Value( value );
+}
+
+XMLError XMLFrozenNode::QueryBoolAttribute( const char* name, bool* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryBoolValue( value );
+}
+
+XMLError XMLFrozenNode::QueryDoubleAttribute( const char* name, double* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryDoubleValue( value );
+}
+
+XMLError XMLFrozenNode::QueryFloatAttribute( const char* name, float* value ) const
+{
+    const XMLFrozenAttribute a = FindAttribute( name );
+    if ( !a.Valid() ) {
+        return XML_NO_ATTRIBUTE;
+    }
+    return a.QueryFloatValue( value );
+}
+
+int XMLFrozenNode::IntAttribute( const char* name, int defaultValue ) const
+{
+    int value = defaultValue;
+    QueryIntAttribute( name, &value );
+    return value;
+}
+
+unsigned XMLFrozenNode::UnsignedAttribute( const char* name, unsigned defaultValue ) const
+{
+    unsigned value = defaultValue;
+    QueryUnsignedAttribute( name, &value );
+    return value;
+}
+
+int64_t XMLFrozenNode::Int64Attribute( const char* name, int64_t defaultValue ) const
+{
+    int64_t value = defaultValue;
+    QueryInt64Attribute( name, &value );
+    return value;
+}
+
+uint64_t XMLFrozenNode::Unsigned64Attribute( const char* name, uint64_t defaultValue ) const
+{
+    uint64_t value = defaultValue;
+    QueryUnsigned64Attribute( name, &value );
+    return value;
+}
+
+bool XMLFrozenNode::BoolAttribute( const char* name, bool defaultValue ) const
+{
+    bool value = defaultValue;
+    QueryBoolAttribute( name, &value );
+    return value;
+}
+
+double XMLFrozenNode::DoubleAttribute( const char* name, double defaultValue ) const
+{
+    double value = defaultValue;
+    QueryDoubleAttribute( name, &value );
+    return value;
+}
+
+float XMLFrozenNode::FloatAttribute( const char* name, float defaultValue ) const
+{
+    float value = defaultValue;
+    QueryFloatAttribute( name, &value );
+    return value;
+}
+
+
+const char* XMLFrozenNode::GetText() const
+{
+    const XMLFrozenNode child = FirstChild();
+    if ( child.IsText() ) {
+        return child.Value();
+    }
     return 0;
 }
 
+XMLError XMLFrozenNode::QueryIntText( int* ival ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToInt( t, ival ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
+XMLError XMLFrozenNode::QueryUnsignedText( unsigned* uval ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToUnsigned( t, uval ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
+XMLError XMLFrozenNode::QueryInt64Text( int64_t* uval ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToInt64( t, uval ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
+XMLError XMLFrozenNode::QueryUnsigned64Text( uint64_t* uval ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToUnsigned64( t, uval ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
+XMLError XMLFrozenNode::QueryBoolText( bool* bval ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToBool( t, bval ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
+XMLError XMLFrozenNode::QueryDoubleText( double* dval ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToDouble( t, dval ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
+XMLError XMLFrozenNode::QueryFloatText( float* fval ) const
+{
+    const char* t = GetText();
+    if ( !t ) {
+        return XML_NO_TEXT_NODE;
+    }
+    if ( XMLUtil::ToFloat( t, fval ) ) {
+        return XML_SUCCESS;
+    }
+    return XML_CAN_NOT_CONVERT_TEXT;
+}
+
 
-const XMLElement* XMLNode::NextSiblingElement( const char* name ) const
+XMLError XMLDocument::Parse( const char* p, size_t len )
 {
-    for( const XMLNode* node = _next; node; node = node->_next ) {
-        const XMLElement* element = node->ToElementWithName( name );
-        if ( element ) {
-            return element;
-        }
+    Clear();
+
+    if ( len == static_cast<size_t>(-1) && p ) {
+        len = strlen( p );
     }
-    return 0;
+    // UTF-16 may start with a null; UTF-8 may not.
+    if ( len == 0 || !p || ( !*p && len < 2 ) ) {
+        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+        return _errorID;
+    }
+    const XMLEncoding encoding = DetectEncoding( p, len );
+    TIXMLASSERT( _charBuffer == 0 );
+    _charBuffer = new char[ DecodedSize( encoding, len )+1 ];
+    len = DecodeText( encoding, p, len, _charBuffer );
+    _charBufferSize = len+1;
+    _charBuffer[len] = 0;
+    _inputEncoding = encoding;
+
+    Parse();
+    if ( Error() ) {
+        // clean up now essentially dangling memory.
+        // and the parse fail can put objects in the
+        // pools that are dead and inaccessible.
+        DeleteChildren();
+        _elementPool.Clear();
+        _attributePool.Clear();
+        _textPool.Clear();
+        _commentPool.Clear();
+        _cachedAttributePool.Clear();
+    }
+    return _errorID;
 }
 
 
-const XMLElement* XMLNode::PreviousSiblingElement( const char* name ) const
+void XMLDocument::Print( XMLPrinter* streamer ) const
 {
-    for( const XMLNode* node = _prev; node; node = node->_prev ) {
-        const XMLElement* element = node->ToElementWithName( name );
-        if ( element ) {
-            return element;
-        }
+    if ( streamer ) {
+        Accept( streamer );
+    }
+    else {
+        XMLPrinter stdoutStreamer( stdout );
+        Accept( &stdoutStreamer );
     }
-    return 0;
 }
 
 
-char* XMLNode::ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr )
-{
-    // This is a recursive method, but thinking about it "at the current level"
-    // it is a pretty simple flat list:
-    //		<foo/>
-    //		<!-- comment -->
-    //
-    // With a special case:
-    //		<foo>
-    //		</foo>
-    //		<!-- comment -->
-    //
-    // Where the closing element (/foo) *must* be the next thing after the opening
-    // element, and the names must match. BUT the tricky bit is that the closing
-    // element will be read by the child.
-    //
-    // 'endTag' is the end tag for this node, it is returned by a call to a child.
-    // 'parentEnd' is the end tag for the parent, which is filled in and returned.
-
-	XMLDocument::DepthTracker tracker(_document);
-	if (_document->Error())
-		return 0;
+void XMLDocument::ClearError() {
+    _errorID = XML_SUCCESS;
+    _errorLineNum = 0;
+    _errorStr.Reset();
+}
 
-	while( p && *p ) {
-        XMLNode* node = 0;
 
-        p = _document->Identify( p, &node );
-        TIXMLASSERT( p );
-        if ( node == 0 ) {
-            break;
-        }
+void XMLDocument::SetError( XMLError error, int lineNum, const char* format, ... )
+{
+    TIXMLASSERT( error >= 0 && error < XML_ERROR_COUNT );
+    _errorID = error;
+    _errorLineNum = lineNum;
+	_errorStr.Reset();
 
-       const int initialLineNum = node->_parseLineNum;
+    const size_t BUFFER_SIZE = 1000;
+    char* buffer = new char[BUFFER_SIZE];
 
-        StrPair endTag;
-        p = node->ParseDeep( p, &endTag, curLineNumPtr );
-        if ( !p ) {
-            DeleteNode( node );
-            if ( !_document->Error() ) {
-                _document->SetError( XML_ERROR_PARSING, initialLineNum, 0);
-            }
-            break;
-        }
+    TIXMLASSERT(sizeof(error) <= sizeof(int));
+    TIXML_SNPRINTF(buffer, BUFFER_SIZE, "Error=%s ErrorID=%d (0x%x) Line number=%d", ErrorIDToName(error), int(error), int(error), lineNum);
 
-        const XMLDeclaration* const decl = node->ToDeclaration();
-        if ( decl ) {
-            // Declarations are only allowed at document level
-            //
-            // Multiple declarations are allowed but all declarations
-            // must occur before anything else. 
-            //
-            // Optimized due to a security test case. If the first node is 
-            // a declaration, and the last node is a declaration, then only 
-            // declarations have so far been added.
-            bool wellLocated = false;
+	if (format) {
+		size_t len = strlen(buffer);
+		TIXML_SNPRINTF(buffer + len, BUFFER_SIZE - len, ": ");
+		len = strlen(buffer);
 
-            if (ToDocument()) {
-                if (FirstChild()) {
-                    wellLocated =
-                        FirstChild() &&
-                        FirstChild()->ToDeclaration() &&
-                        LastChild() &&
-                        LastChild()->ToDeclaration();
-                }
-                else {
-                    wellLocated = true;
-                }
-            }
-            if ( !wellLocated ) {
-                _document->SetError( XML_ERROR_PARSING_DECLARATION, initialLineNum, "XMLDeclaration value=%s", decl->Value());
-                DeleteNode( node );
-                break;
-            }
-        }
+		va_list va;
+		va_start(va, format);
+		TIXML_VSNPRINTF(buffer + len, BUFFER_SIZE - len, format, va);
+		va_end(va);
+	}
+	_errorStr.SetStr(buffer);
+	delete[] buffer;
+}
 
-        XMLElement* ele = node->ToElement();
-        if ( ele ) {
-            // We read the end tag. Return it to the parent.
-            if ( ele->ClosingType() == XMLElement::CLOSING ) {
-                if ( parentEndTag ) {
-                    ele->_value.TransferTo( parentEndTag );
-                }
-                node->_memPool->SetTracked();   // created and then immediately deleted.
-                DeleteNode( node );
-                return p;
-            }
 
-            // Handle an end tag returned to this level.
-            // And handle a bunch of annoying errors.
-            bool mismatch = false;
-            if ( endTag.Empty() ) {
-                if ( ele->ClosingType() == XMLElement::OPEN ) {
-                    mismatch = true;
-                }
-            }
-            else {
-                if ( ele->ClosingType() != XMLElement::OPEN ) {
-                    mismatch = true;
-                }
-                else if ( !XMLUtil::StringEqual( endTag.GetStr(), ele->Name() ) ) {
-                    mismatch = true;
-                }
-            }
-            if ( mismatch ) {
-                _document->SetError( XML_ERROR_MISMATCHED_ELEMENT, initialLineNum, "XMLElement name=%s", ele->Name());
-                DeleteNode( node );
-                break;
-            }
-        }
-        InsertEndChild( node );
-    }
-    return 0;
+/*static*/ const char* XMLDocument::ErrorIDToName(XMLError errorID)
+{
+	TIXMLASSERT( errorID >= 0 && errorID < XML_ERROR_COUNT );
+    const char* errorName = _errorNames[errorID];
+    TIXMLASSERT( errorName && errorName[0] );
+    return errorName;
 }
 
-/*static*/ void XMLNode::DeleteNode( XMLNode* node )
+const char* XMLDocument::ErrorStr() const
 {
-    if ( node == 0 ) {
-        return;
-    }
-	TIXMLASSERT(node->_document);
-	if (!node->ToDocument()) {
-		node->_document->MarkInUse(node);
-	}
-
-    MemPool* pool = node->_memPool;
-    node->~XMLNode();
-    pool->Free( node );
+	return _errorStr.Empty() ? "" : _errorStr.GetStr();
 }
 
-void XMLNode::InsertChildPreamble( XMLNode* insertThis ) const
-{
-    TIXMLASSERT( insertThis );
-    TIXMLASSERT( insertThis->_document == _document );
 
-	if (insertThis->_parent) {
-        insertThis->_parent->Unlink( insertThis );
-	}
-	else {
-		insertThis->_document->MarkInUse(insertThis);
-        insertThis->_memPool->SetTracked();
-	}
+void XMLDocument::PrintError() const
+{
+    printf("%s\n", ErrorStr());
 }
 
-const XMLElement* XMLNode::ToElementWithName( const char* name ) const
+const char* XMLDocument::ErrorName() const
 {
-    const XMLElement* element = this->ToElement();
-    if ( element == 0 ) {
-        return 0;
-    }
-    if ( name == 0 ) {
-        return element;
-    }
-    if ( XMLUtil::StringEqual( element->Name(), name ) ) {
-       return element;
-    }
-    return 0;
+    return ErrorIDToName(_errorID);
 }
 
-// --------- XMLText ---------- //
-char* XMLText::ParseDeep( char* p, StrPair*, int* curLineNumPtr )
+void XMLDocument::Parse()
 {
-    if ( this->CData() ) {
-        p = _value.ParseText( p, "]]>", StrPair::NEEDS_NEWLINE_NORMALIZATION, curLineNumPtr );
-        if ( !p ) {
-            _document->SetError( XML_ERROR_PARSING_CDATA, _parseLineNum, 0 );
+    TIXMLASSERT( NoChildren() ); // Clear() must have been called previously
+    TIXMLASSERT( _charBuffer );
+    _parseLineNum = 1;
+    _parseColumn = 1;
+    char* p = _charBuffer;
+    IndexNewlines();
+    if ( _validateUTF8 && _inputEncoding == XML_ENCODING_UTF8 ) {
+        const char* bad = XMLUtil::FindInvalidUTF8( p, _charBufferSize - 1 );
+        if ( bad ) {
+            SetError( XML_ERROR_INVALID_UTF8, LineAt( bad ), "byte 0x%02x at offset %d",
+                      static_cast<unsigned char>( *bad ), static_cast<int>( bad - p ) );
+            return;
         }
-        return p;
+    }
+    p = XMLUtil::SkipWhiteSpace( p, 0 );
+    p = const_cast<char*>( XMLUtil::ReadBOM( p, &_writeBOM ) );
+    if ( !*p ) {
+        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
+        return;
+    }
+    if ( !_subtreeFilters.Empty() ) {
+        ParseFiltered( p );
     }
     else {
-        int flags = _document->ProcessEntities() ? StrPair::TEXT_ELEMENT : StrPair::TEXT_ELEMENT_LEAVE_ENTITIES;
-        if ( _document->WhitespaceMode() == COLLAPSE_WHITESPACE ) {
-            flags |= StrPair::NEEDS_WHITESPACE_COLLAPSING;
-        }
-
-        p = _value.ParseText( p, "<", flags, curLineNumPtr );
-        if ( p && *p ) {
-            return p-1;
-        }
-        if ( !p ) {
-            _document->SetError( XML_ERROR_PARSING_TEXT, _parseLineNum, 0 );
+        if ( _lazyParse ) {
+            ScanLazySpans( p );
+            if ( Error() ) {
+                return;
+            }
         }
+        ParseDeep(p, 0 );
     }
-    return 0;
-}
-
-
-XMLNode* XMLText::ShallowClone( XMLDocument* doc ) const
-{
-    if ( !doc ) {
-        doc = _document;
+    if ( _inputEncoding != XML_ENCODING_UTF8 && !Error() ) {
+        DeclareUTF8();
     }
-    XMLText* text = doc->NewText( Value() );	// fixme: this will always allocate memory. Intern?
-    text->SetCData( this->CData() );
-    return text;
 }
 
 
-bool XMLText::ShallowEqual( const XMLNode* compare ) const
+// Decoded text is UTF-8, and its declaration now says so; printed, it
+// would otherwise be decoded again when read back.
+void XMLDocument::DeclareUTF8()
 {
-    TIXMLASSERT( compare );
-    const XMLText* text = compare->ToText();
-    return ( text && XMLUtil::StringEqual( text->Value(), Value() ) );
+    XMLDeclaration* declaration = FirstChild() ? FirstChild()->ToDeclaration() : 0;
+    if ( !declaration ) {
+        return;
+    }
+    const char* const value = declaration->Value();
+    size_t length = 0;
+    const char* const name = FindDeclaredEncoding( value, value + strlen( value ), &length );
+    if ( !name ) {
+        return;
+    }
+    static const char utf8[] = "UTF-8";
+    const size_t before = name - value;
+    const size_t after = strlen( name + length );
+    DynArray< char, 64 > declared;
+    char* const q = declared.PushArr( static_cast<int>( before + sizeof( utf8 ) - 1 + after + 1 ) );
+    memcpy( q, value, before );
+    memcpy( q + before, utf8, sizeof( utf8 ) - 1 );
+    memcpy( q + before + sizeof( utf8 ) - 1, name + length, after + 1 );
+    declaration->SetValue( q );
 }
 
-
-bool XMLText::Accept( XMLVisitor* visitor ) const
+#if defined( TIXML_SSE2 )
+static inline int LowestBit( uint64_t bits )
 {
-    TIXMLASSERT( visitor );
-    return visitor->Visit( *this );
+    TIXMLASSERT( bits );
+#if defined( __GNUC__ )
+    return __builtin_ctzll( bits );
+#else
+    int n = 0;
+    while ( !( bits & 0xff ) ) {
+        bits >>= 8;
+        n += 8;
+    }
+    while ( !( bits & 1 ) ) {
+        bits >>= 1;
+        ++n;
+    }
+    return n;
+#endif
 }
+#endif
 
+// Finds the newlines 64 bytes at a time; they are usually tens of bytes
+// apart, so this beats a memchr() per line.
+void XMLDocument::IndexNewlines()
+{
+    _newlines.Clear();
+    const size_t size = ( _charBufferSize - 1 < 0xFFFFFFFFu ) ? _charBufferSize - 1 : 0xFFFFFFFFu;
+    size_t i = 0;
+#if defined( TIXML_SSE2 )
+    const __m128i nl = _mm_set1_epi8( '\n' );
+    for( ; i + 64 <= size; i += 64 ) {
+        const __m128i* v = reinterpret_cast<const __m128i*>( _charBuffer + i );
+        uint64_t bits = 0;
+        for( int j = 0; j < 4; ++j ) {
+            const unsigned mask = static_cast<unsigned>( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( v + j ), nl ) ) );
+            bits |= static_cast<uint64_t>( mask ) << ( 16 * j );
+        }
+        if ( !bits ) {
+            continue;
+        }
+        // Room for a newline in every byte, and what isn't used given back.
+        uint32_t* const out = _newlines.PushArr( 64 );
+        int found = 0;
+        while ( bits ) {
+            out[found++] = static_cast<uint32_t>( i + LowestBit( bits ) );
+            bits &= bits - 1;
+        }
+        _newlines.PopArr( 64 - found );
+    }
+#endif
+    const char* const end = _charBuffer + size;
+    for( const char* q = _charBuffer + i; ( q = static_cast<const char*>( memchr( q, '\n', end - q ) ) ) != 0; ++q ) {
+        _newlines.Push( static_cast<uint32_t>( q - _charBuffer ) );
+    }
+    SetLine( 0 );
+}
 
-// --------- XMLComment ---------- //
 
-XMLComment::XMLComment( XMLDocument* doc ) : XMLNode( doc )
+void XMLDocument::LocateLine( const char* p, int* lineNum, int* column )
 {
+    TIXMLASSERT( p >= _charBuffer && p < _charBuffer + _charBufferSize );
+    const size_t offset = p - _charBuffer;
+    if ( offset > 0xFFFFFFFFu ) {
+        *lineNum = 0;
+        *column = 0;
+        return;
+    }
+    const uint32_t* const newlines = _newlines.Mem();
+    const int count = _newlines.Size();
+    // The number of newlines before 'p'. Past the end of the last line
+    // found, it is most often the next line; otherwise search, and lazy
+    // parsing may also move back.
+    int low = 0;
+    int high = _newlineCursor;
+    if ( offset > _lineEnd ) {
+        low = _newlineCursor + 1;
+        high = count;
+        if ( low < count && newlines[low] >= offset ) {
+            high = low;
+        }
+    }
+    while ( low < high ) {
+        const int mid = low + ( high - low ) / 2;
+        if ( newlines[mid] < offset ) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    SetLine( low );
+    *lineNum = low + 1;
+    *column = static_cast<int>( offset - _lineStart ) + 1;
 }
 
 
-XMLComment::~XMLComment()
+// Makes 'line', counted from 0, the one Locate() looks in first.
+void XMLDocument::SetLine( int line )
 {
+    const int count = _newlines.Size();
+    TIXMLASSERT( line >= 0 && line <= count );
+    _newlineCursor = line;
+    _lineStart = line ? _newlines[line-1] + 1 : 0;
+    if ( line < count ) {
+        _lineEnd = _newlines[line];
+    }
+    else {
+        // The last line runs to the terminator, or to the end of what is
+        // indexed.
+        _lineEnd = ( _charBufferSize - 1 < 0xFFFFFFFFu ) ? _charBufferSize - 1 : 0xFFFFFFFFu;
+    }
 }
 
 
-char* XMLComment::ParseDeep( char* p, StrPair*, int* curLineNumPtr )
+int XMLDocument::LineAt( const char* p )
 {
-    // Comment parses as text.
-    p = _value.ParseText( p, "-->", StrPair::COMMENT, curLineNumPtr );
-    if ( p == 0 ) {
-        _document->SetError( XML_ERROR_PARSING_COMMENT, _parseLineNum, 0 );
-    }
-    return p;
+    int lineNum = 0;
+    int column = 0;
+    Locate( p, &lineNum, &column );
+    return lineNum;
 }
 
 
-XMLNode* XMLComment::ShallowClone( XMLDocument* doc ) const
+bool XMLDocument::AddSubtreeFilter( const char* path )
 {
-    if ( !doc ) {
-        doc = _document;
+    XMLQuery* filter = new XMLQuery( path );
+    if ( filter->Error() || !filter->NamesOnly() ) {
+        delete filter;
+        return false;
     }
-    XMLComment* comment = doc->NewComment( Value() );	// fixme: this will always allocate memory. Intern?
-    return comment;
+    _subtreeFilters.Push( filter );
+    return true;
 }
 
 
-bool XMLComment::ShallowEqual( const XMLNode* compare ) const
+void XMLDocument::ClearSubtreeFilters()
 {
-    TIXMLASSERT( compare );
-    const XMLComment* comment = compare->ToComment();
-    return ( comment && XMLUtil::StringEqual( comment->Value(), Value() ));
+    for( int i = 0; i < _subtreeFilters.Size(); ++i ) {
+        delete _subtreeFilters[i];
+    }
+    _subtreeFilters.Clear();
 }
 
 
-bool XMLComment::Accept( XMLVisitor* visitor ) const
+bool XMLDocument::MatchesSubtreeFilter( const char* const* names, const int* lengths, int depth ) const
 {
-    TIXMLASSERT( visitor );
-    return visitor->Visit( *this );
+    for( int i = 0; i < _subtreeFilters.Size(); ++i ) {
+        if ( _subtreeFilters[i]->MatchesNames( 0, names, lengths, 0, depth ) ) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
-// --------- XMLDeclaration ---------- //
-
-XMLDeclaration::XMLDeclaration( XMLDocument* doc ) : XMLNode( doc )
+// Helpers for the subtree filter scanner.
+static char* SkipPast( char* p, const char* end )
 {
+    const char first = *end;
+    const size_t length = strlen( end );
+    for( ; ( p = strchr( p, first ) ) != 0; ++p ) {
+        if ( strncmp( p, end, length ) == 0 ) {
+            return p + length;
+        }
+    }
+    return 0;
 }
 
-
-XMLDeclaration::~XMLDeclaration()
+// Skips a tag's attributes, or a DTD, up to and including its '>'. Quoted
+// values and the DTD's internal subset may contain '>'.
+static char* SkipTag( char* p )
 {
-    //printf( "~XMLDeclaration\n" );
+    char quote = 0;
+    int brackets = 0;
+    for( ; *p; ++p ) {
+        if ( quote ) {
+            if ( *p == quote ) {
+                quote = 0;
+            }
+        }
+        else if ( *p == '\"' || *p == '\'' ) {
+            quote = *p;
+        }
+        else if ( *p == '[' ) {
+            ++brackets;
+        }
+        else if ( *p == ']' ) {
+            --brackets;
+        }
+        else if ( *p == '>' && brackets <= 0 ) {
+            return p + 1;
+        }
+    }
+    return 0;
 }
 
-
-char* XMLDeclaration::ParseDeep( char* p, StrPair*, int* curLineNumPtr )
+static char* ScanName( char* p )
 {
-    // Declaration parses as text.
-    p = _value.ParseText( p, "?>", StrPair::NEEDS_NEWLINE_NORMALIZATION, curLineNumPtr );
-    if ( p == 0 ) {
-        _document->SetError( XML_ERROR_PARSING_DECLARATION, _parseLineNum, 0 );
+    while ( *p && *p != '>' && *p != '/' && !XMLUtil::IsWhiteSpace( *p ) ) {
+        ++p;
     }
     return p;
 }
 
-
-XMLNode* XMLDeclaration::ShallowClone( XMLDocument* doc ) const
+// If 'p' starts a comment, CDATA section, processing instruction or DTD,
+// skips it and returns the position after it - or null, with 'error' set,
+// if it isn't terminated. Returns 'p' itself for element tags.
+static char* SkipMarkup( char* p, XMLError* error )
 {
-    if ( !doc ) {
-        doc = _document;
+    TIXMLASSERT( *p == '<' );
+    char* next = p;
+    if ( XMLUtil::StringEqual( p, "<!--", 4 ) ) {
+        next = SkipPast( p + 4, "-->" );
+        *error = XML_ERROR_PARSING_COMMENT;
     }
-    XMLDeclaration* dec = doc->NewDeclaration( Value() );	// fixme: this will always allocate memory. Intern?
-    return dec;
+    else if ( XMLUtil::StringEqual( p, "<![CDATA[", 9 ) ) {
+        next = SkipPast( p + 9, "]]>" );
+        *error = XML_ERROR_PARSING_CDATA;
+    }
+    else if ( XMLUtil::StringEqual( p, "<?", 2 ) ) {
+        next = SkipPast( p + 2, "?>" );
+        *error = XML_ERROR_PARSING_DECLARATION;
+    }
+    else if ( XMLUtil::StringEqual( p, "<!", 2 ) ) {
+        next = SkipTag( p + 2 );
+        *error = XML_ERROR_PARSING_UNKNOWN;
+    }
+    return next;
 }
 
-
-bool XMLDeclaration::ShallowEqual( const XMLNode* compare ) const
+// Advances to the next '<', or the terminator.
+static char* SkipToMarkup( char* p )
 {
-    TIXMLASSERT( compare );
-    const XMLDeclaration* declaration = compare->ToDeclaration();
-    return ( declaration && XMLUtil::StringEqual( declaration->Value(), Value() ));
+    char* const next = strchr( p, '<' );
+    return next ? next : p + strlen( p );
 }
 
 
-
-bool XMLDeclaration::Accept( XMLVisitor* visitor ) const
+// The subtree filter scanner. It only tracks the names of the open
+// elements; when one matches a filter, the element is parsed normally
+// with XMLElement::ParseDeep(), and the scan resumes after it.
+void XMLDocument::ParseFiltered( char* p )
 {
-    TIXMLASSERT( visitor );
-    return visitor->Visit( *this );
-}
-
-// --------- XMLUnknown ---------- //
+    DynArray< const char*, 32 > names;
+    DynArray< int, 32 > lengths;
+    for( p = SkipToMarkup( p ); *p; p = SkipToMarkup( p ) ) {
+        XMLError error = XML_SUCCESS;
+        char* next = SkipMarkup( p, &error );
+        if ( next == p ) {
+            error = XML_ERROR_PARSING_ELEMENT;
+            if ( p[1] == '/' ) {
+                char* name = p + 2;
+                char* nameEnd = ScanName( name );
+                const int length = static_cast<int>( nameEnd - name );
+                if ( names.Empty() || lengths.PeekTop() != length || strncmp( names.PeekTop(), name, length ) != 0 ) {
+                    SetError( XML_ERROR_MISMATCHED_ELEMENT, LineAt( p ), 0 );
+                    return;
+                }
+                names.Pop();
+                lengths.Pop();
+                next = SkipTag( nameEnd );
+            }
+            else {
+                char* name = p + 1;
+                char* nameEnd = ScanName( name );
+                if ( nameEnd == name ) {
+                    SetError( XML_ERROR_PARSING_ELEMENT, LineAt( p ), 0 );
+                    return;
+                }
+                if ( names.Size() == TINYXML2_MAX_ELEMENT_DEPTH ) {
+                    SetError( XML_ELEMENT_DEPTH_EXCEEDED, LineAt( p ), "Element nesting is too deep." );
+                    return;
+                }
+                names.Push( name );
+                lengths.Push( static_cast<int>( nameEnd - name ) );
+
+                if ( MatchesSubtreeFilter( names.Mem(), lengths.Mem(), names.Size() ) ) {
+                    names.Pop();
+                    lengths.Pop();
+                    if ( !ParseFilteredSubtree( &p ) ) {
+                        return;
+                    }
+                    continue;
+                }
 
-XMLUnknown::XMLUnknown( XMLDocument* doc ) : XMLNode( doc )
-{
+                next = SkipTag( nameEnd );
+                if ( next && next[-2] == '/' ) {
+                    // Self-closing: it's already done.
+                    names.Pop();
+                    lengths.Pop();
+                }
+            }
+        }
+        if ( !next ) {
+            SetError( error, LineAt( p ), 0 );
+            return;
+        }
+        p = next;
+    }
+    if ( !names.Empty() ) {
+        SetError( XML_ERROR_PARSING, LineAt( p ), 0 );
+    }
 }
 
 
-XMLUnknown::~XMLUnknown()
+// Parses the matching element at *p, and moves *p past it. Returns false
+// when parsing should stop, because of an error or the handler.
+bool XMLDocument::ParseFilteredSubtree( char** p )
 {
+    XMLElement* element = CreateUnlinkedNode<XMLElement>( _elementPool );
+    Locate( *p, &element->_parseLineNum, &element->_parseColumn );
+    const int startLine = element->_parseLineNum;
+    StrPair endTag;
+    *p = element->ParseDeep( *p + 1, &endTag );
+    if ( !*p ) {
+        DeleteNode( element );
+        if ( !Error() ) {
+            SetError( XML_ERROR_PARSING, startLine, 0 );
+        }
+        return false;
+    }
+    const bool mismatch = endTag.Empty() ? ( element->ClosingType() == XMLElement::OPEN )
+                                         : ( element->ClosingType() != XMLElement::OPEN
+                                             || !XMLUtil::StringEqual( endTag.GetStr(), element->Name() ) );
+    if ( mismatch ) {
+        SetError( XML_ERROR_MISMATCHED_ELEMENT, startLine, "XMLElement name=%s", element->Name() );
+        DeleteNode( element );
+        return false;
+    }
+    if ( _subtreeHandler ) {
+        const bool more = _subtreeHandler->Subtree( element );
+        DeleteNode( element );
+        return more;
+    }
+    InsertEndChild( element );
+    return true;
 }
 
 
-char* XMLUnknown::ParseDeep( char* p, StrPair*, int* curLineNumPtr )
+struct LazyOpenTag
 {
-    // Unknown parses as text.
-    p = _value.ParseText( p, ">", StrPair::NEEDS_NEWLINE_NORMALIZATION, curLineNumPtr );
-    if ( !p ) {
-        _document->SetError( XML_ERROR_PARSING_UNKNOWN, _parseLineNum, 0 );
+    int span;
+    const char* name;
+    int length;
+};
+
+// The pre-scan of lazy parsing: records where the content of every
+// element with content starts and ends, checking that the tags match.
+void XMLDocument::ScanLazySpans( char* p )
+{
+    DynArray< LazyOpenTag, 32 > openTags;
+    for( p = SkipToMarkup( p ); *p; p = SkipToMarkup( p ) ) {
+        XMLError error = XML_SUCCESS;
+        char* next = SkipMarkup( p, &error );
+        if ( next == p ) {
+            error = XML_ERROR_PARSING_ELEMENT;
+            if ( p[1] == '/' ) {
+                char* name = p + 2;
+                char* nameEnd = ScanName( name );
+                const int length = static_cast<int>( nameEnd - name );
+                if ( openTags.Empty() || openTags.PeekTop().length != length || strncmp( openTags.PeekTop().name, name, length ) != 0 ) {
+                    SetError( XML_ERROR_MISMATCHED_ELEMENT, LineAt( p ), 0 );
+                    return;
+                }
+                next = SkipTag( nameEnd );
+                if ( next ) {
+                    XMLLazySpan& span = _lazySpans[openTags.Pop().span];
+                    span.end = next;
+                }
+            }
+            else {
+                char* name = p + 1;
+                char* nameEnd = ScanName( name );
+                if ( nameEnd == name ) {
+                    SetError( XML_ERROR_PARSING_ELEMENT, LineAt( p ), 0 );
+                    return;
+                }
+                next = SkipTag( nameEnd );
+                if ( next && next[-2] != '/' ) {
+                    if ( openTags.Size() == TINYXML2_MAX_ELEMENT_DEPTH ) {
+                        SetError( XML_ELEMENT_DEPTH_EXCEEDED, LineAt( p ), "Element nesting is too deep." );
+                        return;
+                    }
+                    XMLLazySpan span;
+                    span.content = next;
+                    span.end = 0;
+                    LazyOpenTag o;
+                    o.span = _lazySpans.Size();
+                    o.name = name;
+                    o.length = static_cast<int>( nameEnd - name );
+                    _lazySpans.Push( span );
+                    openTags.Push( o );
+                }
+            }
+        }
+        if ( !next ) {
+            SetError( error, LineAt( p ), 0 );
+            return;
+        }
+        p = next;
+    }
+    if ( !openTags.Empty() ) {
+        SetError( XML_ERROR_PARSING, LineAt( p ), 0 );
     }
-    return p;
 }
 
 
-XMLNode* XMLUnknown::ShallowClone( XMLDocument* doc ) const
+// The spans are recorded in document order, so sorted by their content.
+const XMLLazySpan* XMLDocument::FindLazySpan( const char* content ) const
 {
-    if ( !doc ) {
-        doc = _document;
+    int low = 0;
+    int high = _lazySpans.Size();
+    while ( low < high ) {
+        const int mid = low + ( high - low ) / 2;
+        if ( _lazySpans[mid].content < content ) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
     }
-    XMLUnknown* text = doc->NewUnknown( Value() );	// fixme: this will always allocate memory. Intern?
-    return text;
+    if ( low < _lazySpans.Size() && _lazySpans[low].content == content ) {
+        return &_lazySpans[low];
+    }
+    return 0;
 }
 
 
-bool XMLUnknown::ShallowEqual( const XMLNode* compare ) const
+void XMLDocument::PushDepth(const char* p)
 {
-    TIXMLASSERT( compare );
-    const XMLUnknown* unknown = compare->ToUnknown();
-    return ( unknown && XMLUtil::StringEqual( unknown->Value(), Value() ));
+	_parsingDepth++;
+	if (_parsingDepth == TINYXML2_MAX_ELEMENT_DEPTH) {
+		SetError(XML_ELEMENT_DEPTH_EXCEEDED, LineAt( p ), "Element nesting is too deep." );
+	}
 }
 
-
-bool XMLUnknown::Accept( XMLVisitor* visitor ) const
+void XMLDocument::PopDepth()
 {
-    TIXMLASSERT( visitor );
-    return visitor->Visit( *this );
+	TIXMLASSERT(_parsingDepth > 0);
+	--_parsingDepth;
 }
 
-// --------- XMLAttribute ---------- //
+// --------- XMLQuery ----------- //
 
-const char* XMLAttribute::Name() const
+XMLQuery::XMLQuery( const char* path ) :
+    _error( false ),
+    _absolute( false ),
+    _strings( 0 ),
+    _steps(),
+    _predicates()
 {
-    return _name.GetStr();
+    _error = !Compile( path );
 }
 
-const char* XMLAttribute::Value() const
-{
-    return _value.GetStr();
-}
 
-char* XMLAttribute::ParseDeep( char* p, bool processEntities, int* curLineNumPtr )
+XMLQuery::~XMLQuery()
 {
-    // Parse using the name rules: bug fix, was using ParseText before
-    p = _name.ParseName( p );
-    if ( !p || !*p ) {
-        return 0;
-    }
-
-    // Skip white space before =
-    p = XMLUtil::SkipWhiteSpace( p, curLineNumPtr );
-    if ( *p != '=' ) {
-        return 0;
-    }
-
-    ++p;	// move up to opening quote
-    p = XMLUtil::SkipWhiteSpace( p, curLineNumPtr );
-    if ( *p != '\"' && *p != '\'' ) {
-        return 0;
-    }
-
-    const char endTag[2] = { *p, 0 };
-    ++p;	// move past opening quote
-
-    p = _value.ParseText( p, endTag, processEntities ? StrPair::ATTRIBUTE_VALUE : StrPair::ATTRIBUTE_VALUE_LEAVE_ENTITIES, curLineNumPtr );
-    return p;
+    delete [] _strings;
 }
 
 
-void XMLAttribute::SetName( const char* n )
+// Copies [start, end) to *out, null terminated, and returns the copy.
+static const char* CopyQueryToken( const char* start, const char* end, char** out )
 {
-    _name.SetStr( n );
+    char* copy = *out;
+    memcpy( copy, start, end - start );
+    copy[end - start] = 0;
+    *out += end - start + 1;
+    return copy;
 }
 
 
-XMLError XMLAttribute::QueryIntValue( int* value ) const
+bool XMLQuery::Compile( const char* path )
 {
-    if ( XMLUtil::ToInt( Value(), value )) {
-        return XML_SUCCESS;
+    if ( !path || !*path ) {
+        return false;
     }
-    return XML_WRONG_ATTRIBUTE_TYPE;
-}
+    // Names and values are copied into one block; every copy is shorter
+    // than the text it came from, plus its null terminator.
+    const size_t length = strlen( path );
+    _strings = new char[length * 2 + 1];
+    char* out = _strings;
 
+    const char* p = path;
+    _absolute = ( *p == '/' );
+    bool first = true;
+    while ( *p ) {
+        Step step;
+        step.descendant = false;
+        if ( !first || _absolute ) {
+            if ( *p != '/' ) {
+                return false;
+            }
+            ++p;
+            if ( *p == '/' ) {
+                step.descendant = true;
+                ++p;
+            }
+        }
+        first = false;
 
-XMLError XMLAttribute::QueryUnsignedValue( unsigned int* value ) const
-{
-    if ( XMLUtil::ToUnsigned( Value(), value )) {
-        return XML_SUCCESS;
+        const char* start = p;
+        while ( *p && *p != '/' && *p != '[' && *p != ']' ) {
+            ++p;
+        }
+        if ( p == start ) {
+            return false;
+        }
+        if ( p - start == 1 && *start == '*' ) {
+            step.name = 0;
+        }
+        else {
+            step.name = CopyQueryToken( start, p, &out );
+        }
+
+        step.firstPredicate = _predicates.Size();
+        while ( *p == '[' ) {
+            p = CompilePredicate( p + 1, &out );
+            if ( !p ) {
+                return false;
+            }
+        }
+        step.predicateCount = _predicates.Size() - step.firstPredicate;
+        if ( step.predicateCount > MAX_PREDICATES ) {
+            return false;
+        }
+        _steps.Push( step );
     }
-    return XML_WRONG_ATTRIBUTE_TYPE;
+    return true;
 }
 
 
-XMLError XMLAttribute::QueryInt64Value(int64_t* value) const
+// Compiles the predicate starting after '[', and returns the position after its ']'.
+const char* XMLQuery::CompilePredicate( const char* p, char** out )
 {
-	if (XMLUtil::ToInt64(Value(), value)) {
-		return XML_SUCCESS;
-	}
-	return XML_WRONG_ATTRIBUTE_TYPE;
-}
-
+    Predicate predicate;
+    predicate.name = 0;
+    predicate.value = 0;
+    predicate.position = 0;
 
-XMLError XMLAttribute::QueryUnsigned64Value(uint64_t* value) const
-{
-    if(XMLUtil::ToUnsigned64(Value(), value)) {
-        return XML_SUCCESS;
+    if ( *p == '@' ) {
+        ++p;
+        const char* start = p;
+        while ( *p && *p != '=' && *p != ']' ) {
+            ++p;
+        }
+        if ( p == start ) {
+            return 0;
+        }
+        predicate.name = CopyQueryToken( start, p, out );
+        predicate.type = Predicate::HAS_ATTRIBUTE;
+        if ( *p == '=' ) {
+            ++p;
+            const char quote = *p;
+            if ( quote != '\'' && quote != '\"' ) {
+                return 0;
+            }
+            start = ++p;
+            while ( *p && *p != quote ) {
+                ++p;
+            }
+            if ( !*p ) {
+                return 0;
+            }
+            predicate.value = CopyQueryToken( start, p, out );
+            predicate.type = Predicate::ATTRIBUTE_EQUALS;
+            ++p;
+        }
     }
-    return XML_WRONG_ATTRIBUTE_TYPE;
-}
-
-
-XMLError XMLAttribute::QueryBoolValue( bool* value ) const
-{
-    if ( XMLUtil::ToBool( Value(), value )) {
-        return XML_SUCCESS;
+    else {
+        const char* start = p;
+        int position = 0;
+        for( ; *p >= '0' && *p <= '9'; ++p ) {
+            if ( position > ( INT_MAX - 9 ) / 10 ) {
+                return 0;
+            }
+            position = position * 10 + ( *p - '0' );
+        }
+        if ( p == start || position < 1 ) {
+            return 0;
+        }
+        predicate.type = Predicate::POSITION;
+        predicate.position = position;
     }
-    return XML_WRONG_ATTRIBUTE_TYPE;
+    if ( *p != ']' ) {
+        return 0;
+    }
+    _predicates.Push( predicate );
+    return p + 1;
 }
 
 
-XMLError XMLAttribute::QueryFloatValue( float* value ) const
+bool XMLQuery::Evaluate( const XMLNode* context, XMLQueryHandler* handler ) const
 {
-    if ( XMLUtil::ToFloat( Value(), value )) {
-        return XML_SUCCESS;
+    TIXMLASSERT( handler );
+    if ( _error || !context ) {
+        return true;
     }
-    return XML_WRONG_ATTRIBUTE_TYPE;
+    if ( _absolute ) {
+        context = context->GetDocument();
+    }
+    return EvaluateStep( 0, context, handler );
 }
 
 
-XMLError XMLAttribute::QueryDoubleValue( double* value ) const
+bool XMLQuery::EvaluateStep( int step, const XMLNode* node, XMLQueryHandler* handler ) const
 {
-    if ( XMLUtil::ToDouble( Value(), value )) {
-        return XML_SUCCESS;
+    if ( _steps[step].descendant ) {
+        return SelectDescendants( step, node, handler );
     }
-    return XML_WRONG_ATTRIBUTE_TYPE;
+    return SelectChildren( step, node, handler );
 }
 
 
-void XMLAttribute::SetAttribute( const char* v )
+// Applies the step to one child. 'counts' tracks, per predicate, how many
+// siblings have reached it, for the position predicates.
+bool XMLQuery::MatchStep( int step, const XMLElement* element, int* counts ) const
 {
-    _value.SetStr( v );
+    const Step& s = _steps[step];
+    if ( s.name && !XMLUtil::StringEqual( element->Name(), s.name ) ) {
+        return false;
+    }
+    for( int i = 0; i < s.predicateCount; ++i ) {
+        const Predicate& predicate = _predicates[s.firstPredicate + i];
+        switch ( predicate.type ) {
+            case Predicate::HAS_ATTRIBUTE:
+                if ( !element->FindAttribute( predicate.name ) ) {
+                    return false;
+                }
+                break;
+            case Predicate::ATTRIBUTE_EQUALS:
+                if ( !element->Attribute( predicate.name, predicate.value ) ) {
+                    return false;
+                }
+                break;
+            case Predicate::POSITION:
+                if ( ++counts[i] != predicate.position ) {
+                    return false;
+                }
+                break;
+            default:
+                TIXMLASSERT( false );
+                return false;
+        }
+    }
+    return true;
 }
 
 
-void XMLAttribute::SetAttribute( int v )
+// Reports a match of the last step, or carries on with the next one.
+bool XMLQuery::Continue( int step, const XMLElement* element, XMLQueryHandler* handler ) const
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    _value.SetStr( buf );
+    if ( step + 1 == _steps.Size() ) {
+        return handler->Match( *element );
+    }
+    return EvaluateStep( step + 1, element, handler );
 }
 
 
-void XMLAttribute::SetAttribute( unsigned v )
+bool XMLQuery::SelectChildren( int step, const XMLNode* parent, XMLQueryHandler* handler ) const
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    _value.SetStr( buf );
+    int counts[MAX_PREDICATES] = { 0 };
+    const char* name = _steps[step].name;
+    for( const XMLElement* child = parent->FirstChildElement( name ); child; child = child->NextSiblingElement( name ) ) {
+        if ( MatchStep( step, child, counts ) && !Continue( step, child, handler ) ) {
+            return false;
+        }
+    }
+    return true;
 }
 
 
-void XMLAttribute::SetAttribute(int64_t v)
-{
-	char buf[BUF_SIZE];
-	XMLUtil::ToStr(v, buf, BUF_SIZE);
-	_value.SetStr(buf);
-}
-
-void XMLAttribute::SetAttribute(uint64_t v)
+bool XMLQuery::SelectDescendants( int step, const XMLNode* node, XMLQueryHandler* handler ) const
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr(v, buf, BUF_SIZE);
-    _value.SetStr(buf);
+    int counts[MAX_PREDICATES] = { 0 };
+    for( const XMLElement* child = node->FirstChildElement(); child; child = child->NextSiblingElement() ) {
+        if ( MatchStep( step, child, counts ) && !Continue( step, child, handler ) ) {
+            return false;
+        }
+        if ( !SelectDescendants( step, child, handler ) ) {
+            return false;
+        }
+    }
+    return true;
 }
 
 
-void XMLAttribute::SetAttribute( bool v )
+bool XMLQuery::NamesOnly() const
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    _value.SetStr( buf );
+    return _predicates.Empty();
 }
 
-void XMLAttribute::SetAttribute( double v )
-{
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    _value.SetStr( buf );
-}
 
-void XMLAttribute::SetAttribute( float v )
+// Matches the steps from 'step' on against the element names from 'level'
+// to 'depth'; the last step has to match the last name. The first step of
+// a relative path may match at any depth.
+bool XMLQuery::MatchesNames( int step, const char* const* names, const int* lengths, int level, int depth ) const
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    _value.SetStr( buf );
+    const Step& s = _steps[step];
+    const bool anyDepth = s.descendant || ( step == 0 && !_absolute );
+    const int lastLevel = anyDepth ? depth - 1 : level;
+    for( int i = level; i <= lastLevel && i < depth; ++i ) {
+        if ( s.name && ( strncmp( s.name, names[i], lengths[i] ) != 0 || s.name[lengths[i]] != 0 ) ) {
+            continue;
+        }
+        if ( step + 1 == _steps.Size() ) {
+            if ( i == depth - 1 ) {
+                return true;
+            }
+        }
+        else if ( MatchesNames( step + 1, names, lengths, i + 1, depth ) ) {
+            return true;
+        }
+    }
+    return false;
 }
 
 
-// --------- XMLElement ---------- //
-XMLElement::XMLElement( XMLDocument* doc ) : XMLNode( doc ),
-    _closingType( OPEN ),
-    _rootAttribute( 0 )
+class XMLQueryFirst : public XMLQueryHandler
 {
-}
+public:
+    XMLQueryFirst() : first( 0 ) {}
+    virtual bool Match( const XMLElement& element ) {
+        first = &element;
+        return false;
+    }
+    const XMLElement* first;
+};
 
 
-XMLElement::~XMLElement()
+class XMLQueryCount : public XMLQueryHandler
 {
-    while( _rootAttribute ) {
-        XMLAttribute* next = _rootAttribute->_next;
-        DeleteAttribute( _rootAttribute );
-        _rootAttribute = next;
+public:
+    XMLQueryCount() : count( 0 ) {}
+    virtual bool Match( const XMLElement& ) {
+        ++count;
+        return true;
     }
-}
+    int count;
+};
 
 
-const XMLAttribute* XMLElement::FindAttribute( const char* name ) const
+const XMLElement* XMLQuery::First( const XMLNode* context ) const
 {
-    for( XMLAttribute* a = _rootAttribute; a; a = a->_next ) {
-        if ( XMLUtil::StringEqual( a->Name(), name ) ) {
-            return a;
-        }
-    }
-    return 0;
+    XMLQueryFirst handler;
+    Evaluate( context, &handler );
+    return handler.first;
 }
 
 
-const char* XMLElement::Attribute( const char* name, const char* value ) const
+XMLElement* XMLQuery::First( XMLNode* context ) const
 {
-    const XMLAttribute* a = FindAttribute( name );
-    if ( !a ) {
-        return 0;
-    }
-    if ( !value || XMLUtil::StringEqual( a->Value(), value )) {
-        return a->Value();
-    }
-    return 0;
+    return const_cast<XMLElement*>( First( const_cast<const XMLNode*>( context ) ) );
 }
 
-int XMLElement::IntAttribute(const char* name, int defaultValue) const
-{
-	int i = defaultValue;
-	QueryIntAttribute(name, &i);
-	return i;
-}
 
-unsigned XMLElement::UnsignedAttribute(const char* name, unsigned defaultValue) const
+int XMLQuery::Count( const XMLNode* context ) const
 {
-	unsigned i = defaultValue;
-	QueryUnsignedAttribute(name, &i);
-	return i;
+    XMLQueryCount handler;
+    Evaluate( context, &handler );
+    return handler.count;
 }
 
-int64_t XMLElement::Int64Attribute(const char* name, int64_t defaultValue) const
-{
-	int64_t i = defaultValue;
-	QueryInt64Attribute(name, &i);
-	return i;
-}
 
-uint64_t XMLElement::Unsigned64Attribute(const char* name, uint64_t defaultValue) const
+XMLPrinter::XMLPrinter( FILE* file, bool compact, int depth ) :
+    _elementJustOpened( false ),
+    _stack(),
+    _firstElement( true ),
+    _fp( file ),
+    _sink( 0 ),
+    _depth( depth ),
+    _textDepth( -1 ),
+    _processEntities( true ),
+    _compactMode( compact ),
+    _buffer( 0 ),
+    _bufferSize( 0 ),
+    _bufferCapacity( 0 )
 {
-	uint64_t i = defaultValue;
-	QueryUnsigned64Attribute(name, &i);
-	return i;
+    Init();
 }
 
-bool XMLElement::BoolAttribute(const char* name, bool defaultValue) const
-{
-	bool b = defaultValue;
-	QueryBoolAttribute(name, &b);
-	return b;
-}
 
-double XMLElement::DoubleAttribute(const char* name, double defaultValue) const
+XMLPrinter::XMLPrinter( XMLOutputSink& sink, bool compact, int depth ) :
+    _elementJustOpened( false ),
+    _stack(),
+    _firstElement( true ),
+    _fp( 0 ),
+    _sink( &sink ),
+    _depth( depth ),
+    _textDepth( -1 ),
+    _processEntities( true ),
+    _compactMode( compact ),
+    _buffer( 0 ),
+    _bufferSize( 0 ),
+    _bufferCapacity( 0 )
 {
-	double d = defaultValue;
-	QueryDoubleAttribute(name, &d);
-	return d;
+    Init();
 }
 
-float XMLElement::FloatAttribute(const char* name, float defaultValue) const
-{
-	float f = defaultValue;
-	QueryFloatAttribute(name, &f);
-	return f;
-}
 
-const char* XMLElement::GetText() const
+void XMLPrinter::Init()
 {
-    /* skip comment node */
-    const XMLNode* node = FirstChild();
-    while (node) {
-        if (node->ToComment()) {
-            node = node->NextSibling();
-            continue;
-        }
-        break;
+    for( int i=0; i<ENTITY_RANGE; ++i ) {
+        _entityFlag[i] = false;
+        _restrictedEntityFlag[i] = false;
     }
-
-    if ( node && node->ToText() ) {
-        return node->Value();
+    for( int i=0; i<NUM_ENTITIES; ++i ) {
+        const char entityValue = entities[i].value;
+        const unsigned char flagIndex = static_cast<unsigned char>(entityValue);
+        TIXMLASSERT( flagIndex < ENTITY_RANGE );
+        _entityFlag[flagIndex] = true;
     }
-    return 0;
-}
-
-
-void	XMLElement::SetText( const char* inText )
-{
-	if ( FirstChild() && FirstChild()->ToText() )
-		FirstChild()->SetValue( inText );
-	else {
-		XMLText*	theText = GetDocument()->NewText( inText );
-		InsertFirstChild( theText );
-	}
+    _restrictedEntityFlag[static_cast<unsigned char>('&')] = true;
+    _restrictedEntityFlag[static_cast<unsigned char>('<')] = true;
+    _restrictedEntityFlag[static_cast<unsigned char>('>')] = true;	// not required, but consistency is nice
 }
 
 
-void XMLElement::SetText( int v )
+XMLPrinter::~XMLPrinter()
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    SetText( buf );
+    delete [] _buffer;
 }
 
 
-void XMLElement::SetText( unsigned v )
+void XMLPrinter::Reserve( size_t size )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    SetText( buf );
+    if ( _sink ) {
+        _sink->Reserve( size );
+    }
+    else if ( !_fp ) {
+        TIXMLASSERT( size < static_cast<size_t>(-1) - _bufferSize );
+        EnsureBufferCapacity( _bufferSize + size + 1 );
+    }
 }
 
 
-void XMLElement::SetText(int64_t v)
+char* XMLPrinter::ReleaseBuffer( size_t* length )
 {
-	char buf[BUF_SIZE];
-	XMLUtil::ToStr(v, buf, BUF_SIZE);
-	SetText(buf);
-}
-
-void XMLElement::SetText(uint64_t v) {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr(v, buf, BUF_SIZE);
-    SetText(buf);
+    char* released = _buffer;
+    if ( !released ) {
+        released = new char[1];
+        released[0] = 0;
+    }
+    if ( length ) {
+        *length = _bufferSize;
+    }
+    _buffer = 0;
+    _bufferSize = 0;
+    _bufferCapacity = 0;
+    return released;
 }
 
 
-void XMLElement::SetText( bool v )
+void XMLPrinter::EnsureBufferCapacity( size_t capacity )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    SetText( buf );
+    if ( capacity <= _bufferCapacity ) {
+        return;
+    }
+    // Grow geometrically, so printing a large document costs a
+    // logarithmic number of reallocations.
+    static const size_t MIN_CAPACITY = 256;
+    size_t newCapacity = ( _bufferCapacity > static_cast<size_t>(-1) / 2 ) ? capacity : _bufferCapacity * 2;
+    if ( newCapacity < capacity ) {
+        newCapacity = capacity;
+    }
+    if ( newCapacity < MIN_CAPACITY ) {
+        newCapacity = MIN_CAPACITY;
+    }
+    char* newBuffer = new char[newCapacity];
+    if ( _buffer ) {
+        memcpy( newBuffer, _buffer, _bufferSize + 1 );
+        delete [] _buffer;
+    }
+    else {
+        newBuffer[0] = 0;
+    }
+    _buffer = newBuffer;
+    _bufferCapacity = newCapacity;
 }
 
 
-void XMLElement::SetText( float v )
+// Appends 'size' bytes to the memory buffer (and moves the null
+// terminator) returning where they go.
+char* XMLPrinter::PushToBuffer( size_t size )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    SetText( buf );
+    TIXMLASSERT( size < static_cast<size_t>(-1) - _bufferSize - 1 );
+    EnsureBufferCapacity( _bufferSize + size + 1 );
+    char* p = _buffer + _bufferSize;
+    _bufferSize += size;
+    _buffer[_bufferSize] = 0;
+    return p;
 }
 
 
-void XMLElement::SetText( double v )
+void XMLPrinter::Print( const char* format, ... )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    SetText( buf );
-}
-
+    va_list     va;
+    va_start( va, format );
 
-XMLError XMLElement::QueryIntText( int* ival ) const
-{
-    if ( FirstChild() && FirstChild()->ToText() ) {
-        const char* t = FirstChild()->Value();
-        if ( XMLUtil::ToInt( t, ival ) ) {
-            return XML_SUCCESS;
+    if ( _sink ) {
+        char buf[BUF_SIZE];
+        const int len = TIXML_VSNPRINTF( buf, BUF_SIZE, format, va );
+        // Close out and re-start the va-args
+        va_end( va );
+        va_start( va, format );
+        if ( len >= 0 && len < BUF_SIZE ) {
+            _sink->Write( buf, len );
+        }
+        else {
+            // Didn't fit (or the runtime doesn't say how long it is); measure
+            // and format again into a buffer of the right size.
+            const int required = TIXML_VSCPRINTF( format, va );
+            va_end( va );
+            TIXMLASSERT( required >= 0 );
+            va_start( va, format );
+            char* mem = new char[required+1];
+            TIXML_VSNPRINTF( mem, required+1, format, va );
+            _sink->Write( mem, required );
+            delete [] mem;
+        }
+    }
+    else if ( _fp ) {
+        vfprintf( _fp, format, va );
+    }
+    else {
+        // Format straight into the free end of the buffer. Only if it
+        // doesn't fit is the length measured and the formatting repeated.
+        EnsureBufferCapacity( _bufferSize + 1 );
+        const size_t available = _bufferCapacity - _bufferSize;
+        const int len = TIXML_VSNPRINTF( _buffer + _bufferSize, available, format, va );
+        // Close out and re-start the va-args
+        va_end( va );
+        va_start( va, format );
+        if ( len >= 0 && static_cast<size_t>( len ) < available ) {
+            _bufferSize += len;
+        }
+        else {
+            _buffer[_bufferSize] = 0;
+            int required = len;
+            if ( required < 0 ) {
+                required = TIXML_VSCPRINTF( format, va );
+                va_end( va );
+                va_start( va, format );
+            }
+            TIXMLASSERT( required >= 0 );
+            char* p = PushToBuffer( required );
+            TIXML_VSNPRINTF( p, required+1, format, va );
         }
-        return XML_CAN_NOT_CONVERT_TEXT;
     }
-    return XML_NO_TEXT_NODE;
+    va_end( va );
 }
 
 
-XMLError XMLElement::QueryUnsignedText( unsigned* uval ) const
+void XMLPrinter::Write( const char* data, size_t size )
 {
-    if ( FirstChild() && FirstChild()->ToText() ) {
-        const char* t = FirstChild()->Value();
-        if ( XMLUtil::ToUnsigned( t, uval ) ) {
-            return XML_SUCCESS;
-        }
-        return XML_CAN_NOT_CONVERT_TEXT;
+    if ( _sink ) {
+        _sink->Write( data, size );
+    }
+    else if ( _fp ) {
+        fwrite ( data , sizeof(char), size, _fp);
+    }
+    else {
+        char* p = PushToBuffer( size );
+        memcpy( p, data, size );
     }
-    return XML_NO_TEXT_NODE;
 }
 
 
-XMLError XMLElement::QueryInt64Text(int64_t* ival) const
+void XMLPrinter::Putc( char ch )
 {
-	if (FirstChild() && FirstChild()->ToText()) {
-		const char* t = FirstChild()->Value();
-		if (XMLUtil::ToInt64(t, ival)) {
-			return XML_SUCCESS;
-		}
-		return XML_CAN_NOT_CONVERT_TEXT;
-	}
-	return XML_NO_TEXT_NODE;
+    if ( _sink ) {
+        _sink->Write( &ch, 1 );
+    }
+    else if ( _fp ) {
+        fputc ( ch, _fp);
+    }
+    else {
+        char* p = PushToBuffer( 1 );
+        p[0] = ch;
+    }
 }
 
 
-XMLError XMLElement::QueryUnsigned64Text(uint64_t* ival) const
+void XMLPrinter::PrintSpace( int depth )
 {
-    if(FirstChild() && FirstChild()->ToText()) {
-        const char* t = FirstChild()->Value();
-        if(XMLUtil::ToUnsigned64(t, ival)) {
-            return XML_SUCCESS;
-        }
-        return XML_CAN_NOT_CONVERT_TEXT;
+    for( int i=0; i<depth; ++i ) {
+        Write( "    " );
     }
-    return XML_NO_TEXT_NODE;
 }
 
 
-XMLError XMLElement::QueryBoolText( bool* bval ) const
+void XMLPrinter::PrintString( const char* p, bool restricted )
 {
-    if ( FirstChild() && FirstChild()->ToText() ) {
-        const char* t = FirstChild()->Value();
-        if ( XMLUtil::ToBool( t, bval ) ) {
-            return XML_SUCCESS;
+    // Look for runs of bytes between entities to print.
+    const char* q = p;
+
+    if ( _processEntities ) {
+        const bool* flag = restricted ? _restrictedEntityFlag : _entityFlag;
+        while ( *q ) {
+            TIXMLASSERT( p <= q );
+            // Remember, char is sometimes signed. (How many times has that bitten me?)
+            if ( *q > 0 && *q < ENTITY_RANGE ) {
+                // Check for entities. If one is found, flush
+                // the stream up until the entity, write the
+                // entity, and keep looking.
+                if ( flag[static_cast<unsigned char>(*q)] ) {
+                    while ( p < q ) {
+                        const size_t delta = q - p;
+                        const int toPrint = ( INT_MAX < delta ) ? INT_MAX : static_cast<int>(delta);
+                        Write( p, toPrint );
+                        p += toPrint;
+                    }
+                    bool entityPatternPrinted = false;
+                    for( int i=0; i<NUM_ENTITIES; ++i ) {
+                        if ( entities[i].value == *q ) {
+                            Putc( '&' );
+                            Write( entities[i].pattern, entities[i].length );
+                            Putc( ';' );
+                            entityPatternPrinted = true;
+                            break;
+                        }
+                    }
+                    if ( !entityPatternPrinted ) {
+                        // TIXMLASSERT( entityPatternPrinted ) causes gcc -Wunused-but-set-variable in release
+                        TIXMLASSERT( false );
+                    }
+                    ++p;
+                }
+            }
+            ++q;
+            TIXMLASSERT( p <= q );
+        }
+        // Flush the remaining string. This will be the entire
+        // string if an entity wasn't found.
+        if ( p < q ) {
+            const size_t delta = q - p;
+            const int toPrint = ( INT_MAX < delta ) ? INT_MAX : static_cast<int>(delta);
+            Write( p, toPrint );
         }
-        return XML_CAN_NOT_CONVERT_TEXT;
     }
-    return XML_NO_TEXT_NODE;
+    else {
+        Write( p );
+    }
 }
 
 
-XMLError XMLElement::QueryDoubleText( double* dval ) const
+void XMLPrinter::PushHeader( bool writeBOM, bool writeDec )
 {
-    if ( FirstChild() && FirstChild()->ToText() ) {
-        const char* t = FirstChild()->Value();
-        if ( XMLUtil::ToDouble( t, dval ) ) {
-            return XML_SUCCESS;
-        }
-        return XML_CAN_NOT_CONVERT_TEXT;
+    if ( writeBOM ) {
+        static const unsigned char bom[] = { TIXML_UTF_LEAD_0, TIXML_UTF_LEAD_1, TIXML_UTF_LEAD_2, 0 };
+        Write( reinterpret_cast< const char* >( bom ) );
+    }
+    if ( writeDec ) {
+        PushDeclaration( "xml version=\"1.0\"" );
     }
-    return XML_NO_TEXT_NODE;
 }
 
-
-XMLError XMLElement::QueryFloatText( float* fval ) const
+void XMLPrinter::PrepareForNewNode( bool compactMode )
 {
-    if ( FirstChild() && FirstChild()->ToText() ) {
-        const char* t = FirstChild()->Value();
-        if ( XMLUtil::ToFloat( t, fval ) ) {
-            return XML_SUCCESS;
-        }
-        return XML_CAN_NOT_CONVERT_TEXT;
+    SealElementIfJustOpened();
+
+    if ( compactMode ) {
+        return;
     }
-    return XML_NO_TEXT_NODE;
+
+    if ( _firstElement ) {
+        PrintSpace (_depth);
+    } else if ( _textDepth < 0) {
+        Putc( '\n' );
+        PrintSpace( _depth );
+    }
+
+    _firstElement = false;
 }
 
-int XMLElement::IntText(int defaultValue) const
+void XMLPrinter::OpenElement( const char* name, bool compactMode )
 {
-	int i = defaultValue;
-	QueryIntText(&i);
-	return i;
+    PrepareForNewNode( compactMode );
+    _stack.Push( name );
+
+    Putc( '<' );
+    Write( name );
+
+    _elementJustOpened = true;
+    ++_depth;
 }
 
-unsigned XMLElement::UnsignedText(unsigned defaultValue) const
+
+void XMLPrinter::PushAttribute( const char* name, const char* value )
 {
-	unsigned i = defaultValue;
-	QueryUnsignedText(&i);
-	return i;
+    TIXMLASSERT( _elementJustOpened );
+    Putc ( ' ' );
+    Write( name );
+    Write( "=\"", 2 );
+    PrintString( value, false );
+    Putc ( '\"' );
 }
 
-int64_t XMLElement::Int64Text(int64_t defaultValue) const
+
+// Numbers never need entity escaping, so their attributes skip PrintString().
+void XMLPrinter::PushNumberAttribute( const char* name, const char* value )
 {
-	int64_t i = defaultValue;
-	QueryInt64Text(&i);
-	return i;
+    TIXMLASSERT( _elementJustOpened );
+    Putc ( ' ' );
+    Write( name );
+    Write( "=\"", 2 );
+    Write( value );
+    Putc ( '\"' );
 }
 
-uint64_t XMLElement::Unsigned64Text(uint64_t defaultValue) const
+
+void XMLPrinter::PushAttribute( const char* name, int v )
 {
-	uint64_t i = defaultValue;
-	QueryUnsigned64Text(&i);
-	return i;
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    PushNumberAttribute( name, buf );
 }
 
-bool XMLElement::BoolText(bool defaultValue) const
+
+void XMLPrinter::PushAttribute( const char* name, unsigned v )
 {
-	bool b = defaultValue;
-	QueryBoolText(&b);
-	return b;
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    PushNumberAttribute( name, buf );
 }
 
-double XMLElement::DoubleText(double defaultValue) const
+
+void XMLPrinter::PushAttribute(const char* name, int64_t v)
 {
-	double d = defaultValue;
-	QueryDoubleText(&d);
-	return d;
+	char buf[BUF_SIZE];
+	XMLUtil::ToStr(v, buf, BUF_SIZE);
+	PushNumberAttribute(name, buf);
 }
 
-float XMLElement::FloatText(float defaultValue) const
+
+void XMLPrinter::PushAttribute(const char* name, uint64_t v)
 {
-	float f = defaultValue;
-	QueryFloatText(&f);
-	return f;
+	char buf[BUF_SIZE];
+	XMLUtil::ToStr(v, buf, BUF_SIZE);
+	PushNumberAttribute(name, buf);
 }
 
 
-XMLAttribute* XMLElement::FindOrCreateAttribute( const char* name )
+void XMLPrinter::PushAttribute( const char* name, bool v )
 {
-    XMLAttribute* last = 0;
-    XMLAttribute* attrib = 0;
-    for( attrib = _rootAttribute;
-            attrib;
-            last = attrib, attrib = attrib->_next ) {
-        if ( XMLUtil::StringEqual( attrib->Name(), name ) ) {
-            break;
-        }
-    }
-    if ( !attrib ) {
-        attrib = CreateAttribute();
-        TIXMLASSERT( attrib );
-        if ( last ) {
-            TIXMLASSERT( last->_next == 0 );
-            last->_next = attrib;
-        }
-        else {
-            TIXMLASSERT( _rootAttribute == 0 );
-            _rootAttribute = attrib;
-        }
-        attrib->SetName( name );
-    }
-    return attrib;
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    PushAttribute( name, buf );
 }
 
 
-void XMLElement::DeleteAttribute( const char* name )
-{
-    XMLAttribute* prev = 0;
-    for( XMLAttribute* a=_rootAttribute; a; a=a->_next ) {
-        if ( XMLUtil::StringEqual( name, a->Name() ) ) {
-            if ( prev ) {
-                prev->_next = a->_next;
-            }
-            else {
-                _rootAttribute = a->_next;
-            }
-            DeleteAttribute( a );
-            break;
-        }
-        prev = a;
-    }
+void XMLPrinter::PushAttribute( const char* name, double v )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( v, buf, BUF_SIZE );
+    PushNumberAttribute( name, buf );
 }
 
 
-char* XMLElement::ParseAttributes( char* p, int* curLineNumPtr )
+void XMLPrinter::CloseElement( bool compactMode )
 {
-    XMLAttribute* prevAttribute = 0;
+    --_depth;
+    const char* name = _stack.Pop();
 
-    // Read the attributes.
-    while( p ) {
-        p = XMLUtil::SkipWhiteSpace( p, curLineNumPtr );
-        if ( !(*p) ) {
-            _document->SetError( XML_ERROR_PARSING_ELEMENT, _parseLineNum, "XMLElement name=%s", Name() );
-            return 0;
+    if ( _elementJustOpened ) {
+        Write( "/>", 2 );
+    }
+    else {
+        if ( _textDepth < 0 && !compactMode) {
+            Putc( '\n' );
+            PrintSpace( _depth );
         }
+        Write( "</", 2 );
+        Write( name );
+        Putc( '>' );
+    }
 
-        // attribute.
-        if (XMLUtil::IsNameStartChar( (unsigned char) *p ) ) {
-            XMLAttribute* attrib = CreateAttribute();
-            TIXMLASSERT( attrib );
-            attrib->_parseLineNum = _document->_parseCurLineNum;
-
-            const int attrLineNum = attrib->_parseLineNum;
-
-            p = attrib->ParseDeep( p, _document->ProcessEntities(), curLineNumPtr );
-            if ( !p || Attribute( attrib->Name() ) ) {
-                DeleteAttribute( attrib );
-                _document->SetError( XML_ERROR_PARSING_ATTRIBUTE, attrLineNum, "XMLElement name=%s", Name() );
-                return 0;
-            }
-            // There is a minor bug here: if the attribute in the source xml
-            // document is duplicated, it will not be detected and the
-            // attribute will be doubly added. However, tracking the 'prevAttribute'
-            // avoids re-scanning the attribute list. Preferring performance for
-            // now, may reconsider in the future.
-            if ( prevAttribute ) {
-                TIXMLASSERT( prevAttribute->_next == 0 );
-                prevAttribute->_next = attrib;
-            }
-            else {
-                TIXMLASSERT( _rootAttribute == 0 );
-                _rootAttribute = attrib;
-            }
-            prevAttribute = attrib;
-        }
-        // end of the tag
-        else if ( *p == '>' ) {
-            ++p;
-            break;
-        }
-        // end of the tag
-        else if ( *p == '/' && *(p+1) == '>' ) {
-            _closingType = CLOSED;
-            return p+2;	// done; sealed element.
-        }
-        else {
-            _document->SetError( XML_ERROR_PARSING_ELEMENT, _parseLineNum, 0 );
-            return 0;
-        }
+    if ( _textDepth == _depth ) {
+        _textDepth = -1;
     }
-    return p;
+    if ( _depth == 0 && !compactMode) {
+        Putc( '\n' );
+    }
+    _elementJustOpened = false;
 }
 
-void XMLElement::DeleteAttribute( XMLAttribute* attribute )
+
+void XMLPrinter::SealElementIfJustOpened()
 {
-    if ( attribute == 0 ) {
+    if ( !_elementJustOpened ) {
         return;
     }
-    MemPool* pool = attribute->_memPool;
-    attribute->~XMLAttribute();
-    pool->Free( attribute );
+    _elementJustOpened = false;
+    Putc( '>' );
 }
 
-XMLAttribute* XMLElement::CreateAttribute()
+
+void XMLPrinter::PushText( const char* text, bool cdata )
 {
-    TIXMLASSERT( sizeof( XMLAttribute ) == _document->_attributePool.ItemSize() );
-    XMLAttribute* attrib = new (_document->_attributePool.Alloc() ) XMLAttribute();
-    TIXMLASSERT( attrib );
-    attrib->_memPool = &_document->_attributePool;
-    attrib->_memPool->SetTracked();
-    return attrib;
+    _textDepth = _depth-1;
+
+    SealElementIfJustOpened();
+    if ( cdata ) {
+        Write( "<![CDATA[" );
+        Write( text );
+        Write( "]]>" );
+    }
+    else {
+        PrintString( text, true );
+    }
 }
 
 
-XMLElement* XMLElement::InsertNewChildElement(const char* name)
+// Like PushNumberAttribute(), number text needs no entity escaping.
+void XMLPrinter::PushNumberText( const char* text )
 {
-    XMLElement* node = _document->NewElement(name);
-    return InsertEndChild(node) ? node : 0;
-}
+    _textDepth = _depth-1;
 
-XMLComment* XMLElement::InsertNewComment(const char* comment)
-{
-    XMLComment* node = _document->NewComment(comment);
-    return InsertEndChild(node) ? node : 0;
+    SealElementIfJustOpened();
+    Write( text );
 }
 
-XMLText* XMLElement::InsertNewText(const char* text)
+
+void XMLPrinter::PushText( int64_t value )
 {
-    XMLText* node = _document->NewText(text);
-    return InsertEndChild(node) ? node : 0;
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( value, buf, BUF_SIZE );
+    PushNumberText( buf );
 }
 
-XMLDeclaration* XMLElement::InsertNewDeclaration(const char* text)
+
+void XMLPrinter::PushText( uint64_t value )
 {
-    XMLDeclaration* node = _document->NewDeclaration(text);
-    return InsertEndChild(node) ? node : 0;
+	char buf[BUF_SIZE];
+	XMLUtil::ToStr(value, buf, BUF_SIZE);
+	PushNumberText(buf);
 }
 
-XMLUnknown* XMLElement::InsertNewUnknown(const char* text)
+
+void XMLPrinter::PushText( int value )
 {
-    XMLUnknown* node = _document->NewUnknown(text);
-    return InsertEndChild(node) ? node : 0;
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( value, buf, BUF_SIZE );
+    PushNumberText( buf );
 }
 
 
-
-//
-//	<ele></ele>
-//	<ele>foo<b>bar</b></ele>
-//
-char* XMLElement::ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr )
+void XMLPrinter::PushText( unsigned value )
 {
-    // Read the element name.
-    p = XMLUtil::SkipWhiteSpace( p, curLineNumPtr );
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( value, buf, BUF_SIZE );
+    PushNumberText( buf );
+}
 
-    // The closing element is the </element> form. It is
-    // parsed just like a regular element then deleted from
-    // the DOM.
-    if ( *p == '/' ) {
-        _closingType = CLOSING;
-        ++p;
-    }
 
-    p = _value.ParseName( p );
-    if ( _value.Empty() ) {
-        return 0;
-    }
+void XMLPrinter::PushText( bool value )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( value, buf, BUF_SIZE );
+    PushText( buf, false );
+}
 
-    p = ParseAttributes( p, curLineNumPtr );
-    if ( !p || !*p || _closingType != OPEN ) {
-        return p;
-    }
 
-    p = XMLNode::ParseDeep( p, parentEndTag, curLineNumPtr );
-    return p;
+void XMLPrinter::PushText( float value )
+{
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( value, buf, BUF_SIZE );
+    PushNumberText( buf );
 }
 
 
-
-XMLNode* XMLElement::ShallowClone( XMLDocument* doc ) const
+void XMLPrinter::PushText( double value )
 {
-    if ( !doc ) {
-        doc = _document;
-    }
-    XMLElement* element = doc->NewElement( Value() );					// fixme: this will always allocate memory. Intern?
-    for( const XMLAttribute* a=FirstAttribute(); a; a=a->Next() ) {
-        element->SetAttribute( a->Name(), a->Value() );					// fixme: this will always allocate memory. Intern?
-    }
-    return element;
+    char buf[BUF_SIZE];
+    XMLUtil::ToStr( value, buf, BUF_SIZE );
+    PushNumberText( buf );
 }
 
 
-bool XMLElement::ShallowEqual( const XMLNode* compare ) const
+void XMLPrinter::PushText( const int* values, int count )
 {
-    TIXMLASSERT( compare );
-    const XMLElement* other = compare->ToElement();
-    if ( other && XMLUtil::StringEqual( other->Name(), Name() )) {
-
-        const XMLAttribute* a=FirstAttribute();
-        const XMLAttribute* b=other->FirstAttribute();
+    TIXMLASSERT( values || count == 0 );
+    _textDepth = _depth-1;
+    SealElementIfJustOpened();
 
-        while ( a && b ) {
-            if ( !XMLUtil::StringEqual( a->Value(), b->Value() ) ) {
-                return false;
-            }
-            a = a->Next();
-            b = b->Next();
-        }
-        if ( a || b ) {
-            // different count
-            return false;
+    char buf[BUF_SIZE];
+    for( int i = 0; i < count; ++i ) {
+        if ( i ) {
+            Putc( ' ' );
         }
-        return true;
+        XMLUtil::ToStr( values[i], buf, BUF_SIZE );
+        Write( buf );
     }
-    return false;
 }
 
 
-bool XMLElement::Accept( XMLVisitor* visitor ) const
+void XMLPrinter::PushText( const double* values, int count )
 {
-    TIXMLASSERT( visitor );
-    if ( visitor->VisitEnter( *this, _rootAttribute ) ) {
-        for ( const XMLNode* node=FirstChild(); node; node=node->NextSibling() ) {
-            if ( !node->Accept( visitor ) ) {
-                break;
-            }
+    TIXMLASSERT( values || count == 0 );
+    _textDepth = _depth-1;
+    SealElementIfJustOpened();
+
+    char buf[BUF_SIZE];
+    for( int i = 0; i < count; ++i ) {
+        if ( i ) {
+            Putc( ' ' );
         }
+        XMLUtil::ToStr( values[i], buf, BUF_SIZE );
+        Write( buf );
     }
-    return visitor->VisitExit( *this );
 }
 
 
-// --------- XMLDocument ----------- //
-
-// Warning: List must match 'enum XMLError'
-const char* XMLDocument::_errorNames[XML_ERROR_COUNT] = {
-    "XML_SUCCESS",
-    "XML_NO_ATTRIBUTE",
-    "XML_WRONG_ATTRIBUTE_TYPE",
-    "XML_ERROR_FILE_NOT_FOUND",
-    "XML_ERROR_FILE_COULD_NOT_BE_OPENED",
-    "XML_ERROR_FILE_READ_ERROR",
-    "XML_ERROR_PARSING_ELEMENT",
-    "XML_ERROR_PARSING_ATTRIBUTE",
-    "XML_ERROR_PARSING_TEXT",
-    "XML_ERROR_PARSING_CDATA",
-    "XML_ERROR_PARSING_COMMENT",
-    "XML_ERROR_PARSING_DECLARATION",
-    "XML_ERROR_PARSING_UNKNOWN",
-    "XML_ERROR_EMPTY_DOCUMENT",
-    "XML_ERROR_MISMATCHED_ELEMENT",
-    "XML_ERROR_PARSING",
-    "XML_CAN_NOT_CONVERT_TEXT",
-    "XML_NO_TEXT_NODE",
-	"XML_ELEMENT_DEPTH_EXCEEDED"
-};
-
-
-XMLDocument::XMLDocument( bool processEntities, Whitespace whitespaceMode ) :
-    XMLNode( 0 ),
-    _writeBOM( false ),
-    _processEntities( processEntities ),
-    _errorID(XML_SUCCESS),
-    _whitespaceMode( whitespaceMode ),
-    _errorStr(),
-    _errorLineNum( 0 ),
-    _charBuffer( 0 ),
-    _parseCurLineNum( 0 ),
-	_parsingDepth(0),
-    _unlinked(),
-    _elementPool(),
-    _attributePool(),
-    _textPool(),
-    _commentPool()
+void XMLPrinter::PushComment( const char* comment )
 {
-    // avoid VC++ C4355 warning about 'this' in initializer list (C4355 is off by default in VS2012+)
-    _document = this;
-}
-
+    PrepareForNewNode( _compactMode );
 
-XMLDocument::~XMLDocument()
-{
-    Clear();
+    Write( "<!--" );
+    Write( comment );
+    Write( "-->" );
 }
 
 
-void XMLDocument::MarkInUse(const XMLNode* const node)
+void XMLPrinter::PushDeclaration( const char* value )
 {
-	TIXMLASSERT(node);
-	TIXMLASSERT(node->_parent == 0);
+    PrepareForNewNode( _compactMode );
 
-	for (int i = 0; i < _unlinked.Size(); ++i) {
-		if (node == _unlinked[i]) {
-			_unlinked.SwapRemove(i);
-			break;
-		}
-	}
+    Write( "<?" );
+    Write( value );
+    Write( "?>" );
 }
 
-void XMLDocument::Clear()
-{
-    DeleteChildren();
-	while( _unlinked.Size()) {
-		DeleteNode(_unlinked[0]);	// Will remove from _unlinked as part of delete.
-	}
 
-#ifdef TINYXML2_DEBUG
-    const bool hadError = Error();
-#endif
-    ClearError();
+void XMLPrinter::PushUnknown( const char* value )
+{
+    PrepareForNewNode( _compactMode );
 
-    delete [] _charBuffer;
-    _charBuffer = 0;
-	_parsingDepth = 0;
+    Write( "<!" );
+    Write( value );
+    Putc( '>' );
+}
 
-#if 0
-    _textPool.Trace( "text" );
-    _elementPool.Trace( "element" );
-    _commentPool.Trace( "comment" );
-    _attributePool.Trace( "attribute" );
-#endif
 
-#ifdef TINYXML2_DEBUG
-    if ( !hadError ) {
-        TIXMLASSERT( _elementPool.CurrentAllocs()   == _elementPool.Untracked() );
-        TIXMLASSERT( _attributePool.CurrentAllocs() == _attributePool.Untracked() );
-        TIXMLASSERT( _textPool.CurrentAllocs()      == _textPool.Untracked() );
-        TIXMLASSERT( _commentPool.CurrentAllocs()   == _commentPool.Untracked() );
+bool XMLPrinter::VisitEnter( const XMLDocument& doc )
+{
+    _processEntities = doc.ProcessEntities();
+    if ( doc.HasBOM() ) {
+        PushHeader( true, false );
     }
-#endif
+    return true;
 }
 
 
-void XMLDocument::DeepCopy(XMLDocument* target) const
+bool XMLPrinter::VisitEnter( const XMLElement& element, const XMLAttribute* attribute )
 {
-	TIXMLASSERT(target);
-    if (target == this) {
-        return; // technically success - a no-op.
+    const XMLElement* parentElem = 0;
+    if ( element.Parent() ) {
+        parentElem = element.Parent()->ToElement();
     }
-
-	target->Clear();
-	for (const XMLNode* node = this->FirstChild(); node; node = node->NextSibling()) {
-		target->InsertEndChild(node->DeepClone(target));
-	}
+    const bool compactMode = parentElem ? CompactMode( *parentElem ) : _compactMode;
+    OpenElement( element.Name(), compactMode );
+    while ( attribute ) {
+        PushAttribute( attribute->Name(), attribute->Value() );
+        attribute = attribute->Next();
+    }
+    return true;
 }
 
-XMLElement* XMLDocument::NewElement( const char* name )
+
+bool XMLPrinter::VisitExit( const XMLElement& element )
 {
-    XMLElement* ele = CreateUnlinkedNode<XMLElement>( _elementPool );
-    ele->SetName( name );
-    return ele;
+    CloseElement( CompactMode(element) );
+    return true;
 }
 
 
-XMLComment* XMLDocument::NewComment( const char* str )
+bool XMLPrinter::Visit( const XMLText& text )
 {
-    XMLComment* comment = CreateUnlinkedNode<XMLComment>( _commentPool );
-    comment->SetValue( str );
-    return comment;
+    PushText( text.Value(), text.CData() );
+    return true;
 }
 
 
-XMLText* XMLDocument::NewText( const char* str )
+bool XMLPrinter::Visit( const XMLComment& comment )
 {
-    XMLText* text = CreateUnlinkedNode<XMLText>( _textPool );
-    text->SetValue( str );
-    return text;
+    PushComment( comment.Value() );
+    return true;
 }
 
-
-XMLDeclaration* XMLDocument::NewDeclaration( const char* str )
+bool XMLPrinter::Visit( const XMLDeclaration& declaration )
 {
-    XMLDeclaration* dec = CreateUnlinkedNode<XMLDeclaration>( _commentPool );
-    dec->SetValue( str ? str : "xml version=\"1.0\" encoding=\"UTF-8\"" );
-    return dec;
+    PushDeclaration( declaration.Value() );
+    return true;
 }
 
 
-XMLUnknown* XMLDocument::NewUnknown( const char* str )
+bool XMLPrinter::Visit( const XMLUnknown& unknown )
 {
-    XMLUnknown* unk = CreateUnlinkedNode<XMLUnknown>( _commentPool );
-    unk->SetValue( str );
-    return unk;
+    PushUnknown( unknown.Value() );
+    return true;
 }
 
-static FILE* callfopen( const char* filepath, const char* mode )
-{
-    TIXMLASSERT( filepath );
-    TIXMLASSERT( mode );
-#if defined(_MSC_VER) && (_MSC_VER >= 1400 ) && (!defined WINCE)
-    FILE* fp = 0;
-    const errno_t err = fopen_s( &fp, filepath, mode );
-    if ( err ) {
-        return 0;
-    }
-#else
-    FILE* fp = fopen( filepath, mode );
-#endif
-    return fp;
-}
 
-void XMLDocument::DeleteNode( XMLNode* node )	{
-    TIXMLASSERT( node );
-    TIXMLASSERT(node->_document == this );
-    if (node->_parent) {
-        node->_parent->DeleteChild( node );
-    }
-    else {
-        // Isn't in the tree.
-        // Use the parent delete.
-        // Also, we need to mark it tracked: we 'know'
-        // it was never used.
-        node->_memPool->SetTracked();
-        // Call the static XMLNode version:
-        XMLNode::DeleteNode(node);
-    }
-}
+// --------- XMLCanonicalPrinter ----------- //
 
+static const char XML_NAMESPACE_URI[] = "http://www.w3.org/XML/1998/namespace";
 
-XMLError XMLDocument::LoadFile( const char* filename )
+// An attribute or namespace declaration of an element being written.
+struct CanonicalAttribute {
+    const char* name;
+    const char* value;
+    const char* uri;        // sort key: namespace URI, or the prefix declared
+    const char* local;
+};
+
+static bool IsNamespaceDeclaration( const char* name )
 {
-    if ( !filename ) {
-        TIXMLASSERT( false );
-        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
-        return _errorID;
-    }
+    return strncmp( name, "xmlns", 5 ) == 0 && ( name[5] == 0 || name[5] == ':' );
+}
 
-    Clear();
-    FILE* fp = callfopen( filename, "rb" );
-    if ( !fp ) {
-        SetError( XML_ERROR_FILE_NOT_FOUND, 0, "filename=%s", filename );
-        return _errorID;
-    }
-    LoadFile( fp );
-    fclose( fp );
-    return _errorID;
+static const char* LocalName( const char* name )
+{
+    const char* colon = strchr( name, ':' );
+    return colon ? colon + 1 : name;
 }
 
-XMLError XMLDocument::LoadFile( FILE* fp )
+// Declarations sort by the prefix declared, attributes by URI then local name.
+static bool CanonicalBefore( const CanonicalAttribute& a, const CanonicalAttribute& b )
 {
-    Clear();
+    const int byUri = strcmp( a.uri, b.uri );
+    return byUri < 0 || ( byUri == 0 && strcmp( a.local, b.local ) < 0 );
+}
 
-    TIXML_FSEEK( fp, 0, SEEK_SET );
-    if ( fgetc( fp ) == EOF && ferror( fp ) != 0 ) {
-        SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
-        return _errorID;
+static void InsertCanonical( DynArray< CanonicalAttribute, 16 >* list, const CanonicalAttribute& a )
+{
+    list->Push( a );
+    int i = list->Size() - 1;
+    for( ; i > 0 && CanonicalBefore( a, (*list)[i-1] ); --i ) {
+        (*list)[i] = (*list)[i-1];
     }
+    (*list)[i] = a;
+}
 
-    TIXML_FSEEK( fp, 0, SEEK_END );
-
-    unsigned long long filelength;
-    {
-        const long long fileLengthSigned = TIXML_FTELL( fp );
-        TIXML_FSEEK( fp, 0, SEEK_SET );
-        if ( fileLengthSigned == -1L ) {
-            SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
-            return _errorID;
+// Adds a or, if one with the same name is there, replaces it.
+static void SetCanonical( DynArray< CanonicalAttribute, 16 >* list, const CanonicalAttribute& a )
+{
+    for( int i = 0; i < list->Size(); ++i ) {
+        if ( strcmp( (*list)[i].name, a.name ) == 0 ) {
+            (*list)[i] = a;
+            return;
         }
-        TIXMLASSERT( fileLengthSigned >= 0 );
-        filelength = static_cast<unsigned long long>(fileLengthSigned);
-    }
-
-    const size_t maxSizeT = static_cast<size_t>(-1);
-    // We'll do the comparison as an unsigned long long, because that's guaranteed to be at
-    // least 8 bytes, even on a 32-bit platform.
-    if ( filelength >= static_cast<unsigned long long>(maxSizeT) ) {
-        // Cannot handle files which won't fit in buffer together with null terminator
-        SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
-        return _errorID;
     }
+    list->Push( a );
+}
 
-    if ( filelength == 0 ) {
-        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
-        return _errorID;
-    }
 
-    const size_t size = static_cast<size_t>(filelength);
-    TIXMLASSERT( _charBuffer == 0 );
-    _charBuffer = new char[size+1];
-    const size_t read = fread( _charBuffer, 1, size, fp );
-    if ( read != size ) {
-        SetError( XML_ERROR_FILE_READ_ERROR, 0, 0 );
-        return _errorID;
-    }
+XMLCanonicalPrinter::XMLCanonicalPrinter( FILE* file, bool withComments ) :
+    XMLPrinter( file, true ),
+    _withComments( withComments ),
+    _elementDepth( 0 ),
+    _rootWritten( false ),
+    _decodeEntities( false ),
+    _namespaces(),
+    _namespaceScopes()
+{
+}
 
-    _charBuffer[size] = 0;
 
-    Parse();
-    return _errorID;
+XMLCanonicalPrinter::XMLCanonicalPrinter( XMLOutputSink& sink, bool withComments ) :
+    XMLPrinter( sink, true ),
+    _withComments( withComments ),
+    _elementDepth( 0 ),
+    _rootWritten( false ),
+    _decodeEntities( false ),
+    _namespaces(),
+    _namespaceScopes()
+{
 }
 
 
-XMLError XMLDocument::SaveFile( const char* filename, bool compact )
+bool XMLCanonicalPrinter::VisitEnter( const XMLDocument& )
 {
-    if ( !filename ) {
-        TIXMLASSERT( false );
-        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=<null>" );
-        return _errorID;
-    }
-
-    FILE* fp = callfopen( filename, "w" );
-    if ( !fp ) {
-        SetError( XML_ERROR_FILE_COULD_NOT_BE_OPENED, 0, "filename=%s", filename );
-        return _errorID;
-    }
-    SaveFile(fp, compact);
-    fclose( fp );
-    return _errorID;
+    // No BOM and no declaration.
+    _rootWritten = false;
+    return true;
 }
 
 
-XMLError XMLDocument::SaveFile( FILE* fp, bool compact )
+bool XMLCanonicalPrinter::VisitExit( const XMLDocument& )
 {
-    // Clear any error from the last save, otherwise it will get reported
-    // for *this* call.
-    ClearError();
-    XMLPrinter stream( fp, compact );
-    Print( &stream );
-    return _errorID;
+    return true;
 }
 
 
-XMLError XMLDocument::Parse( const char* p, size_t len )
+const char* XMLCanonicalPrinter::FindNamespace( const char* prefix, size_t length ) const
 {
-    Clear();
+    for( int i = _namespaces.Size() - 2; i >= 0; i -= 2 ) {
+        const char* p = _namespaces[i];
+        if ( strlen( p ) == length && strncmp( p, prefix, length ) == 0 ) {
+            return _namespaces[i+1];
+        }
+    }
+    return 0;
+}
 
-    if ( len == 0 || !p || !*p ) {
-        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
-        return _errorID;
+
+bool XMLCanonicalPrinter::VisitEnter( const XMLElement& element, const XMLAttribute* attribute )
+{
+    // What could be written: the element's own attributes, and for the
+    // first element printed, what it inherits from the ancestors that are
+    // not printed - namespace declarations and xml: attributes.
+    DynArray< CanonicalAttribute, 16 > candidates;
+    if ( _elementDepth == 0 ) {
+        // Without entity processing, values keep their references.
+        _decodeEntities = !element.GetDocument()->ProcessEntities();
+        DynArray< const XMLElement*, 16 > ancestors;
+        for( const XMLNode* node = element.Parent(); node && node->ToElement(); node = node->Parent() ) {
+            ancestors.Push( node->ToElement() );
+        }
+        while ( !ancestors.Empty() ) {
+            for( const XMLAttribute* a = ancestors.Pop()->FirstAttribute(); a; a = a->Next() ) {
+                if ( IsNamespaceDeclaration( a->Name() ) || strncmp( a->Name(), "xml:", 4 ) == 0 ) {
+                    CanonicalAttribute c = { a->Name(), a->Value(), "", "" };
+                    SetCanonical( &candidates, c );
+                }
+            }
+        }
     }
-    if ( len == static_cast<size_t>(-1) ) {
-        len = strlen( p );
+    for( const XMLAttribute* a = attribute; a; a = a->Next() ) {
+        CanonicalAttribute c = { a->Name(), a->Value(), "", "" };
+        SetCanonical( &candidates, c );
     }
-    TIXMLASSERT( _charBuffer == 0 );
-    _charBuffer = new char[ len+1 ];
-    memcpy( _charBuffer, p, len );
-    _charBuffer[len] = 0;
 
-    Parse();
-    if ( Error() ) {
-        // clean up now essentially dangling memory.
-        // and the parse fail can put objects in the
-        // pools that are dead and inaccessible.
-        DeleteChildren();
-        _elementPool.Clear();
-        _attributePool.Clear();
-        _textPool.Clear();
-        _commentPool.Clear();
+    // Namespace declarations first: they are needed to sort the attributes.
+    _namespaceScopes.Push( _namespaces.Size() );
+    DynArray< CanonicalAttribute, 16 > declarations;
+    for( int i = 0; i < candidates.Size(); ++i ) {
+        CanonicalAttribute c = candidates[i];
+        if ( !IsNamespaceDeclaration( c.name ) ) {
+            continue;
+        }
+        const char* prefix = c.name[5] ? c.name + 6 : "";
+        const char* inScope = FindNamespace( prefix, strlen( prefix ) );
+        const bool redundant = inScope ? strcmp( inScope, c.value ) == 0 : ( !*prefix && !*c.value );
+        if ( !redundant ) {
+            c.uri = prefix;
+            c.local = "";
+            InsertCanonical( &declarations, c );
+        }
+        _namespaces.Push( prefix );
+        _namespaces.Push( c.value );
     }
-    return _errorID;
+    DynArray< CanonicalAttribute, 16 > attributes;
+    for( int i = 0; i < candidates.Size(); ++i ) {
+        CanonicalAttribute c = candidates[i];
+        if ( IsNamespaceDeclaration( c.name ) ) {
+            continue;
+        }
+        c.local = LocalName( c.name );
+        if ( c.local != c.name ) {
+            const size_t prefixLength = c.local - 1 - c.name;
+            if ( prefixLength == 3 && strncmp( c.name, "xml", 3 ) == 0 ) {
+                c.uri = XML_NAMESPACE_URI;
+            }
+            else {
+                const char* uri = FindNamespace( c.name, prefixLength );
+                // An unbound prefix is an error in the document; sort by it
+                // rather than fail.
+                c.uri = uri ? uri : c.name;
+            }
+        }
+        InsertCanonical( &attributes, c );
+    }
+
+    Putc( '<' );
+    Write( element.Name() );
+    for( int pass = 0; pass < 2; ++pass ) {
+        const DynArray< CanonicalAttribute, 16 >& list = pass ? attributes : declarations;
+        for( int i = 0; i < list.Size(); ++i ) {
+            Putc( ' ' );
+            Write( list[i].name );
+            Write( "=\"", 2 );
+            WriteEscaped( list[i].value, true, _decodeEntities );
+            Putc( '"' );
+        }
+    }
+    Putc( '>' );
+    ++_elementDepth;
+    return true;
 }
 
 
-void XMLDocument::Print( XMLPrinter* streamer ) const
+bool XMLCanonicalPrinter::VisitExit( const XMLElement& element )
 {
-    if ( streamer ) {
-        Accept( streamer );
-    }
-    else {
-        XMLPrinter stdoutStreamer( stdout );
-        Accept( &stdoutStreamer );
+    Write( "</", 2 );
+    Write( element.Name() );
+    Putc( '>' );
+    _namespaces.PopArr( _namespaces.Size() - _namespaceScopes.Pop() );
+    if ( --_elementDepth == 0 ) {
+        _rootWritten = true;
     }
+    return true;
 }
 
 
-void XMLDocument::ClearError() {
-    _errorID = XML_SUCCESS;
-    _errorLineNum = 0;
-    _errorStr.Reset();
+bool XMLCanonicalPrinter::Visit( const XMLText& text )
+{
+    // Text outside the root element is only ever whitespace; CDATA
+    // sections are written as their text.
+    if ( _elementDepth > 0 ) {
+        WriteEscaped( text.Value(), false, _decodeEntities && !text.CData() );
+    }
+    return true;
 }
 
 
-void XMLDocument::SetError( XMLError error, int lineNum, const char* format, ... )
+bool XMLCanonicalPrinter::Visit( const XMLComment& comment )
 {
-    TIXMLASSERT( error >= 0 && error < XML_ERROR_COUNT );
-    _errorID = error;
-    _errorLineNum = lineNum;
-	_errorStr.Reset();
+    if ( _withComments ) {
+        BeginTopLevel();
+        Write( "<!--", 4 );
+        Write( comment.Value() );
+        Write( "-->", 3 );
+        EndTopLevel();
+    }
+    return true;
+}
 
-    const size_t BUFFER_SIZE = 1000;
-    char* buffer = new char[BUFFER_SIZE];
 
-    TIXMLASSERT(sizeof(error) <= sizeof(int));
-    TIXML_SNPRINTF(buffer, BUFFER_SIZE, "Error=%s ErrorID=%d (0x%x) Line number=%d", ErrorIDToName(error), int(error), int(error), lineNum);
+bool XMLCanonicalPrinter::Visit( const XMLDeclaration& declaration )
+{
+    // TinyXML-2 reads every <?...?> as a declaration. The XML declaration
+    // itself is dropped, other processing instructions are kept, with one
+    // space between target and data.
+    const char* p = declaration.Value();
+    const char* target = p;
+    while ( *p && !XMLUtil::IsWhiteSpace( *p ) ) {
+        ++p;
+    }
+    const size_t targetLength = p - target;
+    if ( targetLength == 3 && strncmp( target, "xml", 3 ) == 0 ) {
+        return true;
+    }
+    p = XMLUtil::SkipWhiteSpace( p, 0 );
+    BeginTopLevel();
+    Write( "<?", 2 );
+    Write( target, targetLength );
+    if ( *p ) {
+        Putc( ' ' );
+        Write( p );
+    }
+    Write( "?>", 2 );
+    EndTopLevel();
+    return true;
+}
 
-	if (format) {
-		size_t len = strlen(buffer);
-		TIXML_SNPRINTF(buffer + len, BUFFER_SIZE - len, ": ");
-		len = strlen(buffer);
 
-		va_list va;
-		va_start(va, format);
-		TIXML_VSNPRINTF(buffer + len, BUFFER_SIZE - len, format, va);
-		va_end(va);
-	}
-	_errorStr.SetStr(buffer);
-	delete[] buffer;
+bool XMLCanonicalPrinter::Visit( const XMLUnknown& )
+{
+    // DOCTYPE and the like are not part of the canonical form.
+    return true;
 }
 
 
-/*static*/ const char* XMLDocument::ErrorIDToName(XMLError errorID)
+void XMLCanonicalPrinter::BeginTopLevel()
 {
-	TIXMLASSERT( errorID >= 0 && errorID < XML_ERROR_COUNT );
-    const char* errorName = _errorNames[errorID];
-    TIXMLASSERT( errorName && errorName[0] );
-    return errorName;
+    if ( _elementDepth == 0 && _rootWritten ) {
+        Putc( '\n' );
+    }
 }
 
-const char* XMLDocument::ErrorStr() const
+
+void XMLCanonicalPrinter::EndTopLevel()
 {
-	return _errorStr.Empty() ? "" : _errorStr.GetStr();
+    if ( _elementDepth == 0 && !_rootWritten ) {
+        Putc( '\n' );
+    }
 }
 
 
-void XMLDocument::PrintError() const
+void XMLCanonicalPrinter::WriteEscaped( const char* p, bool attribute, bool decode )
 {
-    printf("%s\n", ErrorStr());
+    const char* run = p;
+    while ( *p ) {
+        if ( decode && *p == '&' ) {
+            // A reference left in the text: written as its character.
+            char value[10] = { 0 };
+            int length = 0;
+            const char* next = 0;
+            if ( *(p+1) == '#' ) {
+                next = XMLUtil::GetCharacterRef( p, value, &length );
+            }
+            else {
+                for( int i = 0; i < NUM_ENTITIES; ++i ) {
+                    if ( strncmp( p + 1, entities[i].pattern, entities[i].length ) == 0
+                            && *( p + entities[i].length + 1 ) == ';' ) {
+                        value[0] = entities[i].value;
+                        length = 1;
+                        next = p + entities[i].length + 2;
+                        break;
+                    }
+                }
+            }
+            if ( next ) {
+                Write( run, p - run );
+                TIXMLASSERT( 0 <= length && length < (int)sizeof( value ) );
+                value[length] = 0;
+                WriteEscaped( value, attribute, false );
+                p = next;
+                run = p;
+                continue;
+            }
+        }
+        const char* entity = 0;
+        switch ( *p ) {
+            case '&':   entity = "&amp;";   break;
+            case '<':   entity = "&lt;";    break;
+            case '>':   entity = attribute ? 0 : "&gt;";        break;
+            case '"':   entity = attribute ? "&quot;" : 0;      break;
+            case '\t':  entity = attribute ? "&#x9;" : 0;       break;
+            case '\n':  entity = attribute ? "&#xA;" : 0;       break;
+            case '\r':  entity = "&#xD;";   break;
+            default:    break;
+        }
+        if ( entity ) {
+            Write( run, p - run );
+            Write( entity );
+            run = p + 1;
+        }
+        ++p;
+    }
+    Write( run, p - run );
 }
 
-const char* XMLDocument::ErrorName() const
+
+// --------- XMLHasher ----------- //
+//
+// XXH64, by Yann Collet (https://github.com/Cyan4973/xxHash), streaming.
+
+static const uint64_t XXH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t XXH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t XXH_PRIME3 = 1609587929392839161ULL;
+static const uint64_t XXH_PRIME4 = 9650029242287828579ULL;
+static const uint64_t XXH_PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t RotateLeft( uint64_t x, int r )
 {
-    return ErrorIDToName(_errorID);
+    return ( x << r ) | ( x >> ( 64 - r ) );
 }
 
-void XMLDocument::Parse()
+static inline uint64_t ReadLE64( const unsigned char* p )
 {
-    TIXMLASSERT( NoChildren() ); // Clear() must have been called previously
-    TIXMLASSERT( _charBuffer );
-    _parseCurLineNum = 1;
-    _parseLineNum = 1;
-    char* p = _charBuffer;
-    p = XMLUtil::SkipWhiteSpace( p, &_parseCurLineNum );
-    p = const_cast<char*>( XMLUtil::ReadBOM( p, &_writeBOM ) );
-    if ( !*p ) {
-        SetError( XML_ERROR_EMPTY_DOCUMENT, 0, 0 );
-        return;
+    uint64_t v = 0;
+    for( int i = 7; i >= 0; --i ) {
+        v = ( v << 8 ) | p[i];
     }
-    ParseDeep(p, 0, &_parseCurLineNum );
+    return v;
 }
 
-void XMLDocument::PushDepth()
+static inline uint64_t XXHRound( uint64_t acc, uint64_t input )
 {
-	_parsingDepth++;
-	if (_parsingDepth == TINYXML2_MAX_ELEMENT_DEPTH) {
-		SetError(XML_ELEMENT_DEPTH_EXCEEDED, _parseCurLineNum, "Element nesting is too deep." );
-	}
+    acc += input * XXH_PRIME2;
+    acc = RotateLeft( acc, 31 );
+    return acc * XXH_PRIME1;
 }
 
-void XMLDocument::PopDepth()
+static inline uint64_t XXHMergeRound( uint64_t acc, uint64_t value )
 {
-	TIXMLASSERT(_parsingDepth > 0);
-	--_parsingDepth;
+    acc ^= XXHRound( 0, value );
+    return acc * XXH_PRIME1 + XXH_PRIME4;
 }
 
-XMLPrinter::XMLPrinter( FILE* file, bool compact, int depth ) :
-    _elementJustOpened( false ),
-    _stack(),
-    _firstElement( true ),
-    _fp( file ),
-    _depth( depth ),
-    _textDepth( -1 ),
-    _processEntities( true ),
-    _compactMode( compact ),
-    _buffer()
+static void HashInit( XMLHashState* state, uint64_t seed )
 {
-    for( int i=0; i<ENTITY_RANGE; ++i ) {
-        _entityFlag[i] = false;
-        _restrictedEntityFlag[i] = false;
-    }
-    for( int i=0; i<NUM_ENTITIES; ++i ) {
-        const char entityValue = entities[i].value;
-        const unsigned char flagIndex = static_cast<unsigned char>(entityValue);
-        TIXMLASSERT( flagIndex < ENTITY_RANGE );
-        _entityFlag[flagIndex] = true;
-    }
-    _restrictedEntityFlag[static_cast<unsigned char>('&')] = true;
-    _restrictedEntityFlag[static_cast<unsigned char>('<')] = true;
-    _restrictedEntityFlag[static_cast<unsigned char>('>')] = true;	// not required, but consistency is nice
-    _buffer.Push( 0 );
+    state->acc[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    state->acc[1] = seed + XXH_PRIME2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - XXH_PRIME1;
+    state->total = 0;
+    state->buffered = 0;
 }
 
-
-void XMLPrinter::Print( const char* format, ... )
+static void HashUpdate( XMLHashState* state, const void* data, size_t size )
 {
-    va_list     va;
-    va_start( va, format );
+    const unsigned char* p = static_cast<const unsigned char*>( data );
+    const unsigned char* const end = p + size;
+    state->total += size;
 
-    if ( _fp ) {
-        vfprintf( _fp, format, va );
+    if ( state->buffered + size < 32 ) {
+        memcpy( state->buffer + state->buffered, p, size );
+        state->buffered += size;
+        return;
     }
-    else {
-        const int len = TIXML_VSCPRINTF( format, va );
-        // Close out and re-start the va-args
-        va_end( va );
-        TIXMLASSERT( len >= 0 );
-        va_start( va, format );
-        TIXMLASSERT( _buffer.Size() > 0 && _buffer[_buffer.Size() - 1] == 0 );
-        char* p = _buffer.PushArr( len ) - 1;	// back up over the null terminator.
-		TIXML_VSNPRINTF( p, len+1, format, va );
+    if ( state->buffered ) {
+        const size_t fill = 32 - state->buffered;
+        memcpy( state->buffer + state->buffered, p, fill );
+        p += fill;
+        for( int i = 0; i < 4; ++i ) {
+            state->acc[i] = XXHRound( state->acc[i], ReadLE64( state->buffer + 8*i ) );
+        }
+        state->buffered = 0;
     }
-    va_end( va );
+    for( ; end - p >= 32; p += 32 ) {
+        for( int i = 0; i < 4; ++i ) {
+            state->acc[i] = XXHRound( state->acc[i], ReadLE64( p + 8*i ) );
+        }
+    }
+    memcpy( state->buffer, p, end - p );
+    state->buffered = end - p;
 }
 
-
-void XMLPrinter::Write( const char* data, size_t size )
+static uint64_t HashDigest( const XMLHashState& state, uint64_t seed )
 {
-    if ( _fp ) {
-        fwrite ( data , sizeof(char), size, _fp);
+    uint64_t h = 0;
+    if ( state.total >= 32 ) {
+        h = RotateLeft( state.acc[0], 1 ) + RotateLeft( state.acc[1], 7 )
+            + RotateLeft( state.acc[2], 12 ) + RotateLeft( state.acc[3], 18 );
+        for( int i = 0; i < 4; ++i ) {
+            h = XXHMergeRound( h, state.acc[i] );
+        }
     }
     else {
-        char* p = _buffer.PushArr( static_cast<int>(size) ) - 1;   // back up over the null terminator.
-        memcpy( p, data, size );
-        p[size] = 0;
+        h = seed + XXH_PRIME5;
     }
-}
-
+    h += state.total;
 
-void XMLPrinter::Putc( char ch )
-{
-    if ( _fp ) {
-        fputc ( ch, _fp);
+    const unsigned char* p = state.buffer;
+    const unsigned char* const end = p + state.buffered;
+    for( ; end - p >= 8; p += 8 ) {
+        h ^= XXHRound( 0, ReadLE64( p ) );
+        h = RotateLeft( h, 27 ) * XXH_PRIME1 + XXH_PRIME4;
     }
-    else {
-        char* p = _buffer.PushArr( sizeof(char) ) - 1;   // back up over the null terminator.
-        p[0] = ch;
-        p[1] = 0;
+    if ( end - p >= 4 ) {
+        const uint64_t k = (uint64_t)p[0] | ( (uint64_t)p[1] << 8 ) | ( (uint64_t)p[2] << 16 ) | ( (uint64_t)p[3] << 24 );
+        h ^= k * XXH_PRIME1;
+        h = RotateLeft( h, 23 ) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for( ; p < end; ++p ) {
+        h ^= *p * XXH_PRIME5;
+        h = RotateLeft( h, 11 ) * XXH_PRIME1;
     }
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
 }
 
-
-void XMLPrinter::PrintSpace( int depth )
+// Numbers go in little endian, so hashes are the same everywhere.
+static void HashNumber( XMLHashState* state, uint64_t n )
 {
-    for( int i=0; i<depth; ++i ) {
-        Write( "    " );
+    unsigned char bytes[8];
+    for( int i = 0; i < 8; ++i ) {
+        bytes[i] = (unsigned char)( n >> ( 8*i ) );
     }
+    HashUpdate( state, bytes, sizeof( bytes ) );
 }
 
+// Strings are length prefixed, so "ab","c" and "a","bc" differ.
+static void HashString( XMLHashState* state, const char* str )
+{
+    const size_t length = strlen( str );
+    HashNumber( state, length );
+    HashUpdate( state, str, length );
+}
 
-void XMLPrinter::PrintString( const char* p, bool restricted )
+enum {
+    HASH_DOCUMENT = 'D',
+    HASH_ELEMENT = 'E',
+    HASH_TEXT = 'T',
+    HASH_COMMENT = 'C',
+    HASH_DECLARATION = 'P',
+    HASH_UNKNOWN = 'U'
+};
+
+static uint64_t HashLeaf( int kind, const char* value, uint64_t seed )
 {
-    // Look for runs of bytes between entities to print.
-    const char* q = p;
+    XMLHashState state;
+    HashInit( &state, seed );
+    HashNumber( &state, kind );
+    HashString( &state, value );
+    return HashDigest( state, seed );
+}
 
-    if ( _processEntities ) {
-        const bool* flag = restricted ? _restrictedEntityFlag : _entityFlag;
-        while ( *q ) {
-            TIXMLASSERT( p <= q );
-            // Remember, char is sometimes signed. (How many times has that bitten me?)
-            if ( *q > 0 && *q < ENTITY_RANGE ) {
-                // Check for entities. If one is found, flush
-                // the stream up until the entity, write the
-                // entity, and keep looking.
-                if ( flag[static_cast<unsigned char>(*q)] ) {
-                    while ( p < q ) {
-                        const size_t delta = q - p;
-                        const int toPrint = ( INT_MAX < delta ) ? INT_MAX : static_cast<int>(delta);
-                        Write( p, toPrint );
-                        p += toPrint;
-                    }
-                    bool entityPatternPrinted = false;
-                    for( int i=0; i<NUM_ENTITIES; ++i ) {
-                        if ( entities[i].value == *q ) {
-                            Putc( '&' );
-                            Write( entities[i].pattern, entities[i].length );
-                            Putc( ';' );
-                            entityPatternPrinted = true;
-                            break;
-                        }
-                    }
-                    if ( !entityPatternPrinted ) {
-                        // TIXMLASSERT( entityPatternPrinted ) causes gcc -Wunused-but-set-variable in release
-                        TIXMLASSERT( false );
-                    }
-                    ++p;
-                }
-            }
-            ++q;
-            TIXMLASSERT( p <= q );
-        }
-        // Flush the remaining string. This will be the entire
-        // string if an entity wasn't found.
-        if ( p < q ) {
-            const size_t delta = q - p;
-            const int toPrint = ( INT_MAX < delta ) ? INT_MAX : static_cast<int>(delta);
-            Write( p, toPrint );
-        }
+static uint64_t HashLeafNode( const XMLNode& node, uint64_t seed )
+{
+    int kind = HASH_UNKNOWN;
+    if ( node.ToText() ) {
+        kind = HASH_TEXT;
     }
-    else {
-        Write( p );
+    else if ( node.ToComment() ) {
+        kind = HASH_COMMENT;
+    }
+    else if ( node.ToDeclaration() ) {
+        kind = HASH_DECLARATION;
+    }
+    return HashLeaf( kind, node.Value(), seed );
+}
+
+// Starts the hash of an element: its name, then its attributes as a count
+// and a sum of their hashes, which does not depend on their order.
+static void BeginElementHash( XMLHashState* state, const XMLElement& element, const XMLAttribute* attribute, uint64_t seed )
+{
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for( ; attribute; attribute = attribute->Next() ) {
+        XMLHashState a;
+        HashInit( &a, seed );
+        HashString( &a, attribute->Name() );
+        HashString( &a, attribute->Value() );
+        sum += HashDigest( a, seed );
+        ++count;
     }
+    HashInit( state, seed );
+    HashNumber( state, HASH_ELEMENT );
+    HashString( state, element.Name() );
+    HashNumber( state, count );
+    HashNumber( state, sum );
 }
 
 
-void XMLPrinter::PushHeader( bool writeBOM, bool writeDec )
+uint64_t XMLElement::SubtreeHash() const
 {
-    if ( writeBOM ) {
-        static const unsigned char bom[] = { TIXML_UTF_LEAD_0, TIXML_UTF_LEAD_1, TIXML_UTF_LEAD_2, 0 };
-        Write( reinterpret_cast< const char* >( bom ) );
+    const XMLElementExtension* cached = Extension( false );
+    if ( cached && cached->subtreeHashValid ) {
+        return cached->subtreeHash;
     }
-    if ( writeDec ) {
-        PushDeclaration( "xml version=\"1.0\"" );
+    XMLHashState state;
+    BeginElementHash( &state, *this, FirstAttribute(), 0 );
+    for( const XMLNode* child = FirstChild(); child; child = child->NextSibling() ) {
+        const XMLElement* element = child->ToElement();
+        HashNumber( &state, element ? element->SubtreeHash() : HashLeafNode( *child, 0 ) );
     }
+    // Hashing the children may have moved the extensions.
+    XMLElementExtension* extension = Extension( true );
+    extension->subtreeHash = HashDigest( state, 0 );
+    extension->subtreeHashValid = true;
+    return extension->subtreeHash;
 }
 
-void XMLPrinter::PrepareForNewNode( bool compactMode )
-{
-    SealElementIfJustOpened();
 
-    if ( compactMode ) {
-        return;
-    }
+XMLHasher::XMLHasher( uint64_t seed ) :
+    _seed( seed ),
+    _hash( 0 ),
+    _open(),
+    _cached( false )
+{
+}
 
-    if ( _firstElement ) {
-        PrintSpace (_depth);
-    } else if ( _textDepth < 0) {
-        Putc( '\n' );
-        PrintSpace( _depth );
-    }
 
-    _firstElement = false;
+uint64_t XMLHasher::HashNode( const XMLNode& node, uint64_t seed )
+{
+    XMLHasher hasher( seed );
+    node.Accept( &hasher );
+    return hasher.Hash();
 }
 
-void XMLPrinter::OpenElement( const char* name, bool compactMode )
+
+uint64_t XMLHasher::HashBytes( const void* data, size_t size, uint64_t seed )
 {
-    PrepareForNewNode( compactMode );
-    _stack.Push( name );
+    XMLHashState state;
+    HashInit( &state, seed );
+    HashUpdate( &state, data, size );
+    return HashDigest( state, seed );
+}
 
-    Write ( "<" );
-    Write ( name );
 
-    _elementJustOpened = true;
-    ++_depth;
+void XMLHasher::Done( uint64_t hash )
+{
+    if ( _open.Empty() ) {
+        _hash = hash;
+    }
+    else {
+        HashNumber( &_open[_open.Size() - 1], hash );
+    }
 }
 
 
-void XMLPrinter::PushAttribute( const char* name, const char* value )
+bool XMLHasher::VisitEnter( const XMLDocument& )
 {
-    TIXMLASSERT( _elementJustOpened );
-    Putc ( ' ' );
-    Write( name );
-    Write( "=\"" );
-    PrintString( value, false );
-    Putc ( '\"' );
+    XMLHashState* state = _open.PushArr( 1 );
+    HashInit( state, _seed );
+    HashNumber( state, HASH_DOCUMENT );
+    return true;
 }
 
 
-void XMLPrinter::PushAttribute( const char* name, int v )
+bool XMLHasher::VisitExit( const XMLDocument& )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    PushAttribute( name, buf );
+    const XMLHashState state = _open.Pop();
+    Done( HashDigest( state, _seed ) );
+    return true;
 }
 
 
-void XMLPrinter::PushAttribute( const char* name, unsigned v )
+bool XMLHasher::VisitEnter( const XMLElement& element, const XMLAttribute* attribute )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    PushAttribute( name, buf );
+    const XMLElementExtension* extension = element.Extension( false );
+    if ( _seed == 0 && extension && extension->subtreeHashValid ) {
+        // Unchanged since it was last hashed: its children are skipped,
+        // and VisitExit() comes next and uses the cache.
+        _cached = true;
+        return false;
+    }
+    BeginElementHash( _open.PushArr( 1 ), element, attribute, _seed );
+    return true;
 }
 
 
-void XMLPrinter::PushAttribute(const char* name, int64_t v)
+bool XMLHasher::VisitExit( const XMLElement& element )
 {
-	char buf[BUF_SIZE];
-	XMLUtil::ToStr(v, buf, BUF_SIZE);
-	PushAttribute(name, buf);
+    if ( _cached ) {
+        _cached = false;
+        Done( element.Extension( false )->subtreeHash );
+        return true;
+    }
+    const XMLHashState state = _open.Pop();
+    Done( HashDigest( state, _seed ) );
+    return true;
 }
 
 
-void XMLPrinter::PushAttribute(const char* name, uint64_t v)
+bool XMLHasher::Visit( const XMLText& text )
 {
-	char buf[BUF_SIZE];
-	XMLUtil::ToStr(v, buf, BUF_SIZE);
-	PushAttribute(name, buf);
+    Done( HashLeaf( HASH_TEXT, text.Value(), _seed ) );
+    return true;
 }
 
 
-void XMLPrinter::PushAttribute( const char* name, bool v )
+bool XMLHasher::Visit( const XMLComment& comment )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    PushAttribute( name, buf );
+    Done( HashLeaf( HASH_COMMENT, comment.Value(), _seed ) );
+    return true;
 }
 
 
-void XMLPrinter::PushAttribute( const char* name, double v )
+bool XMLHasher::Visit( const XMLDeclaration& declaration )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( v, buf, BUF_SIZE );
-    PushAttribute( name, buf );
+    Done( HashLeaf( HASH_DECLARATION, declaration.Value(), _seed ) );
+    return true;
 }
 
 
-void XMLPrinter::CloseElement( bool compactMode )
+bool XMLHasher::Visit( const XMLUnknown& unknown )
 {
-    --_depth;
-    const char* name = _stack.Pop();
-
-    if ( _elementJustOpened ) {
-        Write( "/>" );
-    }
-    else {
-        if ( _textDepth < 0 && !compactMode) {
-            Putc( '\n' );
-            PrintSpace( _depth );
-        }
-        Write ( "</" );
-        Write ( name );
-        Write ( ">" );
-    }
-
-    if ( _textDepth == _depth ) {
-        _textDepth = -1;
-    }
-    if ( _depth == 0 && !compactMode) {
-        Putc( '\n' );
-    }
-    _elementJustOpened = false;
+    Done( HashLeaf( HASH_UNKNOWN, unknown.Value(), _seed ) );
+    return true;
 }
 
 
-void XMLPrinter::SealElementIfJustOpened()
+// --------- XMLDiff ----------- //
+
+static uint64_t NodeHash( const XMLNode& node )
 {
-    if ( !_elementJustOpened ) {
-        return;
-    }
-    _elementJustOpened = false;
-    Putc( '>' );
+    const XMLElement* element = node.ToElement();
+    return element ? element->SubtreeHash() : HashLeafNode( node, 0 );
 }
 
 
-void XMLPrinter::PushText( const char* text, bool cdata )
+// Whether 'from' can be turned into 'to' by edits inside it.
+static bool Updatable( const XMLNode& from, const XMLNode& to )
 {
-    _textDepth = _depth-1;
-
-    SealElementIfJustOpened();
-    if ( cdata ) {
-        Write( "<![CDATA[" );
-        Write( text );
-        Write( "]]>" );
+    const XMLElement* element = from.ToElement();
+    if ( element ) {
+        return to.ToElement() && XMLUtil::StringEqual( element->Name(), to.Value() );
     }
-    else {
-        PrintString( text, true );
+    if ( from.ToText() ) {
+        return to.ToText() != 0;
     }
+    return from.ToDocument() && to.ToDocument();
 }
 
 
-void XMLPrinter::PushText( int64_t value )
+// A child hash in the middle of two lists of children, and where it is.
+struct DiffEntry
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( value, buf, BUF_SIZE );
-    PushText( buf, false );
-}
+    uint64_t hash;
+    int fromCount;
+    int toCount;
+    int fromIndex;
+    int toIndex;
+};
 
 
-void XMLPrinter::PushText( uint64_t value )
+// An identical pair of children, and the anchor before it in the longest run.
+struct DiffAnchor
 {
-	char buf[BUF_SIZE];
-	XMLUtil::ToStr(value, buf, BUF_SIZE);
-	PushText(buf, false);
-}
+    int from;
+    int to;
+    int previous;
+};
 
 
-void XMLPrinter::PushText( int value )
+// Writes "/index" to 'step', and returns its length.
+static int FormatStep( int index, char* step, int size )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( value, buf, BUF_SIZE );
-    PushText( buf, false );
+    step[0] = '/';
+    XMLUtil::ToStr( index, step + 1, size - 1 );
+    return (int)strlen( step );
 }
 
 
-void XMLPrinter::PushText( unsigned value )
+static DiffEntry* FindDiffEntry( DiffEntry* table, int mask, uint64_t hash )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( value, buf, BUF_SIZE );
-    PushText( buf, false );
+    int slot = (int)( hash & (uint64_t)mask );
+    while ( table[slot].fromCount + table[slot].toCount != 0 && table[slot].hash != hash ) {
+        slot = ( slot + 1 ) & mask;
+    }
+    table[slot].hash = hash;
+    return &table[slot];
 }
 
 
-void XMLPrinter::PushText( bool value )
+XMLDiff::XMLDiff()
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( value, buf, BUF_SIZE );
-    PushText( buf, false );
 }
 
 
-void XMLPrinter::PushText( float value )
+void XMLDiff::Clear()
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( value, buf, BUF_SIZE );
-    PushText( buf, false );
+    _edits.Clear();
+    _pathOffsets.Clear();
+    _paths.Clear();
+    _path.Clear();
 }
 
 
-void XMLPrinter::PushText( double value )
+bool XMLDiff::Compare( const XMLNode& from, const XMLNode& to )
 {
-    char buf[BUF_SIZE];
-    XMLUtil::ToStr( value, buf, BUF_SIZE );
-    PushText( buf, false );
+    Clear();
+    if ( !Updatable( from, to ) ) {
+        return NodeHash( from ) == NodeHash( to );
+    }
+    DiffNodes( from, to );
+    for( int i = 0; i < _edits.Size(); ++i ) {
+        _edits[i].path = _paths.Mem() + _pathOffsets[i];
+    }
+    return true;
 }
 
 
-void XMLPrinter::PushComment( const char* comment )
+void XMLDiff::AddEdit( XMLEditType type, int child, const char* name, const char* value, const XMLNode* node )
 {
-    PrepareForNewNode( _compactMode );
+    XMLEdit* edit = _edits.PushArr( 1 );
+    edit->type = type;
+    edit->path = 0;
+    edit->name = name;
+    edit->value = value;
+    edit->node = node;
 
-    Write( "<!--" );
-    Write( comment );
-    Write( "-->" );
+    _pathOffsets.Push( _paths.Size() );
+    if ( _path.Size() ) {
+        memcpy( _paths.PushArr( _path.Size() ), _path.Mem(), _path.Size() );
+    }
+    if ( child >= 0 ) {
+        char step[16];
+        const int length = FormatStep( child, step, sizeof( step ) );
+        memcpy( _paths.PushArr( length ), step, length );
+    }
+    _paths.Push( 0 );
 }
 
 
-void XMLPrinter::PushDeclaration( const char* value )
+void XMLDiff::DiffNodes( const XMLNode& from, const XMLNode& to )
 {
-    PrepareForNewNode( _compactMode );
-
-    Write( "<?" );
-    Write( value );
-    Write( "?>" );
+    const XMLElement* element = from.ToElement();
+    if ( element ) {
+        if ( element->SubtreeHash() == to.ToElement()->SubtreeHash() ) {
+            return;
+        }
+        DiffAttributes( *element, *to.ToElement() );
+        DiffChildren( from, to );
+    }
+    else if ( from.ToText() ) {
+        if ( !XMLUtil::StringEqual( from.Value(), to.Value() ) ) {
+            AddEdit( XML_EDIT_SET_TEXT, -1, 0, to.Value(), 0 );
+        }
+    }
+    else {
+        DiffChildren( from, to );
+    }
 }
 
 
-void XMLPrinter::PushUnknown( const char* value )
+void XMLDiff::DiffAttributes( const XMLElement& from, const XMLElement& to )
 {
-    PrepareForNewNode( _compactMode );
-
-    Write( "<!" );
-    Write( value );
-    Putc( '>' );
+    for( const XMLAttribute* a = from.FirstAttribute(); a; a = a->Next() ) {
+        if ( !to.FindAttribute( a->Name() ) ) {
+            AddEdit( XML_EDIT_DELETE_ATTRIBUTE, -1, a->Name(), 0, 0 );
+        }
+    }
+    for( const XMLAttribute* b = to.FirstAttribute(); b; b = b->Next() ) {
+        const XMLAttribute* a = from.FindAttribute( b->Name() );
+        if ( !a || !XMLUtil::StringEqual( a->Value(), b->Value() ) ) {
+            AddEdit( XML_EDIT_SET_ATTRIBUTE, -1, b->Name(), b->Value(), 0 );
+        }
+    }
 }
 
 
-bool XMLPrinter::VisitEnter( const XMLDocument& doc )
+void XMLDiff::DiffChild( const XMLNode& from, const XMLNode& to, int position )
 {
-    _processEntities = doc.ProcessEntities();
-    if ( doc.HasBOM() ) {
-        PushHeader( true, false );
-    }
-    return true;
+    char step[16];
+    const int length = FormatStep( position, step, sizeof( step ) );
+    memcpy( _path.PushArr( length ), step, length );
+    DiffNodes( from, to );
+    _path.PopArr( length );
 }
 
 
-bool XMLPrinter::VisitEnter( const XMLElement& element, const XMLAttribute* attribute )
+void XMLDiff::DiffChildren( const XMLNode& from, const XMLNode& to )
 {
-    const XMLElement* parentElem = 0;
-    if ( element.Parent() ) {
-        parentElem = element.Parent()->ToElement();
+    // Identical children at the start and the end are skipped.
+    const XMLNode* a = from.FirstChild();
+    const XMLNode* b = to.FirstChild();
+    int position = 0;
+    while ( a && b && NodeHash( *a ) == NodeHash( *b ) ) {
+        a = a->NextSibling();
+        b = b->NextSibling();
+        ++position;
     }
-    const bool compactMode = parentElem ? CompactMode( *parentElem ) : _compactMode;
-    OpenElement( element.Name(), compactMode );
-    while ( attribute ) {
-        PushAttribute( attribute->Name(), attribute->Value() );
-        attribute = attribute->Next();
+    const XMLNode* aStop = 0;
+    const XMLNode* bStop = 0;
+    while ( a != aStop && b != bStop ) {
+        const XMLNode* aLast = aStop ? aStop->PreviousSibling() : from.LastChild();
+        const XMLNode* bLast = bStop ? bStop->PreviousSibling() : to.LastChild();
+        if ( NodeHash( *aLast ) != NodeHash( *bLast ) ) {
+            break;
+        }
+        aStop = aLast;
+        bStop = bLast;
     }
-    return true;
+
+    DynArray< const XMLNode*, 32 > aNodes;
+    DynArray< const XMLNode*, 32 > bNodes;
+    for( ; a != aStop; a = a->NextSibling() ) {
+        aNodes.Push( a );
+    }
+    for( ; b != bStop; b = b->NextSibling() ) {
+        bNodes.Push( b );
+    }
+    if ( aNodes.Empty() || bNodes.Empty() ) {
+        DiffRange( aNodes.Mem(), 0, aNodes.Size(), bNodes.Mem(), 0, bNodes.Size(), &position );
+        return;
+    }
+
+    // In between, the children that appear once on each side are matched,
+    // and the longest run of them in the same order is kept (patience diff).
+    int size = 16;
+    while ( size < 2 * ( aNodes.Size() + bNodes.Size() ) ) {
+        size *= 2;
+    }
+    DynArray< DiffEntry, 16 > table;
+    DiffEntry* entries = table.PushArr( size );
+    memset( entries, 0, size * sizeof( DiffEntry ) );
+    DynArray< uint64_t, 32 > aHashes;
+    for( int i = 0; i < aNodes.Size(); ++i ) {
+        aHashes.Push( NodeHash( *aNodes[i] ) );
+        DiffEntry* entry = FindDiffEntry( entries, size - 1, aHashes[i] );
+        ++entry->fromCount;
+        entry->fromIndex = i;
+    }
+    for( int j = 0; j < bNodes.Size(); ++j ) {
+        DiffEntry* entry = FindDiffEntry( entries, size - 1, NodeHash( *bNodes[j] ) );
+        ++entry->toCount;
+        entry->toIndex = j;
+    }
+
+    DynArray< DiffAnchor, 16 > anchors;
+    DynArray< int, 16 > tails;      // the anchor ending the longest run of each length
+    for( int i = 0; i < aNodes.Size(); ++i ) {
+        const DiffEntry* entry = FindDiffEntry( entries, size - 1, aHashes[i] );
+        if ( entry->fromCount != 1 || entry->toCount != 1 ) {
+            continue;
+        }
+        int low = 0;
+        int high = tails.Size();
+        while ( low < high ) {
+            const int middle = ( low + high ) / 2;
+            if ( anchors[tails[middle]].to < entry->toIndex ) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        DiffAnchor* anchor = anchors.PushArr( 1 );
+        anchor->from = i;
+        anchor->to = entry->toIndex;
+        anchor->previous = low > 0 ? tails[low - 1] : -1;
+        if ( low == tails.Size() ) {
+            tails.Push( anchors.Size() - 1 );
+        }
+        else {
+            tails[low] = anchors.Size() - 1;
+        }
+    }
+
+    DynArray< int, 16 > run;
+    for( int k = tails.Empty() ? -1 : tails.PeekTop(); k >= 0; k = anchors[k].previous ) {
+        run.Push( k );
+    }
+    int i = 0;
+    int j = 0;
+    while ( !run.Empty() ) {
+        const DiffAnchor& anchor = anchors[run.Pop()];
+        DiffRange( aNodes.Mem(), i, anchor.from, bNodes.Mem(), j, anchor.to, &position );
+        ++position;
+        i = anchor.from + 1;
+        j = anchor.to + 1;
+    }
+    DiffRange( aNodes.Mem(), i, aNodes.Size(), bNodes.Mem(), j, bNodes.Size(), &position );
 }
 
 
-bool XMLPrinter::VisitExit( const XMLElement& element )
+void XMLDiff::DiffRange( const XMLNode* const* from, int i, int iEnd,
+                         const XMLNode* const* to, int j, int jEnd, int* position )
 {
-    CloseElement( CompactMode(element) );
-    return true;
+    // Pairs up what can be updated, looking one node ahead on each side
+    // for a node that was inserted or deleted.
+    while ( i < iEnd && j < jEnd ) {
+        if ( Updatable( *from[i], *to[j] ) || NodeHash( *from[i] ) == NodeHash( *to[j] ) ) {
+            DiffChild( *from[i], *to[j], *position );
+            ++i;
+            ++j;
+            ++*position;
+        }
+        else if ( j + 1 < jEnd && Updatable( *from[i], *to[j + 1] ) ) {
+            AddEdit( XML_EDIT_INSERT, *position, 0, 0, to[j] );
+            ++j;
+            ++*position;
+        }
+        else {
+            AddEdit( XML_EDIT_DELETE, *position, 0, 0, 0 );
+            ++i;
+        }
+    }
+    for( ; i < iEnd; ++i ) {
+        AddEdit( XML_EDIT_DELETE, *position, 0, 0, 0 );
+    }
+    for( ; j < jEnd; ++j ) {
+        AddEdit( XML_EDIT_INSERT, *position, 0, 0, to[j] );
+        ++*position;
+    }
 }
 
 
-bool XMLPrinter::Visit( const XMLText& text )
+// --------- Applying edits ----------- //
+
+// A node on the path of the last edit, and its index among its siblings.
+struct EditStep
 {
-    PushText( text.Value(), text.CData() );
-    return true;
-}
+    XMLNode* node;
+    int index;
+};
 
 
-bool XMLPrinter::Visit( const XMLComment& comment )
+// Finds the nodes that edit paths lead to. It keeps the path of the last
+// edit, and walks from there to the next one: the edits of a script are
+// ordered by position, so each walk is short.
+class XMLEditCursor
 {
-    PushComment( comment.Value() );
-    return true;
-}
+public:
+    explicit XMLEditCursor( XMLNode* root ) : _root( root ) {}
 
-bool XMLPrinter::Visit( const XMLDeclaration& declaration )
+    // Parses "/i/j/..."; the number of steps, or -1 if it is malformed.
+    int SetPath( const char* path ) {
+        _indices.Clear();
+        if ( !path ) {
+            return -1;
+        }
+        while ( *path ) {
+            if ( *path != '/' || !IsDecimalDigit( path[1] ) ) {
+                return -1;
+            }
+            int index = 0;
+            for( ++path; IsDecimalDigit( *path ); ++path ) {
+                if ( index > ( INT_MAX - 9 ) / 10 ) {
+                    return -1;
+                }
+                index = index * 10 + ( *path - '0' );
+            }
+            _indices.Push( index );
+        }
+        return _indices.Size();
+    }
+
+    int Index( int depth ) const {
+        return _indices[depth - 1];
+    }
+    void SetIndex( int depth, int index ) {
+        _indices[depth - 1] = index;
+    }
+
+    // The node at the first 'depth' steps of the path, or null.
+    XMLNode* Walk( int depth ) {
+        XMLNode* parent = _root;
+        bool same = true;
+        for( int level = 0; level < depth; ++level ) {
+            const int index = _indices[level];
+            XMLNode* node = 0;
+            int at = 0;
+            if ( same && level < _steps.Size() ) {
+                node = _steps[level].node;
+                at = _steps[level].index;
+                same = at == index;
+            }
+            else {
+                node = parent->FirstChild();
+                same = false;
+            }
+            while ( node && at < index ) {
+                node = node->NextSibling();
+                ++at;
+            }
+            while ( node && at > index ) {
+                node = node->PreviousSibling();
+                --at;
+            }
+            if ( level < _steps.Size() ) {
+                _steps.PopArr( _steps.Size() - level );
+            }
+            if ( !node ) {
+                return 0;
+            }
+            EditStep* step = _steps.PushArr( 1 );
+            step->node = node;
+            step->index = index;
+            parent = node;
+        }
+        if ( depth < _steps.Size() ) {
+            _steps.PopArr( _steps.Size() - depth );
+        }
+        return parent;
+    }
+
+    // After Walk( depth ): the node there is now 'node', at 'index', or
+    // there is none.
+    void Replace( int depth, XMLNode* node, int index ) {
+        _steps.PopArr( _steps.Size() - ( depth - 1 ) );
+        if ( node ) {
+            EditStep* step = _steps.PushArr( 1 );
+            step->node = node;
+            step->index = index;
+        }
+    }
+
+private:
+    XMLNode* _root;
+    DynArray< int, 16 > _indices;
+    DynArray< EditStep, 16 > _steps;
+};
+
+
+XMLError XMLDocument::ApplyEdits( const XMLEdit* edits, int count )
 {
-    PushDeclaration( declaration.Value() );
-    return true;
+    ClearError();
+    XMLEditCursor cursor( this );
+    for( int i = 0; i < count; ++i ) {
+        const XMLEdit& edit = edits[i];
+        const int depth = cursor.SetPath( edit.path );
+        bool applied = false;
+        if ( depth < 0 ) {
+            // Malformed path.
+        }
+        else if ( edit.type == XML_EDIT_INSERT ) {
+            const int index = depth > 0 ? cursor.Index( depth ) : 0;
+            XMLNode* parent = 0;
+            XMLNode* after = 0;
+            if ( depth > 0 && index == 0 ) {
+                parent = cursor.Walk( depth - 1 );
+            }
+            else if ( depth > 0 ) {
+                cursor.SetIndex( depth, index - 1 );
+                after = cursor.Walk( depth );
+                parent = after ? after->Parent() : 0;
+            }
+            if ( edit.node && parent && ( parent->ToElement() || parent->ToDocument() ) ) {
+                XMLNode* clone = edit.node->DeepClone( this );
+                if ( clone ) {
+                    if ( after ) {
+                        parent->InsertAfterChild( after, clone );
+                    }
+                    else {
+                        parent->InsertFirstChild( clone );
+                    }
+                    cursor.Replace( depth, clone, index );
+                    applied = true;
+                }
+            }
+        }
+        else if ( edit.type == XML_EDIT_DELETE ) {
+            XMLNode* node = depth > 0 ? cursor.Walk( depth ) : 0;
+            if ( node ) {
+                const int index = cursor.Index( depth );
+                XMLNode* next = node->NextSibling();
+                XMLNode* previous = node->PreviousSibling();
+                node->Parent()->DeleteChild( node );
+                if ( next ) {
+                    cursor.Replace( depth, next, index );
+                }
+                else {
+                    cursor.Replace( depth, previous, index - 1 );
+                }
+                applied = true;
+            }
+        }
+        else {
+            XMLNode* node = cursor.Walk( depth );
+            XMLElement* element = node ? node->ToElement() : 0;
+            XMLText* text = node ? node->ToText() : 0;
+            if ( edit.type == XML_EDIT_SET_ATTRIBUTE && element && edit.name && edit.value ) {
+                element->SetAttribute( edit.name, edit.value );
+                applied = true;
+            }
+            else if ( edit.type == XML_EDIT_DELETE_ATTRIBUTE && element && edit.name ) {
+                element->DeleteAttribute( edit.name );
+                applied = true;
+            }
+            else if ( edit.type == XML_EDIT_SET_TEXT && text && edit.value ) {
+                text->SetValue( edit.value );
+                applied = true;
+            }
+        }
+        if ( !applied ) {
+            SetError( XML_ERROR_INVALID_EDIT, 0, "edit=%d path=%s", i, edit.path ? edit.path : "<null>" );
+            break;
+        }
+    }
+    return _errorID;
 }
 
 
-bool XMLPrinter::Visit( const XMLUnknown& unknown )
+XMLError XMLDocument::ApplyEdits( const XMLDiff& diff )
 {
-    PushUnknown( unknown.Value() );
-    return true;
+    // The edits of a diff are stored in order, one after the other.
+    return ApplyEdits( diff.EditCount() ? &diff.Edit( 0 ) : 0, diff.EditCount() );
 }
 
 }   // namespace tinyxml2
@@ -124,6 +124,9 @@ class XMLText;
 class XMLDeclaration;
 class XMLUnknown;
 class XMLPrinter;
+class XMLQuery;
+class XMLDiff;
+struct XMLEdit;
 
 /*
 	A class that wraps strings. Normally stores the start and end
@@ -173,19 +176,35 @@ public:
     }
 
     void SetStr( const char* str, int flags=0 );
+    // Points at a copy of 'str' in '*block', a block of strings that is
+    // freed with the last string in it. A new block is started when it is
+    // full; '*block' keeps the one being filled, until ReleaseBlock().
+    void SetCounted( const char* str, char** block );
+    static void ReleaseBlock( char* block );
 
-    char* ParseText( char* in, const char* endTag, int strFlags, int* curLineNumPtr );
+    char* ParseText( char* in, const char* endTag, int strFlags );
     char* ParseName( char* in );
 
     void TransferTo( StrPair* other );
 	void Reset();
+    // Points at the string of 'other', which keeps its memory.
+    void Share( StrPair* other );
+
+    // Widens [*low, *high) to take in the string, if it points into
+    // [begin, end) without owning its memory.
+    void Cover( const char* begin, const char* end, char** low, char** high ) const;
+    // A string that Cover() took in now points to the same place in a
+    // copy of [low, high) at 'copy'. Returns false for a string kept
+    // elsewhere, which only a copy of its own can take along.
+    bool Relocate( const char* low, const char* high, char* copy );
 
 private:
-    void CollapseWhitespace();
+    static void WritePendingSpace( char** q, bool* space );
 
     enum {
         NEEDS_FLUSH = 0x100,
-        NEEDS_DELETE = 0x200
+        NEEDS_DELETE = 0x200,
+        NEEDS_RELEASE = 0x400
     };
 
     int     _flags;
@@ -540,6 +559,8 @@ enum XMLError {
     XML_CAN_NOT_CONVERT_TEXT,
     XML_NO_TEXT_NODE,
 	XML_ELEMENT_DEPTH_EXCEEDED,
+    XML_ERROR_INVALID_EDIT,
+    XML_ERROR_INVALID_UTF8,
 
 	XML_ERROR_COUNT
 };
@@ -615,6 +636,9 @@ public:
     // the UTF-8 value of the entity will be placed in value, and length filled in.
     static const char* GetCharacterRef( const char* p, char* value, int* length );
     static void ConvertUTF32ToUTF8( unsigned long input, char* output, int* length );
+    // The first byte of the first malformed UTF-8 sequence in the 'length'
+    // bytes at 'p', or null if they are well formed.
+    static const char* FindInvalidUTF8( const char* p, size_t length );
 
     // converts primitive types to strings
     static void ToStr( int v, char* buffer, int bufferSize );
@@ -633,6 +657,11 @@ public:
     static bool ToDouble( const char* str, double* value );
 	static bool ToInt64(const char* str, int64_t* value);
     static bool ToUnsigned64(const char* str, uint64_t* value);
+    // Converts a whitespace separated list. On input *count is the capacity
+    // of 'values', on output the number of values read. Fails on a bad
+    // value or when there are more values than fit.
+    static bool ToIntArray( const char* str, int* values, int* count );
+    static bool ToDoubleArray( const char* str, double* values, int* count );
 	// Changes what is serialized for a boolean value.
 	// Default to "true" and "false". Shouldn't be changed
 	// unless you have a special testing or compatibility need.
@@ -646,6 +675,56 @@ private:
 };
 
 
+/*
+	Element content found by the pre-scan of XMLDocument::SetLazyParse(),
+	parsed when the element's children are first accessed.
+*/
+struct XMLLazySpan
+{
+    char*	content;		// just past the start tag
+    char*	end;			// just past the end tag
+};
+
+
+/*
+	A namespace declaration, from an xmlns attribute, with those of the
+	enclosing elements behind it; see XMLDocument::SetNamespaces().
+*/
+struct XMLNamespaceDecl
+{
+    const char*	prefix;			// empty for the default namespace
+    size_t		prefixLength;
+    const char*	uri;			// interned; null where xmlns="" undeclares
+    const XMLNamespaceDecl* outer;
+};
+
+
+/*
+	State that only some elements have, kept by the document so that the
+	elements without it don't pay for it. An element with any of it has
+	its XMLElement::_extension set.
+*/
+struct XMLElementExtension
+{
+    // With XMLDocument::SetLazyParse(), the unparsed content of the
+    // element until its children are first needed.
+    const XMLLazySpan*	pendingChildren;
+    // XMLElement::SubtreeHash(), valid only if the hashes of all the
+    // descendant elements are too.
+    bool				subtreeHashValid;
+    uint64_t			subtreeHash;
+    // With XMLDocument::Snapshot(), the element of the template whose
+    // children are this element's, until they are first needed.
+    const XMLElement*	sharedChildren;
+    // With XMLDocument::SetNamespaces(), the namespace of the element, the
+    // declarations in scope (null until they are resolved) and where the
+    // name goes on past the prefix.
+    const char*			namespaceURI;
+    const XMLNamespaceDecl* namespaceScope;
+    int					localNameOffset;
+};
+
+
 /** XMLNode is a base class for every object that is in the
 	XML Document Object Model (DOM), except XMLAttributes.
 	Nodes have siblings, a parent, and children which can
@@ -750,6 +829,10 @@ public:
 
     /// Gets the line number the node is in, if the document was parsed from a file.
     int GetLineNum() const { return _parseLineNum; }
+    /** Gets the column the node starts at, counted in bytes from 1, if the
+    	document was parsed from text; 0 otherwise.
+    */
+    int GetColumn() const { return _parseColumn; }
 
     /// Get the parent of this node on the DOM.
     const XMLNode*	Parent() const			{
@@ -762,15 +845,24 @@ public:
 
     /// Returns true if this node has no children.
     bool NoChildren() const					{
+        if ( !_firstChild ) {
+            MaterializeChildren();
+        }
         return !_firstChild;
     }
 
     /// Get the first child node, or null if none exists.
     const XMLNode*  FirstChild() const		{
+        if ( !_firstChild ) {
+            MaterializeChildren();
+        }
         return _firstChild;
     }
 
     XMLNode*		FirstChild()			{
+        if ( !_firstChild ) {
+            MaterializeChildren();
+        }
         return _firstChild;
     }
 
@@ -785,10 +877,16 @@ public:
 
     /// Get the last child node, or null if none exists.
     const XMLNode*	LastChild() const						{
+        if ( !_firstChild ) {
+            MaterializeChildren();
+        }
         return _lastChild;
     }
 
     XMLNode*		LastChild()								{
+        if ( !_firstChild ) {
+            MaterializeChildren();
+        }
         return _lastChild;
     }
 
@@ -833,6 +931,23 @@ public:
         return const_cast<XMLElement*>(const_cast<const XMLNode*>(this)->NextSiblingElement( name ) );
     }
 
+    /** Get the first child element in the namespace 'uri' (null or empty
+        for none) with the local name 'localName', or any local name if
+        that is null. Needs XMLDocument::SetNamespaces().
+    */
+    const XMLElement* FirstChildElementNS( const char* uri, const char* localName = 0 ) const;
+
+    XMLElement* FirstChildElementNS( const char* uri, const char* localName = 0 ) {
+        return const_cast<XMLElement*>(const_cast<const XMLNode*>(this)->FirstChildElementNS( uri, localName ) );
+    }
+
+    /// Get the next sibling element by namespace and local name; see FirstChildElementNS().
+    const XMLElement* NextSiblingElementNS( const char* uri, const char* localName = 0 ) const;
+
+    XMLElement* NextSiblingElementNS( const char* uri, const char* localName = 0 ) {
+        return const_cast<XMLElement*>(const_cast<const XMLNode*>(this)->NextSiblingElementNS( uri, localName ) );
+    }
+
     /**
     	Add a child node as the last (right) child.
 		If the child node is already part of the document,
@@ -892,6 +1007,10 @@ public:
         is specified, the memory will be allocated is the
         specified XMLDocument.
 
+		The strings of the copy are kept together in large blocks, each
+		freed with the last string in it, so deleting the copy gives
+		them back.
+
 		NOTE: This is probably not the correct tool to
 		copy a document, since XMLDocuments can have multiple
 		top level XMLNodes. You probably want to use
@@ -899,6 +1018,24 @@ public:
 	*/
 	XMLNode* DeepClone( XMLDocument* target ) const;
 
+	/**
+		Moves this node and its children to the 'target' document, without
+		copying them one by one: it is removed from its document and
+		returned as an unlinked node of 'target', ready to be inserted.
+		Within the same document the node itself is returned, where it is;
+		inserting it moves it.
+
+		Across documents the nodes are made anew in the target's pools, but
+		their strings are handed over rather than copied: strings that were
+		set are passed on as they are, and those still in the parse buffer
+		are copied in one block. Only strings kept elsewhere, such as those
+		of a node moved in earlier, are copied one by one. This node, and the ones under it, are then
+		deleted. The target does not depend on the source document.
+
+		Returns null if called on a XMLDocument.
+	*/
+	XMLNode* TransferTo( XMLDocument* target );
+
     /**
     	Test if 2 nodes are the same, but don't test children.
     	The 2 nodes do not need to be in the same Document.
@@ -949,12 +1086,13 @@ protected:
     explicit XMLNode( XMLDocument* );
     virtual ~XMLNode();
 
-    virtual char* ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr);
+    virtual char* ParseDeep( char* p, StrPair* parentEndTag );
 
     XMLDocument*	_document;
     XMLNode*		_parent;
     mutable StrPair	_value;
     int             _parseLineNum;
+    int             _parseColumn;
 
     XMLNode*		_firstChild;
     XMLNode*		_lastChild;
@@ -966,9 +1104,23 @@ protected:
 
 private:
     MemPool*		_memPool;
+    // Builds the children a lazy parse left pending, if there are any.
+    void MaterializeChildren() const;
+    void CopySharedChildren( const XMLNode* holder ) const;
+    // The node of the template whose children are this node's, in a
+    // snapshot that has not yet copied them; or null.
+    const XMLNode* SharedChildren() const;
+    // The node that holds the children of this one: a node of the
+    // template, for children a snapshot has not yet copied.
+    const XMLNode* ChildrenHolder() const;
+    // Drops the cached subtree hashes of the elements from here up.
+    void InvalidateSubtreeHash();
     void Unlink( XMLNode* child );
     static void DeleteNode( XMLNode* node );
     void InsertChildPreamble( XMLNode* insertThis ) const;
+    // Links a node made for it, never unlinked, after the last child. The
+    // subtree is being built: subtree hashes are left to the caller.
+    void InsertNewEndChild( XMLNode* addThis );
     const XMLElement* ToElementWithName( const char* name ) const;
 
     XMLNode( const XMLNode& );	// not supported
@@ -1017,7 +1169,7 @@ protected:
     explicit XMLText( XMLDocument* doc )	: XMLNode( doc ), _isCData( false )	{}
     virtual ~XMLText()												{}
 
-    char* ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr );
+    char* ParseDeep( char* p, StrPair* parentEndTag );
 
 private:
     bool _isCData;
@@ -1048,7 +1200,7 @@ protected:
     explicit XMLComment( XMLDocument* doc );
     virtual ~XMLComment();
 
-    char* ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr);
+    char* ParseDeep( char* p, StrPair* parentEndTag );
 
 private:
     XMLComment( const XMLComment& );	// not supported
@@ -1087,7 +1239,7 @@ protected:
     explicit XMLDeclaration( XMLDocument* doc );
     virtual ~XMLDeclaration();
 
-    char* ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr );
+    char* ParseDeep( char* p, StrPair* parentEndTag );
 
 private:
     XMLDeclaration( const XMLDeclaration& );	// not supported
@@ -1122,7 +1274,7 @@ protected:
     explicit XMLUnknown( XMLDocument* doc );
     virtual ~XMLUnknown();
 
-    char* ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr );
+    char* ParseDeep( char* p, StrPair* parentEndTag );
 
 private:
     XMLUnknown( const XMLUnknown& );	// not supported
@@ -1130,6 +1282,35 @@ private:
 };
 
 
+/*
+	The last successful typed conversion of an attribute value, kept by
+	attributes created while XMLDocument::SetCacheAttributeValues() is on.
+*/
+struct XMLAttributeValueCache
+{
+    enum Type {
+        NONE,
+        INT,
+        UNSIGNED,
+        INT64,
+        UNSIGNED64,
+        BOOL,
+        FLOAT,
+        DOUBLE
+    };
+
+    Type		type;
+    union {
+        int			i;
+        unsigned	u;
+        int64_t		i64;
+        uint64_t	u64;
+        bool		b;
+        float		f;
+        double		d;
+    } value;
+};
+
 
 /** An attribute is a name-value pair. Elements have an arbitrary
 	number of attributes, each with a unique name.
@@ -1140,6 +1321,9 @@ private:
 class TINYXML2_LIB XMLAttribute
 {
     friend class XMLElement;
+    friend class XMLDocument;
+    friend class XMLCachedAttribute;
+    friend class XMLNode;
 public:
     /// The name of the attribute.
     const char* Name() const;
@@ -1149,6 +1333,8 @@ public:
 
     /// Gets the line number the attribute is in, if the document was parsed from a file.
     int GetLineNum() const { return _parseLineNum; }
+    /// Gets the column the attribute starts at, as XMLNode::GetColumn().
+    int GetColumn() const { return _parseColumn; }
 
     /// The next attribute in the list.
     const XMLAttribute* Next() const {
@@ -1220,6 +1406,16 @@ public:
     /// See QueryIntValue
     XMLError QueryFloatValue( float* value ) const;
 
+    /** Interprets the attribute as a whitespace separated list of integers,
+    	like "1 2 3". On input *count is the number of entries 'values' can
+    	hold; on success it is set to the number read. Returns
+    	XML_WRONG_ATTRIBUTE_TYPE if a value can't be converted or there are
+    	more values than fit.
+    */
+    XMLError QueryIntArrayValue( int* values, int* count ) const;
+    /// See QueryIntArrayValue
+    XMLError QueryDoubleArrayValue( double* values, int* count ) const;
+
     /// Set the attribute to a string value.
     void SetAttribute( const char* value );
     /// Set the attribute to value.
@@ -1240,23 +1436,58 @@ public:
 private:
     enum { BUF_SIZE = 200 };
 
-    XMLAttribute() : _name(), _value(),_parseLineNum( 0 ), _next( 0 ), _memPool( 0 ) {}
+    XMLAttribute() : _name(), _value(),_parseLineNum( 0 ), _parseColumn( 0 ), _next( 0 ), _memPool( 0 ) {}
     virtual ~XMLAttribute()	{}
 
     XMLAttribute( const XMLAttribute& );	// not supported
     void operator=( const XMLAttribute& );	// not supported
     void SetName( const char* name );
+    // Where the last typed conversion is kept, if anywhere.
+    virtual XMLAttributeValueCache* Cache() const {
+        return 0;
+    }
+    void InvalidateCache() {
+        XMLAttributeValueCache* cache = Cache();
+        if ( cache ) {
+            cache->type = XMLAttributeValueCache::NONE;
+        }
+    }
 
-    char* ParseDeep( char* p, bool processEntities, int* curLineNumPtr );
+    char* ParseDeep( char* p, bool processEntities );
 
     mutable StrPair _name;
     mutable StrPair _value;
     int             _parseLineNum;
+    int             _parseColumn;
     XMLAttribute*   _next;
     MemPool*        _memPool;
 };
 
 
+/*
+	An attribute created while XMLDocument::SetCacheAttributeValues() is
+	on. Only these pay for the cache, in a pool of their own.
+*/
+class XMLCachedAttribute : public XMLAttribute
+{
+    friend class XMLElement;
+private:
+    XMLCachedAttribute() : XMLAttribute() {
+        _cache.type = XMLAttributeValueCache::NONE;
+    }
+    virtual ~XMLCachedAttribute()	{}
+
+    XMLCachedAttribute( const XMLCachedAttribute& );	// not supported
+    void operator=( const XMLCachedAttribute& );	// not supported
+
+    virtual XMLAttributeValueCache* Cache() const {
+        return &_cache;
+    }
+
+    mutable XMLAttributeValueCache _cache;
+};
+
+
 /** The element is a container class. It has a value, the element name,
 	and can contain other elements, text, comments, and unknowns.
 	Elements also contain an arbitrary number of attributes.
@@ -1264,6 +1495,8 @@ private:
 class TINYXML2_LIB XMLElement : public XMLNode
 {
     friend class XMLDocument;
+    friend class XMLNode;
+    friend class XMLHasher;
 public:
     /// Get the name of an element (which is the Value() of the node.)
     const char* Name() const		{
@@ -1274,6 +1507,15 @@ public:
         SetValue( str, staticMem );
     }
 
+    /** The namespace of the element, resolved from the xmlns
+        declarations in scope when the document was parsed: the same
+        pointer for the same URI throughout the document, or null for
+        none. Needs XMLDocument::SetNamespaces().
+    */
+    const char* NamespaceURI() const;
+    /// The name without its prefix.
+    const char* LocalName() const;
+
     virtual XMLElement* ToElement()				{
         return this;
     }
@@ -1399,6 +1641,22 @@ public:
         }
         return a->QueryFloatValue( value );
     }
+    /// See XMLAttribute::QueryIntArrayValue()
+    XMLError QueryIntArrayAttribute( const char* name, int* values, int* count ) const {
+        const XMLAttribute* a = FindAttribute( name );
+        if ( !a ) {
+            return XML_NO_ATTRIBUTE;
+        }
+        return a->QueryIntArrayValue( values, count );
+    }
+    /// See XMLAttribute::QueryIntArrayValue()
+    XMLError QueryDoubleArrayAttribute( const char* name, double* values, int* count ) const {
+        const XMLAttribute* a = FindAttribute( name );
+        if ( !a ) {
+            return XML_NO_ATTRIBUTE;
+        }
+        return a->QueryDoubleArrayValue( values, count );
+    }
 
 	/// See QueryIntAttribute()
 	XMLError QueryStringAttribute(const char* name, const char** value) const {
@@ -1516,6 +1774,12 @@ public:
     }
     /// Query a specific attribute in the list.
     const XMLAttribute* FindAttribute( const char* name ) const;
+    /** Query an attribute by namespace and local name. Attributes without
+        a prefix are in no namespace, whatever the default namespace.
+    */
+    const XMLAttribute* FindAttributeNS( const char* uri, const char* localName ) const;
+    /// The value of an attribute by namespace and local name, or null.
+    const char* AttributeNS( const char* uri, const char* localName ) const;
 
     /** Convenience function for easy access to the text inside an element. Although easy
     	and concise, GetText() is limited compared to getting the XMLText child
@@ -1637,6 +1901,20 @@ public:
     /// See QueryIntText()
     XMLError QueryFloatText( float* fval ) const;
 
+    /** Reads the child text as a whitespace separated list of numbers:
+    	@verbatim
+    		<samples>1.2 3.4 5.6</samples>
+    	@endverbatim
+
+    	On input *count is the number of entries 'values' can hold; on
+    	success it is set to the number read. Returns XML_CAN_NOT_CONVERT_TEXT
+    	if a value can't be converted or there are more values than fit, and
+    	XML_NO_TEXT_NODE if there is no child text.
+    */
+    XMLError QueryIntArrayText( int* values, int* count ) const;
+    /// See QueryIntArrayText()
+    XMLError QueryDoubleArrayText( double* values, int* count ) const;
+
 	int IntText(int defaultValue = 0) const;
 
 	/// See QueryIntText()
@@ -1679,8 +1957,16 @@ public:
     virtual XMLNode* ShallowClone( XMLDocument* document ) const;
     virtual bool ShallowEqual( const XMLNode* compare ) const;
 
+    /** The XMLHasher hash of this element and everything in it, cached
+    	in the element (and its descendants) until something in the
+    	subtree changes. After a change only the path from the change to
+    	the root is hashed again, so comparing the hashes of sections of
+    	a large document costs little more than the changes.
+    */
+    uint64_t SubtreeHash() const;
+
 protected:
-    char* ParseDeep( char* p, StrPair* parentEndTag, int* curLineNumPtr );
+    char* ParseDeep( char* p, StrPair* parentEndTag );
 
 private:
     XMLElement( XMLDocument* doc );
@@ -1689,12 +1975,28 @@ private:
     void operator=( const XMLElement& );	// not supported
 
     XMLAttribute* FindOrCreateAttribute( const char* name );
-    char* ParseAttributes( char* p, int* curLineNumPtr );
+    char* ParseAttributes( char* p );
     static void DeleteAttribute( XMLAttribute* attribute );
     XMLAttribute* CreateAttribute();
+    // The extension of this element, made on first use if 'create' is
+    // set. Valid until the document makes another one.
+    XMLElementExtension* Extension( bool create ) const;
+    // Takes the cached subtree hash of an element with the same content.
+    void CopySubtreeHash( const XMLElement& from );
+    // Takes the namespace of an element with the same name and scope.
+    void CopyNamespace( const XMLElement& from );
+    // Takes in the xmlns attributes of the element, over the declarations
+    // of its parent, 'outer'.
+    void ResolveNamespaces( const XMLNamespaceDecl* outer );
+    // Resolves the name again, after a change, in the same declarations.
+    void ResolveName();
+    // The declarations in scope, or null if they are not resolved.
+    const XMLNamespaceDecl* NamespaceScope() const;
 
     enum { BUF_SIZE = 200 };
     ElementClosingType _closingType;
+    // One past the index of the extension in the document, or 0.
+    mutable uint32_t _extension;
     // The attribute list is ordered; there is no 'lastAttribute'
     // because the list needs to be scanned for dupes before adding
     // a new attribute.
@@ -1708,6 +2010,32 @@ enum Whitespace {
 };
 
 
+/// The encoding a document was read in; see XMLDocument::InputEncoding().
+enum XMLEncoding {
+    XML_ENCODING_UTF8,
+    XML_ENCODING_UTF16LE,
+    XML_ENCODING_UTF16BE,
+    XML_ENCODING_LATIN1
+};
+
+
+/**
+	Receives the subtrees selected with XMLDocument::AddSubtreeFilter(),
+	one at a time, while the document is parsed.
+*/
+class TINYXML2_LIB XMLSubtreeHandler
+{
+public:
+    virtual ~XMLSubtreeHandler() {}
+    /** Called with each matching subtree as soon as it is parsed. The
+    	element is deleted when this returns; copy anything that should be
+    	kept (DeepClone() into another document, for instance). Return false
+    	to stop parsing.
+    */
+    virtual bool Subtree( XMLElement* element ) = 0;
+};
+
+
 /** A Document binds together all the functionality.
 	It can be saved, loaded, and printed to the screen.
 	All Nodes are connected and allocated to a Document.
@@ -1746,13 +2074,18 @@ public:
     	the number of bytes which will be parsed. If not
     	specified, TinyXML-2 will assume 'xml' points to a
     	null terminated string.
+
+    	UTF-16 (with a byte order mark, or starting with '<') and
+    	ISO-8859-1 (named by the XML declaration) are decoded to UTF-8 as
+    	they are copied in; see InputEncoding(). UTF-16 needs 'nBytes'.
     */
     XMLError Parse( const char* xml, size_t nBytes=static_cast<size_t>(-1) );
 
     /**
     	Load an XML file from disk.
     	Returns XML_SUCCESS (0) on success, or
-    	an errorID.
+    	an errorID. Files in UTF-16 or ISO-8859-1 are decoded to
+    	UTF-8, as by Parse().
     */
     XMLError LoadFile( const char* filename );
 
@@ -1785,6 +2118,58 @@ public:
     */
     XMLError SaveFile( FILE* fp, bool compact = false );
 
+    /**
+    	Save the document as a binary image: a string table with every
+    	name and value, already normalized, followed by a table of nodes
+    	that refer to it by offset. LoadBinary() rebuilds the document from
+    	it without looking at any text, which is much faster than parsing.
+
+    	The image is a cache, not an exchange format. It is tied to the
+    	version of the format (checked on load), so keep the XML as the
+    	source of truth and fall back to it when LoadBinary() fails.
+    	Documents whose strings or nodes take more than 512 MB in the
+    	image can't be saved this way; SaveBinary() then fails with
+    	XML_ERROR_FILE_COULD_NOT_BE_OPENED and writes nothing.
+
+    	Returns XML_SUCCESS (0) on success, or an errorID.
+    */
+    XMLError SaveBinary( const char* filename );
+
+    /**
+    	Save a binary image. You are responsible for providing
+    	and closing the FILE*, which should be opened as binary ("wb").
+    */
+    XMLError SaveBinary( FILE* fp );
+
+    /**
+    	Load a binary image written by SaveBinary(). A malformed image
+    	gives XML_ERROR_PARSING.
+    	Returns XML_SUCCESS (0) on success, or an errorID.
+    */
+    XMLError LoadBinary( const char* filename );
+
+    /**
+    	Load a binary image. You are responsible for providing
+    	and closing the FILE*, which should be opened as binary ("rb").
+    */
+    XMLError LoadBinary( FILE* fp );
+
+    /**
+    	Save the document in the frozen format read by XMLFrozenDocument:
+    	fixed size records that can be used in place, without loading, from
+    	a memory mapped file. As with SaveBinary(), each table is limited
+    	to 512 MB; a larger document fails with
+    	XML_ERROR_FILE_COULD_NOT_BE_OPENED and writes nothing.
+    	Returns XML_SUCCESS (0) on success, or an errorID.
+    */
+    XMLError SaveFrozen( const char* filename );
+
+    /**
+    	Save the document in the frozen format. You are responsible for
+    	providing and closing the FILE*, which should be opened as binary ("wb").
+    */
+    XMLError SaveFrozen( FILE* fp );
+
     bool ProcessEntities() const		{
         return _processEntities;
     }
@@ -1792,6 +2177,15 @@ public:
         return _whitespaceMode;
     }
 
+    /** The encoding the document was read in. The document itself is
+    	UTF-8, and saved as UTF-8; an encoding named in its declaration is
+    	changed to UTF-8. Characters that aren't valid UTF-16 are read as
+    	U+FFFD.
+    */
+    XMLEncoding InputEncoding() const {
+        return _inputEncoding;
+    }
+
     /**
     	Returns true if this document has a leading Byte Order Mark of UTF8.
     */
@@ -1804,6 +2198,117 @@ public:
         _writeBOM = useBOM;
     }
 
+    /** When on, attributes remember their last successful typed
+    	conversion, so that repeated calls like IntAttribute() on the
+    	same attribute skip re-parsing the value. Setting the attribute
+    	clears it. Those attributes are 16 bytes larger, and it applies to
+    	attributes created (or parsed) after it is turned on - so set it
+    	before Parse() or LoadFile(). Note that with caching on, typed
+    	queries write to the attribute, so concurrent reads of the same
+    	document from several threads are no longer safe.
+    */
+    void SetCacheAttributeValues( bool cache ) {
+        _cacheAttributeValues = cache;
+    }
+    bool CacheAttributeValues() const {
+        return _cacheAttributeValues;
+    }
+
+    /** Restricts parsing to the elements matching 'path', which is an
+    	XMLQuery path of names and '*' only (no predicates). A path that
+    	doesn't start with '/' matches at any depth, like "//path".
+
+    	With filters set, Parse() and LoadFile() run a fast scanner over
+    	the document that only tracks element nesting, and build nodes
+    	just for the matching subtrees (a match inside a match is part of
+    	the outer subtree). These become the top level elements of the
+    	document, or, if a handler is set, are handed to it one at a time
+    	and freed. Everything else - including the declaration, comments
+    	and text outside the matches - is skipped.
+
+    	@verbatim
+    	XMLDocument doc;
+    	doc.AddSubtreeFilter( "/feed/entry" );
+    	doc.LoadFile( "feed.xml" );
+    	for( XMLElement* entry = doc.FirstChildElement(); entry; entry = entry->NextSiblingElement() ) {
+    		...
+    	}
+    	@endverbatim
+
+    	Filters stay set across Clear() and later parses. Returns false,
+    	and adds nothing, if the path isn't usable as a filter.
+    */
+    bool AddSubtreeFilter( const char* path );
+    /// Removes all filters; parsing builds the whole document again.
+    void ClearSubtreeFilters();
+    /** Delivers the filtered subtrees to 'handler' instead of keeping them
+    	in the document. Null restores the default.
+    */
+    void SetSubtreeHandler( XMLSubtreeHandler* handler ) {
+        _subtreeHandler = handler;
+    }
+
+    /** Parse on demand. When on, Parse() and LoadFile() only make a fast
+    	pass over the document to find where every element ends, and then
+    	build the top level nodes. The children of an element are parsed the
+    	first time they are accessed - through FirstChild(),
+    	FirstChildElement(), Accept(), GetText() and the like - so time and
+    	memory go to the parts of the document that are actually read.
+
+    	The structure (matching tags, comments, CDATA) is checked up front,
+    	but other errors in an element's content, like a malformed
+    	attribute, are only found when it is parsed; check Error() after
+    	reading if that matters. Parsing on access writes to the document,
+    	so it can't be read from several threads at once.
+    */
+    void SetLazyParse( bool lazy ) {
+        _lazyParse = lazy;
+    }
+    bool LazyParse() const {
+        return _lazyParse;
+    }
+
+    /** Check that the input is well-formed UTF-8 before parsing it, and
+    	fail with XML_ERROR_INVALID_UTF8 and the line of the first bad
+    	sequence if it isn't. Overlong forms, surrogates and code points
+    	past U+10FFFF are rejected. ASCII is checked 64 bytes at a time.
+    	Input decoded from UTF-16 or Latin-1 is always valid.
+    */
+    void SetValidateUTF8( bool validate ) {
+        _validateUTF8 = validate;
+    }
+    bool ValidateUTF8() const {
+        return _validateUTF8;
+    }
+
+    /** Resolve namespaces while parsing. Every element then knows its
+    	namespace URI, interned so that each URI has one pointer in the
+    	document, and the xmlns declarations in scope, for
+    	FirstChildElementNS(), FindAttributeNS() and the like.
+
+    	Renamed elements take the namespace of their new prefix. Elements
+    	added after parsing, and those cloned or moved in from another
+    	document, have no namespace until ResolveNamespaces().
+    */
+    void SetNamespaces( bool namespaces ) {
+        _namespaces = namespaces;
+    }
+    bool Namespaces() const {
+        return _namespaces;
+    }
+    /** Resolve the namespaces of the whole document again, after changes.
+    	The declarations of elements whose xmlns attributes, and those of
+    	their ancestors, did not change are kept as they are. Elements not
+    	in the document keep the declarations they had; the memory for
+    	replaced declarations is kept until Clear().
+    */
+    void ResolveNamespaces();
+    /** The interned pointer for 'uri', as returned by
+    	XMLElement::NamespaceURI(), or null if nothing in the document is in
+    	that namespace. Passing it to the NS lookups saves a search.
+    */
+    const char* FindNamespaceURI( const char* uri ) const;
+
     /** Return the root element of DOM. Equivalent to FirstChildElement().
         To get the first node, use FirstChild().
     */
@@ -1914,6 +2419,39 @@ public:
 	*/
 	void DeepCopy(XMLDocument* target) const;
 
+	/**
+		Makes the target a copy-on-write snapshot of this document: the
+		same content, for a fraction of the cost of DeepCopy(). The
+		target will be completely cleared first.
+
+		The snapshot makes its nodes as they are first reached, and
+		shares their strings with this document until they are changed.
+		Changing a node far down the tree copies the nodes along the way
+		there, and their siblings, but nothing else. Printing, or any
+		other XMLVisitor, reads the parts not yet reached from this
+		document, and does not copy them.
+
+		This document must outlive the snapshot, and must not be changed
+		while the snapshot is in use. Snapshots of a snapshot are allowed.
+	*/
+	void Snapshot( XMLDocument* target ) const;
+
+	/**
+		Applies an edit script, as made by XMLDiff, to this document in
+		place. The edits are applied in order, and each path is taken from
+		the document. Paths that share a parent with the edit before them
+		are found from where that edit left off, so a script over a large
+		document costs little more than its edits.
+
+		Inserted nodes are deep clones of the edit's node. Returns
+		XML_ERROR_INVALID_EDIT, and stops, at the first edit whose path
+		does not lead to a node of the right kind; the edits before it
+		stay applied.
+	*/
+	XMLError ApplyEdits( const XMLEdit* edits, int count );
+	/// Applies the edits of 'diff', from a Compare() of two documents.
+	XMLError ApplyEdits( const XMLDiff& diff );
+
 	// internal
     char* Identify( char* p, XMLNode** node );
 
@@ -1933,12 +2471,22 @@ private:
 
     bool			_writeBOM;
     bool			_processEntities;
+    bool			_cacheAttributeValues;
     XMLError		_errorID;
     Whitespace		_whitespaceMode;
     mutable StrPair	_errorStr;
     int             _errorLineNum;
     char*			_charBuffer;
-    int				_parseCurLineNum;
+    size_t          _charBufferSize;
+    // The offsets of the newlines in _charBuffer, found before parsing,
+    // which nodes take their line and column from. Past 4GB, nodes get
+    // no line number.
+    DynArray< uint32_t, 64 > _newlines;
+    // How many of them are before the last position located, and the
+    // offsets of the start and end (its newline) of that line.
+    int             _newlineCursor;
+    size_t          _lineStart;
+    size_t          _lineEnd;
 	int				_parsingDepth;
 	// Memory tracking does add some overhead.
 	// However, the code assumes that you don't
@@ -1947,15 +2495,80 @@ private:
 	// in the document vs. a linked list in the XMLNode,
 	// and the performance is the same.
 	DynArray<XMLNode*, 10> _unlinked;
+    // Strings of nodes moved in from other documents, and of namespaces,
+    // freed by Clear(). Namespaces take their strings from the last block,
+    // in turn.
+    DynArray<char*, 4> _stringBlocks;
+    char*           _stringSpace;
+    size_t          _stringSpaceLeft;
+    // The counted block clones take their strings from; see
+    // StrPair::SetCounted().
+    char*           _cloneStrings;
 
     MemPoolT< sizeof(XMLElement) >	 _elementPool;
     MemPoolT< sizeof(XMLAttribute) > _attributePool;
     MemPoolT< sizeof(XMLText) >		 _textPool;
     MemPoolT< sizeof(XMLComment) >	 _commentPool;
+    MemPoolT< sizeof(XMLCachedAttribute) > _cachedAttributePool;
+
+    DynArray< XMLQuery*, 4 > _subtreeFilters;
+    XMLSubtreeHandler* _subtreeHandler;
+
+    bool _lazyParse;
+    DynArray< XMLLazySpan, 16 > _lazySpans;
+    // With Snapshot(), the document whose content this one shares, and
+    // whether its top-level nodes are still to be copied.
+    const XMLDocument* _snapshotOf;
+    mutable bool _sharesChildren;
+
+    DynArray< XMLElementExtension, 16 > _elementExtensions;
+    DynArray< uint32_t, 16 > _freeElementExtensions;
+
+    XMLEncoding _inputEncoding;
+    bool _validateUTF8;
+
+    bool _namespaces;
+    // The namespace URIs, each once, in the string blocks.
+    DynArray< const char*, 8 > _namespaceURIs;
+    MemPoolT< sizeof(XMLNamespaceDecl) > _namespacePool;
+    // The xml and xmlns prefixes, under every element's declarations.
+    const XMLNamespaceDecl* _namespaceBase;
+    // The declarations in scope for the elements being parsed.
+    const XMLNamespaceDecl* _parseNamespaces;
 
 	static const char* _errorNames[XML_ERROR_COUNT];
 
     void Parse();
+    void DeclareUTF8();
+    void IndexNewlines();
+    // Sets the line and column of 'p', in _charBuffer. Parsing moves
+    // forward, so this starts from the last position looked up; often
+    // that is on the same line.
+    void Locate( const char* p, int* lineNum, int* column ) {
+        const size_t offset = p - _charBuffer;
+        if ( offset >= _lineStart && offset <= _lineEnd ) {
+            *lineNum = _newlineCursor + 1;
+            *column = static_cast<int>( offset - _lineStart ) + 1;
+            return;
+        }
+        LocateLine( p, lineNum, column );
+    }
+    void LocateLine( const char* p, int* lineNum, int* column );
+    void SetLine( int line );
+    int LineAt( const char* p );
+    // Text in UTF-16 or Latin-1 is decoded to UTF-8 if 'decode' is set.
+    bool ReadFile( FILE* fp, size_t* length, bool decode );
+    void ParseBinary( size_t size );
+    void ParseFiltered( char* p );
+    bool ParseFilteredSubtree( char** p );
+    void ScanLazySpans( char* p );
+    const XMLLazySpan* FindLazySpan( const char* content ) const;
+    // Whether some nodes may have children that are not made yet: lazily
+    // parsed, or shared with the template of a snapshot.
+    bool DefersChildren() const {
+        return !_lazySpans.Empty() || _snapshotOf;
+    }
+    bool MatchesSubtreeFilter( const char* const* names, const int* lengths, int depth ) const;
 
     void SetError( XMLError error, int lineNum, const char* format, ... );
 
@@ -1964,9 +2577,9 @@ private:
 	// the stack. Track stack depth, and error out if needed.
 	class DepthTracker {
 	public:
-		explicit DepthTracker(XMLDocument * document) {
+		DepthTracker(XMLDocument * document, const char* p) {
 			this->_document = document;
-			document->PushDepth();
+			document->PushDepth(p);
 		}
 		~DepthTracker() {
 			_document->PopDepth();
@@ -1974,11 +2587,25 @@ private:
 	private:
 		XMLDocument * _document;
 	};
-	void PushDepth();
+	void PushDepth(const char* p);
 	void PopDepth();
 
     template<class NodeType, int PoolElementSize>
     NodeType* CreateUnlinkedNode( MemPoolT<PoolElementSize>& pool );
+    // A copy of the 'length' chars at 'value', null terminated, in the
+    // string blocks.
+    char* CopyToStringBlock( const char* value, size_t length );
+    const char* InternNamespace( const char* uri );
+    const XMLNamespaceDecl* DeclareNamespace( const char* prefix, size_t length, const char* uri, const XMLNamespaceDecl* outer );
+    const XMLNamespaceDecl* NamespaceBase();
+    // Moves the string 'from' of a node coming from another document to
+    // 'to', with the strings of its parse buffer relocated to 'copy'.
+    void MoveString( StrPair* from, StrPair* to, const char* low, const char* high, char* copy );
+    // An empty node of the same kind as 'node': unlinked, or about to be
+    // linked with XMLNode::InsertNewEndChild().
+    XMLNode* CreateNodeLike( const XMLNode& node, bool unlinked );
+    template<class NodeType, int PoolElementSize>
+    NodeType* CreateNode( MemPoolT<PoolElementSize>& pool, bool unlinked );
 };
 
 template<class NodeType, int PoolElementSize>
@@ -1994,6 +2621,19 @@ inline NodeType* XMLDocument::CreateUnlinkedNode( MemPoolT<PoolElementSize>& poo
     return returnNode;
 }
 
+template<class NodeType, int PoolElementSize>
+inline NodeType* XMLDocument::CreateNode( MemPoolT<PoolElementSize>& pool, bool unlinked )
+{
+    if ( unlinked ) {
+        return CreateUnlinkedNode<NodeType>( pool );
+    }
+    NodeType* returnNode = new (pool.Alloc()) NodeType( this );
+    TIXMLASSERT( returnNode );
+    returnNode->_memPool = &pool;
+    pool.SetTracked();
+    return returnNode;
+}
+
 /**
 	A XMLHandle is a class that wraps a node pointer with null checks; this is
 	an incredibly useful thing. Note that XMLHandle is not part of the TinyXML-2
@@ -2192,6 +2832,360 @@ private:
 };
 
 
+class XMLFrozenDocument;
+
+/**
+	An attribute of a frozen document; see XMLFrozenDocument. A null
+	attribute (Valid() is false) is returned where XMLElement would
+	return a null pointer.
+*/
+class TINYXML2_LIB XMLFrozenAttribute
+{
+public:
+    XMLFrozenAttribute() : _document( 0 ), _index( 0 ), _end( 0 ) {}
+
+    bool Valid() const {
+        return _document != 0;
+    }
+    const char* Name() const;
+    const char* Value() const;
+    int GetLineNum() const;
+    /// The next attribute of the same element.
+    XMLFrozenAttribute Next() const;
+
+    XMLError QueryIntValue( int* value ) const;
+    XMLError QueryUnsignedValue( unsigned int* value ) const;
+    XMLError QueryInt64Value( int64_t* value ) const;
+    XMLError QueryUnsigned64Value( uint64_t* value ) const;
+    XMLError QueryBoolValue( bool* value ) const;
+    XMLError QueryDoubleValue( double* value ) const;
+    XMLError QueryFloatValue( float* value ) const;
+
+private:
+    friend class XMLFrozenNode;
+    XMLFrozenAttribute( const XMLFrozenDocument* document, uint32_t index, uint32_t end ) :
+        _document( document ), _index( index ), _end( end ) {}
+
+    const XMLFrozenDocument* _document;
+    uint32_t _index;
+    uint32_t _end;
+};
+
+
+/**
+	A node of a frozen document; see XMLFrozenDocument. It is a small
+	value, like a handle: navigation never fails, it returns a null node
+	(Valid() is false) where XMLNode would return a null pointer, and
+	everything can be called on a null node.
+*/
+class TINYXML2_LIB XMLFrozenNode
+{
+public:
+    XMLFrozenNode() : _document( 0 ), _index( 0 ) {}
+
+    bool Valid() const {
+        return _document != 0;
+    }
+    bool IsDocument() const;
+    bool IsElement() const;
+    bool IsText() const;
+    bool IsComment() const;
+    bool IsDeclaration() const;
+    bool IsUnknown() const;
+    /// True for a text node that was a CDATA section.
+    bool CData() const;
+
+    /// The element name, or the text of other nodes, as XMLNode::Value().
+    const char* Value() const;
+    /// The name of an element, null for other nodes.
+    const char* Name() const;
+    int GetLineNum() const;
+
+    XMLFrozenNode Parent() const;
+    XMLFrozenNode FirstChild() const;
+    XMLFrozenNode FirstChildElement( const char* name = 0 ) const;
+    XMLFrozenNode LastChild() const;
+    XMLFrozenNode LastChildElement( const char* name = 0 ) const;
+    XMLFrozenNode PreviousSibling() const;
+    XMLFrozenNode PreviousSiblingElement( const char* name = 0 ) const;
+    XMLFrozenNode NextSibling() const;
+    XMLFrozenNode NextSiblingElement( const char* name = 0 ) const;
+
+    XMLFrozenAttribute FirstAttribute() const;
+    XMLFrozenAttribute FindAttribute( const char* name ) const;
+    /// As XMLElement::Attribute().
+    const char* Attribute( const char* name, const char* value = 0 ) const;
+
+    XMLError QueryIntAttribute( const char* name, int* value ) const;
+    XMLError QueryUnsignedAttribute( const char* name, unsigned int* value ) const;
+    XMLError QueryInt64Attribute( const char* name, int64_t* value ) const;
+    XMLError QueryUnsigned64Attribute( const char* name, uint64_t* value ) const;
+    XMLError QueryBoolAttribute( const char* name, bool* value ) const;
+    XMLError QueryDoubleAttribute( const char* name, double* value ) const;
+    XMLError QueryFloatAttribute( const char* name, float* value ) const;
+
+    int IntAttribute( const char* name, int defaultValue = 0 ) const;
+    unsigned UnsignedAttribute( const char* name, unsigned defaultValue = 0 ) const;
+    int64_t Int64Attribute( const char* name, int64_t defaultValue = 0 ) const;
+    uint64_t Unsigned64Attribute( const char* name, uint64_t defaultValue = 0 ) const;
+    bool BoolAttribute( const char* name, bool defaultValue = false ) const;
+    double DoubleAttribute( const char* name, double defaultValue = 0 ) const;
+    float FloatAttribute( const char* name, float defaultValue = 0 ) const;
+
+    /// As XMLElement::GetText().
+    const char* GetText() const;
+    XMLError QueryIntText( int* ival ) const;
+    XMLError QueryUnsignedText( unsigned* uval ) const;
+    XMLError QueryInt64Text( int64_t* uval ) const;
+    XMLError QueryUnsigned64Text( uint64_t* uval ) const;
+    XMLError QueryBoolText( bool* bval ) const;
+    XMLError QueryDoubleText( double* dval ) const;
+    XMLError QueryFloatText( float* fval ) const;
+
+private:
+    friend class XMLFrozenDocument;
+    XMLFrozenNode( const XMLFrozenDocument* document, uint32_t index ) :
+        _document( document ), _index( index ) {}
+
+    uint32_t Kind() const;
+    XMLFrozenNode Link( int field ) const;
+
+    const XMLFrozenDocument* _document;
+    uint32_t _index;
+};
+
+
+/**
+	A read-only view of a document written with XMLDocument::SaveFrozen().
+	The frozen format is a table of fixed size node records that refer to
+	each other, and to a string table, by index. The view reads them in
+	place: opening a frozen document costs nothing beyond checking its
+	header, and no memory is allocated, however large the document.
+
+	That makes it suitable for memory mapping. Map the file read-only and
+	hand the mapping to Open(); every process that maps the same file
+	shares one copy of it in the page cache.
+
+	@verbatim
+	// POSIX; CreateFileMapping/MapViewOfFile on Windows.
+	int fd = open( "catalog.txf", O_RDONLY );
+	struct stat st;
+	fstat( fd, &st );
+	const void* data = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+
+	XMLFrozenDocument catalog;
+	catalog.Open( data, st.st_size );
+	XMLFrozenNode item = catalog.RootElement().FirstChildElement( "item" );
+	@endverbatim
+
+	Navigation mirrors XMLConstHandle and the const XMLElement queries.
+	Records are bounds checked as they are read, so a damaged file gives
+	null nodes rather than reads outside the mapping.
+*/
+class TINYXML2_LIB XMLFrozenDocument
+{
+public:
+    XMLFrozenDocument();
+    ~XMLFrozenDocument();
+
+    /**
+    	View the frozen document at data, which is not copied and must stay
+    	valid (and unchanged) until Close() or the destructor.
+    	Returns XML_SUCCESS (0), or XML_ERROR_PARSING if it is not an
+    	intact frozen document.
+    */
+    XMLError Open( const void* data, size_t size );
+    /// Read a frozen document from a file into memory owned by the view.
+    XMLError LoadFile( const char* filename );
+    void Close();
+
+    XMLError ErrorID() const {
+        return _errorID;
+    }
+    bool Error() const {
+        return _errorID != XML_SUCCESS;
+    }
+
+    /// The document node, whose children are the top level nodes.
+    XMLFrozenNode Document() const;
+    /// The first top level element.
+    XMLFrozenNode RootElement() const {
+        return Document().FirstChildElement();
+    }
+    XMLFrozenNode FirstChildElement( const char* name = 0 ) const {
+        return Document().FirstChildElement( name );
+    }
+    /// The number of nodes, the document node included.
+    int NodeCount() const {
+        return static_cast<int>( _nodeCount );
+    }
+
+private:
+    friend class XMLFrozenNode;
+    friend class XMLFrozenAttribute;
+
+    // The record of a node or attribute, or null if the index is out of range.
+    const char* NodeRecord( uint32_t index ) const;
+    const char* AttributeRecord( uint32_t index ) const;
+    const char* String( uint32_t offset ) const;
+
+    XMLError _errorID;
+    const char* _nodes;
+    const char* _attributes;
+    const char* _strings;
+    uint32_t _nodeCount;
+    uint32_t _attributeCount;
+    uint32_t _stringBytes;
+    char* _buffer;      // owned, from LoadFile()
+
+    XMLFrozenDocument( const XMLFrozenDocument& );   // not supported
+    void operator=( const XMLFrozenDocument& );      // not supported
+};
+
+
+/**
+	Receives the elements matched by XMLQuery::Evaluate().
+*/
+class TINYXML2_LIB XMLQueryHandler
+{
+public:
+    virtual ~XMLQueryHandler() {}
+    /// Called for each matching element. Return false to stop the evaluation.
+    virtual bool Match( const XMLElement& element ) = 0;
+};
+
+
+/**
+	A compiled path query: a small subset of XPath that is parsed once and
+	can then be evaluated any number of times, against any node, without
+	allocating memory.
+
+	@verbatim
+	XMLQuery port( "/config/server[@name='x']/port" );
+	const XMLElement* e = port.First( &doc );
+	@endverbatim
+
+	A path is a list of steps separated by '/'. Each step is an element
+	name, or '*' for any element, followed by optional predicates:
+	- [@attr] the element has the attribute
+	- [@attr='value'] (or "value") the attribute has the value
+	- [n] the element is the n-th (starting at 1) matching child of its
+	  parent, counting only the children that passed the earlier predicates
+
+	A step separated by '//' instead of '/' searches all descendants rather
+	than only the children. A path starting with '/' is absolute and
+	resolves from the document of the node it is evaluated against;
+	otherwise it starts at that node.
+
+	Matches are reported depth first, in document order. A path with more
+	than one '//' step, like "//a//b", can reach the same element through
+	different ancestors and then reports it more than once.
+*/
+class TINYXML2_LIB XMLQuery
+{
+public:
+    explicit XMLQuery( const char* path );
+    ~XMLQuery();
+
+    /// True if the path couldn't be compiled. Such a query never matches.
+    bool Error() const {
+        return _error;
+    }
+
+    /** Reports every match below 'context' to the handler. Returns false
+    	if the handler stopped the evaluation.
+    */
+    bool Evaluate( const XMLNode* context, XMLQueryHandler* handler ) const;
+
+    /// The first match, or null.
+    const XMLElement* First( const XMLNode* context ) const;
+    /// The first match, or null.
+    XMLElement* First( XMLNode* context ) const;
+    /// The number of matches.
+    int Count( const XMLNode* context ) const;
+
+private:
+    XMLQuery( const XMLQuery& );	// not supported
+    void operator=( const XMLQuery& );	// not supported
+
+    enum { MAX_PREDICATES = 8 };
+
+    struct Predicate {
+        enum Type {
+            HAS_ATTRIBUTE,
+            ATTRIBUTE_EQUALS,
+            POSITION
+        };
+        Type		type;
+        const char*	name;
+        const char*	value;
+        int			position;
+    };
+    struct Step {
+        bool		descendant;
+        const char*	name;		// null matches any element
+        int			firstPredicate;
+        int			predicateCount;
+    };
+
+    bool Compile( const char* path );
+    const char* CompilePredicate( const char* p, char** out );
+    bool EvaluateStep( int step, const XMLNode* node, XMLQueryHandler* handler ) const;
+    bool MatchStep( int step, const XMLElement* element, int* counts ) const;
+    bool Continue( int step, const XMLElement* element, XMLQueryHandler* handler ) const;
+    bool SelectChildren( int step, const XMLNode* parent, XMLQueryHandler* handler ) const;
+    bool SelectDescendants( int step, const XMLNode* node, XMLQueryHandler* handler ) const;
+
+    // Used by XMLDocument's subtree filters, which match against the
+    // names of the open elements while scanning.
+    friend class XMLDocument;
+    bool NamesOnly() const;
+    bool MatchesNames( int step, const char* const* names, const int* lengths, int level, int depth ) const;
+
+    bool _error;
+    bool _absolute;
+    char* _strings;
+    DynArray< Step, 8 > _steps;
+    DynArray< Predicate, 8 > _predicates;
+};
+
+
+/**
+	An output destination for the XMLPrinter. By default the printer
+	writes to a FILE* or to its own memory buffer; implement this
+	interface to stream the output somewhere else (a socket, a
+	compression stream, caller-provided memory) without it being
+	copied through the printer's buffer first.
+
+	@verbatim
+	class CountingSink : public XMLOutputSink {
+	public:
+		CountingSink() : count( 0 ) {}
+		virtual void Write( const char*, size_t size )	{ count += size; }
+		size_t count;
+	};
+
+	CountingSink sink;
+	XMLPrinter printer( sink );
+	doc.Print( &printer );
+	@endverbatim
+*/
+class TINYXML2_LIB XMLOutputSink
+{
+public:
+    virtual ~XMLOutputSink() {}
+
+    /// Append 'size' bytes of output. The data is not null terminated.
+    virtual void Write( const char* data, size_t size ) = 0;
+
+    /** Hint that roughly 'size' more bytes are about to be written.
+        The default does nothing; a sink may use it to grow its storage
+        or claim space up front.
+    */
+    virtual void Reserve( size_t /*size*/ )	{}
+};
+
+
 /**
 	Printing functionality. The XMLPrinter gives you more
 	options than the XMLDocument::Print() method.
@@ -2199,6 +3193,7 @@ private:
 	It can:
 	-# Print to memory.
 	-# Print to a file you provide.
+	-# Print to an XMLOutputSink you provide.
 	-# Print XML without a XMLDocument.
 
 	Print to Memory
@@ -2217,6 +3212,14 @@ private:
 	doc.Print( &printer );
 	@endverbatim
 
+	Print to a Sink
+
+	You provide the XMLOutputSink, which must outlive the printer.
+	@verbatim
+	XMLPrinter printer( mySink );
+	doc.Print( &printer );
+	@endverbatim
+
 	Print without a XMLDocument
 
 	When loading, an XML parser is very useful. However, sometimes
@@ -2244,7 +3247,18 @@ public:
     	with only required whitespace and newlines.
     */
     XMLPrinter( FILE* file=0, bool compact = false, int depth = 0 );
-    virtual ~XMLPrinter()	{}
+    /** Construct a printer that writes everything to 'sink'. CStr()
+        stays empty; the output only goes to the sink.
+    */
+    explicit XMLPrinter( XMLOutputSink& sink, bool compact = false, int depth = 0 );
+    virtual ~XMLPrinter();
+
+    /** Hint that roughly 'size' more bytes of output are coming. In
+        print to memory mode the buffer is grown once, up front, rather
+        than repeatedly as the output arrives. If there is a sink, the
+        hint is passed on to it.
+    */
+    void Reserve( size_t size );
 
     /** If streaming, write the BOM and declaration. */
     void PushHeader( bool writeBOM, bool writeDeclaration );
@@ -2279,6 +3293,10 @@ public:
     void PushText( float value );
     /// Add a text node from a double.
     void PushText( double value );
+    /// Add a text node from an array of ints, separated by spaces.
+    void PushText( const int* values, int count );
+    /// Add a text node from an array of doubles, separated by spaces.
+    void PushText( const double* values, int count );
 
     /// Add a comment
     void PushComment( const char* comment );
@@ -2304,25 +3322,45 @@ public:
     	the XML file in memory.
     */
     const char* CStr() const {
-        return _buffer.Mem();
+        return _buffer ? _buffer : "";
     }
     /**
     	If in print to memory mode, return the size
     	of the XML file in memory. (Note the size returned
-    	includes the terminating null.)
+    	includes the terminating null.) For output larger
+    	than INT_MAX, use CStrLength().
     */
     int CStrSize() const {
-        return _buffer.Size();
+        TIXMLASSERT( _bufferSize < static_cast<size_t>(INT_MAX) );
+        return static_cast<int>( _bufferSize + 1 );
+    }
+    /**
+    	If in print to memory mode, return the length
+    	of the XML file in memory, not including the
+    	terminating null.
+    */
+    size_t CStrLength() const {
+        return _bufferSize;
     }
     /**
     	If in print to memory mode, reset the buffer to the
-    	beginning.
+    	beginning. The memory is kept for reuse.
     */
     void ClearBuffer( bool resetToFirstElement = true ) {
-        _buffer.Clear();
-        _buffer.Push(0);
+        _bufferSize = 0;
+        if ( _buffer ) {
+            _buffer[0] = 0;
+        }
 		_firstElement = resetToFirstElement;
     }
+    /**
+    	If in print to memory mode, hand the buffer over to the caller
+    	without copying it. The returned string is null terminated and
+    	must be freed with delete[]. If 'length' is not null, it is set
+    	to the length of the string (not counting the null.) The printer
+    	is left with an empty buffer.
+    */
+    char* ReleaseBuffer( size_t* length = 0 );
 
 protected:
 	virtual bool CompactMode( const XMLElement& )	{ return _compactMode; }
@@ -2348,9 +3386,13 @@ private:
      */
     void PrepareForNewNode( bool compactMode );
     void PrintString( const char*, bool restrictedEntitySet );	// prints out, after detecting entities.
+    void PushNumberAttribute( const char* name, const char* value );
+    void PushNumberText( const char* text );
+    void Init();
 
     bool _firstElement;
     FILE* _fp;
+    XMLOutputSink* _sink;
     int _depth;
     int _textDepth;
     bool _processEntities;
@@ -2363,7 +3405,14 @@ private:
     bool _entityFlag[ENTITY_RANGE];
     bool _restrictedEntityFlag[ENTITY_RANGE];
 
-    DynArray< char, 20 > _buffer;
+    // The memory buffer. It is sized with size_t (DynArray is limited
+    // to INT_MAX) and not allocated until something is printed to it.
+    char*  _buffer;
+    size_t _bufferSize;         // not counting the null terminator
+    size_t _bufferCapacity;
+
+    char* PushToBuffer( size_t size );
+    void EnsureBufferCapacity( size_t capacity );
 
     // Prohibit cloning, intentionally not implemented
     XMLPrinter( const XMLPrinter& );
@@ -2371,6 +3420,222 @@ private:
 };
 
 
+/**
+	A printer that writes Canonical XML 1.0 (http://www.w3.org/TR/xml-c14n),
+	the form to hash or sign. It is an XMLPrinter, so it prints a document
+	or any element in one traversal, straight from the DOM to a FILE, to
+	memory or to an XMLOutputSink (a digest, for instance):
+
+	@verbatim
+	XMLCanonicalPrinter printer( digestSink );
+	doc.Accept( &printer );
+	@endverbatim
+
+	The output has no XML declaration, DOCTYPE or BOM; every element has a
+	start and end tag; namespace declarations come first, then attributes
+	sorted by namespace URI and local name; declarations that repeat one
+	already in scope are dropped; and text and attribute values use the
+	fixed C14N escapes. Comments are only written with 'withComments'.
+	Printing an element rather than a document gives the canonical form of
+	that subtree, with the namespaces and xml: attributes it inherits.
+
+	The canonical form is that of the DOM: whitespace-only text between
+	elements is not kept by the parser, so it is not in the output either.
+*/
+class TINYXML2_LIB XMLCanonicalPrinter : public XMLPrinter
+{
+public:
+    explicit XMLCanonicalPrinter( FILE* file = 0, bool withComments = false );
+    explicit XMLCanonicalPrinter( XMLOutputSink& sink, bool withComments = false );
+
+    virtual bool VisitEnter( const XMLDocument& doc );
+    virtual bool VisitExit( const XMLDocument& doc );
+    virtual bool VisitEnter( const XMLElement& element, const XMLAttribute* attribute );
+    virtual bool VisitExit( const XMLElement& element );
+    virtual bool Visit( const XMLText& text );
+    virtual bool Visit( const XMLComment& comment );
+    virtual bool Visit( const XMLDeclaration& declaration );
+    virtual bool Visit( const XMLUnknown& unknown );
+
+private:
+    // Writes 'p' with the C14N escapes; with 'decode', the references
+    // in it are written as the characters they stand for.
+    void WriteEscaped( const char* p, bool attribute, bool decode );
+    // Comments and processing instructions outside the root element are
+    // separated from it by a newline.
+    void BeginTopLevel();
+    void EndTopLevel();
+    // The URI bound to a prefix (of 'length' chars) in the output, or null.
+    const char* FindNamespace( const char* prefix, size_t length ) const;
+
+    bool _withComments;
+    int _elementDepth;
+    bool _rootWritten;
+    bool _decodeEntities;
+    DynArray< const char*, 16 > _namespaces;    // prefix, URI pairs in scope
+    DynArray< int, 16 > _namespaceScopes;       // _namespaces size per open element
+
+    XMLCanonicalPrinter( const XMLCanonicalPrinter& );
+    XMLCanonicalPrinter& operator=( const XMLCanonicalPrinter& );
+};
+
+
+/// The running state of an XMLHasher hash; see XMLHasher.
+struct XMLHashState
+{
+    uint64_t acc[4];
+    uint64_t total;
+    unsigned char buffer[32];
+    size_t buffered;
+};
+
+
+/**
+	Hashes nodes without printing them: the hash of a node is XXH64 over
+	a structural byte stream - the kind of node, its name or value, and
+	for an element its attributes and the hashes of its children. The
+	attributes are combined so that their order does not matter; CDATA
+	and plain text hash alike.
+
+	@verbatim
+	XMLHasher hasher;
+	element->Accept( &hasher );
+	uint64_t h = hasher.Hash();
+	@endverbatim
+
+	The hash of an element is what XMLElement::SubtreeHash() returns, and
+	the hasher uses the hashes cached by it: a subtree that has not
+	changed since its SubtreeHash() was taken is not visited again.
+*/
+class TINYXML2_LIB XMLHasher : public XMLVisitor
+{
+public:
+    /// A seed other than 0 gives different hashes, and ignores cached ones.
+    explicit XMLHasher( uint64_t seed = 0 );
+
+    /// The hash of the node last visited with Accept().
+    uint64_t Hash() const {
+        return _hash;
+    }
+
+    /// The hash of a node, as visiting it would give.
+    static uint64_t HashNode( const XMLNode& node, uint64_t seed = 0 );
+    /// XXH64 of a block of bytes.
+    static uint64_t HashBytes( const void* data, size_t size, uint64_t seed = 0 );
+
+    virtual bool VisitEnter( const XMLDocument& doc );
+    virtual bool VisitExit( const XMLDocument& doc );
+    virtual bool VisitEnter( const XMLElement& element, const XMLAttribute* attribute );
+    virtual bool VisitExit( const XMLElement& element );
+    virtual bool Visit( const XMLText& text );
+    virtual bool Visit( const XMLComment& comment );
+    virtual bool Visit( const XMLDeclaration& declaration );
+    virtual bool Visit( const XMLUnknown& unknown );
+
+private:
+    // The hash of a node is passed to its parent, or is the result.
+    void Done( uint64_t hash );
+
+    uint64_t _seed;
+    uint64_t _hash;
+    DynArray< XMLHashState, 16 > _open;     // one per element being hashed
+    bool _cached;                           // the element entered has a cached hash
+};
+
+
+/// The kinds of change in an XMLDiff edit script.
+enum XMLEditType {
+    XML_EDIT_INSERT,            ///< insert a copy of 'node' so that it is the node at 'path'
+    XML_EDIT_DELETE,            ///< delete the node at 'path'
+    XML_EDIT_SET_ATTRIBUTE,     ///< set the attribute 'name' of the element at 'path' to 'value'
+    XML_EDIT_DELETE_ATTRIBUTE,  ///< delete the attribute 'name' of the element at 'path'
+    XML_EDIT_SET_TEXT           ///< set the value of the text node at 'path' to 'value'
+};
+
+
+/**
+	One change of an edit script. The path is a list of child indices
+	from the compared node, counting every kind of node: "/2/0" is the
+	first child of its third child, and "" is the compared node itself.
+	Fields that do not apply to the type of edit are null.
+*/
+struct XMLEdit
+{
+    XMLEditType type;
+    const char* path;
+    const char* name;
+    const char* value;
+    const XMLNode* node;
+};
+
+
+/**
+	Computes the edit script that turns one document (or element) into
+	another: the inserted and deleted nodes, attribute changes and text
+	changes, in the order they are to be applied. Each path refers to the
+	document as the edits before it have left it.
+
+	@verbatim
+	XMLDiff diff;
+	diff.Compare( live, fetched );
+	for( int i = 0; i < diff.EditCount(); ++i ) {
+		const XMLEdit& edit = diff.Edit( i );
+		...
+	}
+	@endverbatim
+
+	Subtrees are compared by XMLElement::SubtreeHash(), so identical
+	regions are skipped without being walked, and the cost is close to
+	linear in the size of the documents. Identical children are matched
+	first; an element that changed is then matched to one of the same
+	name, and text to text. Anything else is deleted and inserted.
+
+	The names, values and nodes of the edits point into the 'to'
+	document, and are valid as long as it is not changed or deleted.
+*/
+class TINYXML2_LIB XMLDiff
+{
+public:
+    XMLDiff();
+
+    /**
+    	Compares two documents, or two elements with the same name. Returns
+    	false, with no edits, if the nodes cannot be compared.
+    */
+    bool Compare( const XMLNode& from, const XMLNode& to );
+
+    /// The number of edits; 0 if the nodes are equal.
+    int EditCount() const {
+        return _edits.Size();
+    }
+    /// The edit at 'index', from 0 to EditCount() - 1.
+    const XMLEdit& Edit( int index ) const {
+        return _edits[index];
+    }
+
+    void Clear();
+
+private:
+    void DiffNodes( const XMLNode& from, const XMLNode& to );
+    void DiffAttributes( const XMLElement& from, const XMLElement& to );
+    void DiffChildren( const XMLNode& from, const XMLNode& to );
+    // Diffs from[i, iEnd) against to[j, jEnd), from child 'position' on.
+    void DiffRange( const XMLNode* const* from, int i, int iEnd,
+                    const XMLNode* const* to, int j, int jEnd, int* position );
+    void DiffChild( const XMLNode& from, const XMLNode& to, int position );
+    // 'child' is the index of a child of the node at the current path, or -1.
+    void AddEdit( XMLEditType type, int child, const char* name, const char* value, const XMLNode* node );
+
+    DynArray< XMLEdit, 16 > _edits;
+    DynArray< int, 16 > _pathOffsets;       // into _paths, one per edit
+    DynArray< char, 256 > _paths;
+    DynArray< char, 64 > _path;             // of the nodes being compared
+
+    XMLDiff( const XMLDiff& );
+    XMLDiff& operator=( const XMLDiff& );
+};
+
+
 }	// tinyxml2
 
 #if defined(_MSC_VER)
@@ -112,6 +112,37 @@ void NullLineEndings( char* p )
 }
 
 
+// The resident memory of the process in kilobytes, or -1 where it is
+// not known, or not given back (memory checkers hold on to it).
+long ResidentKilobytes()
+{
+	long kilobytes = -1;
+#if defined( __linux__ ) && !defined( __SANITIZE_ADDRESS__ )
+	FILE* statm = fopen( "/proc/self/statm", "r" );
+	if ( statm ) {
+		long size = 0;
+		long resident = 0;
+		if ( fscanf( statm, "%ld %ld", &size, &resident ) == 2 ) {
+			kilobytes = resident * 4;
+		}
+		fclose( statm );
+	}
+#endif
+	return kilobytes;
+}
+
+
+// A deep copy made one node at a time, to compare DeepClone() against.
+XMLNode* CloneNodeByNode( const XMLNode* node, XMLDocument* target )
+{
+	XMLNode* clone = node->ShallowClone( target );
+	for( const XMLNode* child = node->FirstChild(); child; child = child->NextSibling() ) {
+		clone->InsertEndChild( CloneNodeByNode( child, target ) );
+	}
+	return clone;
+}
+
+
 int example_1()
 {
 	XMLDocument doc;
@@ -297,6 +328,696 @@ bool example_4()
 */
 
 
+// Timings kept out of the test run; 'xmltest --benchmark' runs them.
+void Benchmarks()
+{
+	{
+		// Serialization throughput: dream.xml to memory, and number formatting.
+		XMLDocument doc;
+		doc.LoadFile( "resources/dream.xml" );
+		XMLTest( "Load dream.xml for printing", false, doc.Error() );
+
+		static const int COUNT = 10;
+		size_t printed = 0;
+		clock_t cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLPrinter printer;
+			doc.Print( &printer );
+			printed += printer.CStrLength();
+		}
+		clock_t cend = clock();
+		const double printSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		static const int NUMBERS = 200000;
+		XMLPrinter numbers;
+		cstart = clock();
+		numbers.OpenElement( "n" );
+		for ( int i = 0; i < NUMBERS; ++i ) {
+			numbers.PushAttribute( "v", i * 7919 );
+		}
+		numbers.CloseElement();
+		cend = clock();
+		const double numberSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		printf( "Printing dream.xml: %.3f milli-seconds (%.1f MB/s)\n",
+				1000.0 * printSeconds / COUNT,
+				printSeconds > 0 ? (double)printed / ( printSeconds * 1024.0 * 1024.0 ) : 0.0 );
+		printf( "Printing %d int attributes: %.3f milli-seconds\n", NUMBERS, 1000.0 * numberSeconds );
+	}
+	{
+		// Integer parsing, against the sscanf path it replaced.
+		static const char* const values[] = { "0", "42", "-17", "65535", "2147483647", " 1234567", "-99999", "0x1F" };
+		static const int VALUES = (int)( sizeof( values ) / sizeof( values[0] ) );
+		static const int ROUNDS = 200000;
+
+		long long sum = 0;
+		clock_t cstart = clock();
+		for ( int r = 0; r < ROUNDS; ++r ) {
+			for ( int i = 0; i < VALUES; ++i ) {
+				int v = 0;
+				XMLUtil::ToInt( values[i], &v );
+				sum += v;
+			}
+		}
+		clock_t cend = clock();
+		const double parseSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		long long scanSum = 0;
+		cstart = clock();
+		for ( int r = 0; r < ROUNDS; ++r ) {
+			for ( int i = 0; i < VALUES; ++i ) {
+				int v = 0;
+				if ( XMLUtil::IsPrefixHex( values[i] ) ) {
+					unsigned x = 0;
+					sscanf( values[i], "%x", &x );
+					v = (int)x;
+				}
+				else {
+					sscanf( values[i], "%d", &v );
+				}
+				scanSum += v;
+			}
+		}
+		cend = clock();
+		const double scanSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		XMLTest( "ToInt matches sscanf", true, sum == scanSum );
+
+		const double calls = (double)ROUNDS * VALUES;
+		printf( "XMLUtil::ToInt: %.1f nano-seconds per value (sscanf: %.1f)\n",
+				1.0e9 * parseSeconds / calls, 1.0e9 * scanSeconds / calls );
+	}
+	{
+		// Floating point printing and parsing, against the snprintf and
+		// sscanf paths they replaced.
+		static const int VALUES = 200000;
+		char buf[64];
+		size_t printedLength = 0;
+		double v = 1.0 / 3.0;
+		clock_t cstart = clock();
+		for ( int i = 0; i < VALUES; ++i ) {
+			v = v * 1.0001 + 0.37;
+			XMLUtil::ToStr( v, buf, 64 );
+			printedLength += strlen( buf );
+		}
+		clock_t cend = clock();
+		const double toStrSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		size_t snprintfLength = 0;
+		v = 1.0 / 3.0;
+		cstart = clock();
+		for ( int i = 0; i < VALUES; ++i ) {
+			v = v * 1.0001 + 0.37;
+			snprintf( buf, 64, "%.17g", v );
+			snprintfLength += strlen( buf );
+		}
+		cend = clock();
+		const double snprintfSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		static const char* const values[] = { "0.5", "-12.25", "3.14159", "1e-3", "42", "6.02e23", "0.1", "1234.5678" };
+		static const int COUNT = (int)( sizeof( values ) / sizeof( values[0] ) );
+		double sum = 0;
+		cstart = clock();
+		for ( int i = 0; i < VALUES; ++i ) {
+			double d = 0;
+			XMLUtil::ToDouble( values[i % COUNT], &d );
+			sum += d;
+		}
+		cend = clock();
+		const double toDoubleSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		double scanSum = 0;
+		cstart = clock();
+		for ( int i = 0; i < VALUES; ++i ) {
+			double d = 0;
+			sscanf( values[i % COUNT], "%lf", &d );
+			scanSum += d;
+		}
+		cend = clock();
+		const double scanSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		XMLTest( "ToDouble matches sscanf", true, sum == scanSum );
+
+		printf( "XMLUtil::ToStr(double): %.1f nano-seconds, %.1f chars per value (%%.17g: %.1f, %.1f)\n",
+				1.0e9 * toStrSeconds / VALUES, (double)printedLength / VALUES,
+				1.0e9 * snprintfSeconds / VALUES, (double)snprintfLength / VALUES );
+		printf( "XMLUtil::ToDouble: %.1f nano-seconds per value (sscanf: %.1f)\n",
+				1.0e9 * toDoubleSeconds / VALUES, 1.0e9 * scanSeconds / VALUES );
+	}
+	{
+		// Parsing only a few subtrees of dream.xml, against the whole document.
+		static const int COUNT = 10;
+		int speeches = 0;
+		clock_t cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.AddSubtreeFilter( "/PLAY/PERSONAE" );
+			doc.LoadFile( "resources/dream.xml" );
+			speeches += doc.FirstChildElement() ? 1 : 0;
+		}
+		clock_t cend = clock();
+		XMLTest( "Filtered dream.xml", COUNT, speeches );
+		const double filteredSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.LoadFile( "resources/dream.xml" );
+		}
+		cend = clock();
+		const double fullSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "Loading /PLAY/PERSONAE of dream.xml: %.3f milli-seconds (whole document: %.3f)\n",
+				1000.0 * filteredSeconds / COUNT, 1000.0 * fullSeconds / COUNT );
+	}
+	{
+		// Time to first query: a lazy load only builds the path it is asked for.
+		static const int COUNT = 10;
+		int found = 0;
+		clock_t cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.SetLazyParse( true );
+			doc.LoadFile( "resources/dream.xml" );
+			found += doc.FirstChildElement()->FirstChildElement( "TITLE" ) ? 1 : 0;
+		}
+		clock_t cend = clock();
+		XMLTest( "Lazy dream.xml", COUNT, found );
+		const double lazySeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		for ( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.LoadFile( "resources/dream.xml" );
+			found += doc.FirstChildElement()->FirstChildElement( "TITLE" ) ? 1 : 0;
+		}
+		cend = clock();
+		const double eagerSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "First query on dream.xml: %.3f milli-seconds lazy (eager: %.3f)\n",
+				1000.0 * lazySeconds / COUNT, 1000.0 * eagerSeconds / COUNT );
+	}
+	{
+		// Reloading dream.xml from a binary image, against parsing it.
+		static const int COUNT = 10;
+		XMLDocument source;
+		source.LoadFile( "resources/dream.xml" );
+		source.SaveBinary( "resources/out/dream.bin" );
+
+		int loaded = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			loaded += doc.LoadBinary( "resources/out/dream.bin" ) == XML_SUCCESS ? 1 : 0;
+		}
+		clock_t cend = clock();
+		XMLTest( "Binary dream.xml", COUNT, loaded );
+		const double binarySeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.LoadFile( "resources/dream.xml" );
+		}
+		cend = clock();
+		const double textSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "Loading dream.xml from a binary image: %.3f milli-seconds (parsing: %.3f)\n",
+				1000.0 * binarySeconds / COUNT, 1000.0 * textSeconds / COUNT );
+	}
+	{
+		// Time to first query on a frozen dream.xml, against loading it.
+		static const int COUNT = 10;
+		XMLDocument source;
+		source.LoadFile( "resources/dream.xml" );
+		source.SaveFrozen( "resources/out/dream.txf" );
+
+		int found = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLFrozenDocument doc;
+			doc.LoadFile( "resources/out/dream.txf" );
+			found += doc.RootElement().LastChildElement( "ACT" ).LastChildElement().Valid() ? 1 : 0;
+		}
+		clock_t cend = clock();
+		XMLTest( "Frozen dream.xml", COUNT, found );
+		const double frozenSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.LoadFile( "resources/dream.xml" );
+			found += doc.RootElement()->LastChildElement( "ACT" )->LastChildElement() ? 1 : 0;
+		}
+		cend = clock();
+		const double loadSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "First query on a frozen dream.xml: %.3f milli-seconds (loading: %.3f)\n",
+				1000.0 * frozenSeconds / COUNT, 1000.0 * loadSeconds / COUNT );
+	}
+	{
+		// Rehashing dream.xml after a single edit, against hashing it from scratch.
+		static const int COUNT = 10;
+		XMLDocument doc;
+		doc.LoadFile( "resources/dream.xml" );
+		XMLElement* root = doc.RootElement();
+		XMLElement* line = root->LastChildElement( "ACT" )->LastChildElement( "SCENE" )->LastChildElement( "SPEECH" )->LastChildElement( "LINE" );
+		root->SubtreeHash();
+
+		uint64_t hashes = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			line->SetAttribute( "n", i );
+			hashes ^= root->SubtreeHash();
+		}
+		clock_t cend = clock();
+		const double cachedSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			hashes ^= XMLHasher::HashNode( *root, 1 );
+		}
+		cend = clock();
+		const double fullSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		XMLTest( "Hashing dream.xml", true, hashes != 0 );
+		printf( "Rehashing dream.xml after an edit: %.3f milli-seconds (full hash: %.3f)\n",
+				1000.0 * cachedSeconds / COUNT, 1000.0 * fullSeconds / COUNT );
+	}
+	{
+		// Diffing dream.xml against a copy with one change, against printing both.
+		static const int COUNT = 10;
+		XMLDocument live;
+		live.LoadFile( "resources/dream.xml" );
+		XMLDocument fetched;
+		live.DeepCopy( &fetched );
+		fetched.RootElement()->LastChildElement( "ACT" )->SetAttribute( "n", 5 );
+
+		int edits = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDiff diff;
+			diff.Compare( live, fetched );
+			edits += diff.EditCount();
+		}
+		clock_t cend = clock();
+		XMLTest( "Diffing dream.xml", COUNT, edits );
+		const double diffSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLPrinter livePrinter;
+			live.Print( &livePrinter );
+			XMLPrinter fetchedPrinter;
+			fetched.Print( &fetchedPrinter );
+			edits += strcmp( livePrinter.CStr(), fetchedPrinter.CStr() ) ? 1 : 0;
+		}
+		cend = clock();
+		const double printSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "Diffing dream.xml after an edit: %.3f milli-seconds (printing both: %.3f)\n",
+				1000.0 * diffSeconds / COUNT, 1000.0 * printSeconds / COUNT );
+	}
+	{
+		// Applying a small edit script to dream.xml, against parsing the new document.
+		static const int COUNT = 10;
+		XMLDocument live;
+		live.LoadFile( "resources/dream.xml" );
+		XMLDocument fetched;
+		live.DeepCopy( &fetched );
+		XMLElement* act = fetched.RootElement()->LastChildElement( "ACT" );
+		act->SetAttribute( "n", 5 );
+		act->LastChildElement( "SCENE" )->LastChildElement( "SPEECH" )->LastChildElement( "LINE" )->SetText( "Robin shall restore amends." );
+		XMLDiff forward;
+		forward.Compare( live, fetched );
+		XMLDiff back;
+		back.Compare( fetched, live );
+		XMLDocument working;
+		live.DeepCopy( &working );
+
+		int errors = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			errors += working.ApplyEdits( forward ) == XML_SUCCESS ? 0 : 1;
+			errors += working.ApplyEdits( back ) == XML_SUCCESS ? 0 : 1;
+		}
+		clock_t cend = clock();
+		XMLTest( "Applying dream.xml edits", 0, errors );
+		const double applySeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		XMLPrinter printer;
+		fetched.Print( &printer );
+		cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.Parse( printer.CStr() );
+		}
+		cend = clock();
+		const double parseSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "Applying an edit script to dream.xml: %.3f milli-seconds (parsing: %.3f)\n",
+				1000.0 * applySeconds / ( 2 * COUNT ), 1000.0 * parseSeconds / COUNT );
+	}
+	{
+		// Splitting dream.xml into a document per act, moving against cloning.
+		static const int COUNT = 10;
+		static const int ACTS = 5;
+		clock_t moveTicks = 0;
+		clock_t cloneTicks = 0;
+		int acts = 0;
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument batch;
+			batch.LoadFile( "resources/dream.xml" );
+			XMLDocument moved[ACTS];
+			clock_t cstart = clock();
+			int n = 0;
+			for( XMLElement* act = batch.RootElement()->FirstChildElement( "ACT" ); act && n < ACTS; ++n ) {
+				XMLElement* next = act->NextSiblingElement( "ACT" );
+				moved[n].InsertEndChild( act->TransferTo( &moved[n] ) );
+				act = next;
+			}
+			moveTicks += clock() - cstart;
+			acts += n;
+
+			batch.LoadFile( "resources/dream.xml" );
+			XMLDocument cloned[ACTS];
+			cstart = clock();
+			n = 0;
+			for( XMLElement* act = batch.RootElement()->FirstChildElement( "ACT" ); act && n < ACTS; ++n ) {
+				XMLElement* next = act->NextSiblingElement( "ACT" );
+				cloned[n].InsertEndChild( act->DeepClone( &cloned[n] ) );
+				batch.RootElement()->DeleteChild( act );
+				act = next;
+			}
+			cloneTicks += clock() - cstart;
+		}
+		XMLTest( "Splitting dream.xml", COUNT * ACTS, acts );
+		printf( "Splitting dream.xml by moving: %.3f milli-seconds (cloning: %.3f)\n",
+				1000.0 * moveTicks / CLOCKS_PER_SEC / COUNT, 1000.0 * cloneTicks / CLOCKS_PER_SEC / COUNT );
+	}
+	{
+		// Cloning an act of dream.xml, as a template, into one document
+		// against copying it node by node.
+		static const int COUNT = 10;
+		static const int CLONES = 100;
+		XMLDocument source;
+		source.LoadFile( "resources/dream.xml" );
+		const XMLElement* act = source.RootElement()->FirstChildElement( "ACT" );
+
+		int cloned = 0;
+		clock_t cstart = clock();
+		{
+			XMLDocument target;
+			for( int i = 0; i < COUNT * CLONES; ++i ) {
+				cloned += target.InsertEndChild( act->DeepClone( &target ) ) ? 1 : 0;
+			}
+		}
+		clock_t cend = clock();
+		XMLTest( "Cloning dream.xml", COUNT * CLONES, cloned );
+		const double cloneSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+
+		cstart = clock();
+		{
+			XMLDocument target;
+			for( int i = 0; i < COUNT * CLONES; ++i ) {
+				target.InsertEndChild( CloneNodeByNode( act, &target ) );
+			}
+		}
+		cend = clock();
+		const double nodeSeconds = (double)( cend - cstart ) / CLOCKS_PER_SEC;
+		printf( "Cloning an act of dream.xml: %.3f milli-seconds (node by node: %.3f)\n",
+				1000.0 * cloneSeconds / ( COUNT * CLONES ), 1000.0 * nodeSeconds / ( COUNT * CLONES ) );
+	}
+	{
+		// A request handler: dream.xml as a template, one attribute set deep
+		// in it, then printed. Snapshots against copies of the template.
+		static const int COUNT = 10;
+		static const int REQUESTS = 10;
+		XMLDocument source;
+		source.LoadFile( "resources/dream.xml" );
+
+		clock_t editTicks[2] = { 0, 0 };
+		clock_t printTicks[2] = { 0, 0 };
+		size_t printed[2] = { 0, 0 };
+		for( int i = 0; i < COUNT * REQUESTS; ++i ) {
+			for( int snapshot = 0; snapshot < 2; ++snapshot ) {
+				clock_t cstart = clock();
+				XMLDocument request;
+				if ( snapshot ) {
+					source.Snapshot( &request );
+				}
+				else {
+					source.DeepCopy( &request );
+				}
+				request.RootElement()->LastChildElement( "ACT" )->LastChildElement( "SCENE" )
+					->LastChildElement( "SPEECH" )->SetAttribute( "request", i );
+				clock_t cend = clock();
+				editTicks[snapshot] += cend - cstart;
+
+				XMLPrinter printer( 0, true );
+				request.Print( &printer );
+				printed[snapshot] += printer.CStrSize();
+				printTicks[snapshot] += clock() - cend;
+			}
+		}
+		XMLTest( "Snapshot requests", true, printed[0] == printed[1] );
+		printf( "Request on dream.xml: snapshot and edit %.3f milli-seconds, print %.3f (copy and edit: %.3f, print %.3f)\n",
+				1000.0 * editTicks[1] / CLOCKS_PER_SEC / ( COUNT * REQUESTS ), 1000.0 * printTicks[1] / CLOCKS_PER_SEC / ( COUNT * REQUESTS ),
+				1000.0 * editTicks[0] / CLOCKS_PER_SEC / ( COUNT * REQUESTS ), 1000.0 * printTicks[0] / CLOCKS_PER_SEC / ( COUNT * REQUESTS ) );
+	}
+	{
+		// An Atom feed, read by name and by namespace.
+		static const int COUNT = 10;
+		static const int ENTRIES = 2000;
+		XMLPrinter source;
+		source.OpenElement( "feed" );
+		source.PushAttribute( "xmlns", "http://www.w3.org/2005/Atom" );
+		source.PushAttribute( "xmlns:media", "http://search.yahoo.com/mrss/" );
+		for( int i = 0; i < ENTRIES; ++i ) {
+			source.OpenElement( "entry" );
+			source.OpenElement( "title" );
+			source.PushText( "An entry" );
+			source.CloseElement();
+			source.OpenElement( "media:content" );
+			source.PushAttribute( "url", i );
+			source.CloseElement();
+			source.CloseElement();
+		}
+		source.CloseElement();
+
+		clock_t parseTicks[2] = { 0, 0 };
+		clock_t queryTicks[2] = { 0, 0 };
+		int found[2] = { 0, 0 };
+		for( int i = 0; i < COUNT; ++i ) {
+			for( int namespaces = 0; namespaces < 2; ++namespaces ) {
+				clock_t cstart = clock();
+				XMLDocument doc;
+				doc.SetNamespaces( namespaces != 0 );
+				doc.Parse( source.CStr(), source.CStrSize() - 1 );
+				clock_t cend = clock();
+				parseTicks[namespaces] += cend - cstart;
+
+				const XMLElement* feed = doc.RootElement();
+				if ( namespaces ) {
+					const char* atom = doc.FindNamespaceURI( "http://www.w3.org/2005/Atom" );
+					const char* media = doc.FindNamespaceURI( "http://search.yahoo.com/mrss/" );
+					for( const XMLElement* entry = feed->FirstChildElementNS( atom, "entry" ); entry; entry = entry->NextSiblingElementNS( atom, "entry" ) ) {
+						found[1] += entry->FirstChildElementNS( atom, "title" ) && entry->FirstChildElementNS( media, "content" ) ? 1 : 0;
+					}
+				}
+				else {
+					for( const XMLElement* entry = feed->FirstChildElement( "entry" ); entry; entry = entry->NextSiblingElement( "entry" ) ) {
+						found[0] += entry->FirstChildElement( "title" ) && entry->FirstChildElement( "media:content" ) ? 1 : 0;
+					}
+				}
+				queryTicks[namespaces] += clock() - cend;
+			}
+		}
+		XMLTest( "Namespace queries", COUNT * ENTRIES, found[1] );
+		XMLTest( "Name queries", COUNT * ENTRIES, found[0] );
+		printf( "Atom feed: parse %.3f milli-seconds with namespaces (%.3f without), query %.3f (by name: %.3f)\n",
+				1000.0 * parseTicks[1] / CLOCKS_PER_SEC / COUNT, 1000.0 * parseTicks[0] / CLOCKS_PER_SEC / COUNT,
+				1000.0 * queryTicks[1] / CLOCKS_PER_SEC / COUNT, 1000.0 * queryTicks[0] / CLOCKS_PER_SEC / COUNT );
+	}
+
+	{
+		// Decoding cost: dream.xml parsed from UTF-16 against from UTF-8.
+		XMLDocument utf8;
+		utf8.LoadFile( "resources/dream.xml" );
+		XMLPrinter text;
+		utf8.Print( &text );
+		const int length = text.CStrSize() - 1;
+		char* wide = new char[2 * length];
+		for( int i = 0; i < length; ++i ) {
+			// Only the UTF-8 lead bytes widen; good enough for timing.
+			wide[2 * i] = text.CStr()[i];
+			wide[2 * i + 1] = 0;
+		}
+
+		static const int COUNT = 10;
+		clock_t ticks[2] = { 0, 0 };
+		bool failed = false;
+		for( int i = 0; i < COUNT; ++i ) {
+			for( int utf16 = 0; utf16 < 2; ++utf16 ) {
+				clock_t cstart = clock();
+				XMLDocument doc;
+				if ( utf16 ) {
+					doc.Parse( wide, 2 * length );
+				}
+				else {
+					doc.Parse( text.CStr(), length );
+				}
+				ticks[utf16] += clock() - cstart;
+				failed = failed || doc.Error();
+			}
+		}
+		delete[] wide;
+		XMLTest( "Parse dream.xml as UTF-16", false, failed );
+		printf( "Parsing dream.xml from UTF-16: %.3f milli-seconds (from UTF-8: %.3f)\n",
+				1000.0 * ticks[1] / CLOCKS_PER_SEC / COUNT, 1000.0 * ticks[0] / CLOCKS_PER_SEC / COUNT );
+	}
+
+	{
+		// UTF-8 validation throughput, on dream.xml and on text that is
+		// mostly multi-byte.
+		XMLDocument dream;
+		dream.LoadFile( "resources/dream.xml" );
+		XMLPrinter text;
+		dream.Print( &text );
+		const size_t length = text.CStrSize() - 1;
+		char* wide = new char[length];
+		for( size_t i = 0; i + 3 <= length; i += 3 ) {
+			memcpy( wide + i, ( i % 2 ) ? "\xE2\x82\xAC" : "\xC3\xA9" "a", 3 );
+		}
+		memset( wide + length - length % 3, 'a', length % 3 );
+
+		static const int COUNT = 1000;
+		clock_t ticks[2] = { 0, 0 };
+		int invalid = 0;
+		for( int kind = 0; kind < 2; ++kind ) {
+			const char* p = kind ? wide : text.CStr();
+			clock_t cstart = clock();
+			for( int i = 0; i < COUNT; ++i ) {
+				invalid += XMLUtil::FindInvalidUTF8( p, length ) ? 1 : 0;
+			}
+			ticks[kind] = clock() - cstart;
+		}
+		delete[] wide;
+		XMLTest( "Validate dream.xml", 0, invalid );
+
+		clock_t parseTicks[2] = { 0, 0 };
+		for( int i = 0; i < 10; ++i ) {
+			for( int validate = 0; validate < 2; ++validate ) {
+				clock_t cstart = clock();
+				XMLDocument doc;
+				doc.SetValidateUTF8( validate != 0 );
+				doc.Parse( text.CStr(), length );
+				parseTicks[validate] += clock() - cstart;
+			}
+		}
+		const double bytes = static_cast<double>( length ) * COUNT;
+		printf( "UTF-8 validation: %.2f GB/s on dream.xml, %.2f GB/s on multi-byte text; parse %.3f milli-seconds validated (%.3f not)\n",
+				ticks[0] ? bytes * CLOCKS_PER_SEC / ticks[0] / 1e9 : 0.0, ticks[1] ? bytes * CLOCKS_PER_SEC / ticks[1] / 1e9 : 0.0,
+				100.0 * parseTicks[1] / CLOCKS_PER_SEC, 100.0 * parseTicks[0] / CLOCKS_PER_SEC );
+	}
+
+	{
+		// Whitespace collapsing: dream.xml parsed and all of its text read,
+		// in each whitespace mode.
+		FILE* file = fopen( "resources/dream.xml", "rb" );
+		fseek( file, 0, SEEK_END );
+		const size_t length = ftell( file );
+		fseek( file, 0, SEEK_SET );
+		char* text = new char[length];
+		const size_t read = fread( text, 1, length, file );
+		fclose( file );
+
+		static const int COUNT = 10;
+		clock_t ticks[2] = { 0, 0 };
+		size_t bytes[2] = { 0, 0 };
+		for( int i = 0; i < COUNT; ++i ) {
+			for( int mode = 0; mode < 2; ++mode ) {
+				clock_t cstart = clock();
+				XMLDocument doc( true, mode ? COLLAPSE_WHITESPACE : PRESERVE_WHITESPACE );
+				doc.Parse( text, read );
+				for( XMLNode* node = doc.FirstChild(); node; ) {
+					if ( node->ToText() ) {
+						bytes[mode] += strlen( node->Value() );
+					}
+					if ( node->FirstChild() ) {
+						node = node->FirstChild();
+						continue;
+					}
+					while ( node && !node->NextSibling() ) {
+						node = node->Parent();
+					}
+					node = node ? node->NextSibling() : 0;
+				}
+				ticks[mode] += clock() - cstart;
+			}
+		}
+		delete[] text;
+		XMLTest( "Collapsed text is shorter", true, bytes[1] < bytes[0] );
+		printf( "Reading dream.xml text: %.3f milli-seconds collapsing whitespace (%.3f preserving)\n",
+				1000.0 * ticks[1] / CLOCKS_PER_SEC / COUNT, 1000.0 * ticks[0] / CLOCKS_PER_SEC / COUNT );
+	}
+
+	{
+		// Parsing a text heavy document: the parser no longer counts lines
+		// as it goes, so text is scanned for its end character only.
+		static const int COUNT = 10;
+		static const int PARAGRAPHS = 2000;
+		XMLPrinter source;
+		source.OpenElement( "book" );
+		for( int i = 0; i < PARAGRAPHS; ++i ) {
+			source.OpenElement( "p" );
+			source.PushAttribute( "id", i );
+			for( int j = 0; j < 20; ++j ) {
+				source.PushText( "The quick brown fox jumps over the lazy dog, again and again.\n" );
+			}
+			source.CloseElement();
+		}
+		source.CloseElement();
+
+		int parsed = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.Parse( source.CStr(), source.CStrSize() - 1 );
+			parsed += doc.Error() ? 0 : 1;
+		}
+		clock_t cend = clock();
+		XMLTest( "Text heavy parse", COUNT, parsed );
+		printf( "Parsing %d KB of text: %.3f milli-seconds\n",
+				source.CStrSize() / 1024, 1000.0 * ( cend - cstart ) / CLOCKS_PER_SEC / COUNT );
+	}
+
+	{
+		// Line tracking cost: a document of short lines, where the newline
+		// index is largest for its size.
+		static const int ITEMS = 10000;
+		XMLPrinter source;
+		source.OpenElement( "root" );
+		for( int i = 0; i < ITEMS; ++i ) {
+			source.OpenElement( "item" );
+			source.PushAttribute( "id", i );
+			source.OpenElement( "v" );
+			source.PushText( i );
+			source.CloseElement( true );
+			source.CloseElement();
+		}
+		source.CloseElement();
+
+		static const int COUNT = 10;
+		int line = 0;
+		int column = 0;
+		clock_t cstart = clock();
+		for( int i = 0; i < COUNT; ++i ) {
+			XMLDocument doc;
+			doc.Parse( source.CStr(), source.CStrSize() - 1 );
+			const XMLAttribute* id = doc.RootElement()->LastChildElement()->FindAttribute( "id" );
+			line = id->GetLineNum();
+			column = id->GetColumn();
+		}
+		clock_t cend = clock();
+		XMLTest( "Short lines: last line", 3 * ITEMS - 1, line );
+		XMLTest( "Short lines: last column", 11, column );
+		printf( "Parsing %d short lines: %.3f milli-seconds\n", 3 * ITEMS + 2, 1000.0 * ( cend - cstart ) / CLOCKS_PER_SEC / COUNT );
+	}
+}
+
+
 int main( int argc, const char ** argv )
 {
 	#if defined( _MSC_VER ) && defined( TINYXML2_DEBUG )
@@ -313,7 +1034,8 @@ int main( int argc, const char ** argv )
 		TIXMLASSERT( true );
 	}
 
-	if ( argc > 1 ) {
+	const bool benchmark = argc > 1 && strcmp( argv[1], "--benchmark" ) == 0;
+	if ( argc > 1 && !benchmark ) {
 		XMLDocument* doc = new XMLDocument();
 		clock_t startTime = clock();
 		doc->LoadFile( argv[1] );
@@ -345,6 +1067,11 @@ int main( int argc, const char ** argv )
 	}
 	fclose( fp );
 
+	if ( benchmark ) {
+		Benchmarks();
+		exit( 0 );
+	}
+
 	XMLTest( "Example_1", 0, example_1() );
 	XMLTest( "Example_2", 0, example_2() );
 	XMLTest( "Example_3", 0, example_3() );
@@ -2488,6 +3215,1586 @@ int main( int argc, const char ** argv )
     	doc.PrintError();
     }
 
+	{
+		// Printing to a caller-provided sink.
+		class FixedSink : public XMLOutputSink {
+		public:
+			FixedSink() : size( 0 ), overflow( false ) {}
+			virtual void Write( const char* data, size_t n ) {
+				if ( size + n >= sizeof( mem ) ) {
+					overflow = true;
+					return;
+				}
+				memcpy( mem + size, data, n );
+				size += n;
+				mem[size] = 0;
+			}
+			char mem[1024];
+			size_t size;
+			bool overflow;
+		};
+		const char* xml = "<root a=\"1\"><child>text &amp; more</child><!--c--></root>";
+		XMLDocument doc;
+		doc.Parse( xml );
+		XMLTest( "Sink: parse", false, doc.Error() );
+
+		FixedSink sink;
+		XMLPrinter sinkPrinter( sink );
+		doc.Print( &sinkPrinter );
+		XMLPrinter memPrinter;
+		doc.Print( &memPrinter );
+		XMLTest( "Sink: no overflow", false, sink.overflow );
+		XMLTest( "Sink: same output as memory", memPrinter.CStr(), sink.mem, false );
+		XMLTest( "Sink: CStr() stays empty", "", sinkPrinter.CStr() );
+
+		// Print() from a derived printer goes to the sink too, however long.
+		class SpacePrinter : public XMLPrinter {
+		public:
+			explicit SpacePrinter( XMLOutputSink& s ) : XMLPrinter( s ) {}
+			virtual void PrintSpace( int depth ) {
+				Print( "%*s", depth * 150, "" );
+			}
+		};
+		FixedSink spaceSink;
+		SpacePrinter spacePrinter( spaceSink );
+		doc.Print( &spacePrinter );
+		XMLTest( "Sink: Print() length", true, spaceSink.size > 150 && !spaceSink.overflow );
+		XMLTest( "Sink: Print() content", true, strstr( spaceSink.mem, "\n" ) != 0 && spaceSink.mem[200] == ' ' );
+	}
+
+	{
+		// Reserve() and ReleaseBuffer() for print to memory mode.
+		XMLPrinter printer;
+		XMLTest( "Printer: empty CStrSize", 1, printer.CStrSize() );
+		XMLTest( "Printer: empty CStrLength", true, printer.CStrLength() == 0 );
+
+		printer.Reserve( 4096 );
+		const char* reserved = printer.CStr();
+		for ( int i = 0; i < 100; ++i ) {
+			printer.OpenElement( "element" );
+			printer.PushAttribute( "index", i );
+			printer.CloseElement();
+		}
+		XMLTest( "Printer: Reserve() avoids reallocation", true, reserved == printer.CStr() );
+		XMLTest( "Printer: CStrLength", true, printer.CStrLength() == strlen( printer.CStr() ) );
+		XMLTest( "Printer: CStrSize", true, printer.CStrSize() == int( printer.CStrLength() + 1 ) );
+
+		const size_t expectedLength = printer.CStrLength();
+		size_t length = 0;
+		char* released = printer.ReleaseBuffer( &length );
+		XMLTest( "Printer: ReleaseBuffer() takes the buffer", true, released == reserved );
+		XMLTest( "Printer: ReleaseBuffer() length", true, length == expectedLength && released[length] == 0 );
+		XMLTest( "Printer: empty after ReleaseBuffer()", "", printer.CStr() );
+		delete [] released;
+
+		printer.ClearBuffer();
+		printer.OpenElement( "again" );
+		printer.CloseElement();
+		XMLTest( "Printer: usable after ReleaseBuffer()", "<again/>\n", printer.CStr(), false );
+
+		XMLPrinter empty;
+		char* nothing = empty.ReleaseBuffer();
+		XMLTest( "Printer: ReleaseBuffer() of nothing", "", nothing );
+		delete [] nothing;
+	}
+
+	// Integer formatting is done by hand now; make sure it matches printf.
+	{
+		char buf[32];
+		XMLUtil::ToStr( 0, buf, 32 );
+		XMLTest( "ToStr int 0", "0", buf );
+		XMLUtil::ToStr( -7, buf, 32 );
+		XMLTest( "ToStr int -7", "-7", buf );
+		XMLUtil::ToStr( INT_MIN, buf, 32 );
+		XMLTest( "ToStr INT_MIN", "-2147483648", buf );
+		XMLUtil::ToStr( UINT_MAX, buf, 32 );
+		XMLTest( "ToStr UINT_MAX", "4294967295", buf );
+		XMLUtil::ToStr( static_cast<int64_t>( -9223372036854775807LL - 1 ), buf, 32 );
+		XMLTest( "ToStr INT64_MIN", "-9223372036854775808", buf );
+		XMLUtil::ToStr( static_cast<uint64_t>( 18446744073709551615ULL ), buf, 32 );
+		XMLTest( "ToStr UINT64_MAX", "18446744073709551615", buf );
+		XMLUtil::ToStr( 1090, buf, 32 );
+		XMLTest( "ToStr int 1090", "1090", buf );
+		XMLUtil::ToStr( true, buf, 32 );
+		XMLTest( "ToStr true", "true", buf );
+
+		// Truncates like snprintf.
+		XMLUtil::ToStr( 123456, buf, 4 );
+		XMLTest( "ToStr truncates", "123", buf );
+
+		XMLPrinter printer;
+		printer.OpenElement( "a" );
+		printer.PushAttribute( "i", -12 );
+		printer.PushAttribute( "u", 34u );
+		printer.PushText( static_cast<int64_t>( 5678901234LL ) );
+		printer.CloseElement();
+		XMLTest( "Print numbers", "<a i=\"-12\" u=\"34\">5678901234</a>\n", printer.CStr() );
+
+		// Print() formats into the spare capacity and grows when it doesn't fit.
+		class RawPrinter : public XMLPrinter {
+		public:
+			void Raw( const char* s )	{ Print( "%s", s ); }
+			void Raw( int i )			{ Print( "%d", i ); }
+		};
+		RawPrinter big;
+		char text[1000];
+		memset( text, 'x', sizeof( text ) - 1 );
+		text[sizeof( text ) - 1] = 0;
+		big.Raw( "ab" );
+		big.Raw( text );
+		big.Raw( 42 );
+		XMLTest( "Print grows buffer", 1003, static_cast<int>( big.CStrLength() ) );
+		XMLTest( "Print grows buffer head", true, strncmp( big.CStr(), "abxxx", 5 ) == 0 );
+		XMLTest( "Print grows buffer tail", "x42", big.CStr() + 1000 );
+	}
+
+	// Integer parsing is hand-written; it keeps the sscanf forms and
+	// rejects values that overflow.
+	{
+		int i = 0;
+		unsigned u = 0;
+		int64_t i64 = 0;
+		uint64_t u64 = 0;
+		bool b = false;
+
+		XMLTest( "ToInt spaces and sign", true, XMLUtil::ToInt( " \t+42", &i ) );
+		XMLTest( "ToInt spaces and sign value", 42, i );
+		XMLTest( "ToInt trailing text", true, XMLUtil::ToInt( "-17px", &i ) );
+		XMLTest( "ToInt trailing text value", -17, i );
+		XMLTest( "ToInt INT_MIN", true, XMLUtil::ToInt( "-2147483648", &i ) );
+		XMLTest( "ToInt INT_MIN value", INT_MIN, i );
+		XMLTest( "ToInt overflow", false, XMLUtil::ToInt( "2147483648", &i ) );
+		XMLTest( "ToInt underflow", false, XMLUtil::ToInt( "-2147483649", &i ) );
+		XMLTest( "ToInt hex wraps", true, XMLUtil::ToInt( "0xFFFFFFFF", &i ) );
+		XMLTest( "ToInt hex wraps value", -1, i );
+		XMLTest( "ToInt hex overflow", false, XMLUtil::ToInt( "0x100000000", &i ) );
+		XMLTest( "ToInt no digits", false, XMLUtil::ToInt( "-", &i ) );
+		XMLTest( "ToInt no hex digits", false, XMLUtil::ToInt( "0x", &i ) );
+		XMLTest( "ToInt empty", false, XMLUtil::ToInt( "", &i ) );
+
+		XMLTest( "ToUnsigned max", true, XMLUtil::ToUnsigned( "4294967295", &u ) );
+		XMLTest( "ToUnsigned max value", UINT_MAX, u );
+		XMLTest( "ToUnsigned overflow", false, XMLUtil::ToUnsigned( "4294967296", &u ) );
+		XMLTest( "ToUnsigned negative", false, XMLUtil::ToUnsigned( "-1", &u ) );
+		XMLTest( "ToUnsigned hex", true, XMLUtil::ToUnsigned( "0xBeeF", &u ) );
+		XMLTest( "ToUnsigned hex value", 0xbeefu, u );
+
+		XMLTest( "ToInt64 min", true, XMLUtil::ToInt64( "-9223372036854775808", &i64 ) );
+		XMLTest( "ToInt64 min value", true, i64 == -9223372036854775807LL - 1 );
+		XMLTest( "ToInt64 overflow", false, XMLUtil::ToInt64( "9223372036854775808", &i64 ) );
+		XMLTest( "ToUnsigned64 max", true, XMLUtil::ToUnsigned64( "18446744073709551615", &u64 ) );
+		XMLTest( "ToUnsigned64 max value", true, u64 == 18446744073709551615ULL );
+		XMLTest( "ToUnsigned64 overflow", false, XMLUtil::ToUnsigned64( "18446744073709551616", &u64 ) );
+		XMLTest( "ToUnsigned64 hex overflow", false, XMLUtil::ToUnsigned64( "0x10000000000000000", &u64 ) );
+
+		XMLTest( "ToBool number", true, XMLUtil::ToBool( " 2", &b ) );
+		XMLTest( "ToBool number value", true, b );
+		XMLTest( "ToBool text", true, XMLUtil::ToBool( "False", &b ) );
+		XMLTest( "ToBool text value", false, b );
+
+		// The forms both accept give the same values.
+		static const char* const values[] = { "0", "42", "-17", "65535", "2147483647", " 1234567", "-99999", "0x1F" };
+		bool matches = true;
+		for ( size_t n = 0; n < sizeof( values ) / sizeof( values[0] ); ++n ) {
+			int scanned = 0;
+			if ( XMLUtil::IsPrefixHex( values[n] ) ) {
+				unsigned x = 0;
+				sscanf( values[n], "%x", &x );
+				scanned = static_cast<int>( x );
+			}
+			else {
+				sscanf( values[n], "%d", &scanned );
+			}
+			matches = matches && XMLUtil::ToInt( values[n], &i ) && i == scanned;
+		}
+		XMLTest( "ToInt matches sscanf", true, matches );
+
+		XMLDocument doc;
+		doc.Parse( "<a big='99999999999'>4294967296</a>" );
+		int v = 0;
+		XMLTest( "QueryIntAttribute overflow", XML_WRONG_ATTRIBUTE_TYPE, doc.FirstChildElement()->QueryIntAttribute( "big", &v ) );
+		XMLTest( "QueryUnsignedText overflow", XML_CAN_NOT_CONVERT_TEXT, doc.FirstChildElement()->QueryUnsignedText( &u ) );
+	}
+
+	// Floating point values print with the fewest digits that read back
+	// exactly, and parse without sscanf for plain decimals.
+	{
+		char buf[64];
+		XMLUtil::ToStr( 0.1, buf, 64 );
+		XMLTest( "ToStr double 0.1", "0.1", buf );
+		XMLUtil::ToStr( 1.0, buf, 64 );
+		XMLTest( "ToStr double 1", "1", buf );
+		XMLUtil::ToStr( -2.5, buf, 64 );
+		XMLTest( "ToStr double -2.5", "-2.5", buf );
+		XMLUtil::ToStr( 0.1 + 0.2, buf, 64 );
+		XMLTest( "ToStr double 0.1+0.2", "0.30000000000000004", buf );
+		XMLUtil::ToStr( 1e-5, buf, 64 );
+		XMLTest( "ToStr double 1e-5", "1e-05", buf );
+		XMLUtil::ToStr( 1e17, buf, 64 );
+		XMLTest( "ToStr double 1e17", "1e+17", buf );
+		XMLUtil::ToStr( 1.5e300, buf, 64 );
+		XMLTest( "ToStr double 1.5e300", "1.5e+300", buf );
+		XMLUtil::ToStr( 5e-324, buf, 64 );
+		XMLTest( "ToStr double denormal", "5e-324", buf );
+		XMLUtil::ToStr( -0.0, buf, 64 );
+		XMLTest( "ToStr double -0", "-0", buf );
+		XMLUtil::ToStr( 0.1f, buf, 64 );
+		XMLTest( "ToStr float 0.1", "0.1", buf );
+		XMLUtil::ToStr( 3.4028235e38f, buf, 64 );
+		XMLTest( "ToStr float max", "3.4028235e+38", buf );
+
+		double d = 0;
+		XMLTest( "ToDouble exponent", true, XMLUtil::ToDouble( " 1.5e3", &d ) );
+		XMLTest( "ToDouble exponent value", 1500.0, d );
+		XMLTest( "ToDouble fraction", true, XMLUtil::ToDouble( "-0.25", &d ) );
+		XMLTest( "ToDouble fraction value", -0.25, d );
+		XMLTest( "ToDouble trailing text", true, XMLUtil::ToDouble( "2.5px", &d ) );
+		XMLTest( "ToDouble trailing text value", 2.5, d );
+		XMLTest( "ToDouble long", true, XMLUtil::ToDouble( "0.30000000000000004", &d ) );
+		XMLTest( "ToDouble long value", true, d == 0.1 + 0.2 );
+		XMLTest( "ToDouble no digits", false, XMLUtil::ToDouble( ".", &d ) );
+		float f = 0;
+		XMLTest( "ToFloat", true, XMLUtil::ToFloat( "0.1", &f ) );
+		XMLTest( "ToFloat value", 0.1f, f );
+
+		// Every printed value reads back to itself.
+		bool roundTrip = true;
+		double v = 1.0 / 3.0;
+		for ( int i = 0; i < 1000; ++i ) {
+			v = v * -1.7 + 0.001 * i;
+			XMLUtil::ToStr( v, buf, 64 );
+			double back = 0;
+			roundTrip = roundTrip && XMLUtil::ToDouble( buf, &back ) && back == v;
+		}
+		XMLTest( "ToStr/ToDouble round trip", true, roundTrip );
+
+		// The same values as sscanf, with or without the fast path.
+		static const char* const values[] = { "0.5", "-12.25", "3.14159", "1e-3", "42", "6.02e23", "0.1", "1234.5678" };
+		bool matches = true;
+		for ( size_t n = 0; n < sizeof( values ) / sizeof( values[0] ); ++n ) {
+			double scanned = 0;
+			sscanf( values[n], "%lf", &scanned );
+			matches = matches && XMLUtil::ToDouble( values[n], &d ) && d == scanned;
+		}
+		XMLTest( "ToDouble matches sscanf", true, matches );
+
+		XMLDocument doc;
+		XMLElement* e = doc.NewElement( "e" );
+		doc.InsertEndChild( e );
+		e->SetAttribute( "d", 0.7 );
+		XMLTest( "Shortest double attribute", "0.7", e->Attribute( "d" ) );
+	}
+
+	// Numeric arrays in text and attributes.
+	{
+		XMLDocument doc;
+		doc.Parse( "<r ids=' 3 -4\t0x10 ' bad='1,2'><samples>\n 1.2 3.4 -5.6e2\n</samples><none/><odd>1 two</odd></r>" );
+		XMLTest( "Parse arrays", false, doc.Error() );
+		const XMLElement* root = doc.RootElement();
+
+		double d[4] = { 0, 0, 0, 0 };
+		int count = 4;
+		XMLTest( "QueryDoubleArrayText", XML_SUCCESS, root->FirstChildElement( "samples" )->QueryDoubleArrayText( d, &count ) );
+		XMLTest( "QueryDoubleArrayText count", 3, count );
+		XMLTest( "QueryDoubleArrayText values", true, d[0] == 1.2 && d[1] == 3.4 && d[2] == -560.0 );
+
+		count = 2;
+		XMLTest( "QueryDoubleArrayText too many", XML_CAN_NOT_CONVERT_TEXT, root->FirstChildElement( "samples" )->QueryDoubleArrayText( d, &count ) );
+		count = 4;
+		XMLTest( "QueryDoubleArrayText bad value", XML_CAN_NOT_CONVERT_TEXT, root->FirstChildElement( "odd" )->QueryDoubleArrayText( d, &count ) );
+		count = 4;
+		XMLTest( "QueryIntArrayText no text", XML_NO_TEXT_NODE, root->FirstChildElement( "none" )->QueryIntArrayText( 0, &count ) );
+
+		int ids[3] = { 0, 0, 0 };
+		count = 3;
+		XMLTest( "QueryIntArrayAttribute", XML_SUCCESS, root->QueryIntArrayAttribute( "ids", ids, &count ) );
+		XMLTest( "QueryIntArrayAttribute count", 3, count );
+		XMLTest( "QueryIntArrayAttribute values", true, ids[0] == 3 && ids[1] == -4 && ids[2] == 16 );
+		count = 3;
+		XMLTest( "QueryIntArrayAttribute separator", XML_WRONG_ATTRIBUTE_TYPE, root->QueryIntArrayAttribute( "bad", ids, &count ) );
+		XMLTest( "QueryIntArrayAttribute missing", XML_NO_ATTRIBUTE, root->QueryIntArrayAttribute( "none", ids, &count ) );
+
+		double empty[1];
+		count = 1;
+		XMLTest( "ToDoubleArray empty", true, XMLUtil::ToDoubleArray( "  ", empty, &count ) );
+		XMLTest( "ToDoubleArray empty count", 0, count );
+		count = 1;
+		XMLTest( "ToDoubleArray slow path", true, XMLUtil::ToDoubleArray( "1e400", empty, &count ) );
+
+		XMLPrinter printer;
+		const int iv[] = { 1, -2, 30 };
+		const double dv[] = { 0.5, 0.1, 1e-7 };
+		printer.OpenElement( "v" );
+		printer.OpenElement( "i" );
+		printer.PushText( iv, 3 );
+		printer.CloseElement();
+		printer.OpenElement( "d" );
+		printer.PushText( dv, 3 );
+		printer.CloseElement();
+		printer.CloseElement();
+		XMLTest( "PushText arrays", "<v>\n    <i>1 -2 30</i>\n    <d>0.5 0.1 1e-07</d>\n</v>\n", printer.CStr() );
+	}
+
+	// Cached typed attribute values.
+	{
+		XMLDocument doc;
+		doc.SetCacheAttributeValues( true );
+		doc.Parse( "<e i='12' d='2.5' h='0xFFFFFFFF' s='abc'/>" );
+		XMLTest( "Cached attributes parse", false, doc.Error() );
+		XMLElement* e = doc.RootElement();
+
+		XMLTest( "Cached int", 12, e->IntAttribute( "i" ) );
+		XMLTest( "Cached int again", 12, e->IntAttribute( "i" ) );
+		XMLTest( "Cached double", 2.5, e->DoubleAttribute( "d" ) );
+		// The cache is per type: the same text reads differently as int and unsigned.
+		XMLTest( "Cached hex as int", -1, e->IntAttribute( "h" ) );
+		XMLTest( "Cached hex as unsigned", UINT_MAX, e->UnsignedAttribute( "h" ) );
+		XMLTest( "Cached hex as int again", -1, e->IntAttribute( "h" ) );
+		int v = 0;
+		XMLTest( "Cached failed conversion", XML_WRONG_ATTRIBUTE_TYPE, e->QueryIntAttribute( "s", &v ) );
+		XMLTest( "Cached failed conversion again", XML_WRONG_ATTRIBUTE_TYPE, e->QueryIntAttribute( "s", &v ) );
+
+		e->SetAttribute( "i", 99 );
+		XMLTest( "Cache invalidated by SetAttribute", 99, e->IntAttribute( "i" ) );
+		e->SetAttribute( "i", "7" );
+		XMLTest( "Cache invalidated by string SetAttribute", 7, e->IntAttribute( "i" ) );
+
+		// Attributes added later, and deleted ones, use the pool too.
+		e->SetAttribute( "n", 3 );
+		XMLTest( "Cached new attribute", 3, e->IntAttribute( "n" ) );
+		e->DeleteAttribute( "n" );
+		XMLTest( "Cached deleted attribute", 0, e->IntAttribute( "n" ) );
+
+		XMLDocument plain;
+		plain.Parse( "<e i='12'/>" );
+		XMLTest( "Uncached int", 12, plain.RootElement()->IntAttribute( "i" ) );
+		XMLTest( "Caching defaults to off", false, plain.CacheAttributeValues() );
+	}
+
+	// Compiled path queries.
+	{
+		static const char* xml =
+			"<config>"
+			"  <server name='a'><port>1</port></server>"
+			"  <server name='x'><port>2</port><port>3</port></server>"
+			"  <group><server name='x'><port>4</port></server></group>"
+			"</config>";
+		XMLDocument doc;
+		doc.Parse( xml );
+		XMLTest( "Query document", false, doc.Error() );
+
+		XMLQuery port( "/config/server[@name='x']/port" );
+		XMLTest( "Query compiles", false, port.Error() );
+		XMLTest( "Query first", "2", port.First( &doc )->GetText() );
+		XMLTest( "Query count", 2, port.Count( &doc ) );
+		// Absolute paths resolve from the document, whatever the context.
+		XMLTest( "Query absolute from element", 2, port.Count( doc.RootElement()->LastChildElement() ) );
+
+		XMLTest( "Query descendant", 4, XMLQuery( "//port" ).Count( &doc ) );
+		XMLTest( "Query descendant with predicate", 3, XMLQuery( "//server[@name='x']//port" ).Count( &doc ) );
+		XMLTest( "Query has attribute", 3, XMLQuery( "//server[@name]" ).Count( &doc ) );
+		XMLTest( "Query wildcard", 3, XMLQuery( "/config/*" ).Count( &doc ) );
+		XMLTest( "Query position", "3", XMLQuery( "/config/server[2]/port[2]" ).First( &doc )->GetText() );
+		XMLTest( "Query position after predicate", "2", XMLQuery( "/config/server[@name][2]/port" ).First( &doc )->GetText() );
+		XMLTest( "Query predicate after position", 0, XMLQuery( "/config/server[2][@name='a']" ).Count( &doc ) );
+		XMLTest( "Query position per parent", 3, XMLQuery( "//port[1]" ).Count( &doc ) );
+		XMLTest( "Query relative", 3, XMLQuery( "server/port" ).Count( doc.RootElement() ) );
+		XMLTest( "Query no match", true, XMLQuery( "/config/missing" ).First( &doc ) == 0 );
+		XMLTest( "Query root mismatch", 0, XMLQuery( "/server" ).Count( &doc ) );
+
+		XMLTest( "Query bad path", true, XMLQuery( "/config/" ).Error() );
+		XMLTest( "Query bad predicate", true, XMLQuery( "a[@b='c]" ).Error() );
+		XMLTest( "Query bad position", true, XMLQuery( "a[0]" ).Error() );
+		XMLTest( "Query empty", true, XMLQuery( "" ).Error() );
+		XMLTest( "Query error never matches", 0, XMLQuery( "//port[" ).Count( &doc ) );
+
+		// A handler sees matches in order and can stop early.
+		class Collect : public XMLQueryHandler {
+		public:
+			Collect() : _n( 0 ) { _text[0] = 0; }
+			virtual bool Match( const XMLElement& element ) {
+				strcat( _text, element.GetText() );
+				return ++_n < 3;
+			}
+			int _n;
+			char _text[16];
+		};
+		Collect collect;
+		XMLTest( "Query handler stops", false, XMLQuery( "//port" ).Evaluate( &doc, &collect ) );
+		XMLTest( "Query handler order", "123", collect._text );
+	}
+
+	// Subtree filters: only matching subtrees are built.
+	{
+		static const char* xml =
+			"<?xml version='1.0'?>\n"
+			"<!DOCTYPE feed [ <!ELEMENT feed ANY> ]>\n"
+			"<feed>\n"
+			"  <title>skipped <b>text</b></title>\n"
+			"  <!-- <entry>not an entry</entry> -->\n"
+			"  <![CDATA[ <entry> ]]>\n"
+			"  <entry id='1' note='a > b'><t>one</t></entry>\n"
+			"  <meta><entry id='2'/></meta>\n"
+			"  <entry id='3'><entry id='4'/></entry>\n"
+			"</feed>";
+
+		XMLDocument doc;
+		XMLTest( "Filter accepted", true, doc.AddSubtreeFilter( "/feed/entry" ) );
+		XMLTest( "Filter with predicate refused", false, doc.AddSubtreeFilter( "/feed/entry[@id]" ) );
+		doc.Parse( xml );
+		XMLTest( "Filtered parse", false, doc.Error() );
+		XMLTest( "Filtered first", "1", doc.FirstChildElement( "entry" )->Attribute( "id" ) );
+		XMLTest( "Filtered first line", 7, doc.FirstChildElement( "entry" )->GetLineNum() );
+		XMLTest( "Filtered content", "one", doc.FirstChildElement( "entry" )->FirstChildElement( "t" )->GetText() );
+		XMLTest( "Filtered second", "3", doc.LastChildElement()->Attribute( "id" ) );
+		XMLTest( "Filtered nested match stays inside", "4", doc.LastChildElement()->FirstChildElement()->Attribute( "id" ) );
+		int count = 0;
+		for( const XMLNode* node = doc.FirstChild(); node; node = node->NextSibling() ) {
+			++count;
+		}
+		XMLTest( "Filtered top level count", 2, count );
+
+		// Relative filters match at any depth; filters survive re-parsing.
+		XMLDocument any;
+		any.AddSubtreeFilter( "entry" );
+		any.Parse( xml );
+		any.Parse( xml );
+		count = 0;
+		for( const XMLElement* e = any.FirstChildElement(); e; e = e->NextSiblingElement() ) {
+			++count;
+		}
+		XMLTest( "Filtered anywhere", 3, count );
+
+		// A handler gets the subtrees one at a time, and can stop.
+		class Entries : public XMLSubtreeHandler {
+		public:
+			Entries() : _count( 0 ) { _ids[0] = 0; }
+			virtual bool Subtree( XMLElement* element ) {
+				strcat( _ids, element->Attribute( "id" ) );
+				return ++_count < 2;
+			}
+			int _count;
+			char _ids[8];
+		};
+		Entries entries;
+		XMLDocument handled;
+		handled.AddSubtreeFilter( "//entry" );
+		handled.SetSubtreeHandler( &entries );
+		handled.Parse( xml );
+		XMLTest( "Filter handler", false, handled.Error() );
+		XMLTest( "Filter handler subtrees", "12", entries._ids );
+		XMLTest( "Filter handler keeps nothing", true, handled.NoChildren() );
+
+		XMLDocument bad;
+		bad.AddSubtreeFilter( "/a/b" );
+		bad.Parse( "<a>\n<c></d></a>" );
+		XMLTest( "Filter scan mismatch", XML_ERROR_MISMATCHED_ELEMENT, bad.ErrorID() );
+		XMLTest( "Filter scan mismatch line", 2, bad.ErrorLineNum() );
+		bad.Parse( "<a><b><c></b></a>" );
+		XMLTest( "Filter subtree mismatch", XML_ERROR_MISMATCHED_ELEMENT, bad.ErrorID() );
+		bad.Parse( "<a><!-- open" );
+		XMLTest( "Filter unterminated comment", XML_ERROR_PARSING_COMMENT, bad.ErrorID() );
+		bad.ClearSubtreeFilters();
+		bad.Parse( "<a><b/></a>" );
+		XMLTest( "Filters cleared", "a", bad.RootElement()->Name() );
+	}
+
+	// Lazy parsing builds children on first access.
+	{
+		XMLDocument eager;
+		eager.LoadFile( "resources/dream.xml" );
+		XMLPrinter eagerOut;
+		eager.Print( &eagerOut );
+
+		XMLDocument lazy;
+		lazy.SetLazyParse( true );
+		lazy.LoadFile( "resources/dream.xml" );
+		XMLTest( "Lazy load", false, lazy.Error() );
+		XMLTest( "Lazy root", "PLAY", lazy.RootElement()->Name() );
+		const XMLElement* title = lazy.RootElement()->FirstChildElement( "TITLE" );
+		XMLTest( "Lazy title", "A Midsummer Night's Dream", title->GetText() );
+		XMLTest( "Lazy line numbers", eager.RootElement()->FirstChildElement( "TITLE" )->GetLineNum(), title->GetLineNum() );
+		XMLTest( "Lazy last speech line", eager.RootElement()->LastChildElement()->LastChildElement()->GetLineNum(),
+				 lazy.RootElement()->LastChildElement()->LastChildElement()->GetLineNum() );
+
+		XMLPrinter lazyOut;
+		lazy.Print( &lazyOut );
+		XMLTest( "Lazy prints like eager", eagerOut.CStr(), lazyOut.CStr() );
+
+		XMLDocument doc;
+		doc.SetLazyParse( true );
+		doc.Parse( "<a><b x='1'><c/>text</b><d><e/></d></a>" );
+		XMLTest( "Lazy small", false, doc.Error() );
+		XMLElement* b = doc.RootElement()->FirstChildElement( "b" );
+		XMLElement* d = b->NextSiblingElement( "d" );
+		// Inserting into, and deleting, unparsed content.
+		d->InsertEndChild( doc.NewElement( "f" ) );
+		XMLTest( "Lazy insert keeps content", "e", d->FirstChildElement()->Name() );
+		XMLTest( "Lazy insert appends", "f", d->LastChildElement()->Name() );
+		b->DeleteChildren();
+		XMLTest( "Lazy delete children", true, b->NoChildren() );
+		XMLPrinter printer( 0, true );
+		doc.Print( &printer );
+		XMLTest( "Lazy edited", "<a><b x=\"1\"/><d><e/><f/></d></a>", printer.CStr() );
+
+		// Structure errors are found up front, the others on access.
+		doc.Parse( "<a><b></c></a>" );
+		XMLTest( "Lazy mismatch", XML_ERROR_MISMATCHED_ELEMENT, doc.ErrorID() );
+		doc.Parse( "<a>\n<b>\n<c x=></c></b></a>" );
+		XMLTest( "Lazy deferred error", false, doc.Error() );
+		doc.RootElement()->FirstChildElement()->FirstChild();
+		XMLTest( "Lazy error on access", XML_ERROR_PARSING_ATTRIBUTE, doc.ErrorID() );
+		XMLTest( "Lazy error line", 3, doc.ErrorLineNum() );
+	}
+
+	// Binary images reload the same document.
+	{
+		XMLDocument doc;
+		doc.LoadFile( "resources/dream.xml" );
+		XMLTest( "Save binary", XML_SUCCESS, doc.SaveBinary( "resources/out/dream.bin" ) );
+
+		XMLDocument loaded;
+		XMLTest( "Load binary", XML_SUCCESS, loaded.LoadBinary( "resources/out/dream.bin" ) );
+		XMLPrinter original;
+		doc.Print( &original );
+		XMLPrinter reloaded;
+		loaded.Print( &reloaded );
+		XMLTest( "Binary round trip", original.CStr(), reloaded.CStr() );
+		XMLTest( "Binary line numbers", doc.RootElement()->LastChildElement()->LastChildElement()->GetLineNum(),
+				 loaded.RootElement()->LastChildElement()->LastChildElement()->GetLineNum() );
+
+		static const char* xml =
+			"<?xml version='1.0'?>\n"
+			"<!-- comment -->\n"
+			"<a x='&lt;1&gt;' y=''>\n"
+			"  <![CDATA[<raw>]]>text &amp; more<b/>\n"
+			"</a>";
+		doc.Parse( xml );
+		doc.SaveBinary( "resources/out/small.bin" );
+		loaded.LoadBinary( "resources/out/small.bin" );
+		XMLTest( "Binary small", false, loaded.Error() );
+		XMLTest( "Binary attribute", "<1>", loaded.RootElement()->Attribute( "x" ) );
+		XMLTest( "Binary empty attribute", "", loaded.RootElement()->Attribute( "y" ) );
+		XMLTest( "Binary attribute line", 3, loaded.RootElement()->FindAttribute( "y" )->GetLineNum() );
+		XMLTest( "Binary CDATA", true, loaded.RootElement()->FirstChild()->ToText()->CData() );
+		XMLPrinter smallOriginal;
+		doc.Print( &smallOriginal );
+		XMLPrinter smallReloaded;
+		loaded.Print( &smallReloaded );
+		XMLTest( "Binary small round trip", smallOriginal.CStr(), smallReloaded.CStr() );
+
+		// Editing a loaded document.
+		loaded.RootElement()->SetAttribute( "x", 2 );
+		loaded.RootElement()->InsertNewChildElement( "c" );
+		XMLTest( "Binary edit", 2, loaded.RootElement()->IntAttribute( "x" ) );
+
+		// Anything but an intact image is rejected.
+		loaded.LoadBinary( "resources/dream.xml" );
+		XMLTest( "Binary rejects XML", XML_ERROR_PARSING, loaded.ErrorID() );
+		FILE* image = fopen( "resources/out/small.bin", "rb" );
+		char bytes[4096];
+		const size_t size = fread( bytes, 1, sizeof( bytes ), image );
+		fclose( image );
+		int rejected = 0;
+		for( size_t length = 0; length < size; ++length ) {
+			FILE* truncated = fopen( "resources/out/truncated.bin", "wb" );
+			fwrite( bytes, 1, length, truncated );
+			fclose( truncated );
+			rejected += loaded.LoadBinary( "resources/out/truncated.bin" ) != XML_SUCCESS ? 1 : 0;
+		}
+		XMLTest( "Binary rejects truncated images", (int)size, rejected );
+		XMLTest( "Binary missing file", XML_ERROR_FILE_NOT_FOUND, loaded.LoadBinary( "resources/out/nothing.bin" ) );
+	}
+
+	// Frozen documents are read in place.
+	{
+		XMLDocument doc;
+		doc.LoadFile( "resources/dream.xml" );
+		XMLTest( "Save frozen", XML_SUCCESS, doc.SaveFrozen( "resources/out/dream.txf" ) );
+
+		XMLFrozenDocument frozen;
+		XMLTest( "Load frozen", XML_SUCCESS, frozen.LoadFile( "resources/out/dream.txf" ) );
+
+		// Walk both documents in document order.
+		const XMLNode* node = doc.FirstChild();
+		XMLFrozenNode view = frozen.Document().FirstChild();
+		int nodes = 1;
+		bool same = true;
+		while ( node && same ) {
+			same = view.Valid() && strcmp( node->Value(), view.Value() ) == 0 && node->GetLineNum() == view.GetLineNum()
+				   && ( node->ToElement() != 0 ) == view.IsElement() && ( node->ToText() != 0 ) == view.IsText();
+			if ( node->ToElement() ) {
+				const XMLAttribute* a = node->ToElement()->FirstAttribute();
+				XMLFrozenAttribute b = view.FirstAttribute();
+				for( ; a && b.Valid(); a = a->Next(), b = b.Next() ) {
+					same = same && strcmp( a->Name(), b.Name() ) == 0 && strcmp( a->Value(), b.Value() ) == 0;
+				}
+				same = same && !a && !b.Valid();
+			}
+			++nodes;
+			if ( node->FirstChild() ) {
+				node = node->FirstChild();
+				view = view.FirstChild();
+			}
+			else {
+				while ( node && !node->NextSibling() ) {
+					node = node->Parent();
+					view = view.Parent();
+				}
+				if ( node ) {
+					node = node->NextSibling();
+					view = view.NextSibling();
+				}
+			}
+		}
+		XMLTest( "Frozen matches the document", true, same );
+		XMLTest( "Frozen node count", nodes, frozen.NodeCount() );
+		XMLTest( "Frozen root", "PLAY", frozen.RootElement().Name() );
+		XMLTest( "Frozen document value", true, frozen.Document().Value() == 0 );
+
+		doc.Parse( "<?xml version='1.0'?><a n='-3' big='18446744073709551615' on='true' f='1.5'>"
+				   "<b>7</b><c><![CDATA[x]]></c><b>nope</b><d/></a>" );
+		FILE* frozenFile = fopen( "resources/out/small.txf", "wb" );
+		doc.SaveFrozen( frozenFile );
+		fclose( frozenFile );
+		frozenFile = fopen( "resources/out/small.txf", "rb" );
+		char image[4096];
+		const size_t size = fread( image, 1, sizeof( image ), frozenFile );
+		fclose( frozenFile );
+
+		XMLFrozenDocument small;
+		XMLTest( "Open frozen", XML_SUCCESS, small.Open( image, size ) );
+		XMLFrozenNode a = small.FirstChildElement( "a" );
+		XMLTest( "Frozen declaration", true, small.Document().FirstChild().IsDeclaration() );
+		XMLTest( "Frozen int attribute", -3, a.IntAttribute( "n" ) );
+		XMLTest( "Frozen unsigned64 attribute", (uint64_t)18446744073709551615ULL, a.Unsigned64Attribute( "big" ) );
+		XMLTest( "Frozen bool attribute", true, a.BoolAttribute( "on" ) );
+		XMLTest( "Frozen float attribute", 1.5f, a.FloatAttribute( "f" ) );
+		XMLTest( "Frozen default attribute", 9, a.IntAttribute( "none", 9 ) );
+		unsigned u = 0;
+		XMLTest( "Frozen wrong attribute type", XML_WRONG_ATTRIBUTE_TYPE, a.QueryUnsignedAttribute( "n", &u ) );
+		XMLTest( "Frozen no attribute", XML_NO_ATTRIBUTE, a.QueryUnsignedAttribute( "none", &u ) );
+		XMLTest( "Frozen attribute value", "true", a.Attribute( "on", "true" ) );
+		XMLTest( "Frozen attribute other value", true, a.Attribute( "on", "false" ) == 0 );
+
+		int i = 0;
+		XMLTest( "Frozen int text", XML_SUCCESS, a.FirstChildElement( "b" ).QueryIntText( &i ) );
+		XMLTest( "Frozen int text value", 7, i );
+		XMLTest( "Frozen text not a number", XML_CAN_NOT_CONVERT_TEXT, a.LastChildElement( "b" ).QueryIntText( &i ) );
+		XMLTest( "Frozen no text", XML_NO_TEXT_NODE, a.LastChildElement().QueryIntText( &i ) );
+		XMLTest( "Frozen CDATA", true, a.FirstChildElement( "c" ).FirstChild().CData() );
+		XMLTest( "Frozen previous sibling", "c", a.LastChildElement( "b" ).PreviousSiblingElement().Name() );
+		XMLTest( "Frozen next sibling", "d", a.FirstChildElement( "b" ).NextSiblingElement( "d" ).Name() );
+		XMLTest( "Frozen missing element", false, a.FirstChildElement( "z" ).FirstChildElement().Valid() );
+		XMLTest( "Frozen null node", true, a.FirstChildElement( "z" ).Name() == 0 );
+
+		// Anything but an intact image is rejected.
+		int rejected = 0;
+		for( size_t length = 0; length < size; ++length ) {
+			rejected += small.Open( image, length ) != XML_SUCCESS ? 1 : 0;
+		}
+		XMLTest( "Frozen rejects truncated images", (int)size, rejected );
+
+		// Links out of document order, which the writer never makes, are
+		// not followed: d's next sibling pointing back to b, and b's
+		// previous sibling pointing on to d.
+		static const int NODE_SIZE = 40;
+		char* const d = image + 20 + 9 * NODE_SIZE;
+		char* const b = image + 20 + 3 * NODE_SIZE;
+		XMLTest( "Frozen record of d", "d", small.Open( image, size ) == XML_SUCCESS ? small.FirstChildElement( "a" ).LastChildElement().Name() : 0 );
+		d[7 * 4] = 3;
+		d[7 * 4 + 1] = d[7 * 4 + 2] = d[7 * 4 + 3] = 0;
+		b[6 * 4] = 9;
+		b[6 * 4 + 1] = b[6 * 4 + 2] = b[6 * 4 + 3] = 0;
+		small.Open( image, size );
+		XMLTest( "Frozen next link backwards", false, small.FirstChildElement( "a" ).FirstChildElement( "z" ).Valid() );
+		XMLTest( "Frozen previous link forwards", false, small.FirstChildElement( "a" ).FirstChildElement().PreviousSibling().Valid() );
+		b[7 * 4] = 3;
+		small.Open( image, size );
+		XMLTest( "Frozen next link to itself", false, small.FirstChildElement( "a" ).FirstChildElement().NextSibling().Valid() );
+		XMLTest( "Frozen rejects binary images", XML_ERROR_PARSING, small.LoadFile( "resources/out/small.bin" ) );
+		XMLTest( "Frozen missing file", XML_ERROR_FILE_NOT_FOUND, small.LoadFile( "resources/out/nothing.txf" ) );
+	}
+
+	// Canonical XML.
+	{
+		static const char* xml =
+			"<?xml version=\"1.0\"?>\n"
+			"<?xml-stylesheet   href=\"doc.xsl\"\n   type=\"text/xsl\"   ?>\n"
+			"<?pi-without-data     ?>\n"
+			"<!DOCTYPE doc SYSTEM \"doc.dtd\">\n"
+			"<doc>Hello, world!<!-- Comment 1 --></doc>\n"
+			"<!-- Comment 2 -->\n"
+			"<!-- Comment 3 -->";
+		XMLDocument doc;
+		doc.Parse( xml );
+		XMLCanonicalPrinter withComments( 0, true );
+		doc.Accept( &withComments );
+		XMLTest( "C14N with comments",
+				 "<?xml-stylesheet href=\"doc.xsl\"\n   type=\"text/xsl\"   ?>\n"
+				 "<?pi-without-data?>\n"
+				 "<doc>Hello, world!<!-- Comment 1 --></doc>\n"
+				 "<!-- Comment 2 -->\n"
+				 "<!-- Comment 3 -->", withComments.CStr() );
+		XMLCanonicalPrinter withoutComments;
+		doc.Accept( &withoutComments );
+		XMLTest( "C14N without comments",
+				 "<?xml-stylesheet href=\"doc.xsl\"\n   type=\"text/xsl\"   ?>\n"
+				 "<?pi-without-data?>\n"
+				 "<doc>Hello, world!</doc>", withoutComments.CStr() );
+
+		// Start and end tags, attribute order, redundant namespace declarations.
+		doc.Parse( "<doc><e1   /><e2 xmlns=\"\"/>"
+				   "<e5 a:attr=\"out\" b:attr=\"sorted\" attr2=\"all\" attr=\"I'm\" "
+				   "xmlns:b=\"http://www.ietf.org\" xmlns:a=\"http://www.w3.org\" xmlns=\"http://example.org\"/>"
+				   "<e7 xmlns=\"http://www.ietf.org\"><e8 xmlns=\"\"><e9 xmlns=\"\" xmlns:a=\"http://www.ietf.org\"/></e8>"
+				   "<e10 xmlns=\"http://www.ietf.org\"/></e7></doc>" );
+		XMLCanonicalPrinter c14n;
+		doc.Accept( &c14n );
+		XMLTest( "C14N elements and attributes",
+				 "<doc><e1></e1><e2></e2>"
+				 "<e5 xmlns=\"http://example.org\" xmlns:a=\"http://www.w3.org\" xmlns:b=\"http://www.ietf.org\" "
+				 "attr=\"I'm\" attr2=\"all\" b:attr=\"sorted\" a:attr=\"out\"></e5>"
+				 "<e7 xmlns=\"http://www.ietf.org\"><e8 xmlns=\"\"><e9 xmlns:a=\"http://www.ietf.org\"></e9></e8>"
+				 "<e10></e10></e7></doc>", c14n.CStr() );
+
+		// Escaping; CDATA becomes text.
+		doc.Parse( "<a b='\"&lt;&#x9;&#xA;&#xD;>&amp;'>&amp; &lt; &gt; \"q\" &#xD;<![CDATA[<x>&]]></a>" );
+		XMLCanonicalPrinter escaped;
+		doc.Accept( &escaped );
+		XMLTest( "C14N escaping", "<a b=\"&quot;&lt;&#x9;&#xA;&#xD;>&amp;\">&amp; &lt; &gt; \"q\" &#xD;&lt;x&gt;&amp;</a>",
+				 escaped.CStr() );
+
+		// Without entity processing, the references are written as characters.
+		XMLDocument raw( false );
+		raw.Parse( "<a b='x &amp; y &#x41;'>p &lt; q &amp;amp; &#xD; &unknown;<![CDATA[&amp;]]></a>" );
+		XMLCanonicalPrinter rawEscaped;
+		raw.Accept( &rawEscaped );
+		XMLTest( "C14N without entity processing", "<a b=\"x &amp; y A\">p &lt; q &amp;amp; &#xD; &amp;unknown;&amp;amp;</a>",
+				 rawEscaped.CStr() );
+		XMLCanonicalPrinter rawSubtree;
+		raw.RootElement()->Accept( &rawSubtree );
+		XMLTest( "C14N subtree without entity processing", rawEscaped.CStr(), rawSubtree.CStr() );
+
+		// A subtree carries the namespaces and xml: attributes it inherits.
+		doc.Parse( "<r xmlns:p='u' xmlns:q='v' xml:lang='en'><s p:x='1' xmlns:q='v'><t xmlns:p='u'/></s></r>" );
+		XMLCanonicalPrinter subtree;
+		doc.RootElement()->FirstChildElement()->Accept( &subtree );
+		XMLTest( "C14N subtree", "<s xmlns:p=\"u\" xmlns:q=\"v\" xml:lang=\"en\" p:x=\"1\"><t></t></s>", subtree.CStr() );
+
+		// To a sink, in one pass.
+		class StringSink : public XMLOutputSink {
+		public:
+			StringSink() : size( 0 ) {
+				mem[0] = 0;
+			}
+			virtual void Write( const char* data, size_t n ) {
+				if ( size + n < sizeof( mem ) ) {
+					memcpy( mem + size, data, n );
+					size += n;
+					mem[size] = 0;
+				}
+			}
+			char mem[1024];
+			size_t size;
+		};
+		StringSink sink;
+		XMLCanonicalPrinter sinkPrinter( sink );
+		doc.Accept( &sinkPrinter );
+		XMLCanonicalPrinter memPrinter;
+		doc.Accept( &memPrinter );
+		XMLTest( "C14N to a sink", memPrinter.CStr(), sink.mem );
+	}
+
+	// Hashing subtrees.
+	{
+		XMLTest( "XXH64 empty", (uint64_t)0xEF46DB3751D8E999ULL, XMLHasher::HashBytes( "", 0 ) );
+		XMLTest( "XXH64 abc", (uint64_t)0x44BC2CF5AD770999ULL, XMLHasher::HashBytes( "abc", 3 ) );
+		unsigned char bytes[1000];
+		for( int i = 0; i < 1000; ++i ) {
+			bytes[i] = (unsigned char)i;
+		}
+		XMLTest( "XXH64 long", (uint64_t)0x6EF436B00EBA4078ULL, XMLHasher::HashBytes( bytes, sizeof( bytes ) ) );
+		XMLTest( "XXH64 seed", (uint64_t)0x5697DAF2CCBFC5FBULL, XMLHasher::HashBytes( bytes, sizeof( bytes ), 2654435761U ) );
+
+		XMLDocument a;
+		a.Parse( "<r><s x='1' y='2'>text</s><t/></r>" );
+		XMLDocument b;
+		b.Parse( "<r><s y='2' x='1'><![CDATA[text]]></s><t/></r>" );
+		XMLTest( "Hash ignores attribute order and CDATA", XMLHasher::HashNode( a ), XMLHasher::HashNode( b ) );
+		XMLTest( "Hash of the root", XMLHasher::HashNode( *a.RootElement() ), a.RootElement()->SubtreeHash() );
+		XMLTest( "Hash seed", true, XMLHasher::HashNode( a, 1 ) != XMLHasher::HashNode( a ) );
+		b.Parse( "<r><s x='1' y='2'>text.</s><t/></r>" );
+		XMLTest( "Hash sees text", true, XMLHasher::HashNode( a ) != XMLHasher::HashNode( b ) );
+		b.Parse( "<r><s x='1' y='3'>text</s><t/></r>" );
+		XMLTest( "Hash sees attributes", true, XMLHasher::HashNode( a ) != XMLHasher::HashNode( b ) );
+		b.Parse( "<r><s x='1' y='2'>text</s><t/><!--c--></r>" );
+		XMLTest( "Hash sees comments", true, XMLHasher::HashNode( a ) != XMLHasher::HashNode( b ) );
+		b.Parse( "<r><s x='1' y='2'>tex</s>t<t/></r>" );
+		XMLTest( "Hash sees structure", true, XMLHasher::HashNode( a ) != XMLHasher::HashNode( b ) );
+
+		// Cached hashes follow every kind of change.
+		XMLDocument doc;
+		doc.LoadFile( "resources/dream.xml" );
+		XMLElement* root = doc.RootElement();
+		const uint64_t original = root->SubtreeHash();
+		XMLElement* line = root->LastChildElement( "ACT" )->LastChildElement( "SCENE" )->LastChildElement( "SPEECH" )->LastChildElement( "LINE" );
+		int changes = 0;
+		int rehashed = 0;
+		for( int change = 0; change < 8; ++change ) {
+			switch ( change ) {
+				case 0: line->SetText( "Give me your hands, if we be friends," ); break;
+				case 1: line->SetAttribute( "n", 1 ); break;
+				case 2: line->DeleteAttribute( "n" ); break;
+				case 3: line->SetName( "VERSE" ); break;
+				case 4: line->InsertEndChild( doc.NewComment( "c" ) ); break;
+				case 5: line->DeleteChild( line->LastChild() ); break;
+				case 6: root->InsertEndChild( line->FirstChild() ); break;
+				default: line->DeleteChildren(); break;
+			}
+			XMLPrinter printer;
+			doc.Print( &printer );
+			XMLDocument fresh;
+			fresh.Parse( printer.CStr() );
+			changes += root->SubtreeHash() != original ? 1 : 0;
+			rehashed += root->SubtreeHash() == fresh.RootElement()->SubtreeHash() ? 1 : 0;
+		}
+		XMLTest( "Subtree hash changes", 8, changes );
+		XMLTest( "Subtree hash matches a fresh document", 8, rehashed );
+		XMLTest( "Hasher uses the cache", root->SubtreeHash(), XMLHasher::HashNode( *root ) );
+	}
+
+	// Diffing documents.
+	{
+		XMLDocument a;
+		a.Parse( "<r a='1' b='2'><x>t</x><y/></r>" );
+		XMLDocument b;
+		b.Parse( "<r a='1' b='2'><x>t</x><y/></r>" );
+		XMLDiff diff;
+		XMLTest( "Diff of equal documents", true, diff.Compare( a, b ) );
+		XMLTest( "Diff of equal documents is empty", 0, diff.EditCount() );
+
+		b.Parse( "<r c='3' a='1'><x>u</x><z/><y/></r>" );
+		XMLTest( "Diff", true, diff.Compare( a, b ) );
+		XMLTest( "Diff edit count", 4, diff.EditCount() );
+		if ( diff.EditCount() == 4 ) {
+			XMLTest( "Diff delete attribute", (int)XML_EDIT_DELETE_ATTRIBUTE, (int)diff.Edit( 0 ).type );
+			XMLTest( "Diff delete attribute path", "/0", diff.Edit( 0 ).path );
+			XMLTest( "Diff delete attribute name", "b", diff.Edit( 0 ).name );
+			XMLTest( "Diff set attribute", (int)XML_EDIT_SET_ATTRIBUTE, (int)diff.Edit( 1 ).type );
+			XMLTest( "Diff set attribute name", "c", diff.Edit( 1 ).name );
+			XMLTest( "Diff set attribute value", "3", diff.Edit( 1 ).value );
+			XMLTest( "Diff set text", (int)XML_EDIT_SET_TEXT, (int)diff.Edit( 2 ).type );
+			XMLTest( "Diff set text path", "/0/0/0", diff.Edit( 2 ).path );
+			XMLTest( "Diff set text value", "u", diff.Edit( 2 ).value );
+			XMLTest( "Diff insert", (int)XML_EDIT_INSERT, (int)diff.Edit( 3 ).type );
+			XMLTest( "Diff insert path", "/0/1", diff.Edit( 3 ).path );
+			XMLTest( "Diff insert node", "z", diff.Edit( 3 ).node->Value() );
+		}
+
+		// Identical children are kept in place; the paths follow the edits.
+		a.Parse( "<r><a/><b/><c/></r>" );
+		b.Parse( "<r><c/><a/></r>" );
+		diff.Compare( a, b );
+		XMLTest( "Diff reorder edit count", 3, diff.EditCount() );
+		if ( diff.EditCount() == 3 ) {
+			XMLTest( "Diff reorder delete", (int)XML_EDIT_DELETE, (int)diff.Edit( 0 ).type );
+			XMLTest( "Diff reorder delete path", "/0/0", diff.Edit( 0 ).path );
+			XMLTest( "Diff reorder delete again", "/0/0", diff.Edit( 1 ).path );
+			XMLTest( "Diff reorder insert", (int)XML_EDIT_INSERT, (int)diff.Edit( 2 ).type );
+			XMLTest( "Diff reorder insert path", "/0/1", diff.Edit( 2 ).path );
+		}
+
+		XMLTest( "Diff of different elements", false, diff.Compare( *a.RootElement()->FirstChild(), *a.RootElement()->LastChild() ) );
+		XMLTest( "Diff of different elements has no edits", 0, diff.EditCount() );
+		XMLTest( "Diff of elements", true, diff.Compare( *a.RootElement(), *b.RootElement() ) );
+		XMLTest( "Diff of elements path", "/0", diff.Edit( 0 ).path );
+
+		// Only an attribute name differs.
+		a.Parse( "<r><b x='1'/></r>" );
+		b.Parse( "<r><b y='1'/></r>" );
+		diff.Compare( a, b );
+		XMLTest( "Diff of renamed attribute", 2, diff.EditCount() );
+		if ( diff.EditCount() == 2 ) {
+			XMLTest( "Diff of renamed attribute delete", "x", diff.Edit( 0 ).name );
+			XMLTest( "Diff of renamed attribute set", "y", diff.Edit( 1 ).name );
+		}
+
+		// A few changes deep in dream.xml.
+		XMLDocument live;
+		live.LoadFile( "resources/dream.xml" );
+		XMLDocument fetched;
+		live.DeepCopy( &fetched );
+		XMLElement* act = fetched.RootElement()->LastChildElement( "ACT" );
+		act->LastChildElement( "SCENE" )->LastChildElement( "SPEECH" )->LastChildElement( "LINE" )->SetText( "Robin shall restore amends." );
+		act->FirstChildElement( "SCENE" )->DeleteChild( act->FirstChildElement( "SCENE" )->FirstChildElement( "SPEECH" ) );
+		act->SetAttribute( "n", 5 );
+		diff.Compare( live, fetched );
+		XMLTest( "Diff of dream.xml", 3, diff.EditCount() );
+		if ( diff.EditCount() == 3 ) {
+			XMLTest( "Diff of dream.xml attribute", (int)XML_EDIT_SET_ATTRIBUTE, (int)diff.Edit( 0 ).type );
+			XMLTest( "Diff of dream.xml delete", (int)XML_EDIT_DELETE, (int)diff.Edit( 1 ).type );
+			XMLTest( "Diff of dream.xml text", (int)XML_EDIT_SET_TEXT, (int)diff.Edit( 2 ).type );
+			XMLTest( "Diff of dream.xml text value", "Robin shall restore amends.", diff.Edit( 2 ).value );
+		}
+	}
+
+	// Applying edit scripts.
+	{
+		static const char* pairs[] = {
+			"<r a='1' b='2'><x>t</x><y/></r>", "<r c='3' a='1'><x>u</x><z/><y/></r>",
+			"<r><a/><b/><c/></r>", "<r><c/><a/></r>",
+			"<r><a/><b/><c/></r>", "<r/>",
+			"<r/>", "<r><!--c--><a>1</a>text<b/></r>",
+			"<r><a><b>1</b></a><c/></r>", "<r><c/><a><b>2</b><b>3</b></a></r>",
+			"<r/><!--after-->", "<!--before--><r x='1'/>",
+			"<r><b x='1'/></r>", "<r><b y='1'/></r>",
+			"<r a='1' b='2'/>", "<r b='1' a='2'/>"
+		};
+		int applied = 0;
+		for( int i = 0; i < (int)( sizeof( pairs ) / sizeof( pairs[0] ) ); i += 2 ) {
+			XMLDocument from;
+			from.Parse( pairs[i] );
+			XMLDocument to;
+			to.Parse( pairs[i + 1] );
+			XMLDiff diff;
+			diff.Compare( from, to );
+			XMLError error = from.ApplyEdits( diff );
+			applied += ( error == XML_SUCCESS && XMLHasher::HashNode( from ) == XMLHasher::HashNode( to ) ) ? 1 : 0;
+		}
+		XMLTest( "Apply edits", (int)( sizeof( pairs ) / sizeof( pairs[0] ) ) / 2, applied );
+
+		// Many changes to dream.xml.
+		XMLDocument live;
+		live.LoadFile( "resources/dream.xml" );
+		XMLDocument fetched;
+		live.DeepCopy( &fetched );
+		XMLElement* play = fetched.RootElement();
+		int n = 0;
+		for( XMLElement* act = play->FirstChildElement( "ACT" ); act; act = act->NextSiblingElement( "ACT" ) ) {
+			for( XMLElement* scene = act->FirstChildElement( "SCENE" ); scene; scene = scene->NextSiblingElement( "SCENE" ) ) {
+				XMLElement* speech = scene->FirstChildElement( "SPEECH" );
+				speech->FirstChildElement( "LINE" )->SetText( n );
+				speech->SetAttribute( "n", n );
+				scene->DeleteChild( scene->LastChildElement( "SPEECH" ) );
+				scene->InsertFirstChild( scene->LastChildElement( "SPEECH" ) );
+				++n;
+			}
+		}
+		play->InsertEndChild( fetched.NewComment( "end" ) );
+		XMLDiff diff;
+		diff.Compare( live, fetched );
+		XMLTest( "Apply dream.xml edits", XML_SUCCESS, live.ApplyEdits( diff ) );
+		XMLTest( "Applied dream.xml edits", play->SubtreeHash(), live.RootElement()->SubtreeHash() );
+		diff.Compare( live, fetched );
+		XMLTest( "Applied dream.xml edits leave no difference", 0, diff.EditCount() );
+
+		// Edits from elsewhere.
+		XMLDocument doc;
+		doc.Parse( "<r><a/></r>" );
+		XMLDocument source;
+		source.Parse( "<b x='1'><c/></b>" );
+		XMLEdit edits[3];
+		edits[0].type = XML_EDIT_INSERT;
+		edits[0].path = "/0/0";
+		edits[0].name = 0;
+		edits[0].value = 0;
+		edits[0].node = source.RootElement();
+		edits[1].type = XML_EDIT_SET_ATTRIBUTE;
+		edits[1].path = "/0/1";
+		edits[1].name = "y";
+		edits[1].value = "2";
+		edits[1].node = 0;
+		edits[2].type = XML_EDIT_SET_TEXT;
+		edits[2].path = "/0/1";
+		edits[2].name = 0;
+		edits[2].value = "text";
+		edits[2].node = 0;
+		XMLTest( "Apply invalid edit", XML_ERROR_INVALID_EDIT, doc.ApplyEdits( edits, 3 ) );
+		XMLTest( "Apply invalid edit keeps earlier edits", "b", doc.RootElement()->FirstChildElement()->Name() );
+		XMLTest( "Apply edit attribute", 2, doc.RootElement()->LastChildElement()->IntAttribute( "y" ) );
+		XMLTest( "Apply edit clears the error", XML_SUCCESS, doc.ApplyEdits( edits, 2 ) );
+		XMLTest( "Apply edit inserted twice", "a", doc.RootElement()->FirstChildElement()->NextSiblingElement()->NextSiblingElement()->Name() );
+		edits[0].path = "/0/9";
+		XMLTest( "Apply edit past the end", XML_ERROR_INVALID_EDIT, doc.ApplyEdits( edits, 1 ) );
+		edits[0].path = "0/0";
+		XMLTest( "Apply edit bad path", XML_ERROR_INVALID_EDIT, doc.ApplyEdits( edits, 1 ) );
+		edits[0].path = "";
+		XMLTest( "Apply edit insert at the top", XML_ERROR_INVALID_EDIT, doc.ApplyEdits( edits, 1 ) );
+		edits[0].type = XML_EDIT_DELETE;
+		edits[0].path = "/0/2";
+		XMLTest( "Apply edit delete", XML_SUCCESS, doc.ApplyEdits( edits, 1 ) );
+		XMLTest( "Apply edit deleted", "b", doc.RootElement()->LastChildElement()->Name() );
+		XMLTest( "Apply edit error name", "XML_ERROR_INVALID_EDIT", XMLDocument::ErrorIDToName( XML_ERROR_INVALID_EDIT ) );
+	}
+
+	// Moving subtrees between documents.
+	{
+		XMLDocument target;
+		XMLNode* moved = 0;
+		{
+			XMLDocument source;
+			source.Parse( "<batch><tenant id='a' note='x &amp; y'>one\r\ntwo<![CDATA[<raw>]]><!--c--><inner/></tenant><tenant id='b'/></batch>" );
+			XMLElement* tenant = source.RootElement()->FirstChildElement( "tenant" );
+			tenant->FirstChildElement( "inner" )->SetAttribute( "set", "later" );
+			tenant->SetUserData( &target );
+			moved = tenant->TransferTo( &target );
+			XMLTest( "Transfer removes the source", "b", source.RootElement()->FirstChildElement()->Attribute( "id" ) );
+			XMLTest( "Transfer gives a node of the target", true, moved->GetDocument() == &target );
+			XMLNode* other = source.RootElement()->FirstChild();
+			XMLTest( "Transfer within a document", true, other->TransferTo( &source ) == other );
+			XMLTest( "Transfer of an unlinked node", "c", source.NewElement( "c" )->TransferTo( &target )->Value() );
+			XMLTest( "Transfer of a document", true, source.TransferTo( &target ) == 0 );
+		}
+		target.InsertEndChild( moved );
+		XMLPrinter printer;
+		target.Print( &printer );
+		XMLTest( "Transfer outlives the source",
+				 "<tenant id=\"a\" note=\"x &amp; y\">one\ntwo<![CDATA[<raw>]]><!--c--><inner set=\"later\"/></tenant>\n",
+				 printer.CStr() );
+		XMLTest( "Transfer keeps user data", true, moved->GetUserData() == &target );
+		XMLTest( "Transfer keeps line numbers", 1, moved->GetLineNum() );
+
+		// Lazily parsed content is parsed before it is moved.
+		XMLDocument lazy;
+		lazy.SetLazyParse( true );
+		lazy.LoadFile( "resources/dream.xml" );
+		XMLDocument act;
+		XMLElement* first = lazy.RootElement()->FirstChildElement( "ACT" );
+		const uint64_t hash = first->SubtreeHash();
+		act.InsertEndChild( first->TransferTo( &act ) );
+		XMLTest( "Transfer lazy content", hash, act.RootElement()->SubtreeHash() );
+		lazy.Clear();
+		XMLTest( "Transfer lazy content outlives the source", "ACT I", act.RootElement()->FirstChildElement( "TITLE" )->GetText() );
+
+		// A node moved on again takes its strings from the string blocks
+		// of the document it passed through.
+		XMLDocument last;
+		{
+			XMLDocument middle;
+			middle.InsertEndChild( act.RootElement()->TransferTo( &middle ) );
+			XMLElement* passed = middle.RootElement();
+			passed->FirstChildElement( "TITLE" )->SetValue( "HEADING" );
+			last.InsertEndChild( passed->TransferTo( &last ) );
+		}
+		XMLTest( "Transfer twice", "ACT I", last.RootElement()->FirstChildElement( "HEADING" )->GetText() );
+		XMLTest( "Transfer twice, deeper", "THESEUS",
+				 last.RootElement()->FirstChildElement( "SCENE" )->FirstChildElement( "SPEECH" )->FirstChildElement( "SPEAKER" )->GetText() );
+
+		// Strings of clones are kept in blocks of their own.
+		XMLDocument end;
+		{
+			XMLDocument middle;
+			middle.InsertEndChild( last.RootElement()->DeepClone( &middle ) );
+			XMLElement* clone = middle.RootElement();
+			clone->FirstChildElement( "HEADING" )->SetValue( "TITLE" );
+			end.InsertEndChild( clone->TransferTo( &end ) );
+			last.Clear();
+		}
+		XMLTest( "Transfer a clone", "ACT I", end.RootElement()->FirstChildElement( "TITLE" )->GetText() );
+		XMLTest( "Transfer a clone, deeper", "THESEUS",
+				 end.RootElement()->FirstChildElement( "SCENE" )->FirstChildElement( "SPEECH" )->FirstChildElement( "SPEAKER" )->GetText() );
+	}
+
+	// Deep clones keep their strings in counted blocks of the target.
+	{
+		XMLDocument target;
+		XMLNode* clone = 0;
+		uint64_t hash = 0;
+		{
+			XMLDocument source;
+			source.Parse( "<r a='x &amp; y' b=''>one\r\ntwo<![CDATA[<raw>]]><!--c--><s/><t>&#x41;</t></r>" );
+			hash = source.RootElement()->SubtreeHash();
+			clone = source.RootElement()->DeepClone( &target );
+			XMLTest( "Clone keeps the source", "x & y", source.RootElement()->Attribute( "a" ) );
+		}
+		target.InsertEndChild( clone );
+		XMLTest( "Clone outlives the source", "x & y", target.RootElement()->Attribute( "a" ) );
+		XMLTest( "Clone empty attribute", "", target.RootElement()->Attribute( "b" ) );
+		XMLTest( "Clone text", "one\ntwo", target.RootElement()->FirstChild()->Value() );
+		XMLTest( "Clone CDATA", true, target.RootElement()->FirstChild()->NextSibling()->ToText()->CData() );
+		XMLTest( "Clone entity", "A", target.RootElement()->FirstChildElement( "t" )->GetText() );
+		XMLTest( "Clone hash", hash, target.RootElement()->SubtreeHash() );
+		XMLTest( "Clone hash of the copy", hash, XMLHasher::HashNode( *target.RootElement(), 0 ) );
+
+		// Clones within the document, and changes to them.
+		XMLElement* root = target.RootElement();
+		for( int i = 0; i < 100; ++i ) {
+			XMLElement* copy = root->FirstChildElement( "s" )->DeepClone( 0 )->ToElement();
+			copy->SetAttribute( "i", i );
+			root->InsertEndChild( copy );
+		}
+		XMLTest( "Clones in the document", 99, root->LastChildElement( "s" )->IntAttribute( "i" ) );
+		XMLTest( "Clones leave the original", false, root->FirstChildElement( "s" )->Attribute( "i" ) != 0 );
+		XMLTest( "Clone of a document", true, target.DeepClone( &target ) == 0 );
+	}
+	{
+		// Deleting a clone gives its strings back.
+		XMLDocument source;
+		source.LoadFile( "resources/dream.xml" );
+		const XMLElement* act = source.RootElement()->FirstChildElement( "ACT" );
+		XMLDocument target;
+		XMLElement* root = target.NewElement( "r" );
+		target.InsertEndChild( root );
+		root->InsertEndChild( act->DeepClone( &target ) );
+		root->DeleteChildren();
+		const long before = ResidentKilobytes();
+		for( int i = 0; i < 1000; ++i ) {
+			XMLNode* clone = root->InsertEndChild( act->DeepClone( &target ) );
+			clone->ToElement()->FirstChildElement( "TITLE" )->SetText( i );
+			root->DeleteChild( clone );
+		}
+		const long after = ResidentKilobytes();
+		XMLTest( "Clone and delete in bounded memory", true, before < 0 || after - before < 4 * 1024 );
+		root->InsertEndChild( act->DeepClone( &target ) );
+		XMLTest( "Clone after deleted clones", "ACT I", root->FirstChildElement()->FirstChildElement( "TITLE" )->GetText() );
+	}
+	{
+		// Strings longer than a block, and lazily parsed elements, some empty.
+		static const int LONG = 100 * 1000;
+		char* xml = new char[LONG + 64];
+		strcpy( xml, "<r><a><e></e><e/></a><b>" );
+		memset( xml + strlen( xml ), 'x', LONG );
+		strcpy( xml + strlen( "<r><a><e></e><e/></a><b>" ) + LONG, "</b><c/></r>" );
+		XMLDocument source;
+		source.SetLazyParse( true );
+		source.Parse( xml );
+		delete [] xml;
+
+		XMLDocument target;
+		target.InsertEndChild( source.RootElement()->DeepClone( &target ) );
+		XMLTest( "Clone of a long string", LONG, (int)strlen( target.RootElement()->FirstChildElement( "b" )->GetText() ) );
+		XMLTest( "Clone of an empty lazy element", true, target.RootElement()->FirstChildElement( "a" )->FirstChildElement( "e" )->NoChildren() );
+		XMLTest( "Clone after an empty lazy element", true, target.RootElement()->LastChildElement( "c" ) != 0 );
+	}
+
+	// Copy-on-write snapshots of a document.
+	{
+		static const char* xml =
+			"<?xml version='1.0'?>"
+			"<page title='x &amp; y'><head><meta k='1'/></head>"
+			"<body><p class='a'>one</p><p class='b'>two<![CDATA[<raw>]]></p><!--c--></body></page>";
+		XMLDocument source;
+		source.Parse( xml );
+		XMLPrinter original;
+		source.Print( &original );
+
+		XMLDocument snapshot;
+		source.Snapshot( &snapshot );
+		XMLPrinter printer;
+		snapshot.Print( &printer );
+		XMLTest( "Snapshot prints as the source", original.CStr(), printer.CStr() );
+		XMLTest( "Snapshot shares strings", true,
+				 snapshot.RootElement()->Attribute( "title" ) == source.RootElement()->Attribute( "title" ) );
+		XMLTest( "Snapshot hash", source.RootElement()->SubtreeHash(), snapshot.RootElement()->SubtreeHash() );
+		XMLTest( "Snapshot line numbers", 1, snapshot.RootElement()->FirstChildElement( "body" )->GetLineNum() );
+
+		XMLElement* body = snapshot.RootElement()->FirstChildElement( "body" );
+		body->FirstChildElement( "p" )->SetAttribute( "class", "changed" );
+		body->LastChildElement( "p" )->SetText( "three" );
+		snapshot.RootElement()->FirstChildElement( "head" )->DeleteChildren();
+		body->InsertEndChild( snapshot.NewElement( "added" ) );
+		XMLPrinter changed;
+		snapshot.Print( &changed );
+		XMLTest( "Snapshot changed",
+				 "<?xml version='1.0'?>\n<page title=\"x &amp; y\">\n    <head/>\n    <body>\n"
+				 "        <p class=\"changed\">one</p>\n        <p class=\"b\">three<![CDATA[<raw>]]></p>\n"
+				 "        <!--c-->\n        <added/>\n    </body>\n</page>\n",
+				 changed.CStr() );
+		XMLTest( "Snapshot changed hash", XMLHasher::HashNode( *snapshot.RootElement(), 0 ), snapshot.RootElement()->SubtreeHash() );
+		XMLPrinter unchanged;
+		source.Print( &unchanged );
+		XMLTest( "Snapshot leaves the source", original.CStr(), unchanged.CStr() );
+
+		// Snapshots of snapshots see the changes of their own source.
+		XMLDocument second;
+		snapshot.Snapshot( &second );
+		XMLPrinter secondPrinter;
+		second.Print( &secondPrinter );
+		XMLTest( "Snapshot of a snapshot", changed.CStr(), secondPrinter.CStr() );
+		second.RootElement()->DeleteChild( second.RootElement()->FirstChildElement( "body" ) );
+		XMLTest( "Snapshot of a snapshot changed", true, second.RootElement()->FirstChildElement( "body" ) == 0 );
+		XMLTest( "Snapshot of a snapshot leaves its source", true, snapshot.RootElement()->FirstChildElement( "body" ) != 0 );
+
+		// Nodes taken out of a snapshot copy what they share.
+		XMLDocument other;
+		other.InsertEndChild( snapshot.RootElement()->FirstChildElement( "body" )->DeepClone( &other ) );
+		other.InsertEndChild( snapshot.RootElement()->FirstChildElement( "head" )->TransferTo( &other ) );
+		snapshot.Clear();
+		XMLTest( "Snapshot clone", "changed", other.FirstChildElement( "body" )->FirstChildElement( "p" )->Attribute( "class" ) );
+		XMLTest( "Snapshot cleared", true, snapshot.NoChildren() );
+
+		// Lazily parsed sources are parsed as snapshots reach into them.
+		XMLDocument lazy;
+		lazy.SetLazyParse( true );
+		lazy.LoadFile( "resources/dream.xml" );
+		XMLDocument lazySnapshot;
+		lazy.Snapshot( &lazySnapshot );
+		XMLElement* speaker = lazySnapshot.RootElement()->FirstChildElement( "ACT" )->FirstChildElement( "SCENE" )
+			->FirstChildElement( "SPEECH" )->FirstChildElement( "SPEAKER" );
+		XMLTest( "Snapshot of lazy content", "THESEUS", speaker->GetText() );
+		speaker->SetText( "HIPPOLYTA" );
+		XMLTest( "Snapshot of lazy content changed", "THESEUS",
+				 lazy.RootElement()->FirstChildElement( "ACT" )->FirstChildElement( "SCENE" )
+				 ->FirstChildElement( "SPEECH" )->FirstChildElement( "SPEAKER" )->GetText() );
+		source.Snapshot( &source );
+		XMLPrinter itself;
+		source.Print( &itself );
+		XMLTest( "Snapshot of itself", original.CStr(), itself.CStr() );
+	}
+
+	// Namespaces.
+	{
+		static const char* xml =
+			"<soap:Envelope xmlns:soap='http://schemas.xmlsoap.org/soap/envelope/' xmlns='urn:default'>"
+			"<soap:Body soap:encodingStyle='enc' style='plain'>"
+			"<item id='1'/><other:item xmlns:other='urn:other' other:id='2' xml:lang='en'/>"
+			"<item xmlns='' id='3'><inner/></item>"
+			"<soap:item xmlns:soap='urn:redeclared'/>"
+			"</soap:Body></soap:Envelope>";
+		XMLDocument plain;
+		plain.Parse( xml );
+		XMLTest( "Namespaces off", true, plain.RootElement()->NamespaceURI() == 0 );
+
+		XMLDocument doc;
+		doc.SetNamespaces( true );
+		doc.Parse( xml );
+		XMLTest( "Namespaces parse", false, doc.Error() );
+		XMLElement* envelope = doc.RootElement();
+		XMLTest( "Namespace of a prefix", "http://schemas.xmlsoap.org/soap/envelope/", envelope->NamespaceURI() );
+		XMLTest( "Namespace local name", "Envelope", envelope->LocalName() );
+		XMLElement* body = envelope->FirstChildElementNS( "http://schemas.xmlsoap.org/soap/envelope/", "Body" );
+		XMLTest( "Namespace lookup", true, body != 0 );
+		XMLTest( "Namespaces interned", true, body->NamespaceURI() == envelope->NamespaceURI() );
+		XMLTest( "Namespace interned lookup", true, doc.FindNamespaceURI( "http://schemas.xmlsoap.org/soap/envelope/" ) == body->NamespaceURI() );
+		XMLTest( "Namespace unknown", true, doc.FindNamespaceURI( "urn:unknown" ) == 0 );
+		XMLTest( "Namespace lookup unknown", true, envelope->FirstChildElementNS( "urn:unknown", "Body" ) == 0 );
+
+		const XMLElement* item = body->FirstChildElementNS( "urn:default", "item" );
+		XMLTest( "Namespace default", "1", item->Attribute( "id" ) );
+		item = item->NextSiblingElementNS( "urn:default", "item" );
+		XMLTest( "Namespace default, next", true, item == 0 );
+		item = body->FirstChildElementNS( "urn:other" );
+		XMLTest( "Namespace declared on the element", "item", item->LocalName() );
+		XMLTest( "Namespace attribute", "2", item->AttributeNS( "urn:other", "id" ) );
+		XMLTest( "Namespace xml prefix", "en", item->AttributeNS( "http://www.w3.org/XML/1998/namespace", "lang" ) );
+		XMLTest( "Namespace xmlns prefix", "urn:other", item->AttributeNS( "http://www.w3.org/2000/xmlns/", "other" ) );
+		item = body->FirstChildElementNS( 0, "item" );
+		XMLTest( "Namespace undeclared", "3", item->Attribute( "id" ) );
+		XMLTest( "Namespace undeclared, inside", true, item->FirstChildElement()->NamespaceURI() == 0 );
+		XMLTest( "Namespace redeclared", "urn:redeclared", body->LastChildElement()->NamespaceURI() );
+		XMLTest( "Namespace of an attribute", "enc", body->AttributeNS( "http://schemas.xmlsoap.org/soap/envelope/", "encodingStyle" ) );
+		XMLTest( "Namespace, none for attributes", "plain", body->AttributeNS( "", "style" ) );
+		XMLTest( "Namespace, not the default for attributes", true, body->AttributeNS( "urn:default", "style" ) == 0 );
+
+		// Changes after parsing.
+		body->FirstChildElement()->SetName( "soap:item" );
+		XMLTest( "Namespace after SetName", "http://schemas.xmlsoap.org/soap/envelope/", body->FirstChildElement()->NamespaceURI() );
+		XMLElement* added = body->InsertNewChildElement( "added:item" );
+		added->SetAttribute( "xmlns:added", "urn:added" );
+		XMLTest( "Namespace of a new element", true, added->NamespaceURI() == 0 );
+		doc.ResolveNamespaces();
+		XMLTest( "Namespace resolved again", "urn:added", added->NamespaceURI() );
+		XMLTest( "Namespace resolved again, interned", true,
+				 envelope->NamespaceURI() == doc.FindNamespaceURI( "http://schemas.xmlsoap.org/soap/envelope/" ) );
+		// A clone outside the tree keeps its declarations.
+		XMLElement* clone = body->FirstChildElementNS( "urn:other", "item" )->DeepClone( &doc )->ToElement();
+		doc.ResolveNamespaces();
+		XMLTest( "Namespace of an unlinked clone", "2", clone->AttributeNS( "urn:other", "id" ) );
+		clone->SetName( "other:renamed" );
+		XMLTest( "Namespace of a renamed unlinked clone", "urn:other", clone->NamespaceURI() );
+		doc.DeleteNode( clone );
+
+		// Declarations changed after parsing.
+		XMLElement* other = body->FirstChildElementNS( "urn:other" );
+		other->SetAttribute( "xmlns:other", "urn:changed" );
+		doc.ResolveNamespaces();
+		XMLTest( "Namespace declaration changed", "urn:changed", other->NamespaceURI() );
+		XMLTest( "Namespace declaration changed, attribute", "2", other->AttributeNS( "urn:changed", "id" ) );
+		other->SetAttribute( "xmlns:other", "urn:other" );
+		doc.ResolveNamespaces();
+		XMLTest( "Namespace declaration changed back", "urn:other", other->NamespaceURI() );
+
+		// Copies, snapshots and lazily parsed documents.
+		XMLDocument copy;
+		doc.DeepCopy( &copy );
+		XMLTest( "Namespaces of a copy", "urn:added", copy.RootElement()->FirstChildElement()->LastChildElement()->NamespaceURI() );
+		XMLDocument snapshot;
+		doc.Snapshot( &snapshot );
+		XMLTest( "Namespaces of a snapshot", true,
+				 snapshot.RootElement()->FirstChildElementNS( "http://schemas.xmlsoap.org/soap/envelope/", "Body" )
+				 ->FirstChildElementNS( "urn:other", "item" ) != 0 );
+		XMLDocument lazy;
+		lazy.SetNamespaces( true );
+		lazy.SetLazyParse( true );
+		lazy.Parse( xml );
+		XMLTest( "Namespaces of lazy content", "urn:redeclared", lazy.RootElement()->FirstChildElement()->LastChildElement()->NamespaceURI() );
+	}
+	{
+		// Resolving the namespaces again and again takes no more memory.
+		static const int ENTRIES = 2000;
+		static const char entry[] = "<entry xmlns:x='urn:x' x:id='1'><x:title xmlns:y='urn:y'>t</x:title></entry>";
+		char* xml = new char[ENTRIES * sizeof( entry ) + 64];
+		char* p = xml;
+		p += sprintf( p, "<feed xmlns='urn:feed'>" );
+		for( int i = 0; i < ENTRIES; ++i ) {
+			p += sprintf( p, "%s", entry );
+		}
+		sprintf( p, "</feed>" );
+		XMLDocument doc;
+		doc.SetNamespaces( true );
+		doc.Parse( xml );
+		delete [] xml;
+		doc.ResolveNamespaces();
+		const long before = ResidentKilobytes();
+		for( int i = 0; i < 200; ++i ) {
+			doc.ResolveNamespaces();
+		}
+		const long after = ResidentKilobytes();
+		XMLTest( "Namespaces resolved again in bounded memory", true, before < 0 || after - before < 1024 );
+		XMLTest( "Namespaces resolved again, last entry", "urn:x",
+				 doc.RootElement()->LastChildElement()->FirstChildElement()->NamespaceURI() );
+	}
+
+	// UTF-16 and Latin-1 input is decoded to UTF-8 on load.
+	{
+		// <r a='é'>x😀</r> with a BOM, then without, and a lone surrogate.
+		static const unsigned short units[] = {
+			0xFEFF, '<', 'r', ' ', 'a', '=', '\'', 0x00E9, '\'', '>', 'x', 0xD83D, 0xDE00, 0xD800, '<', '/', 'r', '>'
+		};
+		static const int count = sizeof( units ) / sizeof( units[0] );
+		char le[2 * count];
+		char be[2 * count];
+		for( int i = 0; i < count; ++i ) {
+			le[2 * i] = be[2 * i + 1] = static_cast<char>( units[i] & 0xFF );
+			le[2 * i + 1] = be[2 * i] = static_cast<char>( units[i] >> 8 );
+		}
+		const char* utf8Text = "x\xF0\x9F\x98\x80\xEF\xBF\xBD";
+
+		XMLDocument doc;
+		doc.Parse( le, sizeof( le ) );
+		XMLTest( "UTF-16LE with BOM", false, doc.Error() );
+		XMLTest( "UTF-16LE encoding", static_cast<int>( XML_ENCODING_UTF16LE ), static_cast<int>( doc.InputEncoding() ) );
+		XMLTest( "UTF-16LE attribute", "\xC3\xA9", doc.RootElement()->Attribute( "a" ) );
+		XMLTest( "UTF-16LE text", utf8Text, doc.RootElement()->GetText() );
+
+		doc.Parse( be, sizeof( be ) );
+		XMLTest( "UTF-16BE with BOM", false, doc.Error() );
+		XMLTest( "UTF-16BE encoding", static_cast<int>( XML_ENCODING_UTF16BE ), static_cast<int>( doc.InputEncoding() ) );
+		XMLTest( "UTF-16BE attribute", "\xC3\xA9", doc.RootElement()->Attribute( "a" ) );
+		XMLTest( "UTF-16BE text", utf8Text, doc.RootElement()->GetText() );
+
+		doc.Parse( le + 2, sizeof( le ) - 2 );
+		XMLTest( "UTF-16LE without BOM", utf8Text, doc.RootElement()->GetText() );
+		doc.Parse( be + 2, sizeof( be ) - 2 );
+		XMLTest( "UTF-16BE without BOM", utf8Text, doc.RootElement()->GetText() );
+		XMLTest( "UTF-16 saves as UTF-8", false, doc.HasBOM() );
+
+		// Long ASCII runs take the fast path, and must stop at a wide character.
+		static const int length = 200;
+		char wide[4 * length + 32];
+		int n = 0;
+		const char* head = "<long>";
+		for( const char* q = head; *q; ++q ) {
+			wide[n++] = *q;
+			wide[n++] = 0;
+		}
+		for( int i = 0; i < length; ++i ) {
+			const unsigned short unit = ( i % 67 == 66 ) ? 0x20AC : static_cast<unsigned short>( 'a' + i % 26 );
+			wide[n++] = static_cast<char>( unit & 0xFF );
+			wide[n++] = static_cast<char>( unit >> 8 );
+		}
+		for( const char* q = "</long>"; *q; ++q ) {
+			wide[n++] = *q;
+			wide[n++] = 0;
+		}
+		doc.Parse( wide, n );
+		char expected[3 * length + 1];
+		int e = 0;
+		for( int i = 0; i < length; ++i ) {
+			if ( i % 67 == 66 ) {
+				expected[e++] = '\xE2';
+				expected[e++] = '\x82';
+				expected[e++] = '\xAC';
+			}
+			else {
+				expected[e++] = static_cast<char>( 'a' + i % 26 );
+			}
+		}
+		expected[e] = 0;
+		XMLTest( "UTF-16 long text", expected, doc.RootElement()->GetText() );
+
+		// Latin-1 is decoded when the declaration names it.
+		const char* latin1 = "<?xml version='1.0' encoding = \"iso-8859-1\"?><r a='\xE9'>caf\xE9 na\xEFve, \xBD of a long enough ASCII run</r>";
+		doc.Parse( latin1 );
+		XMLTest( "Latin-1", false, doc.Error() );
+		XMLTest( "Latin-1 encoding", static_cast<int>( XML_ENCODING_LATIN1 ), static_cast<int>( doc.InputEncoding() ) );
+		XMLTest( "Latin-1 attribute", "\xC3\xA9", doc.RootElement()->Attribute( "a" ) );
+		XMLTest( "Latin-1 text", "caf\xC3\xA9 na\xC3\xAFve, \xC2\xBD of a long enough ASCII run", doc.RootElement()->GetText() );
+
+		// Printed, the decoded text is declared as UTF-8, and reads back the same.
+		doc.Parse( "<?xml version='1.0' encoding='ISO-8859-1' standalone='yes'?><r a='\xE9'/>" );
+		XMLPrinter latin1Printer;
+		doc.Print( &latin1Printer );
+		XMLTest( "Latin-1 declared as UTF-8", "<?xml version='1.0' encoding='UTF-8' standalone='yes'?>\n<r a=\"\xC3\xA9\"/>\n", latin1Printer.CStr() );
+		doc.Parse( latin1Printer.CStr() );
+		XMLTest( "Latin-1 read back", "\xC3\xA9", doc.RootElement()->Attribute( "a" ) );
+		XMLTest( "Latin-1 read back as UTF-8", static_cast<int>( XML_ENCODING_UTF8 ), static_cast<int>( doc.InputEncoding() ) );
+		const char* declared = "\xFF\xFE<\0?\0x\0m\0l\0 \0e\0n\0c\0o\0d\0i\0n\0g\0=\0'\0U\0T\0F\0-\0" "1\0" "6\0'\0?\0>\0<\0r\0/\0>\0";
+		doc.Parse( declared, 2 + 2 * strlen( "<?xml encoding='UTF-16'?><r/>" ) );
+		XMLTest( "UTF-16 declared as UTF-8", "xml encoding='UTF-8'", doc.FirstChild()->Value() );
+
+		doc.Parse( "<?xml version='1.0' encoding='UTF-8'?><r>caf\xC3\xA9</r>" );
+		XMLTest( "UTF-8 encoding", static_cast<int>( XML_ENCODING_UTF8 ), static_cast<int>( doc.InputEncoding() ) );
+		XMLTest( "UTF-8 text", "caf\xC3\xA9", doc.RootElement()->GetText() );
+
+		// Files are decoded in place.
+		FILE* out = fopen( "resources/out/utf16.xml", "wb" );
+		fwrite( be, 1, sizeof( be ), out );
+		fclose( out );
+		doc.LoadFile( "resources/out/utf16.xml" );
+		XMLTest( "UTF-16 file", utf8Text, doc.RootElement()->GetText() );
+		XMLTest( "UTF-16 file encoding", static_cast<int>( XML_ENCODING_UTF16BE ), static_cast<int>( doc.InputEncoding() ) );
+		out = fopen( "resources/out/latin1.xml", "wb" );
+		fputs( latin1, out );
+		fclose( out );
+		doc.LoadFile( "resources/out/latin1.xml" );
+		XMLTest( "Latin-1 file", "\xC3\xA9", doc.RootElement()->Attribute( "a" ) );
+		doc.Clear();
+		XMLTest( "Encoding cleared", static_cast<int>( XML_ENCODING_UTF8 ), static_cast<int>( doc.InputEncoding() ) );
+	}
+
+	// Optional UTF-8 validation.
+	{
+		const char* valid = "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80 \xF4\x8F\xBF\xBF";
+		XMLTest( "Valid UTF-8", true, XMLUtil::FindInvalidUTF8( valid, strlen( valid ) ) == 0 );
+		static const char* const invalid[] = {
+			"\x80",					// lone continuation
+			"\xC0\xAF",				// overlong '/'
+			"\xC1\xBF",				// overlong
+			"\xE0\x9F\xBF",			// overlong 3 byte
+			"\xED\xA0\x80",			// surrogate
+			"\xF0\x8F\xBF\xBF",		// overlong 4 byte
+			"\xF4\x90\x80\x80",		// past U+10FFFF
+			"\xF5\x80\x80\x80",		// bad lead
+			"\xE2\x82",				// truncated
+			"\xE2\x28\xA1",			// bad continuation
+			"\xFF"
+		};
+		bool allFound = true;
+		for( size_t i = 0; i < sizeof( invalid ) / sizeof( invalid[0] ); ++i ) {
+			const char* bad = invalid[i];
+			allFound = allFound && XMLUtil::FindInvalidUTF8( bad, strlen( bad ) ) == bad;
+		}
+		XMLTest( "Invalid UTF-8 found", true, allFound );
+
+		// Errors past a long ASCII run, and sequences across 64 byte blocks.
+		char text[300];
+		for( int i = 0; i < 299; ++i ) {
+			text[i] = static_cast<char>( 'a' + i % 26 );
+		}
+		text[299] = 0;
+		text[63] = '\xE2';
+		text[64] = '\x82';
+		text[65] = '\xAC';
+		XMLTest( "Valid UTF-8 across blocks", true, XMLUtil::FindInvalidUTF8( text, 299 ) == 0 );
+		text[250] = '\xC3';
+		XMLTest( "Invalid UTF-8 after ASCII", true, XMLUtil::FindInvalidUTF8( text, 299 ) == text + 250 );
+		XMLTest( "Truncated UTF-8 at the end", true, XMLUtil::FindInvalidUTF8( text, 251 ) == text + 250 );
+
+		XMLDocument doc;
+		const char* xml = "<r>\n<a>caf\xC3\xA9</a>\n<b>caf\xE9</b>\n</r>";
+		doc.Parse( xml );
+		XMLTest( "Not validated by default", false, doc.Error() );
+		doc.SetValidateUTF8( true );
+		doc.Parse( xml );
+		XMLTest( "Invalid UTF-8 error", XML_ERROR_INVALID_UTF8, doc.ErrorID() );
+		XMLTest( "Invalid UTF-8 line", 3, doc.ErrorLineNum() );
+		XMLTest( "Invalid UTF-8 name", "XML_ERROR_INVALID_UTF8", doc.ErrorName() );
+		doc.Parse( "\xEF\xBB\xBF<r>caf\xC3\xA9</r>" );
+		XMLTest( "Valid UTF-8 with BOM", false, doc.Error() );
+		doc.Parse( "<?xml version='1.0' encoding='ISO-8859-1'?><r>caf\xE9</r>" );
+		XMLTest( "Latin-1 is valid once decoded", false, doc.Error() );
+	}
+
+	// Whitespace is collapsed in the same pass as entities and newlines.
+	{
+		XMLDocument doc( true, COLLAPSE_WHITESPACE );
+		doc.Parse( "<r><a>\r\n  one\r\n\r\n\ttwo  </a><b>&#32;x &#10; y&#x20;</b><c>&#32;&#9;</c>"
+				   "<d> &lt; &#x4e2d; &amp; </d><e>p <i>q</i>\n r </e></r>" );
+		XMLElement* root = doc.RootElement();
+		XMLTest( "Collapse newlines", "one two", root->FirstChildElement( "a" )->GetText() );
+		XMLTest( "Collapse entity whitespace", "x y", root->FirstChildElement( "b" )->GetText() );
+		XMLTest( "Collapse to nothing", "", root->FirstChildElement( "c" )->GetText() );
+		XMLTest( "Collapse around entities", "< \xE4\xB8\xAD &", root->FirstChildElement( "d" )->GetText() );
+		XMLTest( "Collapse mixed content", "r", root->FirstChildElement( "e" )->LastChild()->Value() );
+		XMLTest( "No whitespace-only text nodes", true, root->FirstChildElement( "e" )->FirstChild()->NextSibling()->ToElement() != 0 );
+
+		XMLDocument leave( false, COLLAPSE_WHITESPACE );
+		leave.Parse( "<a>  x &amp;  y\n</a>" );
+		XMLTest( "Collapse leaving entities", "x &amp; y", leave.RootElement()->GetText() );
+	}
+
+	// Columns, from the newline index built before parsing.
+	{
+		const char* xml =
+			"<?xml version='1.0'?>\n"
+			"<root a='1'\n"
+			"      b='2'>  text\n"
+			"\t<child/><!--c--><![CDATA[x]]>\r\n"
+			"  <last   c = '3'/></root>";
+		XMLDocument doc;
+		doc.Parse( xml );
+		XMLElement* root = doc.RootElement();
+		XMLTest( "Declaration column", 1, doc.FirstChild()->GetColumn() );
+		XMLTest( "Element column", 1, root->GetColumn() );
+		XMLTest( "Attribute column", 7, root->FindAttribute( "a" )->GetColumn() );
+		XMLTest( "Attribute line", 3, root->FindAttribute( "b" )->GetLineNum() );
+		XMLTest( "Next line attribute column", 7, root->FindAttribute( "b" )->GetColumn() );
+		XMLTest( "Text column", 15, root->FirstChild()->GetColumn() );
+		XMLElement* child = root->FirstChildElement( "child" );
+		XMLTest( "Column after a tab", 2, child->GetColumn() );
+		XMLTest( "Comment column", 10, child->NextSibling()->GetColumn() );
+		XMLTest( "CDATA column", 18, child->NextSibling()->NextSibling()->GetColumn() );
+		XMLElement* last = root->LastChildElement();
+		XMLTest( "Line after CRLF", 5, last->GetLineNum() );
+		XMLTest( "Column after CRLF", 3, last->GetColumn() );
+		XMLTest( "Spaced attribute column", 11, last->FindAttribute( "c" )->GetColumn() );
+		XMLTest( "New nodes have no column", 0, doc.NewElement( "new" )->GetColumn() );
+
+		// Lazy parsing jumps back to earlier positions.
+		XMLDocument lazy;
+		lazy.SetLazyParse( true );
+		lazy.Parse( xml );
+		XMLElement* lazyLast = lazy.RootElement()->LastChildElement();
+		XMLTest( "Lazy column", 3, lazyLast->GetColumn() );
+		XMLTest( "Lazy line", 5, lazyLast->GetLineNum() );
+		XMLTest( "Lazy earlier column", 2, lazy.RootElement()->FirstChildElement( "child" )->GetColumn() );
+
+		XMLDocument target;
+		XMLNode* moved = last->TransferTo( &target );
+		target.InsertEndChild( moved );
+		XMLTest( "Transfer keeps columns", 3, moved->GetColumn() );
+
+		// Long lines, past the few lines looked at before searching.
+		XMLDocument dream;
+		dream.LoadFile( "resources/dream.xml" );
+		const XMLElement* speech = dream.RootElement()->LastChildElement()->LastChildElement();
+		XMLTest( "dream.xml line", 3622, speech->GetLineNum() );
+		XMLTest( "dream.xml column", 1, speech->GetColumn() );
+
+		// Too deep: the line of the content that went past the limit.
+		DynArray< char, 1024 > nested;
+		for( int i = 0; i <= TINYXML2_MAX_ELEMENT_DEPTH; ++i ) {
+			memcpy( nested.PushArr( 4 ), "<a>\n", 4 );
+		}
+		nested.Push( 0 );
+		XMLDocument deep;
+		deep.Parse( nested.Mem() );
+		XMLTest( "Depth error", XML_ELEMENT_DEPTH_EXCEEDED, deep.ErrorID() );
+		XMLTest( "Depth error line", TINYXML2_MAX_ELEMENT_DEPTH - 1, deep.ErrorLineNum() );
+	}
+
     // ----------- Performance tracking --------------
 	{
 #if defined( _MSC_VER )